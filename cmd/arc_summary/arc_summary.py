@@ -51,6 +51,7 @@ import errno
 
 from subprocess import Popen, PIPE
 from decimal import Decimal as D
+from uzfs_kstat import kstat_open
 
 show_tunable_descriptions = False
 alternate_tunable_layout = False
@@ -74,10 +75,10 @@ def get_Kstat():
     of the same name.
     """
 
-    def load_proc_kstats(fn, namespace):
+    def load_proc_kstats(name, namespace):
         """Collect information on a specific subsystem of the ARC"""
 
-        kstats = [line.strip() for line in open(fn)]
+        kstats = [line.strip() for line in kstat_open(name)]
         del kstats[0:2]
         for kstat in kstats:
             kstat = kstat.strip()
@@ -85,11 +86,11 @@ def get_Kstat():
             Kstat[namespace + name] = D(value)
 
     Kstat = {}
-    load_proc_kstats('/proc/spl/kstat/zfs/arcstats',
+    load_proc_kstats('arcstats',
                      'kstat.zfs.misc.arcstats.')
-    load_proc_kstats('/proc/spl/kstat/zfs/zfetchstats',
+    load_proc_kstats('zfetchstats',
                      'kstat.zfs.misc.zfetchstats.')
-    load_proc_kstats('/proc/spl/kstat/zfs/vdev_cache_stats',
+    load_proc_kstats('vdev_cache_stats',
                      'kstat.zfs.misc.vdev_cache_stats.')
 
     return Kstat
@@ -52,6 +52,7 @@ import copy
 
 from decimal import Decimal
 from signal import signal, SIGINT, SIGWINCH, SIG_DFL
+from uzfs_kstat import kstat_open
 
 cols = {
     # HDR:        [Size, Scale, Description]
@@ -148,7 +149,7 @@ def usage():
 def kstat_update():
     global kstat
 
-    k = [line.strip() for line in open('/proc/spl/kstat/zfs/arcstats')]
+    k = [line.strip() for line in kstat_open('arcstats')]
 
     if not k:
         sys.exit(1)
@@ -31,6 +31,7 @@
 import sys
 import getopt
 import errno
+from uzfs_kstat import kstat_open
 
 bhdr = ["pool", "objset", "object", "level", "blkid", "offset", "dbsize"]
 bxhdr = ["pool", "objset", "object", "level", "blkid", "offset", "dbsize",
@@ -558,9 +559,12 @@ def main():
             sys.exit(1)
 
     if not ifile:
-        ifile = '/proc/spl/kstat/zfs/dbufs'
-
-    if ifile is not "-":
+        try:
+            sys.stdin = kstat_open('dbufs')
+        except (IOError, OSError):
+            sys.stderr.write("Cannot read dbufs kstat\n")
+            sys.exit(1)
+    elif ifile is not "-":
         try:
             tmp = open(ifile, "r")
             sys.stdin = tmp
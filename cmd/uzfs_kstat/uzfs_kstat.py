@@ -0,0 +1,43 @@
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the
+# Common Development and Distribution License (the "License").
+# You may not use this file except in compliance with the License.
+#
+# You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+# or http://www.opensolaris.org/os/licensing.
+# See the License for the specific language governing permissions
+# and limitations under the License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each
+# file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+# If applicable, add the following below this CDDL HEADER, with the
+# fields enclosed by brackets "[]" replaced with your own identifying
+# information: Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+
+"""Reading of kstats for arcstat, arc_summary and dbufstat. It is installed
+next to them, so that they can import it."""
+
+import os
+import socket
+
+# kstats of zrepl, see include/uzfs_kstat.h
+UZFS_KSTAT_SOCK = '/tmp/uzfs_kstat.sock'
+
+
+def kstat_open(name):
+    """Open kstat zfs/<name> from /proc, or, when ZFS runs in userland in
+    zrepl, from the unix socket on which zrepl serves its kstats"""
+    path = '/proc/spl/kstat/zfs/' + name
+    if os.path.exists(path) or not os.path.exists(UZFS_KSTAT_SOCK):
+        return open(path)
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(UZFS_KSTAT_SOCK)
+    sock.sendall(('zfs/' + name + '\n').encode())
+    f = sock.makefile('r')
+    sock.close()
+    return f
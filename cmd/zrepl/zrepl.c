@@ -9,6 +9,7 @@
 #include <uzfs_mgmt.h>
 #include <zrepl_mgmt.h>
 #include <uzfs_io.h>
+#include <uzfs_kstat.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <uzfs_rebuilding.h>
@@ -18,6 +19,7 @@
 #include <data_conn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/vdev_disk_aio.h>
 #include <fcntl.h>
 
 #include "zfs_events.h"
@@ -35,6 +37,7 @@ inject_error_t	inject_error;
 
 kthread_t	*conn_accpt_thread;
 kthread_t	*uzfs_timer_thread;
+kthread_t	*uzfs_workers_thread;
 kthread_t	*mgmt_conn_thread;
 
 static void
@@ -54,6 +57,11 @@ zrepl_svc_run(void)
 	    (thread_func_t)uzfs_zvol_timer_thread, NULL, 0, NULL, TS_RUN,
 	    0, PTHREAD_CREATE_DETACHED);
 	VERIFY3P(uzfs_timer_thread, !=, NULL);
+
+	uzfs_workers_thread = zk_thread_create(NULL, 0,
+	    (thread_func_t)uzfs_zvol_workers_thread, NULL, 0, NULL, TS_RUN,
+	    0, PTHREAD_CREATE_DETACHED);
+	VERIFY3P(uzfs_workers_thread, !=, NULL);
 }
 
 /*
@@ -163,6 +171,22 @@ main(int argc, char **argv)
 		LOG_INFO("uzfs write size = %d", uzfs_write_size);
 	}
 
+	env = getenv("VDEV_DISK_URING");
+	if (env != NULL) {
+		if (strcmp(env, "1") == 0) {
+			LOG_INFO("Using io_uring for disk vdevs");
+			zfs_vdev_disk_uring = 1;
+		}
+	}
+
+	env = getenv("VDEV_DISK_URING_SQPOLL");
+	if (env != NULL) {
+		if (strcmp(env, "1") == 0) {
+			LOG_INFO("Enabling SQPOLL for io_uring disk vdevs");
+			zfs_vdev_disk_uring_sqpoll = 1;
+		}
+	}
+
 	SLIST_INIT(&uzfs_mgmt_conns);
 	mutex_init(&conn_list_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&async_tasks_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -199,6 +223,9 @@ main(int argc, char **argv)
 		goto initialize_error;
 	}
 
+	/* kstats are only for monitoring, so replica runs without them */
+	(void) uzfs_kstat_server_init(UZFS_KSTAT_SOCK);
+
 	SLIST_INIT(&uzfs_mgmt_conns);
 	mutex_init(&conn_list_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&async_tasks_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -0,0 +1,24 @@
+dnl #
+dnl # Check for io_uring kernel interface, used by io_uring vdev backend
+dnl # through raw syscalls, so, liburing is not needed.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_IO_URING], [
+	AC_MSG_CHECKING([for io_uring kernel interface])
+	AC_TRY_COMPILE([
+		#include <sys/syscall.h>
+		#include <linux/io_uring.h>
+	],[
+		struct io_uring_params p;
+		int nr = __NR_io_uring_setup + __NR_io_uring_enter +
+		    __NR_io_uring_register + IORING_OP_WRITE +
+		    IORING_FEAT_SINGLE_MMAP;
+		(void) p;
+		(void) nr;
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_IO_URING, 1,
+		    [Define if io_uring kernel interface is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -13,4 +13,7 @@ AC_DEFUN([ZFS_AC_CONFIG_USER_LIBAIO], [
 	],[
 		AC_MSG_ERROR([Missing linux AIO library. Install libaio-dev package.])
 	])
+
+	dnl # NVMe ioctls are used by aio vdev backend to flush NVMe disks
+	AC_CHECK_HEADERS([linux/nvme_ioctl.h])
 ])
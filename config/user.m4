@@ -19,6 +19,7 @@ AC_DEFUN([ZFS_AC_CONFIG_USER], [
 	ZFS_AC_CONFIG_USER_MAKEDEV_IN_MKDEV
 	ZFS_AC_CONFIG_USER_NO_FORMAT_TRUNCATION
 	ZFS_AC_CONFIG_USER_LIBAIO
+	ZFS_AC_CONFIG_USER_IO_URING
 	ZFS_AC_CONFIG_USER_JEMALLOC
 	ZFS_AC_CONFIG_USER_FIO
 
@@ -27,6 +27,7 @@
 
 #include <zrepl_prot.h>
 #include <zrepl_mgmt.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,6 +59,15 @@ extern void uzfs_zvol_io_receiver(void *);
 extern uint16_t io_server_port;
 extern uint16_t rebuild_io_server_port;
 extern uint64_t zvol_rebuild_step_size;
+extern uint64_t zvol_rebuild_step_window;
+extern uint64_t zvol_rebuild_progress_interval;
+extern uint64_t zvol_rebuild_compress;
+extern uint64_t zvol_rebuild_holes;
+extern uint64_t zvol_rebuild_scan_threads;
+extern uint64_t zvol_rebuild_write_threads;
+extern uint64_t zvol_rebuild_write_queue_limit;
+extern uint64_t zvol_workers_scale_interval_ms;
+extern uint64_t zvol_max_data_conns;
 
 int uzfs_zvol_get_ip(char *host, size_t host_len);
 void uzfs_zvol_io_conn_acceptor(void *arg);
@@ -68,11 +78,15 @@ void zio_cmd_free(zvol_io_cmd_t **cmd);
 int uzfs_zvol_socket_read(int fd, char *buf, uint64_t nbytes);
 int uzfs_zvol_read_header(int fd, zvol_io_hdr_t *hdr);
 int uzfs_zvol_socket_write(int fd, char *buf, uint64_t nbytes);
+int uzfs_zvol_socket_writev(int fd, struct iovec *iov, int iovcnt);
 void uzfs_zvol_worker(void *arg);
+void uzfs_zvol_rebuild_compress(zvol_io_cmd_t *zio_cmd);
+int uzfs_zvol_rebuild_decompress(zvol_io_cmd_t *zio_cmd);
 void uzfs_zvol_rebuild_dw_replica(void *arg);
 void uzfs_zvol_rebuild_scanner(void *arg);
 void uzfs_update_ionum_interval(zvol_info_t *zinfo, uint32_t timeout);
 void uzfs_zvol_timer_thread(void);
+void uzfs_zvol_workers_thread(void);
 int uzfs_zvol_create_internal_snapshot(zvol_state_t *zv, zvol_state_t **snap_zv,
     uint64_t io_num);
 
@@ -329,6 +329,14 @@ struct metaslab {
 	range_tree_t	*ms_freedtree; /* already freed this syncing txg */
 	range_tree_t	*ms_defertree[TXG_DEFER_SIZE];
 
+	/*
+	 * Space freed, and, not yet trimmed, while the metaslab is loaded.
+	 * When trim runs, it is swapped into ms_trimming, and, those ranges
+	 * are kept out of ms_tree until the trim IOs complete.
+	 */
+	range_tree_t	*ms_trimset;
+	range_tree_t	*ms_trimming;
+
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
 
@@ -662,6 +662,12 @@ extern int spa_scan(spa_t *spa, pool_scan_func_t func);
 extern int spa_scan_stop(spa_t *spa);
 extern int spa_scrub_pause_resume(spa_t *spa, pool_scrub_cmd_t flag);
 
+/* trim */
+extern int spa_trim(spa_t *spa, boolean_t full);
+
+extern int zfs_autotrim;
+extern int zfs_txgs_per_trim;
+
 /* spa syncing */
 extern void spa_sync(spa_t *spa, uint64_t txg); /* only for DMU use */
 extern void spa_sync_allpools(void);
@@ -308,6 +308,9 @@ struct spa {
 	refcount_t	spa_refcount;		/* number of opens */
 
 	taskq_t		*spa_upgrade_taskq;	/* taskq for upgrade jobs */
+	taskq_t		*spa_trim_taskq;	/* taskq for trim jobs */
+	uint64_t	spa_trim_pending;	/* queued or running trims */
+	boolean_t	spa_trim_stop;		/* stop trim on unload */
 	zfs_histogram_t zfs_rio_histogram[ZFS_HISTOGRAM_IO_SIZE /
 	    ZFS_HISTOGRAM_IO_BLOCK + 1];
 	zfs_histogram_t zfs_wio_histogram[ZFS_HISTOGRAM_IO_SIZE /
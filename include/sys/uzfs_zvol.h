@@ -69,6 +69,31 @@ typedef struct zvol_rebuild_info {
 	uint8_t	stale_clone_exist;
 } zvol_rebuild_info_t;
 
+/*
+ * Segment of lun [start, end) whose blocks have same io_num
+ */
+typedef struct zvol_ionum_seg {
+	avl_node_t link;
+	uint64_t start;
+	uint64_t end;
+	uint64_t io_num;
+} zvol_ionum_seg_t;
+
+/*
+ * In-memory index of io_num of blocks of zvol. It is active only while zvol
+ * is being rebuilt, and, lets rebuild writes find the blocks overwritten by
+ * newer IOs without reading metadata object. Writes keep it up to date, and,
+ * ranges missing in it are added when rebuild writes read them from disk.
+ */
+typedef struct zvol_ionum_index {
+	kmutex_t mtx;
+	avl_tree_t tree;			/* of zvol_ionum_seg_t */
+	boolean_t active;
+	uint64_t nsegs;
+	uint64_t hits;				/* lookups served by index */
+	uint64_t misses;			/* lookups that read disk */
+} zvol_ionum_index_t;
+
 /*
  * The in-core state of each volume.
  */
@@ -95,6 +120,7 @@ struct zvol_state {
 	zvol_status_t zv_status;		/* zvol status */
 	kmutex_t rebuild_mtx;
 	zvol_rebuild_info_t rebuild_info;
+	zvol_ionum_index_t zv_ionum_index;	/* io_num index for rebuild */
 	uint8_t zvol_workers;			/* zvol workers count */
 };
 
@@ -134,6 +160,12 @@ const char *rebuild_status_to_str(zvol_rebuild_status_t status);
 extern void zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
     uint64_t size, int sync, blk_metadata_t *md);
 
+/*
+ * logs freeing of range along with metadata 'md' stamped over it
+ */
+extern void zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off,
+    uint64_t len, boolean_t sync, blk_metadata_t *md);
+
 /*
  * returns through 'm' (offset, len) of the block containing metadata of data
  * at 'offset' of lun and length of meta vol block size
@@ -149,6 +181,13 @@ void get_metaobj_block_details(metaobj_blk_offset_t *m, uint64_t blocksize,
  */
 uint64_t get_metadata_len(zvol_state_t *zv, uint64_t offset, uint64_t len);
 
+/*
+ * writes metadata 'md' of every block of lun in range (offset, len) to
+ * metadata object in tx
+ */
+void zvol_write_metadata(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    blk_metadata_t *md, dmu_tx_t *tx);
+
 /*
  * Callback vectors for replaying records.
  * Only TX_WRITE and TX_TRUNCATE are needed for zvol.
@@ -27,6 +27,8 @@
 #ifndef _SYS_VDEV_DISK_AIO_H
 #define	_SYS_VDEV_DISK_AIO_H
 
+#include <sys/vdev_impl.h>
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -34,6 +36,15 @@ extern "C" {
 extern void vdev_disk_aio_init(void);
 extern void vdev_disk_aio_fini(void);
 
+/* io_uring backend of disk vdevs, see vdev_disk_uring.c */
+extern int zfs_vdev_disk_uring;
+extern int zfs_vdev_disk_uring_sqpoll;
+extern uint32_t zfs_vdev_disk_uring_sqpoll_idle;
+
+extern void vdev_disk_uring_init(void);
+extern void vdev_disk_uring_fini(void);
+extern vdev_ops_t *vdev_disk_ops_get(void);
+
 #ifdef	__cplusplus
 }
 #endif
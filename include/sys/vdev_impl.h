@@ -40,6 +40,10 @@
 extern "C" {
 #endif
 
+#ifndef	DKIOCFREE
+#define	DKIOCFREE	(DKIOC|50)
+#endif
+
 /*
  * Virtual device descriptors.
  *
@@ -220,6 +224,7 @@ struct vdev {
 	uint64_t	vdev_not_present; /* not present during import	*/
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_notrim;	/* true if trim failed		*/
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
@@ -400,6 +400,10 @@ extern void kstat_set_raw_ops(kstat_t *ksp,
     int (*headers)(char *buf, size_t size),
     int (*data)(char *buf, size_t size, void *data),
     void *(*addr)(kstat_t *ksp, loff_t index));
+extern int kstat_resize_raw(kstat_t *ksp);
+extern int kstat_show(kstat_t *ksp, FILE *fp);
+extern int kstat_show_path(const char *path, FILE *fp);
+extern int zfs_kstat_io;
 extern void kstat_dump_all(void);
 
 /*
@@ -458,6 +462,8 @@ typedef struct taskq_ent {
 	uintptr_t		tqent_flags;
 } taskq_ent_t;
 
+struct rte_ring;
+
 typedef struct taskq {
 	char		tq_name[TASKQ_NAMELEN + 1];
 	kmutex_t	tq_lock;
@@ -475,6 +481,16 @@ typedef struct taskq {
 	int		tq_maxalloc_wait;
 	taskq_ent_t	*tq_freelist;
 	taskq_ent_t	tq_task;
+	/* TASKQ_LOCKFREE only */
+	struct rte_ring	**tq_rings;	/* per-thread task rings */
+	int		tq_nrings;
+	struct rte_ring	*tq_freering;	/* cached free entries */
+	uint32_t	tq_next;	/* round-robin dispatch cursor */
+	int		tq_ntarget;	/* threads wanted, <= tq_nrings */
+	pri_t		tq_pri;
+	uint32_t	tq_parked;	/* threads waiting for dispatch */
+	uint32_t	tq_waiters;	/* threads in taskq_wait() */
+	uint64_t	tq_pending;	/* dispatched but not yet done */
 } taskq_t;
 
 #define	TQENT_FLAG_PREALLOC	0x1	/* taskq_dispatch_ent used */
@@ -484,6 +500,7 @@ typedef struct taskq {
 #define	TASKQ_DYNAMIC		0x0004	/* Use dynamic thread scheduling */
 #define	TASKQ_THREADS_CPU_PCT	0x0008	/* Scale # threads by # cpus */
 #define	TASKQ_DC_BATCH		0x0010	/* Mark threads as batch */
+#define	TASKQ_LOCKFREE		0x0020	/* Per-thread rings, work stealing */
 
 #define	TQ_SLEEP	KM_SLEEP	/* Can block for memory */
 #define	TQ_NOSLEEP	KM_NOSLEEP	/* cannot block for memory; may fail */
@@ -516,6 +533,7 @@ extern int	taskq_cancel_id(taskq_t *, taskqid_t);
 extern void	system_taskq_init(void);
 extern void	system_taskq_fini(void);
 extern int taskq_check_active_ios(taskq_t *tq);
+extern void taskq_set_nthreads(taskq_t *tq, int nthreads);
 
 #define	XVA_MAPSIZE	3
 #define	XVA_MAGIC	0x78766174
@@ -597,13 +615,19 @@ typedef struct vsecattr {
 
 #define	CRCREAT		0
 
+#define	F_FREESP	11		/* free space in a file range */
+
+typedef struct flock flock64_t;
+
 extern int fop_getattr(vnode_t *vp, vattr_t *vap);
+extern int fop_space(vnode_t *vp, int cmd, flock64_t *bfp);
 
 #define	VOP_CLOSE(vp, f, c, o, cr, ct)	vn_close(vp)
 #define	VOP_PUTPAGE(vp, of, sz, fl, cr, ct)	0
 #define	VOP_GETATTR(vp, vap, fl, cr, ct)  fop_getattr((vp), (vap));
 
 #define	VOP_FSYNC(vp, f, cr, ct)	fsync((vp)->v_fd)
+#define	VOP_SPACE(vp, cmd, a, f, o, cr, ct)	fop_space((vp), (cmd), (a))
 
 #define	VN_RELE(vp)	vn_close(vp)
 
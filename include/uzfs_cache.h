@@ -0,0 +1,116 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_UZFS_CACHE_H
+#define	_UZFS_CACHE_H
+
+#include <pthread.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cache of fixed size objects. Freed objects are kept in free list (upto
+ * max_free of them) to be reused by next allocations, instead of going to
+ * allocator for every IO.
+ *
+ * Every thread has a magazine of objects of the cache in front of the free
+ * list, from which it allocates and to which it frees without taking mtx.
+ * mtx is taken only to refill an empty magazine from the free list, or to
+ * drain half of a full one to it. Magazines are drained when their threads
+ * exit. Counters of cache don't include objects allocated and freed from
+ * magazines since they were last refilled or drained.
+ */
+#define	UZFS_CACHE_MAG_SIZE	32
+/* max bytes of objects in a magazine */
+#define	UZFS_CACHE_MAG_BYTES	(1ULL << 20)
+
+typedef struct uzfs_cache {
+	const char	*name;
+	size_t		size;		/* size of object */
+	uint64_t	max_free;	/* max objects to keep in free list */
+	pthread_mutex_t	mtx;
+	void		*free_list;	/* next pointer is in freed object */
+	uint64_t	free_cnt;	/* objects in free list */
+	uint64_t	inuse_cnt;	/* objects allocated from cache */
+	uint64_t	hits;		/* allocations served from free list */
+	uint64_t	misses;		/* allocations served by allocator */
+	uint64_t	high_water;	/* max of inuse_cnt */
+	boolean_t	mag_key_created;
+	pthread_key_t	mag_key;	/* magazine of thread */
+} uzfs_cache_t;
+
+typedef struct uzfs_cache_mag {
+	uzfs_cache_t	*cache;
+	uint64_t	max_free;	/* max_free of cache for the thread */
+	int		size;		/* max objects in magazine */
+	int		cnt;		/* objects in magazine */
+	uint64_t	allocs;		/* since last refill or drain */
+	uint64_t	frees;		/* since last refill or drain */
+	void		*objs[UZFS_CACHE_MAG_SIZE];
+} uzfs_cache_mag_t;
+
+#define	UZFS_CACHE_INITIALIZER(n, s, m)	{	\
+	.name = (n),				\
+	.size = (s),				\
+	.max_free = (m),			\
+	.mtx = PTHREAD_MUTEX_INITIALIZER,	\
+}
+
+/*
+ * Payload buffers are cached in power of two size classes from
+ * UZFS_BUF_CACHE_MIN to UZFS_BUF_CACHE_MAX. Bigger buffers are not cached.
+ */
+#define	UZFS_BUF_CACHE_MIN_SHIFT	SPA_MINBLOCKSHIFT
+#define	UZFS_BUF_CACHE_MAX_SHIFT	20
+#define	UZFS_BUF_CACHE_MAX		(1ULL << UZFS_BUF_CACHE_MAX_SHIFT)
+#define	UZFS_BUF_CACHE_CLASSES		\
+	(UZFS_BUF_CACHE_MAX_SHIFT - UZFS_BUF_CACHE_MIN_SHIFT + 1)
+
+extern uzfs_cache_t uzfs_zio_cmd_cache;
+extern uzfs_cache_t uzfs_metadata_desc_cache;
+extern uzfs_cache_t uzfs_buf_cache[UZFS_BUF_CACHE_CLASSES];
+
+/* max bytes kept in free list of each size class of payload buffers */
+extern uint64_t uzfs_buf_cache_max_bytes;
+
+extern void *uzfs_cache_alloc(uzfs_cache_t *cache);
+extern void *uzfs_cache_zalloc(uzfs_cache_t *cache);
+extern void uzfs_cache_free(uzfs_cache_t *cache, void *obj);
+extern void uzfs_cache_reap(uzfs_cache_t *cache);
+
+/*
+ * Allocates/frees buffer of 'size' bytes from size classed caches.
+ * Contents of allocated buffer are not initialized.
+ */
+extern void *uzfs_buf_alloc(size_t size);
+extern void uzfs_buf_free(void *buf, size_t size);
+
+/* frees all the objects in free lists of caches */
+extern void uzfs_caches_reap(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
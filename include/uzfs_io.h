@@ -24,6 +24,7 @@
 
 #include <sys/zil.h>
 #include <sys/uzfs_zvol.h>
+#include <uzfs_cache.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,12 +41,13 @@ typedef struct metadata_desc {
 	struct metadata_desc *next; /* next entry in list ordered by offset */
 	size_t	len;	/* length of the chunk of data */
 	blk_metadata_t	metadata;
+	boolean_t	hole;	/* chunk is not allocated, i.e., it is zeros */
 } metadata_desc_t;
 
 #define	FREE_METADATA_LIST(head)	\
 	while ((head) != NULL) {	\
 		metadata_desc_t *tmp = (head)->next;	\
-		kmem_free((head), sizeof (metadata_desc_t));	\
+		uzfs_cache_free(&uzfs_metadata_desc_cache, (head));	\
 		(head) = tmp;	\
 	}
 
@@ -63,6 +65,21 @@ int uzfs_write_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
 int uzfs_read_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
     metadata_desc_t **md);
 
+/*
+ * marks the chunks of metadata list 'md' of data read from 'offset' to
+ * 'offset + len' which are holes, splitting them as needed. List with
+ * single chunk of io_num 0 is created if 'md' is empty.
+ */
+int uzfs_read_holes(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    metadata_desc_t **md);
+
+/*
+ * frees data in range 'offset' to 'offset + len' and stamps
+ * metadata 'md' over the freed range
+ */
+int uzfs_unmap_data(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    blk_metadata_t *metadata);
+
 extern void uzfs_flush_data(zvol_state_t *zv);
 
 int uzfs_update_metadata_granularity(zvol_state_t *zv, uint64_t block_size);
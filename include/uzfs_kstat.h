@@ -0,0 +1,43 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_UZFS_KSTAT_H
+#define	_UZFS_KSTAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Unix socket on which kstats are served, as there is no /proc/spl/kstat
+ * when ZFS runs in userland. Client writes path of a kstat ended by newline,
+ * like "zfs/arcstats\n", and reads the kstat in the format of its
+ * /proc/spl/kstat file till the connection is closed. Empty path gets the
+ * paths of all the kstats.
+ */
+#define	UZFS_KSTAT_SOCK	"/tmp/uzfs_kstat.sock"
+
+extern int uzfs_kstat_server_init(const char *sock_path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
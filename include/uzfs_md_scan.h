@@ -0,0 +1,61 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_UZFS_MD_SCAN_H
+#define	_UZFS_MD_SCAN_H
+
+#include <sys/zfs_context.h>
+#include <sys/zil.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scanners of metadata buffers, i.e., arrays of blk_metadata_t, used to find
+ * blocks changed after a given io_num. Vectorized implementations are
+ * selected at runtime based on cpu features, as in vdev_raidz_math.
+ */
+typedef struct uzfs_md_scan_ops {
+	/* returns index of first entry with io_num > low, or n if none */
+	uint64_t (*skip)(const blk_metadata_t *md, uint64_t n, uint64_t low);
+	/* returns number of leading entries with io_num equal to io_num */
+	uint64_t (*run)(const blk_metadata_t *md, uint64_t n, uint64_t io_num);
+	boolean_t (*is_supported)(void);
+	const char *name;
+} uzfs_md_scan_ops_t;
+
+/* implementation in use, scalar one till uzfs_md_scan_init is called */
+extern const uzfs_md_scan_ops_t *uzfs_md_scan_ops;
+
+/* selects the fastest implementation supported by cpu */
+extern void uzfs_md_scan_init(void);
+
+/*
+ * Sets implementation with 'name' to be used. Returns EINVAL if there is no
+ * such implementation or cpu doesn't support it.
+ */
+extern int uzfs_md_scan_impl_set(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
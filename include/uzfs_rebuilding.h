@@ -56,6 +56,17 @@ int uzfs_get_io_diff(zvol_state_t *zv, blk_metadata_t *base_metadata,
  */
 int uzfs_get_nonoverlapping_ondisk_blks(zvol_state_t *zv, uint64_t offset,
     uint64_t len, blk_metadata_t *incoming_md, void **list);
+
+/*
+ * In-memory io_num index of zvol, which is used by
+ * uzfs_get_nonoverlapping_ondisk_blks while zvol is being rebuilt.
+ */
+extern uint64_t zvol_ionum_index_max_segs;
+void uzfs_ionum_index_init(zvol_state_t *zv);
+void uzfs_ionum_index_fini(zvol_state_t *zv);
+void uzfs_ionum_index_set_active(zvol_state_t *zv, boolean_t active);
+void uzfs_ionum_index_update(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    uint64_t io_num);
 int uzfs_zvol_get_or_create_internal_clone(zvol_state_t *zv,
     zvol_state_t **snap_zv, zvol_state_t **clone_zv, int *ret_val);
 int uzfs_zvol_release_internal_clone(zvol_state_t *zv,
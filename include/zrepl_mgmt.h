@@ -65,6 +65,16 @@ void zrepl_log(enum zrepl_log_level lvl, const char *fmt, ...);
 #define	LOG_ERRNO(fmt, ...)	zrepl_log(LOG_LEVEL_ERR, \
 				    fmt ": %s", ##__VA_ARGS__, strerror(errno))
 
+/* Latency histogram, see ZVOL_LAT_HIST_BUCKETS for its buckets */
+typedef struct zvol_lat_hist {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	buckets[ZVOL_LAT_HIST_BUCKETS];
+} zvol_lat_hist_t;
+
+/* Stage histograms are kept for READ, WRITE, SYNC and UNMAP */
+#define	ZVOL_STAGE_HIST_OPS	(ZVOL_OPCODE_UNMAP - ZVOL_OPCODE_READ + 1)
+
 SLIST_HEAD(zvol_list, zvol_info_s);
 extern kmutex_t zvol_list_mutex;
 extern struct zvol_list zvol_list;
@@ -83,6 +93,7 @@ typedef struct inject_delay_s {
 
 typedef struct inject_rebuild_error_s {
 	uint64_t dw_replica_rebuild_error_io;
+	uint64_t dw_replica_rebuild_write_error_io;
 } inject_rebuild_error_t;
 
 typedef struct inject_error_s {
@@ -93,6 +104,9 @@ typedef struct inject_error_s {
 extern inject_error_t inject_error;
 #endif
 
+STAILQ_HEAD(zvol_io_cmd_list, zvol_io_cmd_s);
+typedef struct zvol_io_cmd_list zvol_io_cmd_list_t;
+
 typedef enum zvol_info_state_e {
 	ZVOL_INFO_STATE_ONLINE,
 	ZVOL_INFO_STATE_OFFLINE,
@@ -101,6 +115,7 @@ typedef enum zvol_info_state_e {
 typedef struct zvol_info_s {
 
 	SLIST_ENTRY(zvol_info_s) zinfo_next;
+	SLIST_ENTRY(zvol_info_s) zinfo_hash_next;
 
 	/* Logical Unit related fields */
 	zvol_info_state_t	state;
@@ -108,7 +123,6 @@ typedef struct zvol_info_s {
 	zvol_state_t	*main_zv; // original volume
 	zvol_state_t	*clone_zv; // cloned volume for rebuilding
 	zvol_state_t	*snapshot_zv; // snap volume from where clone is created
-	zvol_state_t    *rebuild_zv; // current snapshot which is rebuilding
 	uint64_t	refcnt;
 
 	/*
@@ -153,6 +167,12 @@ typedef struct zvol_info_s {
 	uint32_t	update_ionum_interval;	/* how often to update io seq */
 	taskq_t		*uzfs_zvol_taskq;	/* Taskq for minor management */
 
+	/* Sizing of uzfs_zvol_taskq, see uzfs_zinfo_scale_workers() */
+	uint64_t	workers_load;	/* average outstanding IOs * 16 */
+	uint64_t	workers_last_latency;
+	hrtime_t	workers_last_time;
+	int		workers_wanted;
+
 	/* Thread sync related */
 
 	/*
@@ -162,8 +182,18 @@ typedef struct zvol_info_s {
 	pthread_cond_t	io_ack_cond;
 	pthread_mutex_t	zinfo_ionum_mutex;
 
+	/*
+	 * Group commit of SYNC cmds. write_done_seq counts write cmds that are
+	 * done, and, ZIL is committed upto write_synced_seq of them.
+	 */
+	pthread_mutex_t	sync_mutex;
+	pthread_cond_t	sync_cond;
+	uint8_t		sync_in_progress;
+	uint64_t	write_done_seq;
+	uint64_t	write_synced_seq;
+
 	/* All cmds after execution will go here for ack */
-	STAILQ_HEAD(, zvol_io_cmd_s)	complete_queue;
+	zvol_io_cmd_list_t	complete_queue;
 
 	/* fds related to this zinfo on which threads are waiting */
 	STAILQ_HEAD(, zinfo_fd_s)	fd_list;
@@ -171,6 +201,14 @@ typedef struct zvol_info_s {
 	/* rebuild scanner info related to this zinfo */
 	STAILQ_HEAD(, zvol_rebuild_scanner_info_s) rebuild_scanner_list;
 
+	/*
+	 * Additional data connections opened by target after the first one.
+	 * State of the first data connection is in zinfo itself, as, rebuild
+	 * scanner acks also go through it.
+	 */
+	STAILQ_HEAD(, zvol_io_conn_s)	io_conn_list;
+	uint32_t	io_conn_cnt;
+
 	uint8_t		io_ack_waiting;
 
 	/* Will be used to singal ack-sender to exit */
@@ -201,6 +239,9 @@ typedef struct zvol_info_s {
 	uint64_t 	write_byte;
 	uint64_t	sync_req_ack_cnt;
 	uint64_t 	sync_latency;
+	uint64_t 	unmap_req_received_cnt;
+	uint64_t	unmap_req_ack_cnt;
+	uint64_t 	unmap_latency;
 	uint64_t 	inflight_io_cnt; // ongoing IOs count
 	uint64_t	dispatched_io_cnt; // total received but incomplete IOs
 
@@ -209,13 +250,28 @@ typedef struct zvol_info_s {
 	    ZFS_HISTOGRAM_IO_BLOCK + 1];
 	zfs_histogram_t uzfs_wio_histogram[ZFS_HISTOGRAM_IO_SIZE /
 	    ZFS_HISTOGRAM_IO_BLOCK + 1];
+
+	/* latency of stages of IOs from data connections, by opcode */
+	zvol_lat_hist_t	io_stage_hist[ZVOL_STAGE_HIST_OPS][ZVOL_IO_STAGE_MAX];
 } zvol_info_t;
 
+/*
+ * Rebuild scanner of helping replica. Range of each REBUILD_STEP is scanned
+ * in parts by threads of scan_tq, and, reads of changed blocks are
+ * dispatched to zvol workers. Counters and rebuild_cmd_cond are protected
+ * by zinfo_mutex.
+ */
 typedef struct zvol_rebuild_scanner_info_s {
 	STAILQ_ENTRY(zvol_rebuild_scanner_info_s) link;
 	zvol_info_t	*zinfo;
+	taskq_t		*scan_tq;
 	uint64_t	rebuild_cmd_queued_cnt;
 	uint64_t	rebuild_cmd_acked_cnt;
+	/* reads dispatched to workers, which are not yet completed */
+	uint64_t	rebuild_cmd_inflight;
+	/* threads waiting on rebuild_cmd_cond for acks or completions */
+	uint32_t	rebuild_cmd_waiting;
+	pthread_cond_t	rebuild_cmd_cond;
 	union {
 		struct {
 			int	is_fd_errored: 1;
@@ -224,11 +280,51 @@ typedef struct zvol_rebuild_scanner_info_s {
 	};
 	int		fd;
 	uint16_t	version;
+	/* degraded replica asked for compressed READ replies */
+	boolean_t	compress;
+	/* degraded replica asked for holes in READ replies */
+	boolean_t	holes;
 } zvol_rebuild_scanner_info_t;
 
+/*
+ * Rebuild writer of degraded replica. Writes received on a rebuild
+ * connection are applied by threads of write_tq while the connection keeps
+ * receiving, with at most zvol_rebuild_write_queue_limit of them in flight.
+ * Counters, error and rebuild_write_cond are protected by rebuild_write_mtx.
+ */
+typedef struct zvol_rebuild_writer_info_s {
+	zvol_info_t	*zinfo;
+	taskq_t		*write_tq;
+	/* writes dispatched to write_tq, which are not yet completed */
+	uint64_t	rebuild_write_inflight;
+	/* error of the first failed write */
+	int		rebuild_write_err;
+	pthread_mutex_t	rebuild_write_mtx;
+	pthread_cond_t	rebuild_write_cond;
+	int		fd;
+} zvol_rebuild_writer_info_t;
+
+/*
+ * Additional data connection of zvol. It has its own receiver and ack
+ * sender, and, cmds received on it are acked through its complete_queue.
+ */
+typedef struct zvol_io_conn_s {
+	STAILQ_ENTRY(zvol_io_conn_s) link;
+	int		fd;
+	zvol_io_cmd_list_t	complete_queue;
+	pthread_cond_t	io_ack_cond;
+	uint8_t		io_ack_waiting;
+	/* Will be used to signal ack-sender to exit */
+	uint8_t		conn_closed;
+	uint8_t		is_io_ack_sender_created;
+	/* ongoing command that is being worked on to ack to its sender */
+	void		*zio_cmd_in_ack;
+} zvol_io_conn_t;
+
 typedef struct thread_args_s {
 	char zvol_name[MAXNAMELEN];
 	zvol_info_t *zinfo;
+	zvol_io_conn_t *io_conn;
 	int fd;
 } thread_args_t;
 
@@ -246,16 +342,34 @@ typedef struct zvol_io_cmd_s {
 	zvol_info_t	*zinfo;
 	void		*buf;
 	uint64_t	buf_len;
+	/* receive buffer holding payload, if buf is not allocated for cmd */
+	struct zvol_rcv_buf	*rcv_buf;
+	/* end of stages of IO, io_rcv_time is 0 if not from data connection */
+	uint64_t	io_rcv_time;
+	uint64_t	io_dispatch_time;
 	uint64_t 	io_start_time;
+	uint64_t	io_done_time;
+	uint64_t	io_queued_time;
 	metadata_desc_t	*metadata_desc;
+	/* data connection on which cmd is received, NULL for the first one */
+	zvol_io_conn_t	*io_conn;
+	/* snapshot to read from and scanner, for reads issued by scanner */
+	zvol_state_t	*rebuild_zv;
+	zvol_rebuild_scanner_info_t	*scanner;
+	/* rebuild writer, for writes received on rebuild connection */
+	zvol_rebuild_writer_info_t	*writer;
 	int		conn;
 } zvol_io_cmd_t;
 
 extern int uzfs_zinfo_init(zvol_state_t *zv, const char *ds_name,
     nvlist_t *create_props);
 extern zvol_info_t *uzfs_zinfo_lookup(const char *name);
+extern void uzfs_zinfo_hash_init(void);
+extern void uzfs_zinfo_hash_fini(void);
 extern void uzfs_zinfo_replay_zil_all(void);
 extern int uzfs_zinfo_destroy(const char *ds_name, spa_t *spa);
+extern void uzfs_zinfo_scale_workers(void);
+extern int zvol_workers_adaptive;
 int uzfs_zvol_get_last_committed_io_no(zvol_state_t *, char *, uint64_t *);
 void uzfs_zinfo_store_last_committed_healthy_io_no(zvol_info_t *zinfo,
     uint64_t io_seq);
@@ -271,6 +385,10 @@ void shutdown_fds_related_to_zinfo(zvol_info_t *zinfo);
 extern void uzfs_zinfo_set_status(zvol_info_t *zinfo, zvol_status_t status);
 extern zvol_status_t uzfs_zinfo_get_status(zvol_info_t *zinfo);
 void uzfs_zvol_store_kv_pair(zvol_state_t *, char *, uint64_t);
+int uzfs_zvol_get_rebuild_progress(zvol_state_t *zv, uint64_t io_seq,
+    uint64_t *snap_guid, uint64_t *offset);
+void uzfs_zvol_store_rebuild_progress(zvol_state_t *zv, uint64_t io_seq,
+    uint64_t snap_guid, uint64_t offset);
 int uzfs_zvol_destroy_snapshot_clone(zvol_state_t *zv, zvol_state_t *snap_zv,
     zvol_state_t *clone_zv);
 int uzfs_zinfo_destroy_internal_clone(zvol_info_t *zv);
@@ -308,6 +426,15 @@ int uzfs_zinfo_destroy_stale_clone(zvol_info_t *zinfo);
 #define	HEALTHY_IO_SEQNUM	"io_seq"
 #define	DEGRADED_IO_SEQNUM	"degraded_io_seq"
 
+/*
+ * ZAP keys for progress of rebuild pass of degraded replica, i.e.,
+ * checkpointed io_seq of the pass, guid of the snapshot of helping replica
+ * that the pass is rebuilding from, and offset till which it is done
+ */
+#define	REBUILD_IO_SEQNUM	"rebuild_io_seq"
+#define	REBUILD_SNAP_GUID	"rebuild_snap_guid"
+#define	REBUILD_OFFSET		"rebuild_offset"
+
 /*
  * update interval for io_sequence number in degraded mode
  */
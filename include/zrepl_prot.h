@@ -47,13 +47,54 @@ extern "C" {
 
 #define	MIN_SUPPORTED_REPLICA_VERSION	3
 
-#define	REPLICA_VERSION	4
+#define	REPLICA_VERSION	7
 #define	MAX_NAME_LEN	256
 #define	MAX_IP_LEN	64
 #define	TARGET_PORT	6060
 
 #define	ZVOL_OP_FLAG_REBUILD		0x01
 #define	ZVOL_OP_FLAG_READ_METADATA	0x02
+/*
+ * Set on OPEN (from version 6 onwards) to open additional data connection
+ * to zvol which already has data connection. Max number of data connections
+ * per zvol is told by replica in handshake reply.
+ */
+#define	ZVOL_OP_FLAG_ADD_DATA_CONN	0x04
+/*
+ * Set on STATS to get latency histograms of the stages of IOs after the
+ * "used" stat (see zvol_op_stage_hist). Replicas which don't know it reply
+ * with "used" stat alone.
+ */
+#define	ZVOL_OP_FLAG_STATS_LATENCY	0x08
+/*
+ * Set on STATS to get zvol_op_stats_reply with all the counters of the zvol
+ * instead of the "used" stat. If zvol name is empty, the counters of all the
+ * zvols served by the mgmt connection are sent. Replicas which don't know it
+ * reply with "used" stat, and without this flag in reply.
+ */
+#define	ZVOL_OP_FLAG_STATS_EXT		0x10
+/*
+ * Set on REBUILD_STEP_DONE (from version 7 onwards) by helping replica, with
+ * end of the range of completed step in offset, and guid of the snapshot
+ * the step is scanned from in io_seq. Helping replica serves
+ * REBUILD_STEPs of a connection in the order they are received, so,
+ * degraded replica keeps several of them outstanding on connections on
+ * which it sees this flag.
+ */
+#define	ZVOL_OP_FLAG_REBUILD_STEP_END	0x20
+/*
+ * Set on HANDSHAKE of rebuild connection by degraded replica to ask for
+ * compressed data. Helping replica which knows it sets it on READ replies
+ * whose payload is compressed (see zvol_io_compressed_hdr). Replies which
+ * don't compress well are sent as they are, without this flag.
+ */
+#define	ZVOL_OP_FLAG_REBUILD_COMPRESSED	0x40
+/*
+ * Set on READ by target, or on HANDSHAKE of rebuild connection by degraded
+ * replica for all its READ replies, to allow holes in READ replies. Replicas
+ * which know it keep it set on such replies (see ZVOL_IO_RW_HDR_HOLE).
+ */
+#define	ZVOL_OP_FLAG_READ_HOLES		0x80
 
 enum zvol_op_code {
 	// Used to obtain info about a zvol on mgmt connection
@@ -63,8 +104,9 @@ enum zvol_op_code {
 	ZVOL_OPCODE_READ,
 	ZVOL_OPCODE_WRITE,
 	ZVOL_OPCODE_SYNC,
-	// Following commands apply to mgmt connection
+	// Used on data connection from version 5 onwards
 	ZVOL_OPCODE_UNMAP,
+	// Following commands apply to mgmt connection
 	ZVOL_OPCODE_REPLICA_STATUS,
 	ZVOL_OPCODE_PREPARE_FOR_REBUILD,
 	ZVOL_OPCODE_START_REBUILD,
@@ -112,6 +154,9 @@ struct zvol_io_hdr {
 	 * Length of data in payload, with following exceptions:
 	 *  1) for read request: size of data to read (payload has zero length)
 	 *  2) for write reply: size of data written (payload has zero length)
+	 *  3) for unmap request and reply: size of range to unmap starting
+	 *     at offset (payload has zero length). io_seq is used as io number
+	 *     of the unmapped range.
 	 * Note that for write request it includes size of io headers with
 	 * meta data.
 	 */
@@ -147,7 +192,9 @@ struct mgmt_ack {
 	uint64_t	zvol_guid;
 	uint16_t	port;
 	uint8_t		quorum;
-	uint8_t		reserved[5];
+	// max number of data connections to zvol (from version 6 onwards)
+	uint8_t		max_data_conns;
+	uint8_t		reserved[4];
 	char		ip[MAX_IP_LEN];
 	char		volname[MAX_NAME_LEN]; // zvol helping rebuild
 	char		dw_volname[MAX_NAME_LEN]; // zvol being rebuilt
@@ -206,6 +253,116 @@ struct zvol_op_stat {
 
 typedef struct zvol_op_stat zvol_op_stat_t;
 
+/*
+ * Stages of IO on data connection, timed from the end of one to the end of
+ * the next one.
+ */
+enum zvol_io_stage {
+	ZVOL_IO_STAGE_RECEIVE,	/* IO received -> dispatched to taskq */
+	ZVOL_IO_STAGE_TASKQ,	/* dispatched -> picked up by worker */
+	ZVOL_IO_STAGE_DMU,	/* picked up -> read/write/sync/unmap done */
+	ZVOL_IO_STAGE_QUEUE,	/* done -> queued for ack */
+	ZVOL_IO_STAGE_ACK,	/* queued -> ack written to socket */
+	ZVOL_IO_STAGE_TOTAL,	/* IO received -> ack written to socket */
+	ZVOL_IO_STAGE_MAX
+} __attribute__((packed));
+
+typedef enum zvol_io_stage zvol_io_stage_t;
+
+/*
+ * Latency histograms are log-linear in ns: bucket b < 4 counts latency of
+ * b ns, and above it, every power of two 2^k (k >= 2) is split in four
+ * buckets of 2^(k-2) ns, so bucket 4 * (k - 1) + s counts latencies from
+ * 2^k + s * 2^(k-2) up to the next bucket. The last bucket takes all that
+ * is larger.
+ */
+#define	ZVOL_LAT_HIST_BUCKETS	160
+
+/*
+ * Latency histogram of one stage of one opcode (READ, WRITE, SYNC or UNMAP)
+ * in STATS reply, followed by nbuckets counts for buckets from first_bucket
+ * onwards. Only histograms of stages with IOs are sent.
+ */
+struct zvol_op_stage_hist {
+	zvol_op_code_t	opcode;
+	zvol_io_stage_t	stage;
+	uint16_t	first_bucket;
+	uint16_t	nbuckets;
+	uint8_t		reserved[2];
+	uint64_t	count;		/* number of IOs */
+	uint64_t	sum;		/* latency of all of them, in ns */
+	uint64_t	buckets[0];
+} __attribute__((packed));
+
+typedef struct zvol_op_stage_hist zvol_op_stage_hist_t;
+
+#define	ZVOL_STATS_VERSION		1
+
+/* IO size histograms have a bucket per 32KB, the last one is for >= 1MB */
+#define	ZVOL_STATS_SIZE_HIST_BUCKETS	33
+
+/*
+ * Reply to STATS with ZVOL_OP_FLAG_STATS_EXT, followed by nentries
+ * zvol_op_stats entries of entry_len bytes each. New counters are only
+ * added at the end of zvol_op_stats (which grows entry_len), so that
+ * readers can use entry_len to step over the counters they don't know.
+ */
+struct zvol_op_stats_reply {
+	uint16_t	version;	/* ZVOL_STATS_VERSION */
+	uint16_t	reserved;
+	uint32_t	entry_len;
+	uint32_t	nentries;
+	uint32_t	reserved2;
+} __attribute__((packed));
+
+typedef struct zvol_op_stats_reply zvol_op_stats_reply_t;
+
+struct zvol_op_size_hist {
+	uint64_t	count;		/* number of IOs */
+	uint64_t	size;		/* bytes of all of them */
+	uint64_t	latency;	/* latency of all of them, in ns */
+} __attribute__((packed));
+
+typedef struct zvol_op_size_hist zvol_op_size_hist_t;
+
+/*
+ * Counters of a zvol since it was opened. Latencies, also those of size
+ * histograms, are sums of times in ns from a worker picking up an IO to
+ * its ack, for acked IOs. Times from receipt of IOs are in the histograms
+ * of their stages (see zvol_op_stage_hist).
+ */
+struct zvol_op_stats {
+	char		volname[MAX_NAME_LEN];
+	zvol_status_t	status;
+	zvol_rebuild_status_t rebuild_status;
+	uint16_t	workers;	/* threads wanted to serve IOs */
+	uint32_t	io_conns;	/* number of data connections */
+	uint64_t	used;		/* uncompressed bytes in zvol */
+	uint64_t	running_ionum;
+	uint64_t	checkpointed_ionum;
+	uint64_t	rebuild_bytes;
+	uint64_t	inflight_io_cnt;
+	uint64_t	dispatched_io_cnt;
+	uint64_t	read_req_received_cnt;
+	uint64_t	write_req_received_cnt;
+	uint64_t	sync_req_received_cnt;
+	uint64_t	unmap_req_received_cnt;
+	uint64_t	read_req_ack_cnt;
+	uint64_t	write_req_ack_cnt;
+	uint64_t	sync_req_ack_cnt;
+	uint64_t	unmap_req_ack_cnt;
+	uint64_t	read_byte;
+	uint64_t	write_byte;
+	uint64_t	read_latency;
+	uint64_t	write_latency;
+	uint64_t	sync_latency;
+	uint64_t	unmap_latency;
+	zvol_op_size_hist_t rio_hist[ZVOL_STATS_SIZE_HIST_BUCKETS];
+	zvol_op_size_hist_t wio_hist[ZVOL_STATS_SIZE_HIST_BUCKETS];
+} __attribute__((packed));
+
+typedef struct zvol_op_stats zvol_op_stats_t;
+
 /*
  * Describes chunk of data following this header.
  *
@@ -222,6 +379,23 @@ struct zvol_io_rw_hdr {
 	uint64_t	len;
 } __attribute__((packed));
 
+/*
+ * Set in len of zvol_io_rw_hdr in replies with ZVOL_OP_FLAG_READ_HOLES for
+ * chunk which is a hole, i.e., it is zeros, and no data follows the header.
+ * Rest of the len is length of the chunk.
+ */
+#define	ZVOL_IO_RW_HDR_HOLE	(1ULL << 63)
+
+/*
+ * Payload of READ reply with ZVOL_OP_FLAG_REBUILD_COMPRESSED is this header
+ * followed by LZ4 compressed form of the usual payload (zvol_io_rw_hdrs with
+ * data), which is lsize bytes long. The length in zvol_io_hdr designates the
+ * length of compressed payload including this header.
+ */
+struct zvol_io_compressed_hdr {
+	uint64_t	lsize;
+} __attribute__((packed));
+
 struct zvol_snapshot_list {
 	uint64_t zvol_guid;	/* Replica identity */
 	uint64_t data_len;	/* SNAP_LIST response data length */
@@ -203,6 +203,11 @@ struct dk_callback {
 						/* enablement status */
 #define	DKIOCSETWCE		(DKIOC|37)	/* Enable/Disable write cache */
 
+/*
+ * Free (discard) a range of blocks, which the caller no longer needs.
+ */
+#define	DKIOCFREE		(DKIOC|50)
+
 /*
  * The following ioctls are used by Sun drivers to communicate
  * with their associated format routines. Support of these ioctls
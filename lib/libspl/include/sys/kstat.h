@@ -100,6 +100,7 @@ typedef struct kstat {
 	kstat_raw_ops_t	ks_raw_ops;
 	char	*ks_raw_buf;
 	size_t	ks_raw_bufsize;
+	uint_t	ks_holds;	/* readers, which kstat_delete waits for */
 #endif
 	/*
 	 * Fields relevant to kernel only
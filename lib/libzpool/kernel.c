@@ -71,10 +71,14 @@ struct proc p0;
 pthread_cond_t kthread_cond = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t kthread_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t kstat_module_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t kstat_hold_cond = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t kstat_show_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_key_t kthread_key;
 int kthread_nr = 0;
 
 extern kmutex_t zvol_list_mutex;
+extern void uzfs_zinfo_hash_init(void);
+extern void uzfs_zinfo_hash_fini(void);
 
 void
 thread_init(void)
@@ -235,20 +239,27 @@ zk_thread_join(kt_did_t tid)
 /*ARGSUSED*/
 int kstat_id = 0;
 
+/*
+ * IO kstats are updated for every IO queued to a vdev, under a pool wide
+ * lock, which adds contention on IO path. So they are created only if
+ * this is set.
+ */
+int zfs_kstat_io = 0;
+
 kstat_t *
 kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
     const char *ks_class, uchar_t ks_type, ulong_t ks_ndata, uchar_t ks_flags)
 {
-	if (ks_type ==  KSTAT_TYPE_IO || ks_type == KSTAT_TYPE_TIMER ||
-	    ks_type == KSTAT_TYPE_INTR || ks_type == KSTAT_TYPE_RAW)
-		return (NULL);
 	kstat_t *ksp;
+
+	if (ks_type == KSTAT_TYPE_IO && !zfs_kstat_io)
+		return (NULL);
 	ksp = kmem_zalloc(sizeof (*ksp), KM_SLEEP);
 	if (ksp == NULL)
 		return (ksp);
 
 	pthread_mutex_lock(&kstat_module_lock);
-	kstat_id++;
+	ksp->ks_kid = kstat_id++;
 	pthread_mutex_unlock(&kstat_module_lock);
 	ksp->ks_crtime = gethrtime();
 	ksp->ks_snaptime = ksp->ks_crtime;
@@ -262,10 +273,27 @@ kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
 	ksp->ks_private = NULL;
 
 	switch (ksp->ks_type) {
+		case KSTAT_TYPE_RAW:
+			ksp->ks_ndata = 1;
+			ksp->ks_data_size = ks_ndata;
+			ksp->ks_raw_bufsize = PAGESIZE;
+			break;
 		case KSTAT_TYPE_NAMED:
 			ksp->ks_ndata = ks_ndata;
 			ksp->ks_data_size = ks_ndata * sizeof (kstat_named_t);
 			break;
+		case KSTAT_TYPE_INTR:
+			ksp->ks_ndata = ks_ndata;
+			ksp->ks_data_size = ks_ndata * sizeof (kstat_intr_t);
+			break;
+		case KSTAT_TYPE_IO:
+			ksp->ks_ndata = ks_ndata;
+			ksp->ks_data_size = ks_ndata * sizeof (kstat_io_t);
+			break;
+		case KSTAT_TYPE_TIMER:
+			ksp->ks_ndata = ks_ndata;
+			ksp->ks_data_size = ks_ndata * sizeof (kstat_timer_t);
+			break;
 		default:
 			panic("unknown kstat type");
 	}
@@ -304,6 +332,10 @@ kstat_install(kstat_t *ksp)
 	pthread_mutex_unlock(&kstat_module_lock);
 }
 
+/*
+ * ksp is removed from kstat_nvl before it is freed, so that it can't be
+ * read by kstat_show_path() anymore, and readers holding it are waited for.
+ */
 /*ARGSUSED*/
 void
 kstat_delete(kstat_t *ksp)
@@ -313,52 +345,121 @@ kstat_delete(kstat_t *ksp)
 	snprintf(buf, KSTAT_BUF_LEN, "%s:%x:%s",
 	    ksp->ks_module, ksp->ks_instance, ksp->ks_name);
 
-	if (!(ksp->ks_flags & KSTAT_FLAG_VIRTUAL))
-		kmem_free(ksp->ks_data, ksp->ks_data_size);
-	kmem_free(ksp, (sizeof (*ksp)));
-
 	pthread_mutex_lock(&kstat_module_lock);
 	nvlist_remove_all(kstat_nvl, buf);
+	while (ksp->ks_holds != 0)
+		pthread_cond_wait(&kstat_hold_cond, &kstat_module_lock);
 	pthread_mutex_unlock(&kstat_module_lock);
+
+	if (!(ksp->ks_flags & KSTAT_FLAG_VIRTUAL))
+		kmem_free(ksp->ks_data, ksp->ks_data_size);
+	kmem_free(ksp, (sizeof (*ksp)));
 }
-/*ARGSUSED*/
+
+/*
+ * Queue accounting of KSTAT_TYPE_IO kstats, as in the kernel. Callers hold
+ * the lock which protects kiop.
+ */
 void
 kstat_waitq_enter(kstat_io_t *kiop)
-{}
+{
+	hrtime_t new, delta;
+	uint_t wcnt;
+
+	new = gethrtime();
+	delta = new - kiop->wlastupdate;
+	kiop->wlastupdate = new;
+	wcnt = kiop->wcnt++;
+	if (wcnt != 0) {
+		kiop->wlentime += delta * wcnt;
+		kiop->wtime += delta;
+	}
+}
 
-/*ARGSUSED*/
 void
 kstat_waitq_exit(kstat_io_t *kiop)
-{}
-/*ARGSUSED*/
+{
+	hrtime_t new, delta;
+	uint_t wcnt;
+
+	new = gethrtime();
+	delta = new - kiop->wlastupdate;
+	kiop->wlastupdate = new;
+	wcnt = kiop->wcnt--;
+	ASSERT((int)wcnt > 0);
+	kiop->wlentime += delta * wcnt;
+	kiop->wtime += delta;
+}
+
 void
 kstat_runq_enter(kstat_io_t *kiop)
-{}
-/*ARGSUSED*/
+{
+	hrtime_t new, delta;
+	uint_t rcnt;
+
+	new = gethrtime();
+	delta = new - kiop->rlastupdate;
+	kiop->rlastupdate = new;
+	rcnt = kiop->rcnt++;
+	if (rcnt != 0) {
+		kiop->rlentime += delta * rcnt;
+		kiop->rtime += delta;
+	}
+}
+
 void
 kstat_runq_exit(kstat_io_t *kiop)
-{}
+{
+	hrtime_t new, delta;
+	uint_t rcnt;
+
+	new = gethrtime();
+	delta = new - kiop->rlastupdate;
+	kiop->rlastupdate = new;
+	rcnt = kiop->rcnt--;
+	ASSERT((int)rcnt > 0);
+	kiop->rlentime += delta * rcnt;
+	kiop->rtime += delta;
+}
 
-/*ARGSUSED*/
 void
 kstat_waitq_to_runq(kstat_io_t *kiop)
-{}
+{
+	kstat_waitq_exit(kiop);
+	kstat_runq_enter(kiop);
+}
 
-/*ARGSUSED*/
 void
 kstat_runq_back_to_waitq(kstat_io_t *kiop)
-{}
+{
+	kstat_runq_exit(kiop);
+	kstat_waitq_enter(kiop);
+}
 
 void
 kstat_set_raw_ops(kstat_t *ksp,
     int (*headers)(char *buf, size_t size),
     int (*data)(char *buf, size_t size, void *data),
     void *(*addr)(kstat_t *ksp, loff_t index))
-{}
+{
+	ksp->ks_raw_ops.headers = headers;
+	ksp->ks_raw_ops.data = data;
+	ksp->ks_raw_ops.addr = addr;
+}
 
+/*
+ * Doubles the buffer which raw kstat ops format into, till KSTAT_RAW_MAX.
+ */
 int
 kstat_resize_raw(kstat_t *ksp)
 {
+	if (ksp->ks_raw_bufsize == KSTAT_RAW_MAX)
+		return (ENOMEM);
+
+	kmem_free(ksp->ks_raw_buf, ksp->ks_raw_bufsize);
+	ksp->ks_raw_bufsize = MIN(ksp->ks_raw_bufsize * 2, KSTAT_RAW_MAX);
+	ksp->ks_raw_buf = kmem_alloc(ksp->ks_raw_bufsize, KM_SLEEP);
+
 	return (0);
 }
 
@@ -372,62 +473,251 @@ kstat_lookup_ksp(char *name)
 	return ((kstat_t *)tmp);
 }
 
-int
-kstat_show_named(kstat_t *ksp)
+static void
+kstat_show_named(kstat_named_t *knp, FILE *fp)
 {
+	fprintf(fp, "%-31s %-4u ", knp->name, knp->data_type);
 
-	VERIFY(ksp != NULL);
+	switch (knp->data_type) {
+	case KSTAT_DATA_CHAR:
+		fprintf(fp, "%-16.16s", knp->value.c);
+		break;
+	case KSTAT_DATA_INT32:
+		fprintf(fp, "%d", knp->value.i32);
+		break;
+	case KSTAT_DATA_UINT32:
+		fprintf(fp, "%u", knp->value.ui32);
+		break;
+	case KSTAT_DATA_INT64:
+		fprintf(fp, "%lld", (longlong_t)knp->value.i64);
+		break;
+	case KSTAT_DATA_UINT64:
+		fprintf(fp, "%llu", (u_longlong_t)knp->value.ui64);
+		break;
+	case KSTAT_DATA_STRING:
+		if (KSTAT_NAMED_STR_PTR(knp) != NULL)
+			fprintf(fp, "%s", KSTAT_NAMED_STR_PTR(knp));
+		break;
+	default:
+		fprintf(fp, "NOT IMPLEMENTED %d", knp->data_type);
+		break;
+	}
+	fprintf(fp, "\n");
+}
 
-	kstat_named_t *value = KSTAT_NAMED_PTR(ksp);
+static void
+kstat_show_io(kstat_io_t *kip, FILE *fp)
+{
+	fprintf(fp, "%-8llu %-8llu %-8u %-8u %-8lld %-8lld %-8lld %-8lld "
+	    "%-8lld %-8lld %-8u %-8u\n",
+	    kip->nread, kip->nwritten, kip->reads, kip->writes,
+	    (longlong_t)kip->wtime, (longlong_t)kip->wlentime,
+	    (longlong_t)kip->wlastupdate, (longlong_t)kip->rtime,
+	    (longlong_t)kip->rlentime, (longlong_t)kip->rlastupdate,
+	    kip->wcnt, kip->rcnt);
+}
 
-	if (value == NULL)
-		return (1);
+static void
+kstat_show_raw(kstat_t *ksp, void *data, FILE *fp)
+{
+	int rc;
 
-	for (int i = 0; i < ksp->ks_ndata; i++, value++) {
-		switch (value->data_type) {
-			case KSTAT_DATA_INT64:
-				printf("%s: %ld\n", value->name,
-				    value->value.i64);
-				break;
-			case KSTAT_DATA_UINT64:
-				printf("%s: %lu\n", value->name,
-				    value->value.ui64);
-				break;
-			case KSTAT_DATA_UINT32:
-				printf("%s: %u\n", value->name,
-				    value->value.ui32);
-				break;
-			default:
-				printf("NOT IMPLEMENTED %d\n",
-				    value->data_type);
-		}
+	if (ksp->ks_raw_ops.data == NULL) {
+		uchar_t *p = data;
+
+		for (size_t i = 0; i < ksp->ks_data_size; i++)
+			fprintf(fp, "%02x%s", p[i], (i % 16 == 15) ? "\n" : "");
+		return;
 	}
 
-	return (0);
+	while ((rc = ksp->ks_raw_ops.data(ksp->ks_raw_buf,
+	    ksp->ks_raw_bufsize, data)) == ENOMEM) {
+		if (kstat_resize_raw(ksp) != 0)
+			break;
+	}
+	if (rc == 0)
+		fprintf(fp, "%s", ksp->ks_raw_buf);
 }
 
-int
-kstat_read(kstat_t *ksp)
+static void *
+kstat_data_addr(kstat_t *ksp, loff_t n)
 {
-	int rc = 0;
 	switch (ksp->ks_type) {
-	case KSTAT_TYPE_NAMED:
-		rc = kstat_show_named(ksp);
-		break;
 	case KSTAT_TYPE_RAW:
+		if (ksp->ks_raw_ops.addr != NULL)
+			return (ksp->ks_raw_ops.addr(ksp, n));
+		return (ksp->ks_data);
+	case KSTAT_TYPE_NAMED:
+		return ((kstat_named_t *)ksp->ks_data + n);
 	case KSTAT_TYPE_INTR:
+		return ((kstat_intr_t *)ksp->ks_data + n);
 	case KSTAT_TYPE_IO:
+		return ((kstat_io_t *)ksp->ks_data + n);
 	case KSTAT_TYPE_TIMER:
-		break;
+		return ((kstat_timer_t *)ksp->ks_data + n);
 	default:
-		rc = 1;
-		printf("not IMPLEMENTED %d\n", ksp->ks_type);
+		return (NULL);
+	}
+}
+
+/*
+ * Writes ksp to fp in the format of /proc/spl/kstat files of the kernel
+ * module, which is what arcstat, arc_summary and dbufstat parse.
+ */
+int
+kstat_show(kstat_t *ksp, FILE *fp)
+{
+	kmutex_t *lp = ksp->ks_lock;
+	kstat_timer_t *ktp;
+	kstat_intr_t *kip;
+	void *data;
+	loff_t n;
+
+	if (lp != NULL)
+		mutex_enter(lp);
+	if (ksp->ks_type == KSTAT_TYPE_RAW)
+		ksp->ks_raw_buf = kmem_alloc(ksp->ks_raw_bufsize, KM_SLEEP);
+	if (ksp->ks_update != NULL)
+		(void) ksp->ks_update(ksp, KSTAT_READ);
+	ksp->ks_snaptime = gethrtime();
+
+	fprintf(fp, "%d %d 0x%02x %d %d %lld %lld\n", ksp->ks_kid,
+	    ksp->ks_type, ksp->ks_flags, ksp->ks_ndata,
+	    (int)ksp->ks_data_size, (longlong_t)ksp->ks_crtime,
+	    (longlong_t)ksp->ks_snaptime);
+
+	switch (ksp->ks_type) {
+	case KSTAT_TYPE_RAW:
+		if (ksp->ks_raw_ops.headers == NULL) {
+			fprintf(fp, "raw data\n");
+			break;
+		}
+		while (ksp->ks_raw_ops.headers(ksp->ks_raw_buf,
+		    ksp->ks_raw_bufsize) == ENOMEM) {
+			if (kstat_resize_raw(ksp) != 0)
+				break;
+		}
+		fprintf(fp, "%s", ksp->ks_raw_buf);
+		break;
+	case KSTAT_TYPE_NAMED:
+		fprintf(fp, "%-31s %-4s %s\n", "name", "type", "data");
+		break;
+	case KSTAT_TYPE_INTR:
+		fprintf(fp, "%-8s %-8s %-8s %-8s %-8s\n",
+		    "hard", "soft", "watchdog", "spurious", "multsvc");
+		break;
+	case KSTAT_TYPE_IO:
+		fprintf(fp, "%-8s %-8s %-8s %-8s %-8s %-8s %-8s %-8s %-8s "
+		    "%-8s %-8s %-8s\n", "nread", "nwritten", "reads",
+		    "writes", "wtime", "wlentime", "wupdate", "rtime",
+		    "rlentime", "rupdate", "wcnt", "rcnt");
+		break;
+	case KSTAT_TYPE_TIMER:
+		fprintf(fp, "%-31s %-8s %-8s %-8s %-8s %-8s %-8s\n", "name",
+		    "events", "elapsed", "min", "max", "start", "stop");
 		break;
 	}
 
+	for (n = 0; n < ksp->ks_ndata; n++) {
+		if ((data = kstat_data_addr(ksp, n)) == NULL)
+			break;
+		switch (ksp->ks_type) {
+		case KSTAT_TYPE_RAW:
+			kstat_show_raw(ksp, data, fp);
+			break;
+		case KSTAT_TYPE_NAMED:
+			kstat_show_named(data, fp);
+			break;
+		case KSTAT_TYPE_INTR:
+			kip = data;
+			fprintf(fp, "%-8u %-8u %-8u %-8u %-8u\n",
+			    kip->intrs[KSTAT_INTR_HARD],
+			    kip->intrs[KSTAT_INTR_SOFT],
+			    kip->intrs[KSTAT_INTR_WATCHDOG],
+			    kip->intrs[KSTAT_INTR_SPURIOUS],
+			    kip->intrs[KSTAT_INTR_MULTSVC]);
+			break;
+		case KSTAT_TYPE_IO:
+			kstat_show_io(data, fp);
+			break;
+		case KSTAT_TYPE_TIMER:
+			ktp = data;
+			fprintf(fp, "%-31s %-8llu %-8lld %-8lld %-8lld %-8lld "
+			    "%-8lld\n", ktp->name, ktp->num_events,
+			    (longlong_t)ktp->elapsed_time,
+			    (longlong_t)ktp->min_time,
+			    (longlong_t)ktp->max_time,
+			    (longlong_t)ktp->start_time,
+			    (longlong_t)ktp->stop_time);
+			break;
+		}
+	}
+
+	if (ksp->ks_type == KSTAT_TYPE_RAW) {
+		kmem_free(ksp->ks_raw_buf, ksp->ks_raw_bufsize);
+		ksp->ks_raw_buf = NULL;
+	}
+	if (lp != NULL)
+		mutex_exit(lp);
+
+	return (0);
+}
+
+/*
+ * Writes kstat of path "<module>/<name>" (like "zfs/arcstats" or
+ * "zfs/<pool>/io") to fp. If path is empty, paths of all the kstats are
+ * written instead, one per line.
+ *
+ * Formatting a kstat can take long (i.e. walk of all dbufs), so it is done
+ * with a hold on the kstat instead of kstat_module_lock, not to block
+ * creating and deleting of other kstats. Readers are serialized by
+ * kstat_show_lock, as raw kstats format into the buffer of kstat.
+ */
+int
+kstat_show_path(const char *path, FILE *fp)
+{
+	char buf[KSTAT_BUF_LEN];
+	nvpair_t *pair;
+	kstat_t *ksp = NULL;
+	int rc = ENOENT;
+
+	pthread_mutex_lock(&kstat_module_lock);
+	for (pair = nvlist_next_nvpair(kstat_nvl, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(kstat_nvl, pair)) {
+		ksp = (kstat_t *)fnvpair_value_uint64(pair);
+		snprintf(buf, sizeof (buf), "%s/%s", ksp->ks_module,
+		    ksp->ks_name);
+		if (path[0] == '\0') {
+			fprintf(fp, "%s\n", buf);
+			rc = 0;
+		} else if (strcmp(buf, path) == 0) {
+			ksp->ks_holds++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&kstat_module_lock);
+
+	if (pair == NULL || path[0] == '\0')
+		return (rc);
+
+	pthread_mutex_lock(&kstat_show_lock);
+	rc = kstat_show(ksp, fp);
+	pthread_mutex_unlock(&kstat_show_lock);
+
+	pthread_mutex_lock(&kstat_module_lock);
+	if (--ksp->ks_holds == 0)
+		pthread_cond_broadcast(&kstat_hold_cond);
+	pthread_mutex_unlock(&kstat_module_lock);
+
 	return (rc);
 }
 
+int
+kstat_read(kstat_t *ksp)
+{
+	return (kstat_show(ksp, stdout));
+}
+
 void
 kstat_dump_all(void)
 {
@@ -976,6 +1266,22 @@ fop_getattr(vnode_t *vp, vattr_t *vap)
 	return (0);
 }
 
+/*
+ * Only F_FREESP is supported, and, space is freed by punching a hole so
+ * that the file size doesn't change.
+ */
+int
+fop_space(vnode_t *vp, int cmd, flock64_t *bfp)
+{
+	if (cmd != F_FREESP)
+		return (EINVAL);
+
+	if (fallocate(vp->v_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    bfp->l_start, bfp->l_len) == -1)
+		return (errno);
+	return (0);
+}
+
 /*
  * =========================================================================
  * Figure out which debugging statements to print
@@ -1537,6 +1843,7 @@ kernel_init(int mode)
 	kstat_nvl = fnvlist_alloc();
 	VERIFY0(uname(&hw_utsname));
 	mutex_init(&zvol_list_mutex, NULL, MUTEX_DEFAULT, NULL);
+	uzfs_zinfo_hash_init();
 	thread_init();
 	system_taskq_init();
 	icp_init();
@@ -1558,6 +1865,7 @@ kernel_fini(void)
 	thread_fini();
 	random_fini();
 	fnvlist_free(kstat_nvl);
+	uzfs_zinfo_hash_fini();
 	mutex_destroy(&zvol_list_mutex);
 }
 
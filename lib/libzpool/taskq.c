@@ -30,11 +30,19 @@
 
 #include <sys/zfs_context.h>
 #include <sys/prctl.h>
+#include <rte_ring.h>
 
 int taskq_now;
 taskq_t *system_taskq;
 taskq_t *system_delay_taskq;
 
+/*
+ * Size of the task ring of every TASKQ_LOCKFREE thread, and the number of
+ * rounds an idle thread looks for work before it parks.
+ */
+int taskq_lf_ring_size = 1024;
+int taskq_lf_spin = 128;
+
 #define	TASKQ_ACTIVE	0x00010000
 #define	TASKQ_WAITING	0x00020000
 
@@ -100,6 +108,285 @@ task_free(taskq_t *tq, taskq_ent_t *t)
 		cv_signal(&tq->tq_maxalloc_cv);
 }
 
+static void
+task_insert(taskq_t *tq, taskq_ent_t *t, uint_t tqflags)
+{
+	ASSERT(MUTEX_HELD(&tq->tq_lock));
+
+	if (tqflags & TQ_FRONT) {
+		t->tqent_next = tq->tq_task.tqent_next;
+		t->tqent_prev = &tq->tq_task;
+	} else {
+		t->tqent_next = &tq->tq_task;
+		t->tqent_prev = tq->tq_task.tqent_prev;
+	}
+	t->tqent_next->tqent_prev = t;
+	t->tqent_prev->tqent_next = t;
+}
+
+static taskq_ent_t *
+task_remove_first(taskq_t *tq)
+{
+	taskq_ent_t *t;
+
+	ASSERT(MUTEX_HELD(&tq->tq_lock));
+
+	if ((t = tq->tq_task.tqent_next) == &tq->tq_task)
+		return (NULL);
+	t->tqent_prev->tqent_next = t->tqent_next;
+	t->tqent_next->tqent_prev = t->tqent_prev;
+	t->tqent_next = NULL;
+	t->tqent_prev = NULL;
+	return (t);
+}
+
+/*
+ * TASKQ_LOCKFREE taskqs give every thread a bounded lock-free ring of
+ * tasks. Dispatchers spread tasks over the rings round-robin, and a thread
+ * that finds its own ring empty steals from the rings of the others. Idle
+ * threads spin for a while before they park on tq_dispatch_cv, so tq_lock
+ * is only taken to park and wake threads, and for the tasks that go to the
+ * regular list: TQ_FRONT and taskq_dispatch_ent() tasks, and overflow when
+ * all rings are full. tq_pending counts the tasks dispatched but not yet
+ * done, and is what taskq_wait() and taskq_check_active_ios() look at.
+ *
+ * Parking and waking pair up through tq_parked: a parking thread bumps it
+ * and then looks for work once more, while a dispatcher queues the task
+ * and then checks tq_parked, with a barrier in between on both sides. So
+ * either the thread sees the task, or the dispatcher sees the thread.
+ * taskq_wait() and the thread that finishes the last task use tq_waiters
+ * the same way.
+ */
+static taskq_ent_t *
+taskq_lf_alloc(taskq_t *tq, int tqflags)
+{
+	taskq_ent_t *t;
+
+	if (rte_ring_mc_dequeue(tq->tq_freering, (void **)&t) == 0)
+		return (t);
+
+	t = kmem_alloc(sizeof (taskq_ent_t), tqflags);
+	if (t != NULL)
+		t->tqent_flags = 0;
+	return (t);
+}
+
+static void
+taskq_lf_free(taskq_t *tq, taskq_ent_t *t)
+{
+	if (rte_ring_mp_enqueue(tq->tq_freering, (void **)&t) != 0)
+		kmem_free(t, sizeof (taskq_ent_t));
+}
+
+static void
+taskq_lf_wakeup(taskq_t *tq)
+{
+	membar_enter();
+	if (tq->tq_parked != 0) {
+		mutex_enter(&tq->tq_lock);
+		cv_signal(&tq->tq_dispatch_cv);
+		mutex_exit(&tq->tq_lock);
+	}
+}
+
+static void
+taskq_lf_insert(taskq_t *tq, taskq_ent_t *t, uint_t tqflags)
+{
+	mutex_enter(&tq->tq_lock);
+	task_insert(tq, t, tqflags);
+	mutex_exit(&tq->tq_lock);
+	taskq_lf_wakeup(tq);
+}
+
+static taskqid_t
+taskq_lf_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
+{
+	taskq_ent_t *t;
+	uint32_t next;
+	int i, ntarget;
+
+	ASSERT(tq->tq_flags & TASKQ_ACTIVE);
+	if ((t = taskq_lf_alloc(tq, tqflags)) == NULL)
+		return (0);
+	t->tqent_func = func;
+	t->tqent_arg = arg;
+	atomic_inc_64(&tq->tq_pending);
+
+	/*
+	 * Rings of the threads we want go first, then any other ring, as all
+	 * rings are drained by stealing.
+	 */
+	if (!(tqflags & TQ_FRONT)) {
+		next = atomic_inc_32_nv(&tq->tq_next);
+		ntarget = tq->tq_ntarget;
+		for (i = 0; i < tq->tq_nrings; i++) {
+			if (rte_ring_mp_enqueue(tq->tq_rings[(i < ntarget) ?
+			    (next + i) % ntarget : i], (void **)&t) == 0) {
+				taskq_lf_wakeup(tq);
+				return (1);
+			}
+		}
+	}
+
+	/* TQ_FRONT, or all rings are full */
+	taskq_lf_insert(tq, t, tqflags);
+	return (1);
+}
+
+/*
+ * Takes the next task for thread 'self': the list first, as it has the
+ * TQ_FRONT tasks, then its own ring, then the rings of the other threads.
+ */
+static taskq_ent_t *
+taskq_lf_take(taskq_t *tq, int self)
+{
+	taskq_ent_t *t = NULL;
+	int i;
+
+	if (tq->tq_task.tqent_next != &tq->tq_task) {
+		mutex_enter(&tq->tq_lock);
+		t = task_remove_first(tq);
+		mutex_exit(&tq->tq_lock);
+		if (t != NULL)
+			return (t);
+	}
+
+	for (i = 0; i < tq->tq_nrings; i++) {
+		if (rte_ring_mc_dequeue(tq->tq_rings[(self + i) %
+		    tq->tq_nrings], (void **)&t) == 0)
+			return (t);
+	}
+	return (NULL);
+}
+
+static boolean_t
+taskq_lf_has_work(taskq_t *tq)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(&tq->tq_lock));
+
+	if (tq->tq_task.tqent_next != &tq->tq_task)
+		return (B_TRUE);
+	for (i = 0; i < tq->tq_nrings; i++)
+		if (!rte_ring_empty(tq->tq_rings[i]))
+			return (B_TRUE);
+	return (B_FALSE);
+}
+
+static void
+taskq_lf_wait(taskq_t *tq)
+{
+	mutex_enter(&tq->tq_lock);
+	tq->tq_waiters++;
+	membar_enter();
+	while (tq->tq_pending != 0)
+		cv_wait(&tq->tq_wait_cv, &tq->tq_lock);
+	tq->tq_waiters--;
+	mutex_exit(&tq->tq_lock);
+}
+
+static void
+taskq_lf_thread(void *arg)
+{
+	taskq_t *tq = arg;
+	taskq_ent_t *t;
+	boolean_t prealloc;
+	int self, spin = 0;
+
+	prctl(PR_SET_NAME, tq->tq_name, 0, 0, 0);
+
+	/* Our ring is the one of the slot we were created for */
+	mutex_enter(&tq->tq_lock);
+	for (self = 0; tq->tq_threadlist[self] != curthread; self++)
+		ASSERT3S(self, <, tq->tq_nrings);
+	mutex_exit(&tq->tq_lock);
+
+	for (;;) {
+		if ((t = taskq_lf_take(tq, self)) != NULL) {
+			spin = 0;
+			prealloc = t->tqent_flags & TQENT_FLAG_PREALLOC;
+			t->tqent_func(t->tqent_arg);
+			if (!prealloc)
+				taskq_lf_free(tq, t);
+
+			if (atomic_dec_64_nv(&tq->tq_pending) == 0 &&
+			    tq->tq_waiters != 0) {
+				mutex_enter(&tq->tq_lock);
+				cv_broadcast(&tq->tq_wait_cv);
+				mutex_exit(&tq->tq_lock);
+			}
+			continue;
+		}
+
+		if ((tq->tq_flags & TASKQ_ACTIVE) && self < tq->tq_ntarget &&
+		    spin++ < taskq_lf_spin) {
+			rte_pause();
+			continue;
+		}
+		spin = 0;
+
+		mutex_enter(&tq->tq_lock);
+		if (!(tq->tq_flags & TASKQ_ACTIVE) || self >= tq->tq_ntarget)
+			break;
+		tq->tq_parked++;
+		membar_enter();
+		if (!taskq_lf_has_work(tq))
+			cv_wait(&tq->tq_dispatch_cv, &tq->tq_lock);
+		tq->tq_parked--;
+		mutex_exit(&tq->tq_lock);
+	}
+
+	tq->tq_threadlist[self] = NULL;
+	tq->tq_nthreads--;
+	cv_broadcast(&tq->tq_wait_cv);
+	mutex_exit(&tq->tq_lock);
+	thread_exit();
+}
+
+/*
+ * Creates threads for the empty slots below tq_ntarget. A slot whose thread
+ * is still around, because it didn't notice an earlier shrink yet, keeps
+ * that thread.
+ */
+static void
+taskq_lf_spawn(taskq_t *tq)
+{
+	int t;
+
+	ASSERT(MUTEX_HELD(&tq->tq_lock));
+
+	for (t = 0; t < tq->tq_ntarget; t++) {
+		if (tq->tq_threadlist[t] != NULL)
+			continue;
+		VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0,
+		    taskq_lf_thread, tq, 0, &p0, TS_RUN, tq->tq_pri)) != NULL);
+		tq->tq_nthreads++;
+	}
+}
+
+/*
+ * Resizes a TASKQ_LOCKFREE taskq to between one and the number of threads
+ * it was created with. Threads above the new count exit once they find no
+ * more work, and their rings are drained by the others.
+ */
+void
+taskq_set_nthreads(taskq_t *tq, int nthreads)
+{
+	ASSERT(tq->tq_flags & TASKQ_LOCKFREE);
+
+	nthreads = MAX(1, MIN(nthreads, tq->tq_nrings));
+	mutex_enter(&tq->tq_lock);
+	if (nthreads < tq->tq_ntarget) {
+		tq->tq_ntarget = nthreads;
+		cv_broadcast(&tq->tq_dispatch_cv);
+	} else {
+		tq->tq_ntarget = nthreads;
+		taskq_lf_spawn(tq);
+	}
+	mutex_exit(&tq->tq_lock);
+}
+
 taskqid_t
 taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 {
@@ -110,21 +397,16 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 		return (1);
 	}
 
+	if (tq->tq_flags & TASKQ_LOCKFREE)
+		return (taskq_lf_dispatch(tq, func, arg, tqflags));
+
 	mutex_enter(&tq->tq_lock);
 	ASSERT(tq->tq_flags & TASKQ_ACTIVE);
 	if ((t = task_alloc(tq, tqflags)) == NULL) {
 		mutex_exit(&tq->tq_lock);
 		return (0);
 	}
-	if (tqflags & TQ_FRONT) {
-		t->tqent_next = tq->tq_task.tqent_next;
-		t->tqent_prev = &tq->tq_task;
-	} else {
-		t->tqent_next = &tq->tq_task;
-		t->tqent_prev = tq->tq_task.tqent_prev;
-	}
-	t->tqent_next->tqent_prev = t;
-	t->tqent_prev->tqent_next = t;
+	task_insert(tq, t, tqflags);
 	t->tqent_func = func;
 	t->tqent_arg = arg;
 	t->tqent_flags = 0;
@@ -168,22 +450,20 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	 * to ensure that we don't free it later.
 	 */
 	t->tqent_flags |= TQENT_FLAG_PREALLOC;
+	t->tqent_func = func;
+	t->tqent_arg = arg;
+
+	if (tq->tq_flags & TASKQ_LOCKFREE) {
+		atomic_inc_64(&tq->tq_pending);
+		taskq_lf_insert(tq, t, flags);
+		return;
+	}
+
 	/*
 	 * Enqueue the task to the underlying queue.
 	 */
 	mutex_enter(&tq->tq_lock);
-
-	if (flags & TQ_FRONT) {
-		t->tqent_next = tq->tq_task.tqent_next;
-		t->tqent_prev = &tq->tq_task;
-	} else {
-		t->tqent_next = &tq->tq_task;
-		t->tqent_prev = tq->tq_task.tqent_prev;
-	}
-	t->tqent_next->tqent_prev = t;
-	t->tqent_prev->tqent_next = t;
-	t->tqent_func = func;
-	t->tqent_arg = arg;
+	task_insert(tq, t, flags);
 	if (tq->tq_active < tq->tq_nthreads)
 		cv_signal(&tq->tq_dispatch_cv);
 	mutex_exit(&tq->tq_lock);
@@ -192,6 +472,11 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 void
 taskq_wait(taskq_t *tq)
 {
+	if (tq->tq_flags & TASKQ_LOCKFREE) {
+		taskq_lf_wait(tq);
+		return;
+	}
+
 	mutex_enter(&tq->tq_lock);
 	while (tq->tq_task.tqent_next != &tq->tq_task || tq->tq_active != 0) {
 		tq->tq_flags |= TASKQ_WAITING;
@@ -218,6 +503,10 @@ taskq_check_active_ios(taskq_t *tq)
 {
 	int ret = 0;
 	taskq_ent_t *t;
+
+	if (tq->tq_flags & TASKQ_LOCKFREE)
+		return (tq->tq_pending != 0);
+
 	mutex_enter(&tq->tq_lock);
 	if (((t = tq->tq_task.tqent_next) != &tq->tq_task) ||
 	    (tq->tq_active != 0))
@@ -237,7 +526,7 @@ taskq_thread(void *arg)
 
 	mutex_enter(&tq->tq_lock);
 	while (tq->tq_flags & TASKQ_ACTIVE) {
-		if ((t = tq->tq_task.tqent_next) == &tq->tq_task) {
+		if ((t = task_remove_first(tq)) == NULL) {
 			if (--tq->tq_active == 0)
 				if (tq->tq_flags & TASKQ_WAITING)
 					cv_broadcast(&tq->tq_wait_cv);
@@ -245,10 +534,6 @@ taskq_thread(void *arg)
 			tq->tq_active++;
 			continue;
 		}
-		t->tqent_prev->tqent_next = t->tqent_next;
-		t->tqent_next->tqent_prev = t->tqent_prev;
-		t->tqent_next = NULL;
-		t->tqent_prev = NULL;
 		prealloc = t->tqent_flags & TQENT_FLAG_PREALLOC;
 		mutex_exit(&tq->tq_lock);
 
@@ -272,6 +557,7 @@ taskq_create(const char *name, int nthreads, pri_t pri,
     int minalloc, int maxalloc, uint_t flags)
 {
 	taskq_t *tq = kmem_zalloc(sizeof (taskq_t), KM_SLEEP);
+	char ring_name[RTE_RING_NAMESIZE];
 	int t;
 
 	if (flags & TASKQ_THREADS_CPU_PCT) {
@@ -300,10 +586,39 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	tq->tq_maxalloc = maxalloc;
 	tq->tq_task.tqent_next = &tq->tq_task;
 	tq->tq_task.tqent_prev = &tq->tq_task;
-	tq->tq_threadlist = kmem_alloc(nthreads * sizeof (kthread_t *),
+	tq->tq_threadlist = kmem_zalloc(nthreads * sizeof (kthread_t *),
 	    KM_SLEEP);
 
-	if (flags & TASKQ_PREPOPULATE) {
+	if (flags & TASKQ_LOCKFREE) {
+		tq->tq_nrings = nthreads;
+		tq->tq_pri = pri;
+		tq->tq_rings = kmem_alloc(nthreads * sizeof (struct rte_ring *),
+		    KM_SLEEP);
+		/* ring names are shorter than taskq names */
+		(void) strlcpy(ring_name, name, sizeof (ring_name));
+		for (t = 0; t < nthreads; t++)
+			VERIFY((tq->tq_rings[t] = rte_ring_create(ring_name,
+			    taskq_lf_ring_size, -1, RING_F_EXACT_SZ)) != NULL);
+		VERIFY((tq->tq_freering = rte_ring_create(ring_name,
+		    nthreads * taskq_lf_ring_size, -1,
+		    RING_F_EXACT_SZ)) != NULL);
+		if (flags & TASKQ_PREPOPULATE) {
+			minalloc = MIN(minalloc, nthreads * taskq_lf_ring_size);
+			while (minalloc-- > 0)
+				taskq_lf_free(tq, taskq_lf_alloc(tq, KM_SLEEP));
+		}
+
+		/*
+		 * TASKQ_DYNAMIC starts with one thread, and the owner grows
+		 * it with taskq_set_nthreads().
+		 */
+		tq->tq_nthreads = 0;
+		tq->tq_ntarget = (flags & TASKQ_DYNAMIC) ? 1 : nthreads;
+		mutex_enter(&tq->tq_lock);
+		taskq_lf_spawn(tq);
+		mutex_exit(&tq->tq_lock);
+		return (tq);
+	} else if (flags & TASKQ_PREPOPULATE) {
 		mutex_enter(&tq->tq_lock);
 		while (minalloc-- > 0)
 			task_free(tq, task_alloc(tq, KM_SLEEP));
@@ -320,7 +635,8 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 void
 taskq_destroy(taskq_t *tq)
 {
-	int nthreads = tq->tq_nthreads;
+	int nthreads = (tq->tq_flags & TASKQ_LOCKFREE) ? tq->tq_nrings :
+	    tq->tq_nthreads;
 
 	taskq_wait(tq);
 
@@ -340,6 +656,20 @@ taskq_destroy(taskq_t *tq)
 
 	mutex_exit(&tq->tq_lock);
 
+	if (tq->tq_flags & TASKQ_LOCKFREE) {
+		taskq_ent_t *t;
+
+		while (rte_ring_sc_dequeue(tq->tq_freering, (void **)&t) == 0)
+			kmem_free(t, sizeof (taskq_ent_t));
+		rte_ring_free(tq->tq_freering);
+		for (int i = 0; i < tq->tq_nrings; i++) {
+			ASSERT(rte_ring_empty(tq->tq_rings[i]));
+			rte_ring_free(tq->tq_rings[i]);
+		}
+		kmem_free(tq->tq_rings,
+		    tq->tq_nrings * sizeof (struct rte_ring *));
+	}
+
 	kmem_free(tq->tq_threadlist, nthreads * sizeof (kthread_t *));
 
 	rw_destroy(&tq->tq_threadlock);
@@ -354,12 +684,13 @@ taskq_destroy(taskq_t *tq)
 int
 taskq_member(taskq_t *tq, kthread_t *t)
 {
-	int i;
+	int i, n;
 
 	if (taskq_now)
 		return (1);
 
-	for (i = 0; i < tq->tq_nthreads; i++)
+	n = (tq->tq_flags & TASKQ_LOCKFREE) ? tq->tq_nrings : tq->tq_nthreads;
+	for (i = 0; i < n; i++)
 		if (tq->tq_threadlist[i] == t)
 			return (1);
 
@@ -0,0 +1,347 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <uzfs_io.h>
+#include <zrepl_mgmt.h>
+#include <uzfs_cache.h>
+
+#define	UZFS_ZIO_CMD_CACHE_MAX_FREE		4096
+#define	UZFS_METADATA_DESC_CACHE_MAX_FREE	16384
+#define	UZFS_BUF_CACHE_MAX_BYTES		(32ULL << 20)
+
+uint64_t uzfs_buf_cache_max_bytes = UZFS_BUF_CACHE_MAX_BYTES;
+
+uzfs_cache_t uzfs_zio_cmd_cache = UZFS_CACHE_INITIALIZER("zio_cmd",
+    sizeof (zvol_io_cmd_t), UZFS_ZIO_CMD_CACHE_MAX_FREE);
+
+uzfs_cache_t uzfs_metadata_desc_cache =
+    UZFS_CACHE_INITIALIZER("metadata_desc", sizeof (metadata_desc_t),
+    UZFS_METADATA_DESC_CACHE_MAX_FREE);
+
+/*
+ * max_free of size classes is derived from uzfs_buf_cache_max_bytes
+ * when buffer is allocated or freed, so, it is not set here.
+ */
+#define	UZFS_BUF_CACHE(shift)	\
+	UZFS_CACHE_INITIALIZER("buf_" #shift, (1ULL << (shift)), 0)
+
+uzfs_cache_t uzfs_buf_cache[UZFS_BUF_CACHE_CLASSES] = {
+	UZFS_BUF_CACHE(9),
+	UZFS_BUF_CACHE(10),
+	UZFS_BUF_CACHE(11),
+	UZFS_BUF_CACHE(12),
+	UZFS_BUF_CACHE(13),
+	UZFS_BUF_CACHE(14),
+	UZFS_BUF_CACHE(15),
+	UZFS_BUF_CACHE(16),
+	UZFS_BUF_CACHE(17),
+	UZFS_BUF_CACHE(18),
+	UZFS_BUF_CACHE(19),
+	UZFS_BUF_CACHE(20),
+};
+CTASSERT_GLOBAL(UZFS_BUF_CACHE_MIN_SHIFT == 9);
+CTASSERT_GLOBAL(UZFS_BUF_CACHE_CLASSES == 12);
+
+/*
+ * Adds counts of allocations and frees done from magazine to cache.
+ * Called with mtx held.
+ */
+static void
+uzfs_cache_mag_fold(uzfs_cache_t *cache, uzfs_cache_mag_t *mag)
+{
+	if (mag == NULL)
+		return;
+
+	cache->hits += mag->allocs;
+	cache->inuse_cnt += mag->allocs - mag->frees;
+	if ((int64_t)cache->inuse_cnt > (int64_t)cache->high_water)
+		cache->high_water = cache->inuse_cnt;
+	mag->allocs = mag->frees = 0;
+}
+
+/*
+ * Moves objects from magazine to free list of cache until 'cnt' of them
+ * are left in magazine. Objects which don't fit in free list are returned
+ * as a list, to be freed by caller after dropping mtx.
+ */
+static void *
+uzfs_cache_mag_drain(uzfs_cache_t *cache, uzfs_cache_mag_t *mag, int cnt)
+{
+	void *obj, *excess = NULL;
+
+	while (mag->cnt > cnt) {
+		obj = mag->objs[--mag->cnt];
+		if (cache->free_cnt < mag->max_free) {
+			*(void **)obj = cache->free_list;
+			cache->free_list = obj;
+			cache->free_cnt++;
+		} else {
+			*(void **)obj = excess;
+			excess = obj;
+		}
+	}
+	return (excess);
+}
+
+static void
+uzfs_cache_free_list(uzfs_cache_t *cache, void *list)
+{
+	void *obj;
+
+	while ((obj = list) != NULL) {
+		list = *(void **)obj;
+		kmem_free(obj, cache->size);
+	}
+}
+
+/*
+ * Destructor of magazine, called when its thread exits.
+ */
+static void
+uzfs_cache_mag_destroy(void *arg)
+{
+	uzfs_cache_mag_t *mag = arg;
+	uzfs_cache_t *cache = mag->cache;
+	void *excess;
+
+	(void) pthread_mutex_lock(&cache->mtx);
+	uzfs_cache_mag_fold(cache, mag);
+	excess = uzfs_cache_mag_drain(cache, mag, 0);
+	(void) pthread_mutex_unlock(&cache->mtx);
+
+	uzfs_cache_free_list(cache, excess);
+	kmem_free(mag, sizeof (uzfs_cache_mag_t));
+}
+
+/*
+ * Returns magazine of calling thread, creating it if needed, or NULL if
+ * cache keeps too few objects to have magazines.
+ */
+static uzfs_cache_mag_t *
+uzfs_cache_mag_get(uzfs_cache_t *cache, uint64_t max_free)
+{
+	uzfs_cache_mag_t *mag;
+	uint64_t size;
+
+	if (!__atomic_load_n(&cache->mag_key_created, __ATOMIC_ACQUIRE)) {
+		(void) pthread_mutex_lock(&cache->mtx);
+		if (!cache->mag_key_created) {
+			VERIFY0(pthread_key_create(&cache->mag_key,
+			    uzfs_cache_mag_destroy));
+			__atomic_store_n(&cache->mag_key_created, B_TRUE,
+			    __ATOMIC_RELEASE);
+		}
+		(void) pthread_mutex_unlock(&cache->mtx);
+	}
+
+	mag = pthread_getspecific(cache->mag_key);
+	if (mag != NULL)
+		return (mag);
+
+	/*
+	 * Objects in magazines of all threads are limited to a fraction of
+	 * max_free, and to UZFS_CACHE_MAG_BYTES per magazine.
+	 */
+	size = MIN(UZFS_CACHE_MAG_SIZE, max_free / 4);
+	size = MIN(size, UZFS_CACHE_MAG_BYTES / cache->size);
+	if (size == 0)
+		return (NULL);
+
+	mag = kmem_zalloc(sizeof (uzfs_cache_mag_t), KM_SLEEP);
+	mag->cache = cache;
+	mag->max_free = max_free;
+	mag->size = size;
+	VERIFY0(pthread_setspecific(cache->mag_key, mag));
+	return (mag);
+}
+
+static void *
+uzfs_cache_alloc_impl(uzfs_cache_t *cache, uint64_t max_free)
+{
+	uzfs_cache_mag_t *mag = uzfs_cache_mag_get(cache, max_free);
+	void *obj;
+
+	if (mag != NULL && mag->cnt > 0) {
+		mag->allocs++;
+		return (mag->objs[--mag->cnt]);
+	}
+
+	(void) pthread_mutex_lock(&cache->mtx);
+	uzfs_cache_mag_fold(cache, mag);
+	obj = cache->free_list;
+	if (obj != NULL) {
+		cache->free_list = *(void **)obj;
+		cache->free_cnt--;
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	cache->inuse_cnt++;
+	if ((int64_t)cache->inuse_cnt > (int64_t)cache->high_water)
+		cache->high_water = cache->inuse_cnt;
+
+	/* refill half of magazine for next allocations */
+	while (mag != NULL && mag->cnt < mag->size / 2 &&
+	    cache->free_list != NULL) {
+		mag->objs[mag->cnt++] = cache->free_list;
+		cache->free_list = *(void **)cache->free_list;
+		cache->free_cnt--;
+	}
+	(void) pthread_mutex_unlock(&cache->mtx);
+
+	if (obj == NULL)
+		obj = kmem_alloc(cache->size, KM_SLEEP);
+	return (obj);
+}
+
+void *
+uzfs_cache_alloc(uzfs_cache_t *cache)
+{
+	return (uzfs_cache_alloc_impl(cache, cache->max_free));
+}
+
+void *
+uzfs_cache_zalloc(uzfs_cache_t *cache)
+{
+	void *obj = uzfs_cache_alloc(cache);
+
+	bzero(obj, cache->size);
+	return (obj);
+}
+
+static void
+uzfs_cache_free_impl(uzfs_cache_t *cache, void *obj, uint64_t max_free)
+{
+	uzfs_cache_mag_t *mag = uzfs_cache_mag_get(cache, max_free);
+	void *excess = NULL;
+
+	if (mag != NULL && mag->cnt < mag->size) {
+		mag->frees++;
+		mag->objs[mag->cnt++] = obj;
+		return;
+	}
+
+	(void) pthread_mutex_lock(&cache->mtx);
+	uzfs_cache_mag_fold(cache, mag);
+	cache->inuse_cnt--;
+	if (mag != NULL) {
+		/* drain half of full magazine, and keep obj in it */
+		excess = uzfs_cache_mag_drain(cache, mag, mag->size / 2);
+		mag->objs[mag->cnt++] = obj;
+		obj = NULL;
+	} else if (cache->free_cnt < max_free) {
+		*(void **)obj = cache->free_list;
+		cache->free_list = obj;
+		cache->free_cnt++;
+		obj = NULL;
+	}
+	(void) pthread_mutex_unlock(&cache->mtx);
+
+	if (obj != NULL)
+		kmem_free(obj, cache->size);
+	uzfs_cache_free_list(cache, excess);
+}
+
+void
+uzfs_cache_free(uzfs_cache_t *cache, void *obj)
+{
+	uzfs_cache_free_impl(cache, obj, cache->max_free);
+}
+
+/*
+ * Frees objects in free list, and in magazine of calling thread.
+ */
+void
+uzfs_cache_reap(uzfs_cache_t *cache)
+{
+	uzfs_cache_mag_t *mag = NULL;
+	void *list, *excess = NULL;
+
+	(void) pthread_mutex_lock(&cache->mtx);
+	if (cache->mag_key_created)
+		mag = pthread_getspecific(cache->mag_key);
+	uzfs_cache_mag_fold(cache, mag);
+	list = cache->free_list;
+	cache->free_list = NULL;
+	cache->free_cnt = 0;
+	if (mag != NULL) {
+		while (mag->cnt > 0) {
+			void *obj = mag->objs[--mag->cnt];
+			*(void **)obj = excess;
+			excess = obj;
+		}
+	}
+	(void) pthread_mutex_unlock(&cache->mtx);
+
+	uzfs_cache_free_list(cache, list);
+	uzfs_cache_free_list(cache, excess);
+}
+
+/*
+ * Returns size class cache for buffer of 'size', or NULL if such buffers
+ * are not cached.
+ */
+static uzfs_cache_t *
+uzfs_buf_cache_get(size_t size)
+{
+	int shift;
+
+	if (size == 0 || size > UZFS_BUF_CACHE_MAX)
+		return (NULL);
+
+	shift = MAX(highbit64(size - 1), UZFS_BUF_CACHE_MIN_SHIFT);
+	return (&uzfs_buf_cache[shift - UZFS_BUF_CACHE_MIN_SHIFT]);
+}
+
+void *
+uzfs_buf_alloc(size_t size)
+{
+	uzfs_cache_t *cache = uzfs_buf_cache_get(size);
+
+	if (cache == NULL)
+		return (kmem_alloc(size, KM_SLEEP));
+	return (uzfs_cache_alloc_impl(cache,
+	    uzfs_buf_cache_max_bytes / cache->size));
+}
+
+void
+uzfs_buf_free(void *buf, size_t size)
+{
+	uzfs_cache_t *cache = uzfs_buf_cache_get(size);
+
+	if (cache == NULL)
+		kmem_free(buf, size);
+	else
+		uzfs_cache_free_impl(cache, buf,
+		    uzfs_buf_cache_max_bytes / cache->size);
+}
+
+void
+uzfs_caches_reap(void)
+{
+	int i;
+
+	uzfs_cache_reap(&uzfs_zio_cmd_cache);
+	uzfs_cache_reap(&uzfs_metadata_desc_cache);
+	for (i = 0; i < UZFS_BUF_CACHE_CLASSES; i++)
+		uzfs_cache_reap(&uzfs_buf_cache[i]);
+}
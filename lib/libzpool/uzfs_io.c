@@ -26,9 +26,19 @@
 #include <sys/dsl_dataset.h>
 #include <uzfs_io.h>
 #include <zrepl_mgmt.h>
+#include <uzfs_cache.h>
 
 int uzfs_write_size;
 
+/*
+ * Max size of data written in one transaction. As in zvol_write, large
+ * writes are split so that transaction doesn't exceed DMU_MAX_ACCESS.
+ */
+#define	UZFS_WRITE_TX_MAX	(DMU_MAX_ACCESS >> 1)
+
+/* max size of metadata stamped over unmapped range in one transaction */
+#define	UZFS_UNMAP_MDATA_CHUNK	(1ULL << 20)
+
 #if DEBUG
 inject_error_t	inject_error;
 #endif
@@ -55,37 +65,34 @@ inject_error_t	inject_error;
 			len_in_first_aligned_block = len;	\
 	} while (0)
 
-#define	WRITE_METADATA(zv, metablk, mdata, tx)			\
-	do {							\
-		dmu_write(zv->zv_objset, ZVOL_META_OBJ,		\
-		    metablk.m_offset, metablk.m_len,		\
-		    mdata, tx);					\
-	} while (0)
-
-/* Writes data 'buf' to dataset 'zv' at 'offset' for 'len' */
+/*
+ * Writes data 'buf' to dataset 'zv' at 'offset' for 'len'. Data and its
+ * metadata are written in single transaction for the whole range (or, for
+ * each non-overlapping chunk of range in case of rebuild), unless range is
+ * bigger than UZFS_WRITE_TX_MAX or uzfs_write_size is set.
+ * If 'buf' is NULL, range is freed instead, i.e., it reads as zeros.
+ */
 int
 uzfs_write_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
     blk_metadata_t *metadata, boolean_t is_rebuild)
 {
 	uint64_t bytes = 0, sync;
 	uint64_t volsize = zv->zv_volsize;
-	uint64_t blocksize = zv->zv_volblocksize;
+	uint64_t blocksize = UZFS_WRITE_TX_MAX;
 	uint64_t end = len + offset;
 	uint64_t wrote = 0;
 	objset_t *os = zv->zv_objset;
 	rl_t *rl;
-	uint64_t mlen = 0;
 	int ret = 0, error;
 	metaobj_blk_offset_t metablk;
-	uint64_t metadatasize = zv->zv_volmetadatasize;
 	uint64_t len_in_first_aligned_block = 0;
 	uint32_t count = 0;
 	list_t *chunk_io = NULL;
 	uint64_t orig_offset = offset;
-	char *mdata = NULL, *tmdata = NULL, *tmdataend = NULL;
 
 	if (uzfs_write_size) {
 		// align it in the multiple of blocksize
+		blocksize = zv->zv_volblocksize;
 		blocksize *= ((uzfs_write_size + blocksize - 1) / blocksize);
 	}
 	/*
@@ -113,17 +120,6 @@ uzfs_write_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
 		sleep(10);
 	}
 #endif
-	if (metadata != NULL) {
-		mlen = get_metadata_len(zv, offset, len);
-		VERIFY((mlen % metadatasize) == 0);
-		tmdata = mdata = kmem_alloc(mlen, KM_SLEEP);
-		tmdataend = mdata + mlen;
-		while (tmdata < tmdataend) {
-			memcpy(tmdata, metadata, metadatasize);
-			tmdata += metadatasize;
-		}
-	}
-
 	CHECK_FIRST_ALIGNED_BLOCK(len_in_first_aligned_block, offset, len,
 	    blocksize);
 
@@ -143,7 +139,7 @@ chunk_io:
 			    len_in_first_aligned_block, offset, len,
 			    blocksize);
 
-			zv->rebuild_info.rebuild_bytes += len;
+			atomic_add_64(&zv->rebuild_info.rebuild_bytes, len);
 			count--;
 	}
 
@@ -158,7 +154,10 @@ chunk_io:
 			bytes = volsize - offset;
 
 		dmu_tx_t *tx = dmu_tx_create(os);
-		dmu_tx_hold_write(tx, ZVOL_OBJ, offset, bytes);
+		if (buf != NULL)
+			dmu_tx_hold_write(tx, ZVOL_OBJ, offset, bytes);
+		else
+			dmu_tx_hold_free(tx, ZVOL_OBJ, offset, bytes);
 
 		if (metadata != NULL) {
 			/* This assumes metavolblocksize same as volblocksize */
@@ -175,15 +174,27 @@ chunk_io:
 			ret = error;
 			goto exit_with_error;
 		}
-		dmu_write(os, ZVOL_OBJ, offset, bytes, buf + wrote, tx);
+		if (buf != NULL)
+			dmu_write(os, ZVOL_OBJ, offset, bytes, buf + wrote, tx);
+		else
+			VERIFY0(dmu_free_range(os, ZVOL_OBJ, offset, bytes,
+			    tx));
 
 		if (metadata)
-			WRITE_METADATA(zv, metablk, mdata, tx);
+			zvol_write_metadata(zv, offset, bytes, metadata, tx);
 
-		zvol_log_write(zv, tx, offset, bytes, sync, metadata);
+		if (buf != NULL)
+			zvol_log_write(zv, tx, offset, bytes, sync, metadata);
+		else
+			zvol_log_truncate(zv, tx, offset, bytes, sync,
+			    metadata);
 
 		dmu_tx_commit(tx);
 
+		if (metadata)
+			uzfs_ionum_index_update(zv, offset, bytes,
+			    metadata->io_num);
+
 		offset += bytes;
 		wrote += bytes;
 		len -= bytes;
@@ -204,9 +215,6 @@ exit_with_error:
 	if (sync)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
-	if (mdata)
-		kmem_free(mdata, mlen);
-
 	return (ret);
 }
 
@@ -231,19 +239,20 @@ uzfs_metadata_append(zvol_state_t *zv, blk_metadata_t *metadata, int n,
 			if (tail->metadata.io_num == metadata[i].io_num) {
 				tail->len += zv->zv_metavolblocksize;
 			} else {
-				new_md = kmem_alloc(sizeof (metadata_desc_t),
-				    KM_SLEEP);
+				new_md = uzfs_cache_alloc(
+				    &uzfs_metadata_desc_cache);
 				tail->next = new_md;
 			}
 		} else {
 			ASSERT3P(*head, ==, NULL);
-			new_md = kmem_alloc(sizeof (metadata_desc_t), KM_SLEEP);
+			new_md = uzfs_cache_alloc(&uzfs_metadata_desc_cache);
 			*head = new_md;
 		}
 		if (new_md != NULL) {
 			new_md->next = NULL;
 			new_md->len = zv->zv_metavolblocksize;
 			new_md->metadata = metadata[i];
+			new_md->hole = B_FALSE;
 			tail = new_md;
 		}
 	}
@@ -321,11 +330,11 @@ uzfs_read_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
 			get_zv_metaobj_block_details(&metablk, zv, offset,
 			    bytes);
 
-			metadata = kmem_alloc(metablk.m_len, KM_SLEEP);
+			metadata = uzfs_buf_alloc(metablk.m_len);
 			error = dmu_read(os, ZVOL_META_OBJ, metablk.m_offset,
 			    metablk.m_len, metadata, 0);
 			if (error != 0) {
-				kmem_free(metadata, metablk.m_len);
+				uzfs_buf_free(metadata, metablk.m_len);
 				goto exit;
 			}
 
@@ -336,7 +345,7 @@ uzfs_read_data(zvol_state_t *zv, char *buf, uint64_t offset, uint64_t len,
 
 			md_ent = uzfs_metadata_append(zv, metadata, nmetas,
 			    md_head, md_ent);
-			kmem_free(metadata, metablk.m_len);
+			uzfs_buf_free(metadata, metablk.m_len);
 		}
 		offset += bytes;
 		read += bytes;
@@ -353,6 +362,179 @@ exit:
 	return (error);
 }
 
+/*
+ * Marks the range 'start' to 'end' of metadata list 'head', which starts at
+ * 'offset', as hole. Chunks partially in the range are split at its ends.
+ */
+static void
+uzfs_metadata_mark_hole(metadata_desc_t *head, uint64_t offset,
+    uint64_t start, uint64_t end)
+{
+	metadata_desc_t *md, *new_md;
+	uint64_t split;
+
+	for (md = head; (md != NULL) && (offset < end);
+	    offset += md->len, md = md->next) {
+		if (offset + md->len <= start)
+			continue;
+
+		/* part of chunk before the range is left as it is */
+		if (offset < start)
+			split = start - offset;
+		else if (offset + md->len > end)
+			split = end - offset;
+		else
+			split = md->len;
+
+		if (split < md->len) {
+			new_md = uzfs_cache_alloc(&uzfs_metadata_desc_cache);
+			new_md->next = md->next;
+			new_md->len = md->len - split;
+			new_md->metadata = md->metadata;
+			new_md->hole = md->hole;
+			md->next = new_md;
+			md->len = split;
+		}
+		if (offset >= start)
+			md->hole = B_TRUE;
+	}
+}
+
+/*
+ * Finds holes of data read from volume 'zv' through its block pointers, so
+ * that they are known without checking the data. Holes are not looked for
+ * if data object has changes that are not synced yet.
+ */
+int
+uzfs_read_holes(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    metadata_desc_t **md_head)
+{
+	objset_t *os = zv->zv_objset;
+	uint64_t blksz = zv->zv_metavolblocksize;
+	uint64_t end = offset + len;
+	uint64_t off = offset, hole, data;
+	int error;
+
+	if (*md_head == NULL) {
+		*md_head = uzfs_cache_alloc(&uzfs_metadata_desc_cache);
+		(*md_head)->next = NULL;
+		(*md_head)->len = len;
+		(*md_head)->metadata.io_num = 0;
+		(*md_head)->hole = B_FALSE;
+	}
+
+	while (off < end) {
+		hole = off;
+		error = dmu_offset_next(os, ZVOL_OBJ, B_TRUE, &hole);
+		if ((error == ESRCH) || (error == EBUSY))
+			return (0);
+		if (error != 0)
+			return (error);
+		if (hole >= end)
+			break;
+
+		data = MAX(hole, off);
+		error = dmu_offset_next(os, ZVOL_OBJ, B_FALSE, &data);
+		if (error == ESRCH)
+			data = end;
+		else if (error == EBUSY)
+			return (0);
+		else if (error != 0)
+			return (error);
+
+		/* only whole metadata blocks can be holes */
+		hole = P2ROUNDUP(MAX(hole, off), blksz);
+		data = MIN(P2ALIGN(data, blksz), end);
+		if (hole < data)
+			uzfs_metadata_mark_hole(*md_head, offset, hole, data);
+		if (data <= off)
+			data = off + blksz;
+		off = data;
+	}
+	return (0);
+}
+
+/*
+ * Frees data of volume 'zv' in range offset to offset + len. The freed range
+ * is stamped with given metadata so that rebuild doesn't copy older data over
+ * it. Range is processed in chunks whose metadata is bounded by
+ * UZFS_UNMAP_MDATA_CHUNK, each chunk being logged to ZIL separately.
+ */
+int
+uzfs_unmap_data(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    blk_metadata_t *metadata)
+{
+	uint64_t end = offset + len;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	uint64_t chunk_size, bytes, sync;
+	objset_t *os = zv->zv_objset;
+	metaobj_blk_offset_t metablk;
+	dmu_tx_t *tx;
+	rl_t *rl;
+	int ret = 0;
+
+	if (zv->zv_metavolblocksize == 0)
+		return (EINVAL);
+	if (!IS_P2ALIGNED(offset, zv->zv_metavolblocksize) ||
+	    !IS_P2ALIGNED(len, zv->zv_metavolblocksize) ||
+	    len == 0)
+		return (EINVAL);
+
+	if (offset + len > zv->zv_volsize || offset > zv->zv_volsize)
+		return (EINVAL);
+
+	sync = (dmu_objset_syncprop(os) == ZFS_SYNC_ALWAYS) ? 1 : 0;
+
+	chunk_size = (UZFS_UNMAP_MDATA_CHUNK / metadatasize) *
+	    zv->zv_metavolblocksize;
+	if (chunk_size > len)
+		chunk_size = len;
+
+	rl = zfs_range_lock(&zv->zv_range_lock, offset, len, RL_WRITER);
+
+	while (offset < end) {
+		bytes = MIN(chunk_size, end - offset);
+
+		tx = dmu_tx_create(os);
+		dmu_tx_mark_netfree(tx);
+		if (metadata != NULL) {
+			get_zv_metaobj_block_details(&metablk, zv, offset,
+			    bytes);
+			dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
+			    metablk.m_len);
+		}
+
+		ret = dmu_tx_assign(tx, TXG_WAIT);
+		if (ret != 0) {
+			dmu_tx_abort(tx);
+			break;
+		}
+
+		if (metadata != NULL)
+			zvol_write_metadata(zv, offset, bytes, metadata, tx);
+
+		zvol_log_truncate(zv, tx, offset, bytes, sync, metadata);
+		dmu_tx_commit(tx);
+
+		if (metadata != NULL)
+			uzfs_ionum_index_update(zv, offset, bytes,
+			    metadata->io_num);
+
+		ret = dmu_free_long_range(os, ZVOL_OBJ, offset, bytes);
+		if (ret != 0)
+			break;
+
+		offset += bytes;
+	}
+
+	zfs_range_unlock(rl);
+
+	if (sync && ret == 0)
+		zil_commit(zv->zv_zilog, ZVOL_OBJ);
+
+	return (ret);
+}
+
 void
 uzfs_flush_data(zvol_state_t *zv)
 {
@@ -420,6 +602,7 @@ uzfs_zvol_set_rebuild_status(zvol_state_t *zv, zvol_rebuild_status_t status)
 	    rebuild_status_to_str(zv->rebuild_info.zv_rebuild_status),
 	    rebuild_status_to_str(status));
 	zv->rebuild_info.zv_rebuild_status = status;
+	uzfs_ionum_index_set_active(zv, ZVOL_IS_REBUILDING(zv));
 }
 
 zvol_rebuild_status_t
@@ -0,0 +1,142 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <uzfs_kstat.h>
+#include <zrepl_mgmt.h>
+
+static int uzfs_kstat_fd = -1;
+
+/*
+ * Clients are served one at a time, so, one which doesn't send its request
+ * or doesn't read the reply is dropped after these many seconds.
+ */
+#define	UZFS_KSTAT_CLIENT_TIMEOUT	(2)
+
+/*
+ * Reads path of kstat asked by client on fd, and writes the kstat to it.
+ * Kstat is formatted into memory first, so that kstat locks are not held
+ * while writing to the client.
+ */
+static void
+uzfs_kstat_serve(int fd)
+{
+	char path[KSTAT_BUF_LEN], *buf = NULL, *nl;
+	size_t off = 0, len = 0;
+	ssize_t n;
+	FILE *fp;
+
+	while (off < sizeof (path) - 1) {
+		n = read(fd, path + off, sizeof (path) - 1 - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		/* client timed out or connection failed */
+		if (n < 0)
+			return;
+		if (n == 0)
+			break;
+		off += n;
+		if (memchr(path + off - n, '\n', n) != NULL)
+			break;
+	}
+	path[off] = '\0';
+	if ((nl = strchr(path, '\n')) != NULL)
+		*nl = '\0';
+
+	if ((fp = open_memstream(&buf, &len)) == NULL)
+		return;
+	if (kstat_show_path(path, fp) != 0)
+		fprintf(fp, "kstat %s not found\n", path);
+	fclose(fp);
+
+	for (off = 0; off < len; off += n) {
+		n = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			break;
+	}
+	free(buf);
+}
+
+static void
+uzfs_kstat_server(void *arg)
+{
+	struct timeval tv = { UZFS_KSTAT_CLIENT_TIMEOUT, 0 };
+	int fd;
+
+	while (1) {
+		fd = accept(uzfs_kstat_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			LOG_ERRNO("kstat server accept failed");
+			break;
+		}
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+		    sizeof (tv)) != 0 || setsockopt(fd, SOL_SOCKET,
+		    SO_SNDTIMEO, &tv, sizeof (tv)) != 0) {
+			LOG_ERRNO("kstat server setsockopt failed");
+			close(fd);
+			continue;
+		}
+		uzfs_kstat_serve(fd);
+		close(fd);
+	}
+	zk_thread_exit();
+}
+
+/*
+ * Starts serving kstats on unix socket at sock_path.
+ */
+int
+uzfs_kstat_server_init(const char *sock_path)
+{
+	struct sockaddr_un addr = { 0 };
+	kthread_t *thread;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return (-1);
+
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, sock_path, sizeof (addr.sun_path));
+	if (unlink(addr.sun_path) != 0 && errno != ENOENT)
+		goto err;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+		goto err;
+	if (listen(fd, 8) < 0)
+		goto err;
+
+	uzfs_kstat_fd = fd;
+	thread = zk_thread_create(NULL, 0, uzfs_kstat_server, NULL, 0, NULL,
+	    TS_RUN, 0, PTHREAD_CREATE_DETACHED);
+	VERIFY3P(thread, !=, NULL);
+	return (0);
+err:
+	LOG_ERRNO("Failed to serve kstats on %s", sock_path);
+	close(fd);
+	return (-1);
+}
@@ -0,0 +1,292 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/isa_defs.h>
+#include <uzfs_md_scan.h>
+#include <zrepl_mgmt.h>
+
+#if defined(__x86_64) && (defined(HAVE_SSE2) || defined(HAVE_AVX2))
+#include <linux/simd_x86.h>
+
+#define	__asm __asm__ __volatile__
+#endif
+
+static uint64_t
+md_scan_scalar_skip(const blk_metadata_t *md, uint64_t n, uint64_t low)
+{
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		if (md[i].io_num > low)
+			break;
+	return (i);
+}
+
+static uint64_t
+md_scan_scalar_run(const blk_metadata_t *md, uint64_t n, uint64_t io_num)
+{
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		if (md[i].io_num != io_num)
+			break;
+	return (i);
+}
+
+static boolean_t
+md_scan_scalar_will_work(void)
+{
+	return (B_TRUE);
+}
+
+static const uzfs_md_scan_ops_t md_scan_scalar_impl = {
+	.skip = md_scan_scalar_skip,
+	.run = md_scan_scalar_run,
+	.is_supported = md_scan_scalar_will_work,
+	.name = "scalar"
+};
+
+#if defined(__x86_64) && defined(HAVE_SSE2)
+
+/*
+ * SSE2 doesn't have 64 bit compares. io_num > low is found from borrow out
+ * of (low - io_num), which is sign bit of
+ * (~low & io_num) | (~(low ^ io_num) & (low - io_num)).
+ * Loop covers 4 entries in every iteration, and, entry where the scan
+ * stops is found by scalar code.
+ */
+static uint64_t
+md_scan_sse2_skip(const blk_metadata_t *md, uint64_t n, uint64_t low)
+{
+	uint64_t i;
+	uint32_t mask = 0;
+
+	kfpu_begin();
+	for (i = 0; i + 4 <= n; i += 4) {
+		__asm(
+		    "movq %[l], %%xmm7\n"
+		    "punpcklqdq %%xmm7, %%xmm7\n"
+		    "movdqu 0x00(%[p]), %%xmm0\n"
+		    "movdqu 0x10(%[p]), %%xmm4\n"
+		    "movdqa %%xmm7, %%xmm1\n"
+		    "movdqa %%xmm7, %%xmm2\n"
+		    "movdqa %%xmm7, %%xmm3\n"
+		    "pxor %%xmm0, %%xmm1\n"
+		    "psubq %%xmm0, %%xmm2\n"
+		    "pandn %%xmm2, %%xmm1\n"
+		    "pandn %%xmm0, %%xmm3\n"
+		    "por %%xmm3, %%xmm1\n"
+		    "movdqa %%xmm7, %%xmm5\n"
+		    "movdqa %%xmm7, %%xmm2\n"
+		    "movdqa %%xmm7, %%xmm3\n"
+		    "pxor %%xmm4, %%xmm5\n"
+		    "psubq %%xmm4, %%xmm2\n"
+		    "pandn %%xmm2, %%xmm5\n"
+		    "pandn %%xmm4, %%xmm3\n"
+		    "por %%xmm3, %%xmm5\n"
+		    "por %%xmm5, %%xmm1\n"
+		    "movmskpd %%xmm1, %[m]\n"
+		    : [m] "=r" (mask)
+		    : [p] "r" (md + i), [l] "m" (low)
+		    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm7",
+		    "memory");
+		if (mask != 0)
+			break;
+	}
+	kfpu_end();
+
+	return (i + md_scan_scalar_skip(md + i, n - i, low));
+}
+
+/*
+ * 64 bit entries are equal when both of their 32 bit halves are equal.
+ */
+static uint64_t
+md_scan_sse2_run(const blk_metadata_t *md, uint64_t n, uint64_t io_num)
+{
+	uint64_t i;
+	uint32_t mask = 0;
+
+	kfpu_begin();
+	for (i = 0; i + 4 <= n; i += 4) {
+		__asm(
+		    "movq %[v], %%xmm7\n"
+		    "punpcklqdq %%xmm7, %%xmm7\n"
+		    "movdqu 0x00(%[p]), %%xmm0\n"
+		    "movdqu 0x10(%[p]), %%xmm2\n"
+		    "pcmpeqd %%xmm7, %%xmm0\n"
+		    "pcmpeqd %%xmm7, %%xmm2\n"
+		    "pshufd $0xb1, %%xmm0, %%xmm1\n"
+		    "pshufd $0xb1, %%xmm2, %%xmm3\n"
+		    "pand %%xmm1, %%xmm0\n"
+		    "pand %%xmm3, %%xmm2\n"
+		    "pand %%xmm2, %%xmm0\n"
+		    "movmskpd %%xmm0, %[m]\n"
+		    : [m] "=r" (mask)
+		    : [p] "r" (md + i), [v] "m" (io_num)
+		    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm7", "memory");
+		if (mask != 0x3)
+			break;
+	}
+	kfpu_end();
+
+	return (i + md_scan_scalar_run(md + i, n - i, io_num));
+}
+
+static boolean_t
+md_scan_sse2_will_work(void)
+{
+	return (zfs_sse2_available());
+}
+
+static const uzfs_md_scan_ops_t md_scan_sse2_impl = {
+	.skip = md_scan_sse2_skip,
+	.run = md_scan_sse2_run,
+	.is_supported = md_scan_sse2_will_work,
+	.name = "sse2"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_SSE2) */
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+
+/*
+ * vpcmpgtq is signed compare, so, sign bit of both io_num and low are
+ * flipped to compare them as unsigned. Loop covers 8 entries in every
+ * iteration.
+ */
+static uint64_t
+md_scan_avx2_skip(const blk_metadata_t *md, uint64_t n, uint64_t low)
+{
+	const uint64_t sign = (1ULL << 63);
+	uint64_t lowb = low ^ sign;
+	uint64_t i;
+	uint32_t mask = 0;
+
+	kfpu_begin();
+	for (i = 0; i + 8 <= n; i += 8) {
+		__asm(
+		    "vpbroadcastq %[s], %%ymm2\n"
+		    "vpbroadcastq %[l], %%ymm3\n"
+		    "vpxor 0x00(%[p]), %%ymm2, %%ymm0\n"
+		    "vpxor 0x20(%[p]), %%ymm2, %%ymm1\n"
+		    "vpcmpgtq %%ymm3, %%ymm0, %%ymm0\n"
+		    "vpcmpgtq %%ymm3, %%ymm1, %%ymm1\n"
+		    "vpor %%ymm1, %%ymm0, %%ymm0\n"
+		    "vpmovmskb %%ymm0, %[m]\n"
+		    : [m] "=r" (mask)
+		    : [p] "r" (md + i), [s] "m" (sign), [l] "m" (lowb)
+		    : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+		if (mask != 0)
+			break;
+	}
+	__asm("vzeroupper");
+	kfpu_end();
+
+	return (i + md_scan_scalar_skip(md + i, n - i, low));
+}
+
+static uint64_t
+md_scan_avx2_run(const blk_metadata_t *md, uint64_t n, uint64_t io_num)
+{
+	uint64_t i;
+	uint32_t mask = 0;
+
+	kfpu_begin();
+	for (i = 0; i + 8 <= n; i += 8) {
+		__asm(
+		    "vpbroadcastq %[v], %%ymm2\n"
+		    "vpcmpeqq 0x00(%[p]), %%ymm2, %%ymm0\n"
+		    "vpcmpeqq 0x20(%[p]), %%ymm2, %%ymm1\n"
+		    "vpand %%ymm1, %%ymm0, %%ymm0\n"
+		    "vpmovmskb %%ymm0, %[m]\n"
+		    : [m] "=r" (mask)
+		    : [p] "r" (md + i), [v] "m" (io_num)
+		    : "xmm0", "xmm1", "xmm2", "memory");
+		if (mask != 0xffffffff)
+			break;
+	}
+	__asm("vzeroupper");
+	kfpu_end();
+
+	return (i + md_scan_scalar_run(md + i, n - i, io_num));
+}
+
+static boolean_t
+md_scan_avx2_will_work(void)
+{
+	return (zfs_avx_available() && zfs_avx2_available());
+}
+
+static const uzfs_md_scan_ops_t md_scan_avx2_impl = {
+	.skip = md_scan_avx2_skip,
+	.run = md_scan_avx2_run,
+	.is_supported = md_scan_avx2_will_work,
+	.name = "avx2"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_AVX2) */
+
+/* All compiled in implementations, in increasing order of speed */
+static const uzfs_md_scan_ops_t *md_scan_all_impl[] = {
+	&md_scan_scalar_impl,
+#if defined(__x86_64) && defined(HAVE_SSE2)
+	&md_scan_sse2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&md_scan_avx2_impl,
+#endif
+};
+
+const uzfs_md_scan_ops_t *uzfs_md_scan_ops = &md_scan_scalar_impl;
+
+/*
+ * As in userspace raidz math, benchmarking is skipped and the last
+ * supported implementation is taken as the fastest one.
+ */
+void
+uzfs_md_scan_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(md_scan_all_impl); i++)
+		if (md_scan_all_impl[i]->is_supported())
+			uzfs_md_scan_ops = md_scan_all_impl[i];
+	LOG_INFO("Using %s implementation for metadata scan",
+	    uzfs_md_scan_ops->name);
+}
+
+int
+uzfs_md_scan_impl_set(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(md_scan_all_impl); i++) {
+		if (strcmp(md_scan_all_impl[i]->name, name) == 0) {
+			if (!md_scan_all_impl[i]->is_supported())
+				return (EINVAL);
+			uzfs_md_scan_ops = md_scan_all_impl[i];
+			return (0);
+		}
+	}
+	return (EINVAL);
+}
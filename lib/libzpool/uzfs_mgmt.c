@@ -31,6 +31,7 @@
 #include <uzfs_io.h>
 #include <uzfs_zap.h>
 #include <uzfs_rebuilding.h>
+#include <uzfs_md_scan.h>
 
 static int uzfs_fd_rand = -1;
 kmutex_t zvol_list_mutex;
@@ -107,6 +108,7 @@ uzfs_init(void)
 	int err = 0;
 
 	kernel_init(FREAD | FWRITE);
+	uzfs_md_scan_init();
 	SLIST_INIT(&zvol_list);
 	uzfs_fd_rand = open("/dev/urandom", O_RDONLY);
 	if (uzfs_fd_rand == -1)
@@ -356,6 +358,7 @@ uzfs_dataset_zv_create(const char *ds_name, zvol_state_t **z)
 	zv->zv_spa = spa;
 	zfs_rlock_init(&zv->zv_range_lock);
 	mutex_init(&zv->rebuild_mtx, NULL, MUTEX_DEFAULT, NULL);
+	uzfs_ionum_index_init(zv);
 
 	strlcpy(zv->zv_name, ds_name, MAXNAMELEN);
 
@@ -370,6 +373,7 @@ uzfs_dataset_zv_create(const char *ds_name, zvol_state_t **z)
 disown_free:
 		dmu_objset_disown(zv->zv_objset, zv);
 free_ret:
+		uzfs_ionum_index_fini(zv);
 		mutex_destroy(&zv->rebuild_mtx);
 		zfs_rlock_destroy(&zv->zv_range_lock);
 		spa_close(spa, zv);
@@ -696,6 +700,7 @@ void
 uzfs_close_dataset(zvol_state_t *zv)
 {
 	uzfs_rele_dataset(zv);
+	uzfs_ionum_index_fini(zv);
 	mutex_destroy(&zv->rebuild_mtx);
 	zfs_rlock_destroy(&zv->zv_range_lock);
 	spa_close(zv->zv_spa, zv);
@@ -706,6 +711,7 @@ void
 uzfs_fini(void)
 {
 	kernel_fini();
+	uzfs_caches_reap();
 	if (uzfs_fd_rand != -1)
 		close(uzfs_fd_rand);
 }
@@ -30,6 +30,7 @@
 #include <uzfs_mgmt.h>
 #include <uzfs_rebuilding.h>
 #include <zrepl_mgmt.h>
+#include <uzfs_md_scan.h>
 
 #define	ADD_TO_IO_CHUNK_LIST(list, e_offset, e_len, count)		\
 	do {    							\
@@ -59,39 +60,33 @@ iszero(blk_metadata_t *md)
 	return (B_FALSE);
 }
 
-#define	EXECUTE_DIFF_CALLBACK(last_lun_offset, diff_count, buf, 	\
-    last_index, arg, last_md, zv, func, ret)				\
-		do {							\
-			ret = func(last_lun_offset, diff_count * 	\
-			    zv->zv_metavolblocksize, (blk_metadata_t *) \
-			    (buf + last_index), zv, arg);		\
-			diff_count = 0;					\
-			last_index = 0;					\
-			last_md = NULL;					\
-		} while (0)
+/*
+ * Size of metadata read in one go by uzfs_get_io_diff. Read of next chunk
+ * is prefetched while current one is being scanned.
+ */
+#define	IO_DIFF_READ_CHUNK_SIZE		(1ULL << 20)
 
 int
 uzfs_get_io_diff(zvol_state_t *zv, blk_metadata_t *low, zvol_state_t *snap,
     uzfs_get_io_diff_cb_t *func, off_t lun_offset, size_t lun_len, void *arg)
 {
-	uint64_t blocksize = zv->zv_volmetablocksize;
-	uint64_t metadata_read_chunk_size = 10 * blocksize;
+	uint64_t metadata_read_chunk_size = IO_DIFF_READ_CHUNK_SIZE;
 	uint64_t metaobjectsize = (zv->zv_volsize / zv->zv_metavolblocksize) *
 	    zv->zv_volmetadatasize;
 	uint64_t metadatasize = zv->zv_volmetadatasize;
-	char *buf;
-	uint64_t i, read;
+	const uzfs_md_scan_ops_t *ops = uzfs_md_scan_ops;
+	blk_metadata_t *buf, *md;
+	uint64_t i, n, cnt, read;
 	uint64_t offset, len, end;
 	int ret = 0;
-	int diff_count = 0, last_index = 0;
-	uint64_t last_lun_offset = 0;
-	blk_metadata_t *last_md;
 	zvol_state_t *snap_zv;
 	metaobj_blk_offset_t snap_metablk;
 
 	if (!func || (lun_offset + lun_len) > zv->zv_volsize || snap == NULL)
 		return (EINVAL);
 
+	ASSERT3U(metadatasize, ==, sizeof (blk_metadata_t));
+
 	get_zv_metaobj_block_details(&snap_metablk, zv, lun_offset, lun_len);
 	offset = snap_metablk.m_offset;
 	end = snap_metablk.m_offset + snap_metablk.m_len;
@@ -100,6 +95,9 @@ uzfs_get_io_diff(zvol_state_t *zv, blk_metadata_t *low, zvol_state_t *snap,
 		end = metaobjectsize;
 	snap_zv = snap;
 
+	/* whole range is read in one go if it is smaller than read chunk */
+	if (end > offset && metadata_read_chunk_size > (end - offset))
+		metadata_read_chunk_size = end - offset;
 	metadata_read_chunk_size = (metadata_read_chunk_size / metadatasize) *
 	    metadatasize;
 	buf = umem_alloc(metadata_read_chunk_size, KM_SLEEP);
@@ -112,73 +110,306 @@ uzfs_get_io_diff(zvol_state_t *zv, blk_metadata_t *low, zvol_state_t *snap,
 		if ((offset + len) > end)
 			len = (end - offset);
 
-		ret = uzfs_read_metadata(snap_zv, buf, offset, len, &read);
+		if (offset + len < end)
+			dmu_prefetch(snap_zv->zv_objset, ZVOL_META_OBJ, 0,
+			    offset + len, MIN(len, end - offset - len),
+			    ZIO_PRIORITY_ASYNC_READ);
+
+		ret = uzfs_read_metadata(snap_zv, (char *)buf, offset, len,
+		    &read);
 
 		if (read != len || ret)
 			break;
 
+		/*
+		 * Blocks whose io_num is greater than low are changed ones,
+		 * and, each run of them with same io_num is passed to
+		 * callback. io_num of 0 (never written) is never greater.
+		 */
+		n = len / metadatasize;
 		lun_offset = (offset / metadatasize) * zv->zv_metavolblocksize;
-		for (i = 0; i < len && !ret; i += sizeof (blk_metadata_t)) {
-			if (!iszero((blk_metadata_t *)(buf+i)) &&
-			    (compare_blk_metadata((blk_metadata_t *)(buf + i),
-			    low) > 0)) {
-				/*
-				 * We will keep track of last lun_offset having
-				 * metadata lesser than incoming_metadata and
-				 * join adjacent chunk with the same on_disk
-				 * io_number.
-				 */
-				if (diff_count == 0) {
-					last_lun_offset = lun_offset;
-					last_md = (blk_metadata_t *)(buf+i);
-					last_index = i;
-				}
-
-				if (diff_count &&
-				    compare_blk_metadata((blk_metadata_t *)
-				    (buf + i), last_md) != 0) {
-					/*
-					 * Execute callback function with last
-					 * metadata and diff_count if
-					 * last compared metadata is changed
-					 */
-					EXECUTE_DIFF_CALLBACK(last_lun_offset,
-					    diff_count, buf, last_index, arg,
-					    last_md, snap_zv, func, ret);
-					if (ret != 0)
-						break;
-					last_lun_offset = lun_offset;
-					last_md = (blk_metadata_t *)(buf+i);
-					last_index = i;
-					diff_count++;
-				} else {
-					/*
-					 * increament diff_count with 1 if
-					 * metadata is same
-					 */
-					diff_count++;
-				}
-			} else if (diff_count) {
-				EXECUTE_DIFF_CALLBACK(last_lun_offset,
-				    diff_count, buf, last_index, arg, last_md,
-				    snap_zv, func, ret);
-				if (ret != 0)
-					break;
-			}
-
-			lun_offset += zv->zv_metavolblocksize;
-		}
-		if (!ret && diff_count) {
-			EXECUTE_DIFF_CALLBACK(last_lun_offset, diff_count, buf,
-			    last_index, arg, last_md, snap_zv, func, ret);
-			if (ret != 0)
+		for (i = 0; i < n && !ret; i += cnt) {
+			i += ops->skip(buf + i, n - i, low->io_num);
+			if (i == n)
 				break;
+			md = buf + i;
+			cnt = ops->run(md, n - i, md->io_num);
+			ret = func(lun_offset + i * zv->zv_metavolblocksize,
+			    cnt * zv->zv_metavolblocksize, md, snap_zv, arg);
 		}
 	}
 	umem_free(buf, metadata_read_chunk_size);
 	return (ret);
 }
 
+/*
+ * Max number of segments in io_num index of a zvol. Index is emptied when
+ * it grows beyond this, and, gets populated again by rebuild writes.
+ */
+uint64_t zvol_ionum_index_max_segs = (1ULL << 18);
+
+static int
+ionum_seg_compare(const void *arg1, const void *arg2)
+{
+	const zvol_ionum_seg_t *s1 = arg1;
+	const zvol_ionum_seg_t *s2 = arg2;
+
+	return (AVL_CMP(s1->start, s2->start));
+}
+
+void
+uzfs_ionum_index_init(zvol_state_t *zv)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+
+	mutex_init(&idx->mtx, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&idx->tree, ionum_seg_compare, sizeof (zvol_ionum_seg_t),
+	    offsetof(zvol_ionum_seg_t, link));
+	idx->active = B_FALSE;
+}
+
+static void
+uzfs_ionum_index_clear(zvol_ionum_index_t *idx)
+{
+	zvol_ionum_seg_t *seg;
+	void *cookie = NULL;
+
+	ASSERT(MUTEX_HELD(&idx->mtx));
+	while ((seg = avl_destroy_nodes(&idx->tree, &cookie)) != NULL)
+		kmem_free(seg, sizeof (*seg));
+	idx->nsegs = 0;
+}
+
+void
+uzfs_ionum_index_fini(zvol_state_t *zv)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+
+	mutex_enter(&idx->mtx);
+	uzfs_ionum_index_clear(idx);
+	mutex_exit(&idx->mtx);
+	avl_destroy(&idx->tree);
+	mutex_destroy(&idx->mtx);
+}
+
+/*
+ * Index is maintained only while zvol is being rebuilt. It is emptied when
+ * it is deactivated, as writes that happen meanwhile don't update it.
+ */
+void
+uzfs_ionum_index_set_active(zvol_state_t *zv, boolean_t active)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+
+	mutex_enter(&idx->mtx);
+	if (idx->active && !active) {
+		LOG_INFO("io_num index of zvol %s: segs: %lu hits: %lu "
+		    "misses: %lu", zv->zv_name, idx->nsegs, idx->hits,
+		    idx->misses);
+		uzfs_ionum_index_clear(idx);
+		idx->hits = idx->misses = 0;
+	}
+	idx->active = active;
+	mutex_exit(&idx->mtx);
+}
+
+/*
+ * Sets io_num of range [start, end) in index. Segments overlapping with
+ * range are trimmed, split or removed, and, range is merged with adjacent
+ * segments having same io_num.
+ */
+static void
+uzfs_ionum_index_set_locked(zvol_ionum_index_t *idx, uint64_t start,
+    uint64_t end, uint64_t io_num)
+{
+	zvol_ionum_seg_t search, *seg, *next, *prev, *tail;
+	avl_index_t where;
+
+	ASSERT(MUTEX_HELD(&idx->mtx));
+	ASSERT3U(start, <, end);
+
+	search.start = start;
+	seg = avl_find(&idx->tree, &search, &where);
+	if (seg == NULL) {
+		seg = avl_nearest(&idx->tree, where, AVL_BEFORE);
+		if (seg == NULL || seg->end <= start)
+			seg = avl_nearest(&idx->tree, where, AVL_AFTER);
+	}
+
+	for (; seg != NULL && seg->start < end; seg = next) {
+		next = AVL_NEXT(&idx->tree, seg);
+		if (seg->start < start && seg->end > end) {
+			tail = kmem_alloc(sizeof (*tail), KM_SLEEP);
+			tail->start = end;
+			tail->end = seg->end;
+			tail->io_num = seg->io_num;
+			seg->end = start;
+			avl_insert_here(&idx->tree, tail, seg, AVL_AFTER);
+			idx->nsegs++;
+			break;
+		} else if (seg->start < start) {
+			seg->end = start;
+		} else if (seg->end > end) {
+			seg->start = end;
+		} else {
+			avl_remove(&idx->tree, seg);
+			kmem_free(seg, sizeof (*seg));
+			idx->nsegs--;
+		}
+	}
+
+	search.start = start;
+	VERIFY3P(avl_find(&idx->tree, &search, &where), ==, NULL);
+	prev = avl_nearest(&idx->tree, where, AVL_BEFORE);
+	next = avl_nearest(&idx->tree, where, AVL_AFTER);
+
+	if (prev != NULL && (prev->end != start || prev->io_num != io_num))
+		prev = NULL;
+	if (next != NULL && (next->start != end || next->io_num != io_num))
+		next = NULL;
+
+	if (prev != NULL && next != NULL) {
+		prev->end = next->end;
+		avl_remove(&idx->tree, next);
+		kmem_free(next, sizeof (*next));
+		idx->nsegs--;
+	} else if (prev != NULL) {
+		prev->end = end;
+	} else if (next != NULL) {
+		next->start = start;
+	} else {
+		seg = kmem_alloc(sizeof (*seg), KM_SLEEP);
+		seg->start = start;
+		seg->end = end;
+		seg->io_num = io_num;
+		avl_insert(&idx->tree, seg, where);
+		idx->nsegs++;
+	}
+
+	if (idx->nsegs > zvol_ionum_index_max_segs)
+		uzfs_ionum_index_clear(idx);
+}
+
+/*
+ * Updates index with io_num written over range (offset, len) of zvol.
+ * Caller must hold zv_range_lock on the range.
+ */
+void
+uzfs_ionum_index_update(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    uint64_t io_num)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+
+	mutex_enter(&idx->mtx);
+	if (idx->active)
+		uzfs_ionum_index_set_locked(idx, offset, offset + len, io_num);
+	mutex_exit(&idx->mtx);
+}
+
+/*
+ * Adds io_num of blocks read from metadata object to index. 'buf' has
+ * metadata of blocks of range starting at lun 'offset'.
+ */
+static void
+uzfs_ionum_index_populate(zvol_state_t *zv, uint64_t offset, char *buf,
+    uint64_t len)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+	uint64_t metavolblocksize = zv->zv_metavolblocksize;
+	blk_metadata_t *md, *run_md = NULL;
+	uint64_t run_offset = offset;
+	uint64_t i;
+
+	mutex_enter(&idx->mtx);
+	if (!idx->active)
+		goto exit;
+
+	for (i = 0; i < len; i += sizeof (blk_metadata_t)) {
+		md = (blk_metadata_t *)(buf + i);
+		if (run_md != NULL && md->io_num != run_md->io_num) {
+			uzfs_ionum_index_set_locked(idx, run_offset, offset,
+			    run_md->io_num);
+			run_md = NULL;
+		}
+		if (run_md == NULL) {
+			run_md = md;
+			run_offset = offset;
+		}
+		offset += metavolblocksize;
+	}
+	if (run_md != NULL)
+		uzfs_ionum_index_set_locked(idx, run_offset, offset,
+		    run_md->io_num);
+exit:
+	mutex_exit(&idx->mtx);
+}
+
+/*
+ * Fills chunk_list with parts of range (offset, len) whose io_num in index
+ * is lesser than that of incoming_md. Returns -1 without touching the list
+ * if index doesn't cover the whole range, otherwise count of chunks added.
+ */
+static int
+uzfs_ionum_index_get_nonoverlapping(zvol_state_t *zv, uint64_t offset,
+    uint64_t len, blk_metadata_t *incoming_md, list_t *chunk_list)
+{
+	zvol_ionum_index_t *idx = &zv->zv_ionum_index;
+	zvol_ionum_seg_t search, *seg, *first;
+	avl_index_t where;
+	uint64_t end = offset + len;
+	uint64_t cur, s, e;
+	uint64_t last_offset = 0, last_len = 0;
+	int count = 0;
+
+	mutex_enter(&idx->mtx);
+	if (!idx->active) {
+		mutex_exit(&idx->mtx);
+		return (-1);
+	}
+
+	search.start = offset;
+	first = avl_find(&idx->tree, &search, &where);
+	if (first == NULL)
+		first = avl_nearest(&idx->tree, where, AVL_BEFORE);
+
+	/* check that range is covered without holes */
+	cur = offset;
+	for (seg = first; seg != NULL && cur < end;
+	    seg = AVL_NEXT(&idx->tree, seg)) {
+		if (seg->start > cur || seg->end <= cur)
+			break;
+		cur = seg->end;
+	}
+	if (cur < end) {
+		idx->misses++;
+		mutex_exit(&idx->mtx);
+		return (-1);
+	}
+	idx->hits++;
+
+	for (seg = first; seg != NULL && seg->start < end;
+	    seg = AVL_NEXT(&idx->tree, seg)) {
+		if (seg->io_num >= incoming_md->io_num)
+			continue;
+		s = MAX(seg->start, offset);
+		e = MIN(seg->end, end);
+		if (last_len != 0 && last_offset + last_len == s) {
+			last_len += e - s;
+			continue;
+		}
+		if (last_len != 0)
+			ADD_TO_IO_CHUNK_LIST(chunk_list, last_offset,
+			    last_len, count);
+		last_offset = s;
+		last_len = e - s;
+	}
+	if (last_len != 0)
+		ADD_TO_IO_CHUNK_LIST(chunk_list, last_offset, last_len, count);
+	mutex_exit(&idx->mtx);
+
+	return (count);
+}
+
 int
 uzfs_get_nonoverlapping_ondisk_blks(zvol_state_t *zv, uint64_t offset,
     uint64_t len, blk_metadata_t *incoming_md, void **list)
@@ -196,6 +427,18 @@ uzfs_get_nonoverlapping_ondisk_blks(zvol_state_t *zv, uint64_t offset,
 	uint64_t metavolblocksize = zv->zv_metavolblocksize;
 	uint64_t metadatasize = zv->zv_volmetadatasize;
 
+	chunk_list = umem_alloc(sizeof (*chunk_list), UMEM_NOFAIL);
+	list_create(chunk_list, sizeof (uzfs_io_chunk_list_t),
+	    offsetof(uzfs_io_chunk_list_t, link));
+
+	/* io_num index avoids reading metadata object during rebuild */
+	ret = uzfs_ionum_index_get_nonoverlapping(zv, offset, len,
+	    incoming_md, chunk_list);
+	if (ret != -1) {
+		*list = chunk_list;
+		return (ret);
+	}
+
 	get_zv_metaobj_block_details(&ondisk_metablk, zv, offset, len);
 	ondisk_metadata_buf = umem_alloc(ondisk_metablk.m_len, UMEM_NOFAIL);
 
@@ -206,10 +449,6 @@ uzfs_get_nonoverlapping_ondisk_blks(zvol_state_t *zv, uint64_t offset,
 		goto exit;
 	}
 
-	chunk_list = umem_alloc(sizeof (*chunk_list), UMEM_NOFAIL);
-	list_create(chunk_list, sizeof (uzfs_io_chunk_list_t),
-	    offsetof(uzfs_io_chunk_list_t, link));
-
 	for (i = 0; i < ondisk_metablk.m_len; i += sizeof (blk_metadata_t)) {
 		ondisk_md = (blk_metadata_t *)(ondisk_metadata_buf + i);
 		lun_offset = ((ondisk_metablk.m_offset + i) *
@@ -236,6 +475,9 @@ uzfs_get_nonoverlapping_ondisk_blks(zvol_state_t *zv, uint64_t offset,
 		ADD_TO_IO_CHUNK_LIST(chunk_list, last_lun_offset,
 		    diff_count * metavolblocksize, count);
 
+	uzfs_ionum_index_populate(zv, offset, ondisk_metadata_buf,
+	    ondisk_metablk.m_len);
+
 exit:
 	umem_free(ondisk_metadata_buf, ondisk_metablk.m_len);
 	*list = chunk_list;
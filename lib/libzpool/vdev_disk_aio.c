@@ -38,6 +38,9 @@
 #include <linux/fs.h>
 #include <rte_ring.h>
 #include <scsi/sg.h>
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+#include <linux/nvme_ioctl.h>
+#endif
 
 /*
  * This is a max number of inflight IOs for a single vdev device and it governs
@@ -67,6 +70,26 @@ extern const uint32_t zfs_vdev_max_active;
 #define	SCSI_FLUSH_TIMEOUT	1000
 #define	SCSI_SENSE_BUF_LEN	32
 
+/* opcode of NVMe flush command */
+#define	NVME_CMD_FLUSH		0x00
+
+/*
+ * Max number of ABD chunks submitted as iovecs of a single IO, which covers
+ * 1MB of 4K chunks even if the data doesn't start at chunk boundary.
+ * IOs with more chunks are linearized into a temporary buffer.
+ */
+#define	AIO_TASK_MAX_IOVS	257
+
+/*
+ * Ways of flushing disk write cache, in the order in which they are tried.
+ */
+typedef enum vda_flush_method {
+	VDA_FLUSH_SCSI,		/* SYNCHRONIZE CACHE SCSI command */
+	VDA_FLUSH_NVME,		/* NVMe flush command */
+	VDA_FLUSH_FDATASYNC,	/* fdatasync of the device */
+	VDA_FLUSH_NONE		/* flush isn't supported */
+} vda_flush_method_t;
+
 /*
  * Virtual device vector for disks accessed from userland using linux aio(7) API
  */
@@ -84,13 +107,25 @@ typedef struct vdev_disk_aio {
 				/* read & written only from poller thread */
 	uint32_t vda_zio_top;	/* latest incoming zio from uzfs */
 	struct rte_ring *vda_ring; /* ring buffer to enqueue/dequeue zio */
-	boolean_t vda_noflush;	/* disk cache flush not supported */
+	vda_flush_method_t vda_flush_method; /* how disk cache is flushed */
+	uint32_t vda_nsid;	/* NVMe namespace id, for NVMe flush */
+	/* Flush zios are queued to flusher thread */
+	uintptr_t vda_flusher_tid;
+	int vda_flush_fd;	/* eventfd for waking up flusher */
+	struct rte_ring *vda_flush_ring; /* ring of flush zios */
+	uint64_t vda_secsize;	/* logical sector size of the disk */
+	struct aio_task *vda_tasks; /* preallocated, one per inflight IO */
+	struct rte_ring *vda_free_tasks; /* ring of free tasks */
 } vdev_disk_aio_t;
 
 typedef struct aio_task {
 	zio_t *zio;
-	void *buf;
+	void *buf;	/* linear copy of zio data, if iovecs weren't used */
 	struct iocb iocb;
+	int iovcnt;
+	uint64_t secsize;
+	boolean_t allocated;	/* not from preallocated tasks of vdev */
+	struct iovec iov[AIO_TASK_MAX_IOVS];
 } aio_task_t;
 
 /*
@@ -100,15 +135,31 @@ typedef struct vda_stats {
 	kstat_named_t vda_stat_userspace_polls;
 	kstat_named_t vda_stat_kernel_polls;
 	kstat_named_t vda_stat_flush_errors;
+	kstat_named_t vda_stat_flushes;
+	kstat_named_t vda_stat_flush_zios;
+	kstat_named_t vda_stat_vectored_ios;
+	kstat_named_t vda_stat_linearized_ios;
+	kstat_named_t vda_stat_trims;
+	kstat_named_t vda_stat_trim_errors;
+	kstat_named_t vda_stat_task_allocs;
 } vda_stats_t;
 
 static vda_stats_t vda_stats = {
 	{ "userspace_polls",	KSTAT_DATA_UINT64 },
 	{ "kernel_polls",	KSTAT_DATA_UINT64 },
 	{ "flush_errors",	KSTAT_DATA_UINT64 },
+	{ "flushes",		KSTAT_DATA_UINT64 },
+	{ "flush_zios",		KSTAT_DATA_UINT64 },
+	{ "vectored_ios",	KSTAT_DATA_UINT64 },
+	{ "linearized_ios",	KSTAT_DATA_UINT64 },
+	{ "trims",		KSTAT_DATA_UINT64 },
+	{ "trim_errors",	KSTAT_DATA_UINT64 },
+	{ "task_allocs",	KSTAT_DATA_UINT64 },
 };
 
 #define	VDA_STAT_BUMP(stat)	atomic_inc_64(&vda_stats.stat.value.ui64)
+#define	VDA_STAT_INCR(stat, val) \
+	atomic_add_64(&vda_stats.stat.value.ui64, (val))
 
 kstat_t *vda_ksp = NULL;
 
@@ -116,7 +167,7 @@ kstat_t *vda_ksp = NULL;
  * Process a single result from asynchronous IO.
  */
 static void
-vdev_disk_aio_done(aio_task_t *task, int64_t res)
+vdev_disk_aio_done(vdev_disk_aio_t *vda, aio_task_t *task, int64_t res)
 {
 	zio_t *zio = task->zio;
 
@@ -125,13 +176,17 @@ vdev_disk_aio_done(aio_task_t *task, int64_t res)
 			zio->io_error = (SET_ERROR(-res));
 		}
 	} else {
-		if (zio->io_type == ZIO_TYPE_READ)
-			abd_return_buf_copy(zio->io_abd, task->buf,
-			    zio->io_size);
-		else if (zio->io_type == ZIO_TYPE_WRITE)
-			abd_return_buf(zio->io_abd, task->buf, zio->io_size);
-		else
-			ASSERT(0);
+		/* buf is NULL if IO was done in place on abd chunks */
+		if (task->buf != NULL) {
+			if (zio->io_type == ZIO_TYPE_READ)
+				abd_return_buf_copy(zio->io_abd, task->buf,
+				    zio->io_size);
+			else if (zio->io_type == ZIO_TYPE_WRITE)
+				abd_return_buf(zio->io_abd, task->buf,
+				    zio->io_size);
+			else
+				ASSERT(0);
+		}
 
 		if (res < 0) {
 			zio->io_error = (SET_ERROR(-res));
@@ -141,6 +196,16 @@ vdev_disk_aio_done(aio_task_t *task, int64_t res)
 
 	}
 
+	/*
+	 * Task is given back before finishing the zio, which may issue
+	 * a new IO needing a task.
+	 */
+	if (task->allocated)
+		kmem_free(task, sizeof (aio_task_t));
+	else
+		VERIFY0(rte_ring_mp_enqueue(vda->vda_free_tasks,
+		    (void **)&task));
+
 	/*
 	 * Perf optimisation: For reads there is checksum verify pipeline
 	 * stage which is CPU intensive and could delay next poll considerably
@@ -152,8 +217,6 @@ vdev_disk_aio_done(aio_task_t *task, int64_t res)
 		zio_interrupt(zio);
 	else
 		zio_execute(zio);
-
-	kmem_free(task, sizeof (aio_task_t));
 }
 
 /*
@@ -254,7 +317,8 @@ vdev_disk_aio_poller(void *arg)
 		ASSERT3P(nr, <=, zfs_vdev_max_active);
 
 		for (int i = 0; i < nr; i++) {
-			vdev_disk_aio_done(events[i].data, events[i].res);
+			vdev_disk_aio_done(vda, events[i].data,
+			    events[i].res);
 		}
 	}
 
@@ -263,6 +327,68 @@ vdev_disk_aio_poller(void *arg)
 	thread_exit();
 }
 
+/*
+ * Adds abd chunk to iovecs of the task. Fails if the chunk can't be used
+ * for direct IO as it is, or if there are too many chunks.
+ */
+static int
+vdev_disk_aio_add_iov(void *buf, size_t len, void *priv)
+{
+	aio_task_t *task = priv;
+
+	if (task->iovcnt == AIO_TASK_MAX_IOVS ||
+	    !IS_P2ALIGNED(buf, task->secsize) ||
+	    !IS_P2ALIGNED(len, task->secsize))
+		return (SET_ERROR(EINVAL));
+
+	task->iov[task->iovcnt].iov_base = buf;
+	task->iov[task->iovcnt].iov_len = len;
+	task->iovcnt++;
+	return (0);
+}
+
+/*
+ * Prepares control block of read or write. Data of scattered abd is
+ * transferred directly from/to its chunks using PREADV/PWRITEV. Linear
+ * abds, and abds with chunks not suitable for direct IO, use single buffer
+ * as earlier, which is copied for the latter.
+ */
+static void
+vdev_disk_aio_prep(vdev_disk_aio_t *vda, aio_task_t *task)
+{
+	zio_t *zio = task->zio;
+	struct iocb *iocb = &task->iocb;
+
+	task->buf = NULL;
+	task->iovcnt = 0;
+	task->secsize = vda->vda_secsize;
+
+	if (!abd_is_linear(zio->io_abd)) {
+		if (abd_iterate_func(zio->io_abd, 0, zio->io_size,
+		    vdev_disk_aio_add_iov, task) == 0) {
+			VDA_STAT_BUMP(vda_stat_vectored_ios);
+			if (zio->io_type == ZIO_TYPE_WRITE)
+				io_prep_pwritev(iocb, vda->vda_fd, task->iov,
+				    task->iovcnt, zio->io_offset);
+			else
+				io_prep_preadv(iocb, vda->vda_fd, task->iov,
+				    task->iovcnt, zio->io_offset);
+			return;
+		}
+		VDA_STAT_BUMP(vda_stat_linearized_ios);
+	}
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		task->buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+		io_prep_pwrite(iocb, vda->vda_fd, task->buf, zio->io_size,
+		    zio->io_offset);
+	} else {
+		task->buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+		io_prep_pread(iocb, vda->vda_fd, task->buf, zio->io_size,
+		    zio->io_offset);
+	}
+}
+
 /*
  * Submit all queued ZIOs to kernel and reset length of ZIO queue.
  *
@@ -280,30 +406,25 @@ vdev_disk_aio_submit(vdev_disk_aio_t *vda, zio_t **zios, int nr,
 		zio_t *zio = zios[n];
 		ASSERT3P(zio->io_vd->vdev_tsd, ==, vda);
 
+		ASSERT(zio->io_type == ZIO_TYPE_WRITE ||
+		    zio->io_type == ZIO_TYPE_READ);
+
 		/*
-		 * Prepare AIO command control block.
+		 * Prepare AIO command control block. Vdev queue doesn't
+		 * issue more than zfs_vdev_max_active IOs to vdev, but
+		 * zios flagged with ZIO_FLAG_DONT_QUEUE (i.e. writes with
+		 * coalescing disabled) and aggregation children bypass it,
+		 * so the preallocated tasks may run out.
 		 */
-		task = kmem_alloc(sizeof (aio_task_t), KM_SLEEP);
+		if (rte_ring_sc_dequeue(vda->vda_free_tasks,
+		    (void **)&task) != 0) {
+			task = kmem_alloc(sizeof (aio_task_t), KM_SLEEP);
+			task->allocated = B_TRUE;
+			VDA_STAT_BUMP(vda_stat_task_allocs);
+		}
 		task->zio = zio;
-		task->buf = NULL;
 		iocbs[n] = &task->iocb;
-
-		switch (zio->io_type) {
-		case ZIO_TYPE_WRITE:
-			task->buf = abd_borrow_buf_copy(zio->io_abd,
-			    zio->io_size);
-			io_prep_pwrite(iocbs[n], vda->vda_fd, task->buf,
-			    zio->io_size, zio->io_offset);
-			break;
-		case ZIO_TYPE_READ:
-			task->buf = abd_borrow_buf(zio->io_abd,
-			    zio->io_size);
-			io_prep_pread(iocbs[n], vda->vda_fd, task->buf,
-			    zio->io_size, zio->io_offset);
-			break;
-		default:
-			ASSERT(0);
-		}
+		vdev_disk_aio_prep(vda, task);
 
 		/*
 		 * prep functions above reset data pointer
@@ -329,7 +450,7 @@ vdev_disk_aio_submit(vdev_disk_aio_t *vda, zio_t **zios, int nr,
 
 		for (int i = nr; i < n; i++) {
 			aio_task_t *task = (aio_task_t *)iocbs[i]->data;
-			vdev_disk_aio_done(task, neg_error);
+			vdev_disk_aio_done(vda, task, neg_error);
 		}
 	}
 }
@@ -416,21 +537,12 @@ kick_submitter(vdev_disk_aio_t *vda)
 }
 
 /*
- * This flush write-cache function works only for true SCSI disks (sd driver):
- *
- *  *) NVMe devices don't support the ioctl,
- *  *) ATA/SATA disks haven't been tested.
- *
- * NOTE: This is called synchronously in zio pipeline. Attempt to execute
- * flush asynchronously on behalf of taskq thread resulted in -10%
- * performance regression for sync workloads.
+ * Flushes write cache of SCSI disk (sd driver) with SYNCHRONIZE CACHE.
+ * Returns ENOTSUP if the command isn't supported by the device.
  */
-static void
-vdev_disk_aio_flush(zio_t *zio)
+static int
+vdev_disk_aio_flush_scsi(vdev_t *vd, vdev_disk_aio_t *vda)
 {
-	vdev_t *vd = zio->io_vd;
-	vdev_disk_aio_t *vda = vd->vdev_tsd;
-
 	struct sg_io_hdr io_hdr;
 	unsigned char scCmdBlk[] =
 	    {SYNCHRONIZE_CACHE, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -447,12 +559,9 @@ vdev_disk_aio_flush(zio_t *zio)
 	io_hdr.timeout = SCSI_FLUSH_TIMEOUT;
 
 	if (ioctl(vda->vda_fd, SG_IO, &io_hdr) < 0) {
-		if (errno == EINVAL || errno == ENOTTY) {
-			vda->vda_noflush = B_TRUE;
-		} else {
-			VDA_STAT_BUMP(vda_stat_flush_errors);
-			zio->io_error = errno;
-		}
+		if (errno == EINVAL || errno == ENOTTY)
+			return (SET_ERROR(ENOTSUP));
+		return (SET_ERROR(errno));
 	} else if (io_hdr.status != GOOD) {
 		fprintf(stderr, "Synchronize cache SCSI command failed "
 		    "for %s\n", vd->vdev_path);
@@ -476,23 +585,180 @@ vdev_disk_aio_flush(zio_t *zio)
 				if (len > 2)
 					sense_key = (0xf & io_hdr.sbp[2]);
 			}
-			if (sense_key == ILLEGAL_REQUEST) {
-				vda->vda_noflush = B_TRUE;
-			} else {
-				VDA_STAT_BUMP(vda_stat_flush_errors);
-				zio->io_error = EIO;
-			}
-		} else {
+			if (sense_key == ILLEGAL_REQUEST)
+				return (SET_ERROR(ENOTSUP));
+		}
+		return (SET_ERROR(EIO));
+	}
+	return (0);
+}
+
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+/*
+ * Flushes volatile write cache of NVMe namespace with flush command.
+ */
+static int
+vdev_disk_aio_flush_nvme(vdev_disk_aio_t *vda)
+{
+	struct nvme_passthru_cmd cmd;
+	int rc;
+
+	memset(&cmd, 0, sizeof (cmd));
+	cmd.opcode = NVME_CMD_FLUSH;
+	cmd.nsid = vda->vda_nsid;
+
+	rc = ioctl(vda->vda_fd, NVME_IOCTL_IO_CMD, &cmd);
+	if (rc < 0) {
+		/* passthrough needs CAP_SYS_ADMIN, which containers may lack */
+		if (errno == EINVAL || errno == ENOTTY || errno == EPERM ||
+		    errno == EACCES)
+			return (SET_ERROR(ENOTSUP));
+		return (SET_ERROR(errno));
+	} else if (rc > 0) {
+		/* NVMe status of the command */
+		fprintf(stderr, "NVMe flush failed for namespace %u with "
+		    "status 0x%x\n", vda->vda_nsid, rc);
+		return (SET_ERROR(EIO));
+	}
+	return (0);
+}
+#endif
+
+/*
+ * Flushes disk write cache with the method found to work for the disk.
+ * When SCSI or NVMe command isn't supported, fdatasync of the device is
+ * used, which makes block layer send flush appropriate for the disk.
+ */
+static int
+vdev_disk_aio_flush_disk(vdev_t *vd, vdev_disk_aio_t *vda)
+{
+	int err;
+
+	switch (vda->vda_flush_method) {
+	case VDA_FLUSH_SCSI:
+		err = vdev_disk_aio_flush_scsi(vd, vda);
+		break;
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+	case VDA_FLUSH_NVME:
+		err = vdev_disk_aio_flush_nvme(vda);
+		break;
+#endif
+	case VDA_FLUSH_FDATASYNC:
+		err = (fdatasync(vda->vda_fd) == 0) ? 0 : SET_ERROR(errno);
+		if (err == EINVAL || err == EROFS) {
+			fprintf(stderr, "Disk %s does not support flush\n",
+			    vd->vdev_path);
+			vda->vda_flush_method = VDA_FLUSH_NONE;
+			return (0);
+		}
+		break;
+	default:
+		return (0);
+	}
+
+	if (err == ENOTSUP) {
+		fprintf(stderr, "Disk %s does not support %s flush command, "
+		    "using fdatasync\n", vd->vdev_path,
+		    (vda->vda_flush_method == VDA_FLUSH_SCSI) ? "SCSI" :
+		    "NVMe");
+		vda->vda_flush_method = VDA_FLUSH_FDATASYNC;
+		return (vdev_disk_aio_flush_disk(vd, vda));
+	}
+	return (err);
+}
+
+/*
+ * Flush zios are queued to flusher thread, which flushes disk write cache
+ * on behalf of all flush zios that arrived while previous flush was in
+ * progress. Those zios can't be completed by the previous flush, as it may
+ * have been sent to disk before their writes completed, but all of them are
+ * completed by one flush.
+ */
+static void
+vdev_disk_aio_flusher(void *arg)
+{
+	vdev_t *vd = arg;
+	vdev_disk_aio_t *vda = vd->vdev_tsd;
+	zio_t **zios_buf;
+	struct pollfd fds;
+	uint64_t poll_data;
+	struct timespec ts;
+	int err, rc;
+
+	prctl(PR_SET_NAME, "aio_flusher", 0, 0, 0);
+
+	/* allocated on heap not to exceed recommended frame size */
+	zios_buf = kmem_alloc(zfs_vdev_max_active * sizeof (zio_t *), KM_SLEEP);
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+
+	while (!vda->vda_stop_polling) {
+		fds.fd = vda->vda_flush_fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+
+		rc = ppoll(&fds, 1, &ts, NULL);
+		if (rc < 0) {
+			perror("ppoll in flusher");
+		} else if (rc > 0 && fds.revents == POLLIN) {
+			rc = read(vda->vda_flush_fd, &poll_data,
+			    sizeof (poll_data));
+			ASSERT3P(rc, ==, sizeof (poll_data));
+		}
+
+		rc = rte_ring_sc_dequeue_burst(vda->vda_flush_ring,
+		    (void **) zios_buf, zfs_vdev_max_active, NULL);
+		if (rc <= 0)
+			continue;
+
+		err = vdev_disk_aio_flush_disk(vd, vda);
+		VDA_STAT_BUMP(vda_stat_flushes);
+		VDA_STAT_INCR(vda_stat_flush_zios, rc);
+		if (err != 0)
 			VDA_STAT_BUMP(vda_stat_flush_errors);
-			zio->io_error = EIO;
+
+		for (int i = 0; i < rc; i++) {
+			zios_buf[i]->io_error = err;
+			zio_interrupt(zios_buf[i]);
 		}
 	}
 
-	if (vda->vda_noflush) {
-		fprintf(stderr, "Disk %s does not support synchronize "
-		    "cache SCSI command\n", vd->vdev_path);
+	kmem_free(zios_buf, zfs_vdev_max_active * sizeof (zio_t *));
+	vda->vda_flusher_tid = 0;
+	thread_exit();
+}
+
+static void
+kick_flusher(vdev_disk_aio_t *vda)
+{
+	uint64_t data = 1;
+	int rc;
+
+	rc = write(vda->vda_flush_fd, &data, sizeof (data));
+	assert(rc == sizeof (data));
+}
+
+/*
+ * Queues flush zio to flusher thread. If the queue is full, which happens
+ * only with more than zfs_vdev_max_active flushes waiting, disk is flushed
+ * in the context of the caller.
+ */
+static void
+vdev_disk_aio_flush(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_disk_aio_t *vda = vd->vdev_tsd;
+
+	if (rte_ring_mp_enqueue(vda->vda_flush_ring, (void **)&zio) == 0) {
+		kick_flusher(vda);
+		return;
 	}
 
+	zio->io_error = vdev_disk_aio_flush_disk(vd, vda);
+	VDA_STAT_BUMP(vda_stat_flushes);
+	VDA_STAT_BUMP(vda_stat_flush_zios);
+	if (zio->io_error != 0)
+		VDA_STAT_BUMP(vda_stat_flush_errors);
 	zio_execute(zio);
 }
 
@@ -579,9 +845,52 @@ vdev_disk_aio_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
 		return (SET_ERROR(ENOMEM));
 	}
+	vda->vda_free_tasks = rte_ring_create("aio_task_ring",
+	    zfs_vdev_max_active, -1, RING_F_EXACT_SZ);
+	if (!vda->vda_free_tasks) {
+		fprintf(stderr, "Failed to create aio_task ring\n");
+		rte_ring_free(vda->vda_ring);
+		(void) io_destroy(vda->vda_io_ctx);
+		close(vda->vda_fd);
+		kmem_free(vda, sizeof (vdev_disk_aio_t));
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(ENOMEM));
+	}
+	vda->vda_tasks = kmem_alloc(zfs_vdev_max_active * sizeof (aio_task_t),
+	    KM_SLEEP);
+	for (int i = 0; i < zfs_vdev_max_active; i++) {
+		vda->vda_tasks[i].allocated = B_FALSE;
+		VERIFY0(rte_ring_sp_enqueue(vda->vda_free_tasks,
+		    &vda->vda_tasks[i]));
+	}
+
 	vda->vda_submit_fd = eventfd(0, EFD_NONBLOCK);
 	if (vda->vda_submit_fd < 0) {
 		fprintf(stderr, "Failed to create eventfd descriptor\n");
+		kmem_free(vda->vda_tasks,
+		    zfs_vdev_max_active * sizeof (aio_task_t));
+		rte_ring_free(vda->vda_free_tasks);
+		rte_ring_free(vda->vda_ring);
+		(void) io_destroy(vda->vda_io_ctx);
+		close(vda->vda_fd);
+		kmem_free(vda, sizeof (vdev_disk_aio_t));
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(ENOMEM));
+	}
+
+	vda->vda_flush_ring = rte_ring_create("aio_flush_ring",
+	    zfs_vdev_max_active, -1, RING_F_EXACT_SZ);
+	vda->vda_flush_fd = eventfd(0, EFD_NONBLOCK);
+	if (!vda->vda_flush_ring || vda->vda_flush_fd < 0) {
+		fprintf(stderr, "Failed to create aio flush queue\n");
+		if (vda->vda_flush_fd >= 0)
+			(void) close(vda->vda_flush_fd);
+		if (vda->vda_flush_ring)
+			rte_ring_free(vda->vda_flush_ring);
+		(void) close(vda->vda_submit_fd);
+		kmem_free(vda->vda_tasks,
+		    zfs_vdev_max_active * sizeof (aio_task_t));
+		rte_ring_free(vda->vda_free_tasks);
 		rte_ring_free(vda->vda_ring);
 		(void) io_destroy(vda->vda_io_ctx);
 		close(vda->vda_fd);
@@ -590,14 +899,28 @@ vdev_disk_aio_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 		return (SET_ERROR(ENOMEM));
 	}
 
-	vda->vda_noflush = B_FALSE;
+	/*
+	 * NVMe namespaces are flushed with NVMe command, and other disks
+	 * with SCSI command, until that is found to be unsupported.
+	 */
+	vda->vda_flush_method = VDA_FLUSH_SCSI;
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+	err = ioctl(vda->vda_fd, NVME_IOCTL_ID);
+	if (err > 0) {
+		vda->vda_nsid = err;
+		vda->vda_flush_method = VDA_FLUSH_NVME;
+	}
+#endif
+
+	vd->vdev_tsd = vda;
+
 	vda->vda_stop_polling = B_FALSE;
 	vda->vda_poller_tid = (uintptr_t)thread_create(NULL, 0,
 	    vdev_disk_aio_poller, vda, 0, &p0, TS_RUN, 0);
 	vda->vda_submitter_tid = (uintptr_t)thread_create(NULL, 0,
 	    vdev_disk_aio_submitter, vda, 0, &p0, TS_RUN, 0);
-
-	vd->vdev_tsd = vda;
+	vda->vda_flusher_tid = (uintptr_t)thread_create(NULL, 0,
+	    vdev_disk_aio_flusher, vd, 0, &p0, TS_RUN, 0);
 
 skip_open:
 	if (ioctl(vda->vda_fd, BLKSSZGET, ashift) != 0) {
@@ -605,6 +928,7 @@ skip_open:
 		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
 		return (SET_ERROR(errno));
 	}
+	vda->vda_secsize = MAX(*ashift, SPA_MINBLOCKSIZE);
 	if (ioctl(vda->vda_fd, BLKGETSIZE64, psize) != 0) {
 		(void) close(vda->vda_fd);
 		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
@@ -624,7 +948,8 @@ skip_open:
 }
 
 /*
- * Waits for poller & submitter thread to exit and destroys AIO context.
+ * Waits for poller, submitter & flusher threads to exit and destroys AIO
+ * context.
  */
 static void
 vdev_disk_aio_close(vdev_t *vd)
@@ -641,21 +966,54 @@ vdev_disk_aio_close(vdev_t *vd)
 
 	vda->vda_stop_polling = B_TRUE;
 	kick_submitter(vda);
-	while (vda->vda_poller_tid != 0 || vda->vda_submitter_tid != 0) {
+	kick_flusher(vda);
+	while (vda->vda_poller_tid != 0 || vda->vda_submitter_tid != 0 ||
+	    vda->vda_flusher_tid != 0) {
 		nanosleep(&ts, NULL);
 	}
 
+	ASSERT0(rte_ring_count(vda->vda_flush_ring));
+	rte_ring_free(vda->vda_flush_ring);
+	(void) close(vda->vda_flush_fd);
 	(void) close(vda->vda_submit_fd);
 	(void) io_destroy(vda->vda_io_ctx);
 	(void) close(vda->vda_fd);
 
 	vd->vdev_delayed_close = B_FALSE;
 
+	ASSERT3U(rte_ring_count(vda->vda_free_tasks), ==, zfs_vdev_max_active);
+	kmem_free(vda->vda_tasks, zfs_vdev_max_active * sizeof (aio_task_t));
+	rte_ring_free(vda->vda_free_tasks);
 	rte_ring_free(vda->vda_ring);
 	kmem_free(vda, sizeof (vdev_disk_aio_t));
 	vd->vdev_tsd = NULL;
 }
 
+/*
+ * Discard a range of the disk. This is done in taskq because BLKDISCARD
+ * is synchronous, and, can take long for large ranges.
+ */
+static void
+vdev_disk_aio_trim(void *arg)
+{
+	zio_t *zio = arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_disk_aio_t *vda = vd->vdev_tsd;
+	uint64_t range[2];
+
+	range[0] = zio->io_offset;
+	range[1] = zio->io_size;
+
+	VDA_STAT_BUMP(vda_stat_trims);
+	if (ioctl(vda->vda_fd, BLKDISCARD, range) != 0) {
+		zio->io_error = SET_ERROR(errno);
+		if (errno != EOPNOTSUPP && errno != ENOTTY)
+			VDA_STAT_BUMP(vda_stat_trim_errors);
+	}
+
+	zio_interrupt(zio);
+}
+
 /*
  * Check and put valid IOs to submit queue.
  */
@@ -675,6 +1033,12 @@ vdev_disk_aio_start(zio_t *zio)
 			zio_interrupt(zio);
 			return;
 		}
+		if (zio->io_cmd == DKIOCFREE && !vd->vdev_notrim) {
+			VERIFY3U(taskq_dispatch(system_taskq,
+			    vdev_disk_aio_trim, zio, TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+			return;
+		}
 		if (zio->io_cmd != DKIOCFLUSHWRITECACHE) {
 			zio->io_error = (SET_ERROR(ENOTSUP));
 			zio_execute(zio);
@@ -692,7 +1056,7 @@ vdev_disk_aio_start(zio_t *zio)
 		 * fsync for device files is not be needed because of O_DIRECT
 		 * open flag. But we still need to flush disk write-cache.
 		 */
-		if (!vda->vda_noflush) {
+		if (vda->vda_flush_method != VDA_FLUSH_NONE) {
 			vdev_disk_aio_flush(zio);
 		} else {
 			zio_execute(zio);
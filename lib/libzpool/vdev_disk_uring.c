@@ -0,0 +1,780 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/kstat.h>
+#include <sys/vdev_disk_aio.h>
+
+/*
+ * Selects io_uring backend for disk vdevs opened from now on. As vdev ops
+ * are picked when vdev is allocated, setting this before importing (or
+ * creating) a pool makes all disks of the pool use io_uring.
+ */
+int zfs_vdev_disk_uring = 0;
+
+/*
+ * Use kernel thread to poll submission queue, so that submitting an IO
+ * doesn't need a syscall. Kernel thread goes to sleep after being idle
+ * for zfs_vdev_disk_uring_sqpoll_idle milliseconds.
+ */
+int zfs_vdev_disk_uring_sqpoll = 0;
+uint32_t zfs_vdev_disk_uring_sqpoll_idle = 2000;
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+
+/*
+ * This is a max number of inflight IOs for a single vdev device, and,
+ * governs the size of io_uring submission and completion queues.
+ */
+extern const uint32_t zfs_vdev_max_active;
+
+/*
+ * Virtual device vector for disks accessed from userland using io_uring(7).
+ *
+ * Unlike aio backend, there is no submitter thread. IOs are put into
+ * submission queue by the thread issuing the zio, and all the IOs queued
+ * by then get submitted to kernel in single io_uring_enter. Completions are
+ * reaped in batches by one poller thread per vdev, which sleeps in kernel
+ * while there are no completions.
+ */
+typedef struct vdev_disk_uring {
+	int vdu_fd;
+	int vdu_ring_fd;
+	boolean_t vdu_sqpoll;		/* kernel polls submission queue */
+	boolean_t vdu_fixed_file;	/* vdu_fd is registered with ring */
+	boolean_t vdu_stop_polling;
+	uintptr_t vdu_poller_tid;
+
+	/* protects filling of submission queue entries */
+	kmutex_t vdu_sq_lock;
+	uint32_t vdu_sq_entries;
+	uint32_t *vdu_sq_head;
+	uint32_t *vdu_sq_tail;
+	uint32_t *vdu_sq_mask;
+	uint32_t *vdu_sq_flags;
+	struct io_uring_sqe *vdu_sqes;
+
+	/* accessed only from poller thread */
+	uint32_t *vdu_cq_head;
+	uint32_t *vdu_cq_tail;
+	uint32_t *vdu_cq_mask;
+	struct io_uring_cqe *vdu_cqes;
+
+	void *vdu_sq_ring;
+	size_t vdu_sq_ring_len;
+	void *vdu_cq_ring;
+	size_t vdu_cq_ring_len;
+	size_t vdu_sqes_len;
+} vdev_disk_uring_t;
+
+typedef struct uring_task {
+	zio_t *zio;
+	void *buf;
+} uring_task_t;
+
+/*
+ * io_uring kstats help comparing it with aio vdev backend.
+ */
+typedef struct vdu_stats {
+	kstat_named_t vdu_stat_submit_calls;
+	kstat_named_t vdu_stat_sqpoll_wakeups;
+	kstat_named_t vdu_stat_kernel_polls;
+	kstat_named_t vdu_stat_completions;
+	kstat_named_t vdu_stat_flush_errors;
+	kstat_named_t vdu_stat_trims;
+	kstat_named_t vdu_stat_trim_errors;
+	kstat_named_t vdu_stat_sq_full_waits;
+} vdu_stats_t;
+
+static vdu_stats_t vdu_stats = {
+	{ "submit_calls",	KSTAT_DATA_UINT64 },
+	{ "sqpoll_wakeups",	KSTAT_DATA_UINT64 },
+	{ "kernel_polls",	KSTAT_DATA_UINT64 },
+	{ "completions",	KSTAT_DATA_UINT64 },
+	{ "flush_errors",	KSTAT_DATA_UINT64 },
+	{ "trims",		KSTAT_DATA_UINT64 },
+	{ "trim_errors",	KSTAT_DATA_UINT64 },
+	{ "sq_full_waits",	KSTAT_DATA_UINT64 },
+};
+
+#define	VDU_STAT_BUMP(stat)	atomic_inc_64(&vdu_stats.stat.value.ui64)
+#define	VDU_STAT_INCR(stat, val) \
+	atomic_add_64(&vdu_stats.stat.value.ui64, (val))
+
+static kstat_t *vdu_ksp = NULL;
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+	return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, NULL, 0));
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/*
+ * Process a single completion of IO.
+ */
+static void
+vdev_disk_uring_done(uring_task_t *task, int res)
+{
+	zio_t *zio = task->zio;
+
+	if (zio->io_type == ZIO_TYPE_IOCTL) {
+		if (res != 0) {
+			VDU_STAT_BUMP(vdu_stat_flush_errors);
+			zio->io_error = (SET_ERROR(-res));
+		}
+	} else {
+		if (zio->io_type == ZIO_TYPE_READ)
+			abd_return_buf_copy(zio->io_abd, task->buf,
+			    zio->io_size);
+		else if (zio->io_type == ZIO_TYPE_WRITE)
+			abd_return_buf(zio->io_abd, task->buf, zio->io_size);
+		else
+			ASSERT(0);
+
+		if (res < 0) {
+			zio->io_error = (SET_ERROR(-res));
+		} else if (res != zio->io_size) {
+			zio->io_error = (SET_ERROR(ENOSPC));
+		}
+	}
+
+	kmem_free(task, sizeof (uring_task_t));
+
+	/*
+	 * As in aio backend, checksum verification of reads is done
+	 * asynchronously not to delay reaping of next completions.
+	 */
+	if (zio->io_type == ZIO_TYPE_READ)
+		zio_interrupt(zio);
+	else
+		zio_execute(zio);
+}
+
+/*
+ * Reaps all available completions, and returns the number of them.
+ */
+static int
+vdev_disk_uring_reap(vdev_disk_uring_t *vdu)
+{
+	struct io_uring_cqe *cqe;
+	uring_task_t *task;
+	uint32_t head, tail;
+	int nr = 0;
+
+	head = *vdu->vdu_cq_head;
+	tail = __atomic_load_n(vdu->vdu_cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		cqe = &vdu->vdu_cqes[head & *vdu->vdu_cq_mask];
+		task = (uring_task_t *)(uintptr_t)cqe->user_data;
+		if (task != NULL)
+			vdev_disk_uring_done(task, cqe->res);
+		head++;
+		nr++;
+		/*
+		 * Entries are given back to kernel in batches, but, often
+		 * enough for kernel not to run out of them.
+		 */
+		if ((nr & 0xf) == 0)
+			__atomic_store_n(vdu->vdu_cq_head, head,
+			    __ATOMIC_RELEASE);
+		if (head == tail)
+			tail = __atomic_load_n(vdu->vdu_cq_tail,
+			    __ATOMIC_ACQUIRE);
+	}
+	__atomic_store_n(vdu->vdu_cq_head, head, __ATOMIC_RELEASE);
+
+	return (nr);
+}
+
+/*
+ * Waits for completions of IOs and dispatches them to zio pipeline.
+ */
+static void
+vdev_disk_uring_poller(void *arg)
+{
+	vdev_disk_uring_t *vdu = arg;
+	int nr;
+
+	prctl(PR_SET_NAME, "uring_poller", 0, 0, 0);
+
+	while (!vdu->vdu_stop_polling) {
+		nr = vdev_disk_uring_reap(vdu);
+		if (nr > 0) {
+			VDU_STAT_INCR(vdu_stat_completions, nr);
+			continue;
+		}
+
+		/*
+		 * Entries left in submission queue by a failed submit are
+		 * submitted here too.
+		 */
+		VDU_STAT_BUMP(vdu_stat_kernel_polls);
+		if (io_uring_enter(vdu->vdu_ring_fd,
+		    vdu->vdu_sqpoll ? 0 : vdu->vdu_sq_entries, 1,
+		    IORING_ENTER_GETEVENTS) < 0) {
+			/*
+			 * EAGAIN and EBUSY come from submitting, while
+			 * kernel is short of resources or completion queue
+			 * overflowed, and pass once completions are reaped.
+			 * Other errors except EINTR are unrecoverable.
+			 */
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EBUSY)
+				continue;
+			fprintf(stderr, "Failed when polling for io_uring "
+			    "completions: %d\n", errno);
+			break;
+		}
+	}
+
+	vdu->vdu_poller_tid = 0;
+	thread_exit();
+}
+
+/*
+ * Submits entries queued in submission queue to kernel. Entries queued by
+ * concurrent callers go in the same call, and their io_uring_enter finds
+ * nothing to submit.
+ */
+static void
+vdev_disk_uring_enter(vdev_disk_uring_t *vdu)
+{
+	int rc;
+
+	if (vdu->vdu_sqpoll) {
+		if (__atomic_load_n(vdu->vdu_sq_flags, __ATOMIC_ACQUIRE) &
+		    IORING_SQ_NEED_WAKEUP) {
+			VDU_STAT_BUMP(vdu_stat_sqpoll_wakeups);
+			(void) io_uring_enter(vdu->vdu_ring_fd, 0, 0,
+			    IORING_ENTER_SQ_WAKEUP);
+		}
+		return;
+	}
+
+	VDU_STAT_BUMP(vdu_stat_submit_calls);
+	do {
+		rc = io_uring_enter(vdu->vdu_ring_fd, vdu->vdu_sq_entries,
+		    0, 0);
+	} while (rc < 0 && (errno == EINTR || errno == EAGAIN ||
+	    errno == EBUSY));
+	/*
+	 * Entries stay in the queue, and get submitted by the next
+	 * io_uring_enter of either a submitter or the poller.
+	 */
+	if (rc < 0)
+		fprintf(stderr, "Failed to submit io_uring requests: %d\n",
+		    errno);
+}
+
+/*
+ * Puts an entry for the task into submission queue, and submits it along
+ * with other entries queued by concurrent callers. Task with NULL zio is
+ * used to wake up poller.
+ *
+ * Once the entry is published, it is owned by the ring, and the task is
+ * completed only from its completion queue entry.
+ */
+static void
+vdev_disk_uring_submit(vdev_disk_uring_t *vdu, uring_task_t *task)
+{
+	struct io_uring_sqe *sqe;
+	zio_t *zio = (task != NULL) ? task->zio : NULL;
+	uint32_t head, tail;
+
+	mutex_enter(&vdu->vdu_sq_lock);
+	tail = *vdu->vdu_sq_tail;
+	head = __atomic_load_n(vdu->vdu_sq_head, __ATOMIC_ACQUIRE);
+	/*
+	 * Vdev queue keeps at most zfs_vdev_max_active IOs in flight, but
+	 * zios which bypass it can fill up the queue. Wait for kernel to
+	 * consume entries then.
+	 */
+	while (tail - head >= vdu->vdu_sq_entries) {
+		mutex_exit(&vdu->vdu_sq_lock);
+		VDU_STAT_BUMP(vdu_stat_sq_full_waits);
+		vdev_disk_uring_enter(vdu);
+		sched_yield();
+		mutex_enter(&vdu->vdu_sq_lock);
+		tail = *vdu->vdu_sq_tail;
+		head = __atomic_load_n(vdu->vdu_sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	sqe = &vdu->vdu_sqes[tail & *vdu->vdu_sq_mask];
+	bzero(sqe, sizeof (*sqe));
+	if (zio == NULL) {
+		sqe->opcode = IORING_OP_NOP;
+	} else {
+		if (vdu->vdu_fixed_file) {
+			sqe->fd = 0;
+			sqe->flags = IOSQE_FIXED_FILE;
+		} else {
+			sqe->fd = vdu->vdu_fd;
+		}
+
+		switch (zio->io_type) {
+		case ZIO_TYPE_WRITE:
+			sqe->opcode = IORING_OP_WRITE;
+			break;
+		case ZIO_TYPE_READ:
+			sqe->opcode = IORING_OP_READ;
+			break;
+		case ZIO_TYPE_IOCTL:
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			break;
+		default:
+			ASSERT(0);
+		}
+		if (zio->io_type != ZIO_TYPE_IOCTL) {
+			sqe->addr = (uint64_t)(uintptr_t)task->buf;
+			sqe->len = zio->io_size;
+			sqe->off = zio->io_offset;
+		}
+	}
+	sqe->user_data = (uint64_t)(uintptr_t)task;
+	__atomic_store_n(vdu->vdu_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	mutex_exit(&vdu->vdu_sq_lock);
+
+	vdev_disk_uring_enter(vdu);
+}
+
+/*
+ * We probably can't do anything better from userland than opening the device
+ * to prevent it from going away. So hold and rele are noops.
+ */
+static void
+vdev_disk_uring_hold(vdev_t *vd)
+{
+	ASSERT(vd->vdev_path != NULL);
+}
+
+static void
+vdev_disk_uring_rele(vdev_t *vd)
+{
+	ASSERT(vd->vdev_path != NULL);
+}
+
+static void
+vdev_disk_uring_free(vdev_disk_uring_t *vdu)
+{
+	if (vdu->vdu_sqes != NULL)
+		(void) munmap(vdu->vdu_sqes, vdu->vdu_sqes_len);
+	if (vdu->vdu_cq_ring != NULL && vdu->vdu_cq_ring != vdu->vdu_sq_ring)
+		(void) munmap(vdu->vdu_cq_ring, vdu->vdu_cq_ring_len);
+	if (vdu->vdu_sq_ring != NULL)
+		(void) munmap(vdu->vdu_sq_ring, vdu->vdu_sq_ring_len);
+	if (vdu->vdu_ring_fd >= 0)
+		(void) close(vdu->vdu_ring_fd);
+	if (vdu->vdu_fd >= 0)
+		(void) close(vdu->vdu_fd);
+	mutex_destroy(&vdu->vdu_sq_lock);
+	kmem_free(vdu, sizeof (vdev_disk_uring_t));
+}
+
+/*
+ * Creates io_uring instance and maps its queues.
+ */
+static int
+vdev_disk_uring_setup(vdev_disk_uring_t *vdu)
+{
+	struct io_uring_params p;
+	int fd;
+
+	bzero(&p, sizeof (p));
+	if (zfs_vdev_disk_uring_sqpoll) {
+		p.flags = IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = zfs_vdev_disk_uring_sqpoll_idle;
+	}
+
+	/* one more than max active IOs, for NOP which wakes up poller */
+	fd = io_uring_setup(zfs_vdev_max_active + 1, &p);
+	if (fd < 0 && zfs_vdev_disk_uring_sqpoll) {
+		fprintf(stderr, "Failed to setup io_uring with SQPOLL: %d, "
+		    "trying without it\n", errno);
+		bzero(&p, sizeof (p));
+		fd = io_uring_setup(zfs_vdev_max_active + 1, &p);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "Failed to setup io_uring: %d\n", errno);
+		return (SET_ERROR(errno));
+	}
+	vdu->vdu_ring_fd = fd;
+	vdu->vdu_sqpoll = ((p.flags & IORING_SETUP_SQPOLL) != 0);
+	vdu->vdu_sq_entries = p.sq_entries;
+
+	vdu->vdu_sq_ring_len = p.sq_off.array + p.sq_entries *
+	    sizeof (uint32_t);
+	vdu->vdu_cq_ring_len = p.cq_off.cqes + p.cq_entries *
+	    sizeof (struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		vdu->vdu_sq_ring_len = MAX(vdu->vdu_sq_ring_len,
+		    vdu->vdu_cq_ring_len);
+		vdu->vdu_cq_ring_len = vdu->vdu_sq_ring_len;
+	}
+
+	vdu->vdu_sq_ring = mmap(NULL, vdu->vdu_sq_ring_len,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	    IORING_OFF_SQ_RING);
+	if (vdu->vdu_sq_ring == MAP_FAILED) {
+		vdu->vdu_sq_ring = NULL;
+		return (SET_ERROR(errno));
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		vdu->vdu_cq_ring = vdu->vdu_sq_ring;
+	} else {
+		vdu->vdu_cq_ring = mmap(NULL, vdu->vdu_cq_ring_len,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+		    IORING_OFF_CQ_RING);
+		if (vdu->vdu_cq_ring == MAP_FAILED) {
+			vdu->vdu_cq_ring = NULL;
+			return (SET_ERROR(errno));
+		}
+	}
+	vdu->vdu_sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+	vdu->vdu_sqes = mmap(NULL, vdu->vdu_sqes_len,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	    IORING_OFF_SQES);
+	if (vdu->vdu_sqes == MAP_FAILED) {
+		vdu->vdu_sqes = NULL;
+		return (SET_ERROR(errno));
+	}
+
+#define	SQ_PTR(field)	\
+	((uint32_t *)((char *)vdu->vdu_sq_ring + p.sq_off.field))
+#define	CQ_PTR(field)	\
+	((uint32_t *)((char *)vdu->vdu_cq_ring + p.cq_off.field))
+	vdu->vdu_sq_head = SQ_PTR(head);
+	vdu->vdu_sq_tail = SQ_PTR(tail);
+	vdu->vdu_sq_mask = SQ_PTR(ring_mask);
+	vdu->vdu_sq_flags = SQ_PTR(flags);
+	vdu->vdu_cq_head = CQ_PTR(head);
+	vdu->vdu_cq_tail = CQ_PTR(tail);
+	vdu->vdu_cq_mask = CQ_PTR(ring_mask);
+	vdu->vdu_cqes = (struct io_uring_cqe *)((char *)vdu->vdu_cq_ring +
+	    p.cq_off.cqes);
+
+	/* index array maps ring slots to sqes with the same index */
+	for (uint32_t i = 0; i < p.sq_entries; i++)
+		SQ_PTR(array)[i] = i;
+#undef	SQ_PTR
+#undef	CQ_PTR
+
+	/*
+	 * Registered file saves taking reference on file for every IO.
+	 * It is an optimization, so, failure to register is ignored.
+	 */
+	vdu->vdu_fixed_file = (io_uring_register(fd, IORING_REGISTER_FILES,
+	    &vdu->vdu_fd, 1) == 0);
+
+	return (0);
+}
+
+/*
+ * Opens dev file, creates io_uring instance and poller thread.
+ */
+static int
+vdev_disk_uring_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift)
+{
+	vdev_disk_uring_t *vdu;
+	unsigned short isrot = 0;
+	int err;
+
+	/*
+	 * We must have a pathname, and it must be absolute.
+	 */
+	if (vd->vdev_path == NULL || vd->vdev_path[0] != '/') {
+		vd->vdev_stat.vs_aux = VDEV_AUX_BAD_LABEL;
+		return (SET_ERROR(EINVAL));
+	}
+
+	/*
+	 * Reopen the device if it's not currently open.  Otherwise,
+	 * just update the physical size of the device.
+	 */
+	if (vd->vdev_tsd != NULL) {
+		ASSERT(vd->vdev_reopening);
+		vdu = vd->vdev_tsd;
+		goto skip_open;
+	}
+
+	vdu = kmem_zalloc(sizeof (vdev_disk_uring_t), KM_SLEEP);
+	mutex_init(&vdu->vdu_sq_lock, NULL, MUTEX_DEFAULT, NULL);
+	vdu->vdu_ring_fd = -1;
+
+	vdu->vdu_fd = open(vd->vdev_path,
+	    ((spa_mode(vd->vdev_spa) & FWRITE) != 0) ? O_RDWR|O_DIRECT :
+	    O_RDONLY|O_DIRECT);
+	if (vdu->vdu_fd < 0) {
+		err = errno;
+		vdev_disk_uring_free(vdu);
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(err));
+	}
+
+	err = vdev_disk_uring_setup(vdu);
+	if (err != 0) {
+		vdev_disk_uring_free(vdu);
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (err);
+	}
+
+	vdu->vdu_stop_polling = B_FALSE;
+	vdu->vdu_poller_tid = (uintptr_t)thread_create(NULL, 0,
+	    vdev_disk_uring_poller, vdu, 0, &p0, TS_RUN, 0);
+
+	vd->vdev_tsd = vdu;
+
+skip_open:
+	if (ioctl(vdu->vdu_fd, BLKSSZGET, ashift) != 0 ||
+	    ioctl(vdu->vdu_fd, BLKGETSIZE64, psize) != 0 ||
+	    ioctl(vdu->vdu_fd, BLKROTATIONAL, &isrot) != 0) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(errno));
+	}
+
+	*ashift = highbit64(MAX(*ashift, SPA_MINBLOCKSIZE)) - 1;
+	*max_psize = *psize;
+	vd->vdev_nonrot = !isrot;
+
+	return (0);
+}
+
+/*
+ * Wakes up poller with NOP, waits for it to exit and destroys io_uring.
+ */
+static void
+vdev_disk_uring_close(vdev_t *vd)
+{
+	vdev_disk_uring_t *vdu = vd->vdev_tsd;
+	struct timespec ts;
+
+	if (vd->vdev_reopening || vdu == NULL)
+		return;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;  // 100ms
+
+	vdu->vdu_stop_polling = B_TRUE;
+	while (vdu->vdu_poller_tid != 0) {
+		vdev_disk_uring_submit(vdu, NULL);
+		nanosleep(&ts, NULL);
+	}
+
+	vd->vdev_delayed_close = B_FALSE;
+
+	vdev_disk_uring_free(vdu);
+	vd->vdev_tsd = NULL;
+}
+
+/*
+ * io_uring has no discard operation, so, as in aio backend, BLKDISCARD is
+ * issued from taskq.
+ */
+static void
+vdev_disk_uring_trim(void *arg)
+{
+	zio_t *zio = arg;
+	vdev_disk_uring_t *vdu = zio->io_vd->vdev_tsd;
+	uint64_t range[2];
+
+	range[0] = zio->io_offset;
+	range[1] = zio->io_size;
+
+	VDU_STAT_BUMP(vdu_stat_trims);
+	if (ioctl(vdu->vdu_fd, BLKDISCARD, range) != 0) {
+		zio->io_error = SET_ERROR(errno);
+		if (errno != EOPNOTSUPP && errno != ENOTTY)
+			VDU_STAT_BUMP(vdu_stat_trim_errors);
+	}
+
+	zio_interrupt(zio);
+}
+
+/*
+ * Queues IO to io_uring. Flush of disk write cache is done by fdatasync
+ * of block device, which is also asynchronous with io_uring.
+ */
+static void
+vdev_disk_uring_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_disk_uring_t *vdu = vd->vdev_tsd;
+	uring_task_t *task;
+
+	switch (zio->io_type) {
+	case ZIO_TYPE_IOCTL:
+		if (!vdev_readable(vd)) {
+			zio->io_error = (SET_ERROR(ENXIO));
+			zio_interrupt(zio);
+			return;
+		}
+		if (zio->io_cmd == DKIOCFREE && !vd->vdev_notrim) {
+			VERIFY3U(taskq_dispatch(system_taskq,
+			    vdev_disk_uring_trim, zio, TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+			return;
+		}
+		if (zio->io_cmd != DKIOCFLUSHWRITECACHE) {
+			zio->io_error = (SET_ERROR(ENOTSUP));
+			zio_execute(zio);
+			return;
+		}
+		break;
+	case ZIO_TYPE_WRITE:
+	case ZIO_TYPE_READ:
+		break;
+	default:
+		zio->io_error = (SET_ERROR(ENOTSUP));
+		zio_interrupt(zio);
+		return;
+	}
+
+	task = kmem_alloc(sizeof (uring_task_t), KM_SLEEP);
+	task->zio = zio;
+	task->buf = NULL;
+	if (zio->io_type == ZIO_TYPE_WRITE)
+		task->buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+	else if (zio->io_type == ZIO_TYPE_READ)
+		task->buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+
+	vdev_disk_uring_submit(vdu, task);
+}
+
+/* ARGSUSED */
+static void
+vdev_disk_uring_io_done(zio_t *zio)
+{
+}
+
+vdev_ops_t vdev_disk_uring_ops = {
+	vdev_disk_uring_open,
+	vdev_disk_uring_close,
+	vdev_default_asize,
+	vdev_disk_uring_start,
+	vdev_disk_uring_io_done,
+	NULL,
+	NULL,
+	vdev_disk_uring_hold,
+	vdev_disk_uring_rele,
+	VDEV_TYPE_DISK,		/* name of this vdev type */
+	B_TRUE			/* leaf vdev */
+};
+
+void
+vdev_disk_uring_init(void)
+{
+	vdu_ksp = kstat_create("zfs", 0, "vdev_uring_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdu_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (vdu_ksp != NULL) {
+		vdu_ksp->ks_data = &vdu_stats;
+		kstat_install(vdu_ksp);
+	}
+}
+
+void
+vdev_disk_uring_fini(void)
+{
+	if (vdu_ksp != NULL) {
+		kstat_delete(vdu_ksp);
+		vdu_ksp = NULL;
+	}
+}
+
+/*
+ * Kernel may lack io_uring (ENOSYS), or have it disabled by sysctl or
+ * seccomp (EPERM), though the build supports it. Probing is done for every
+ * vdev, as it is cheap compared to opening the device.
+ */
+static boolean_t
+vdev_disk_uring_supported(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	bzero(&p, sizeof (p));
+	fd = io_uring_setup(1, &p);
+	if (fd < 0) {
+		fprintf(stderr, "io_uring is not usable: %d, using aio for "
+		    "disk vdevs\n", errno);
+		return (B_FALSE);
+	}
+	(void) close(fd);
+	return (B_TRUE);
+}
+
+vdev_ops_t *
+vdev_disk_ops_get(void)
+{
+	if (zfs_vdev_disk_uring && vdev_disk_uring_supported())
+		return (&vdev_disk_uring_ops);
+	return (&vdev_disk_ops);
+}
+
+#else /* HAVE_IO_URING */
+
+void
+vdev_disk_uring_init(void)
+{
+	if (zfs_vdev_disk_uring)
+		fprintf(stderr, "io_uring is not supported by this build, "
+		    "using aio for disk vdevs\n");
+}
+
+void
+vdev_disk_uring_fini(void)
+{
+}
+
+vdev_ops_t *
+vdev_disk_ops_get(void)
+{
+	return (&vdev_disk_ops);
+}
+
+#endif /* HAVE_IO_URING */
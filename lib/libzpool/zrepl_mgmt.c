@@ -25,6 +25,27 @@ void (*zinfo_destroy_hook)(zvol_info_t *);
 
 struct zvol_list zvol_list;
 
+/*
+ * zinfos are also hashed by the last component of their names, which is all
+ * that target knows of a zvol, so that uzfs_zinfo_lookup() doesn't walk
+ * zvol_list under zvol_list_mutex. Lookup takes the reader lock of its
+ * bucket alone, and takes refcount on zinfo under it, so that zinfo can't
+ * be freed under it. zvol_list_mutex is held (and taken before bucket lock)
+ * to add or remove zinfo.
+ */
+#define	ZVOL_HASH_BUCKETS	256
+
+static struct zvol_hash_bucket {
+	krwlock_t	zb_lock;
+	SLIST_HEAD(, zvol_info_s) zb_head;
+} zvol_hash[ZVOL_HASH_BUCKETS];
+
+/*
+ * Size the worker pool of volumes from their load, instead of running
+ * zvol_workers threads for each of them.
+ */
+int zvol_workers_adaptive = 1;
+
 static int uzfs_zinfo_free(zvol_info_t *zinfo);
 
 enum zrepl_log_level zrepl_log_level;
@@ -176,17 +197,67 @@ create_and_bind(const char *port, int bind_needed, boolean_t nonblock)
 	return (sfd);
 }
 
+void
+uzfs_zinfo_hash_init(void)
+{
+	int i;
+
+	for (i = 0; i < ZVOL_HASH_BUCKETS; i++) {
+		rw_init(&zvol_hash[i].zb_lock, NULL, RW_DEFAULT, NULL);
+		SLIST_INIT(&zvol_hash[i].zb_head);
+	}
+}
+
+void
+uzfs_zinfo_hash_fini(void)
+{
+	int i;
+
+	for (i = 0; i < ZVOL_HASH_BUCKETS; i++) {
+		ASSERT(SLIST_EMPTY(&zvol_hash[i].zb_head));
+		rw_destroy(&zvol_hash[i].zb_lock);
+	}
+}
+
+static struct zvol_hash_bucket *
+uzfs_zinfo_hash_bucket(const char *name)
+{
+	const char *p = strrchr(name, '/');
+	uint64_t crc = -1ULL;
+
+	for (p = (p == NULL) ? name : p + 1; *p != '\0'; p++)
+		crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ *p) & 0xFF];
+	return (&zvol_hash[crc & (ZVOL_HASH_BUCKETS - 1)]);
+}
+
 static void
 uzfs_insert_zinfo_list(zvol_info_t *zinfo)
 {
+	struct zvol_hash_bucket *zb = uzfs_zinfo_hash_bucket(zinfo->name);
+
 	LOG_INFO("Instantiating zvol %s", zinfo->name);
 	/* Base refcount is taken here */
 	(void) mutex_enter(&zvol_list_mutex);
 	uzfs_zinfo_take_refcnt(zinfo);
 	SLIST_INSERT_HEAD(&zvol_list, zinfo, zinfo_next);
+	rw_enter(&zb->zb_lock, RW_WRITER);
+	SLIST_INSERT_HEAD(&zb->zb_head, zinfo, zinfo_hash_next);
+	rw_exit(&zb->zb_lock);
 	(void) mutex_exit(&zvol_list_mutex);
 }
 
+static void
+uzfs_remove_zinfo_list(zvol_info_t *zinfo)
+{
+	struct zvol_hash_bucket *zb = uzfs_zinfo_hash_bucket(zinfo->name);
+
+	ASSERT(MUTEX_HELD(&zvol_list_mutex));
+	SLIST_REMOVE(&zvol_list, zinfo, zvol_info_s, zinfo_next);
+	rw_enter(&zb->zb_lock, RW_WRITER);
+	SLIST_REMOVE(&zb->zb_head, zinfo, zvol_info_s, zinfo_hash_next);
+	rw_exit(&zb->zb_lock);
+}
+
 void
 shutdown_fds_related_to_zinfo(zvol_info_t *zinfo)
 {
@@ -281,13 +352,15 @@ uzfs_zvol_name_compare(zvol_info_t *zv, const char *name)
 zvol_info_t *
 uzfs_zinfo_lookup(const char *name)
 {
+	struct zvol_hash_bucket *zb;
 	zvol_info_t *zv = NULL;
 
 	if (name == NULL)
 		return (NULL);
 
-	(void) mutex_enter(&zvol_list_mutex);
-	SLIST_FOREACH(zv, &zvol_list, zinfo_next) {
+	zb = uzfs_zinfo_hash_bucket(name);
+	rw_enter(&zb->zb_lock, RW_READER);
+	SLIST_FOREACH(zv, &zb->zb_head, zinfo_hash_next) {
 		if (uzfs_zvol_name_compare(zv, name) == 0)
 			break;
 	}
@@ -295,7 +368,7 @@ uzfs_zinfo_lookup(const char *name)
 		/* Take refcount */
 		uzfs_zinfo_take_refcnt(zv);
 	}
-	(void) mutex_exit(&zvol_list_mutex);
+	rw_exit(&zb->zb_lock);
 
 	return (zv);
 }
@@ -306,6 +379,8 @@ uzfs_zinfo_init_mutex(zvol_info_t *zinfo)
 	(void) pthread_mutex_init(&zinfo->zinfo_mutex, NULL);
 	(void) pthread_cond_init(&zinfo->io_ack_cond, NULL);
 	(void) pthread_mutex_init(&zinfo->zinfo_ionum_mutex, NULL);
+	(void) pthread_mutex_init(&zinfo->sync_mutex, NULL);
+	(void) pthread_cond_init(&zinfo->sync_cond, NULL);
 }
 
 static void
@@ -315,6 +390,8 @@ uzfs_zinfo_destroy_mutex(zvol_info_t *zinfo)
 	(void) pthread_mutex_destroy(&zinfo->zinfo_mutex);
 	(void) pthread_cond_destroy(&zinfo->io_ack_cond);
 	(void) pthread_mutex_destroy(&zinfo->zinfo_ionum_mutex);
+	(void) pthread_mutex_destroy(&zinfo->sync_mutex);
+	(void) pthread_cond_destroy(&zinfo->sync_cond);
 }
 
 int
@@ -333,8 +410,7 @@ uzfs_zinfo_destroy(const char *name, spa_t *spa)
 		SLIST_FOREACH_SAFE(zinfo, &zvol_list, zinfo_next, zt) {
 			if (strcmp(spa_name(spa),
 			    spa_name(zinfo->main_zv->zv_spa)) == 0) {
-				SLIST_REMOVE(&zvol_list, zinfo, zvol_info_s,
-				    zinfo_next);
+				uzfs_remove_zinfo_list(zinfo);
 
 				mutex_exit(&zvol_list_mutex);
 				main_zv = zinfo->main_zv;
@@ -350,8 +426,7 @@ uzfs_zinfo_destroy(const char *name, spa_t *spa)
 			    ((strncmp(zinfo->name, name, namelen) == 0) &&
 			    zinfo->name[namelen] == '/' &&
 			    zinfo->name[namelen + 1] == '\0')) {
-				SLIST_REMOVE(&zvol_list, zinfo, zvol_info_s,
-				    zinfo_next);
+				uzfs_remove_zinfo_list(zinfo);
 
 				mutex_exit(&zvol_list_mutex);
 				main_zv = zinfo->main_zv;
@@ -391,14 +466,19 @@ uzfs_zinfo_init(zvol_state_t *zv, const char *ds_name, nvlist_t *create_props)
 	if (nworker == 0)
 		nworker = MAX(boot_ncpus, nthread);
 
+	/*
+	 * With adaptive workers, nworker is the upper limit, and the taskq
+	 * starts with one thread.
+	 */
 	zv->zvol_workers = nworker;
 	zinfo->uzfs_zvol_taskq = taskq_create("replica", nworker,
-	    defclsyspri, nworker, INT_MAX,
-	    TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
+	    defclsyspri, nworker, INT_MAX, TASKQ_PREPOPULATE | TASKQ_LOCKFREE |
+	    (zvol_workers_adaptive ? TASKQ_DYNAMIC : 0));
 
 	STAILQ_INIT(&zinfo->complete_queue);
 	STAILQ_INIT(&zinfo->fd_list);
 	STAILQ_INIT(&zinfo->rebuild_scanner_list);
+	STAILQ_INIT(&zinfo->io_conn_list);
 	uzfs_zinfo_init_mutex(zinfo);
 
 	strlcpy(zinfo->name, ds_name, MAXNAMELEN);
@@ -415,6 +495,73 @@ uzfs_zinfo_init(zvol_state_t *zv, const char *ds_name, nvlist_t *create_props)
 	return (0);
 }
 
+/*
+ * Resizes worker pools of volumes to their load. Load of a volume is the
+ * number of its IOs outstanding, which is taken as the larger of
+ * dispatched_io_cnt right now and the average over the last interval. The
+ * total latency of IOs, from their receipt to their ack, summed over the
+ * IOs acked in an interval and divided by the interval, gives that
+ * average. Load rises to new peaks at once and decays by a quarter
+ * every round, so that a short pause in IOs doesn't kill the threads.
+ *
+ * Total of the threads asked for is capped to the number of cores, and when
+ * it is over, each volume gets its share of the cores, but one thread at
+ * least.
+ */
+void
+uzfs_zinfo_scale_workers(void)
+{
+	zvol_info_t *zinfo;
+	hrtime_t now = gethrtime();
+	uint64_t latency, load, total = 0, budget, nvol = 0;
+	int wanted, op;
+
+	if (!zvol_workers_adaptive)
+		return;
+
+	mutex_enter(&zvol_list_mutex);
+	SLIST_FOREACH(zinfo, &zvol_list, zinfo_next) {
+		latency = 0;
+		for (op = 0; op < ZVOL_STAGE_HIST_OPS; op++)
+			latency += zinfo->io_stage_hist[op][
+			    ZVOL_IO_STAGE_TOTAL].sum;
+		load = zinfo->dispatched_io_cnt;
+		if (zinfo->workers_last_time != 0 &&
+		    now > zinfo->workers_last_time)
+			load = MAX(load, (latency -
+			    zinfo->workers_last_latency) /
+			    (now - zinfo->workers_last_time));
+		zinfo->workers_last_latency = latency;
+		zinfo->workers_last_time = now;
+
+		load <<= 4;
+		if (load >= zinfo->workers_load)
+			zinfo->workers_load = load;
+		else
+			zinfo->workers_load = (3 * zinfo->workers_load +
+			    load) / 4;
+
+		wanted = MIN((zinfo->workers_load + 15) >> 4,
+		    zinfo->uzfs_zvol_taskq->tq_nrings);
+		zinfo->workers_wanted = MAX(wanted, 1);
+		total += zinfo->workers_wanted;
+		nvol++;
+	}
+
+	budget = MAX(boot_ncpus, nvol);
+	SLIST_FOREACH(zinfo, &zvol_list, zinfo_next) {
+		wanted = zinfo->workers_wanted;
+		if (total > budget)
+			wanted = MAX(wanted * budget / total, 1);
+		if (wanted != zinfo->uzfs_zvol_taskq->tq_ntarget) {
+			LOG_DEBUG("Workers of %s %d -> %d", zinfo->name,
+			    zinfo->uzfs_zvol_taskq->tq_ntarget, wanted);
+			taskq_set_nthreads(zinfo->uzfs_zvol_taskq, wanted);
+		}
+	}
+	mutex_exit(&zvol_list_mutex);
+}
+
 static int
 uzfs_zinfo_free(zvol_info_t *zinfo)
 {
@@ -424,6 +571,7 @@ uzfs_zinfo_free(zvol_info_t *zinfo)
 	taskq_destroy(zinfo->uzfs_zvol_taskq);
 	(void) uzfs_zinfo_destroy_mutex(zinfo);
 	ASSERT(STAILQ_EMPTY(&zinfo->complete_queue));
+	ASSERT(STAILQ_EMPTY(&zinfo->io_conn_list));
 
 	free(zinfo);
 	return (0);
@@ -465,6 +613,60 @@ uzfs_zvol_store_kv_pair(zvol_state_t *zv, char *key,
 	    (const uzfs_zap_kv_t **) kv_array, 1));
 }
 
+/*
+ * Gets offset till which rebuild pass from checkpointed io_seq is done, and
+ * guid of the snapshot it is rebuilding from. Returns ENOENT if progress
+ * stored is not of the pass from io_seq.
+ */
+int
+uzfs_zvol_get_rebuild_progress(zvol_state_t *zv, uint64_t io_seq,
+    uint64_t *snap_guid, uint64_t *offset)
+{
+	uint64_t stored_io_seq = 0;
+	int error;
+
+	*snap_guid = *offset = 0;
+	error = uzfs_zvol_get_kv_pair(zv, REBUILD_IO_SEQNUM, &stored_io_seq);
+	if (error != 0)
+		return (error);
+	if ((io_seq == 0) || (stored_io_seq != io_seq))
+		return (ENOENT);
+
+	error = uzfs_zvol_get_kv_pair(zv, REBUILD_SNAP_GUID, snap_guid);
+	if (error == 0)
+		error = uzfs_zvol_get_kv_pair(zv, REBUILD_OFFSET, offset);
+	if ((error == 0) && ((*snap_guid == 0) || (*offset == 0)))
+		error = ENOENT;
+	return (error);
+}
+
+/*
+ * Stores progress of rebuild pass in single tx, so that it is never seen
+ * partially updated. Zero io_seq clears the progress.
+ */
+void
+uzfs_zvol_store_rebuild_progress(zvol_state_t *zv, uint64_t io_seq,
+    uint64_t snap_guid, uint64_t offset)
+{
+	uzfs_zap_kv_t *kv_array[3];
+	uzfs_zap_kv_t zap[3];
+	int i;
+
+	zap[0].key = REBUILD_IO_SEQNUM;
+	zap[0].value = io_seq;
+	zap[1].key = REBUILD_SNAP_GUID;
+	zap[1].value = snap_guid;
+	zap[2].key = REBUILD_OFFSET;
+	zap[2].value = offset;
+	for (i = 0; i < 3; i++) {
+		zap[i].size = sizeof (uint64_t);
+		kv_array[i] = &zap[i];
+	}
+
+	VERIFY0(uzfs_update_zap_entries(zv,
+	    (const uzfs_zap_kv_t **) kv_array, 3));
+}
+
 int
 uzfs_zvol_get_last_committed_io_no(zvol_state_t *zv, char *key, uint64_t *ionum)
 {
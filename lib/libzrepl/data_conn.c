@@ -27,12 +27,18 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <sys/dsl_dataset.h>
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_dir.h>
+#include <sys/dmu_objset.h>
+#include <sys/zio_compress.h>
 #include <uzfs_io.h>
+#include <uzfs_cache.h>
 #include <uzfs_rebuilding.h>
 #include <zrepl_mgmt.h>
 #include <uzfs_mgmt.h>
@@ -45,6 +51,18 @@
 #define	ZVOL_REBUILD_STEP_SIZE  (10 * 1024ULL * 1024ULL * 1024ULL) // 10GB
 uint64_t zvol_rebuild_step_size = ZVOL_REBUILD_STEP_SIZE;
 
+/* max number of REBUILD_STEPs outstanding on a rebuild connection */
+#define	ZVOL_REBUILD_STEP_WINDOW	(4)
+#define	ZVOL_REBUILD_STEP_WINDOW_MAX	(64)
+uint64_t zvol_rebuild_step_window = ZVOL_REBUILD_STEP_WINDOW;
+
+/*
+ * min interval in seconds at which degraded replica persists progress of
+ * rebuild pass, to resume from there if rebuild connection breaks
+ */
+#define	ZVOL_REBUILD_PROGRESS_INTERVAL	(10)
+uint64_t zvol_rebuild_progress_interval = ZVOL_REBUILD_PROGRESS_INTERVAL;
+
 #define	REBUILD_CMD_QUEUE_MAX_LIMIT (100)
 uint64_t zvol_rebuild_cmd_queue_limit = REBUILD_CMD_QUEUE_MAX_LIMIT;
 
@@ -53,6 +71,36 @@ uint64_t zvol_rebuild_cmd_queue_limit = REBUILD_CMD_QUEUE_MAX_LIMIT;
 	    scanner_info->rebuild_cmd_acked_cnt) >	\
 	    zvol_rebuild_cmd_queue_limit)
 
+/* number of threads scanning parts of REBUILD_STEP range in parallel */
+#define	ZVOL_REBUILD_SCAN_THREADS	(4)
+uint64_t zvol_rebuild_scan_threads = ZVOL_REBUILD_SCAN_THREADS;
+
+/*
+ * number of threads applying writes received on a rebuild connection, and,
+ * max number of those writes in flight. Writes are applied by the thread
+ * receiving them if there are no such threads.
+ */
+#define	ZVOL_REBUILD_WRITE_THREADS	(4)
+uint64_t zvol_rebuild_write_threads = ZVOL_REBUILD_WRITE_THREADS;
+#define	ZVOL_REBUILD_WRITE_QUEUE_LIMIT	(64)
+uint64_t zvol_rebuild_write_queue_limit = ZVOL_REBUILD_WRITE_QUEUE_LIMIT;
+
+/*
+ * degraded replica asks helping replica for compressed data on rebuild
+ * connections, if set
+ */
+uint64_t zvol_rebuild_compress = 1;
+
+/*
+ * degraded replica asks helping replica to send holes without data on
+ * rebuild connections, if set
+ */
+uint64_t zvol_rebuild_holes = 1;
+
+/* how often worker pools of volumes are resized to their load */
+#define	ZVOL_WORKERS_SCALE_INTERVAL_MS	(1000)
+uint64_t zvol_workers_scale_interval_ms = ZVOL_WORKERS_SCALE_INTERVAL_MS;
+
 uint16_t io_server_port = IO_SERVER_PORT;
 uint16_t rebuild_io_server_port = REBUILD_IO_SERVER_PORT;
 
@@ -66,6 +114,92 @@ typedef struct singly_node_list_s {
 
 SLIST_HEAD(singly_node_list, singly_node_list_s);
 
+/*
+ * Max number of cmds that ack sender takes off complete_queue at once
+ */
+#define	ZVOL_ACK_BATCH_MAX_CMDS	(64)
+uint64_t zvol_ack_batch_max_cmds = ZVOL_ACK_BATCH_MAX_CMDS;
+
+/*
+ * Max number of data connections per zvol, including the first one
+ */
+#define	ZVOL_MAX_DATA_CONNS	(8)
+uint64_t zvol_max_data_conns = ZVOL_MAX_DATA_CONNS;
+
+/*
+ * Ack related state of data connection. It is in zvol_io_conn_t for
+ * additional data connections, and, in zinfo for the first one.
+ */
+#define	IO_CONN_STATE(zinfo, ioc, field)	\
+	(*(((ioc) != NULL) ? &(ioc)->field : &(zinfo)->field))
+
+/*
+ * Responses of a batch of cmds are sent with single writev call.
+ * rw_hdr holds the read headers that are referred by iov.
+ */
+#define	ZVOL_ACK_IOV_MAX	(IOV_MAX)
+typedef struct zvol_ack_batch {
+	struct iovec		iov[ZVOL_ACK_IOV_MAX];
+	struct zvol_io_rw_hdr	rw_hdr[ZVOL_ACK_IOV_MAX];
+	int			iovcnt;
+	int			rw_hdr_cnt;
+} zvol_ack_batch_t;
+
+/*
+ * Data connection is read into receive buffers of size zvol_rcv_buf_size,
+ * so that multiple cmds are received with single read call. Payload of
+ * write cmd that fits in receive buffer is referred by cmd without copying
+ * it, and, receive buffer is freed once all the cmds referring it are freed.
+ */
+#define	ZVOL_RCV_BUF_SIZE	(1024 * 1024)
+uint64_t zvol_rcv_buf_size = ZVOL_RCV_BUF_SIZE;
+
+typedef struct zvol_rcv_buf {
+	uint64_t	refcnt;
+	uint64_t	size;
+	char		*data;
+} zvol_rcv_buf_t;
+
+typedef struct zvol_rcv_ctx {
+	int		fd;
+	zvol_rcv_buf_t	*rbuf;
+	uint64_t	start;	/* offset of data yet to be parsed in rbuf */
+	uint64_t	end;	/* offset till which data is received in rbuf */
+} zvol_rcv_ctx_t;
+
+static zvol_rcv_buf_t *
+uzfs_zvol_rcv_buf_alloc(uint64_t size)
+{
+	zvol_rcv_buf_t *rbuf = kmem_alloc(sizeof (zvol_rcv_buf_t), KM_SLEEP);
+
+	rbuf->data = uzfs_buf_alloc(size);
+	rbuf->size = size;
+	rbuf->refcnt = 1;
+	return (rbuf);
+}
+
+static void
+uzfs_zvol_rcv_buf_rele(zvol_rcv_buf_t *rbuf)
+{
+	if (atomic_dec_64_nv(&rbuf->refcnt) == 0) {
+		uzfs_buf_free(rbuf->data, rbuf->size);
+		kmem_free(rbuf, sizeof (zvol_rcv_buf_t));
+	}
+}
+
+/*
+ * Allocate zio command without buffer
+ */
+static zvol_io_cmd_t *
+zio_cmd_alloc_nobuf(zvol_io_hdr_t *hdr, int fd)
+{
+	zvol_io_cmd_t *zio_cmd = uzfs_cache_zalloc(&uzfs_zio_cmd_cache);
+
+	bcopy(hdr, &zio_cmd->hdr, sizeof (zio_cmd->hdr));
+	zio_cmd->conn = fd;
+	return (zio_cmd);
+}
+
 /*
  * Allocate zio command along with
  * buffer needed for IO completion.
@@ -73,20 +207,17 @@ SLIST_HEAD(singly_node_list, singly_node_list_s);
 zvol_io_cmd_t *
 zio_cmd_alloc(zvol_io_hdr_t *hdr, int fd)
 {
-	zvol_io_cmd_t *zio_cmd = kmem_zalloc(
-	    sizeof (zvol_io_cmd_t), KM_SLEEP);
+	zvol_io_cmd_t *zio_cmd = zio_cmd_alloc_nobuf(hdr, fd);
 
-	bcopy(hdr, &zio_cmd->hdr, sizeof (zio_cmd->hdr));
-
-	if (hdr->len != 0) {
-		zio_cmd->buf = kmem_zalloc(sizeof (char) * hdr->len, KM_SLEEP);
+	/* len of unmap request is size of range, it doesn't carry payload */
+	if (hdr->len != 0 && hdr->opcode != ZVOL_OPCODE_UNMAP) {
+		zio_cmd->buf = uzfs_buf_alloc(hdr->len);
 		zio_cmd->buf_len = hdr->len;
 		ASSERT((hdr->opcode == ZVOL_OPCODE_READ) ||
 		    (hdr->opcode == ZVOL_OPCODE_WRITE) ||
 		    (hdr->opcode == ZVOL_OPCODE_OPEN) ||
 		    (hdr->opcode == ZVOL_OPCODE_REBUILD_SNAP_DONE));
 	}
-	zio_cmd->conn = fd;
 	return (zio_cmd);
 }
 
@@ -116,15 +247,20 @@ zio_cmd_free(zvol_io_cmd_t **cmd)
 	zvol_op_code_t opcode = zio_cmd->hdr.opcode;
 	switch (opcode) {
 		case ZVOL_OPCODE_READ:
+			FREE_METADATA_LIST(zio_cmd->metadata_desc);
+			/* FALLTHRU */
 		case ZVOL_OPCODE_WRITE:
 		case ZVOL_OPCODE_OPEN:
 		case ZVOL_OPCODE_REBUILD_SNAP_DONE:
-			if (zio_cmd->buf != NULL) {
-				kmem_free(zio_cmd->buf, zio_cmd->buf_len);
+			if (zio_cmd->rcv_buf != NULL) {
+				uzfs_zvol_rcv_buf_rele(zio_cmd->rcv_buf);
+			} else if (zio_cmd->buf != NULL) {
+				uzfs_buf_free(zio_cmd->buf, zio_cmd->buf_len);
 			}
 			break;
 
 		case ZVOL_OPCODE_SYNC:
+		case ZVOL_OPCODE_UNMAP:
 		case ZVOL_OPCODE_REBUILD_STEP_DONE:
 		case ZVOL_OPCODE_REBUILD_ALL_SNAP_DONE:
 			/* Nothing to do */
@@ -135,7 +271,7 @@ zio_cmd_free(zvol_io_cmd_t **cmd)
 			break;
 	}
 
-	kmem_free(zio_cmd, sizeof (zvol_io_cmd_t));
+	uzfs_cache_free(&uzfs_zio_cmd_cache, zio_cmd);
 	*cmd = NULL;
 }
 
@@ -199,6 +335,127 @@ uzfs_zvol_read_header(int fd, zvol_io_hdr_t *hdr)
 	return (0);
 }
 
+/*
+ * Makes sure that at least nbytes of data, which is yet to be parsed, is
+ * there in receive buffer. It reads as much data as the socket has, and,
+ * the receive buffer can hold, with single read call.
+ * Returns 0 on success, -1 on error
+ */
+static int
+uzfs_zvol_rcv_fill(zvol_rcv_ctx_t *ctx, uint64_t nbytes)
+{
+	zvol_rcv_buf_t *rbuf = ctx->rbuf;
+	uint64_t avail = ctx->end - ctx->start;
+	ssize_t count;
+
+	ASSERT3U(nbytes, <=, rbuf->size);
+
+	/* start from the beginning if no cmd refers the receive buffer */
+	if ((avail == 0) && (rbuf->refcnt == 1))
+		ctx->start = ctx->end = 0;
+
+	if (ctx->start + nbytes > rbuf->size) {
+		/*
+		 * Not enough room at the end of receive buffer. Move the
+		 * partially received data to new buffer if cmds still refer
+		 * to the current one, otherwise, to its beginning.
+		 */
+		if (rbuf->refcnt != 1) {
+			ctx->rbuf = uzfs_zvol_rcv_buf_alloc(rbuf->size);
+			bcopy(rbuf->data + ctx->start, ctx->rbuf->data, avail);
+			uzfs_zvol_rcv_buf_rele(rbuf);
+			rbuf = ctx->rbuf;
+		} else if (avail != 0) {
+			memmove(rbuf->data, rbuf->data + ctx->start, avail);
+		}
+		ctx->start = 0;
+		ctx->end = avail;
+	}
+
+	while (ctx->end - ctx->start < nbytes) {
+		count = read(ctx->fd, rbuf->data + ctx->end,
+		    rbuf->size - ctx->end);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERRNO("Socket(%d) read error", ctx->fd);
+			return (-1);
+		} else if (count == 0) {
+			LOG_INFO("Connection closed by the peer for socket(%d)",
+			    ctx->fd);
+			return (-1);
+		}
+		ctx->end += count;
+	}
+	return (0);
+}
+
+/*
+ * Same as uzfs_zvol_read_header, but, reads through receive buffer.
+ *
+ * Return value < 0 => error
+ *              > 0 => invalid version
+ *              = 0 => ok
+ */
+static int
+uzfs_zvol_rcv_header(zvol_rcv_ctx_t *ctx, zvol_io_hdr_t *hdr)
+{
+	if (uzfs_zvol_rcv_fill(ctx, sizeof (hdr->version)) != 0)
+		return (-1);
+
+	bcopy(ctx->rbuf->data + ctx->start, &hdr->version,
+	    sizeof (hdr->version));
+	if ((hdr->version > REPLICA_VERSION) ||
+	    (hdr->version < MIN_SUPPORTED_REPLICA_VERSION)) {
+		LOG_ERR("invalid replica protocol version %d",
+		    hdr->version);
+		return (1);
+	}
+
+	if (uzfs_zvol_rcv_fill(ctx, sizeof (*hdr)) != 0)
+		return (-1);
+
+	bcopy(ctx->rbuf->data + ctx->start, hdr, sizeof (*hdr));
+	ctx->start += sizeof (*hdr);
+	return (0);
+}
+
+/*
+ * Allocates write cmd and receives its payload. Payload that fits in
+ * receive buffer is referred from there, otherwise, it is read into buffer
+ * allocated for cmd.
+ * Returns NULL on error
+ */
+static zvol_io_cmd_t *
+uzfs_zvol_rcv_write_cmd(zvol_rcv_ctx_t *ctx, zvol_io_hdr_t *hdr)
+{
+	zvol_io_cmd_t *zio_cmd;
+	uint64_t avail;
+
+	if (hdr->len <= ctx->rbuf->size) {
+		if (uzfs_zvol_rcv_fill(ctx, hdr->len) != 0)
+			return (NULL);
+
+		zio_cmd = zio_cmd_alloc_nobuf(hdr, ctx->fd);
+		zio_cmd->buf = ctx->rbuf->data + ctx->start;
+		zio_cmd->rcv_buf = ctx->rbuf;
+		atomic_inc_64(&ctx->rbuf->refcnt);
+		ctx->start += hdr->len;
+		return (zio_cmd);
+	}
+
+	zio_cmd = zio_cmd_alloc(hdr, ctx->fd);
+	avail = ctx->end - ctx->start;
+	bcopy(ctx->rbuf->data + ctx->start, zio_cmd->buf, avail);
+	ctx->start = ctx->end;
+	if (uzfs_zvol_socket_read(ctx->fd, (char *)zio_cmd->buf + avail,
+	    hdr->len - avail) != 0) {
+		zio_cmd_free(&zio_cmd);
+		return (NULL);
+	}
+	return (zio_cmd);
+}
+
 /*
  * This API is to write data from "blocking" sockets
  * Returns 0 on success, -1 on error
@@ -222,9 +479,88 @@ uzfs_zvol_socket_write(int fd, char *buf, uint64_t nbytes)
 	return (0);
 }
 
+/*
+ * This API is to write vector of buffers to "blocking" sockets.
+ * iov is modified in case of partial writes.
+ * Returns 0 on success, -1 on error
+ */
+int
+uzfs_zvol_socket_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t count = 0;
+	while (iovcnt > 0) {
+		count = writev(fd, iov, iovcnt);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERRNO("Socket writev error");
+			return (-1);
+		}
+		while ((iovcnt > 0) && (count >= (ssize_t)iov->iov_len)) {
+			count -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + count;
+			iov->iov_len -= count;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Update the highest ionum used for checkpointing
+ */
+static void
+uzfs_zinfo_update_running_ionum(zvol_info_t *zinfo, uint64_t io_num)
+{
+	uint64_t running_ionum;
+
+	running_ionum = zinfo->running_ionum;
+	while (running_ionum < io_num) {
+		atomic_cas_64(&zinfo->running_ionum, running_ionum, io_num);
+		running_ionum = zinfo->running_ionum;
+	}
+}
+
+/*
+ * Unmap request carries io number in io_seq of header, which is stamped
+ * over the freed range. Like writes from app, it goes to main_zv when
+ * volume is healthy or in REBUILD_AFS state and to clone when not healthy.
+ */
+static int
+uzfs_submit_unmap(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
+{
+	blk_metadata_t	metadata;
+	zvol_io_hdr_t 	*hdr = &zio_cmd->hdr;
+	int	rc = 0;
+
+	metadata.io_num = hdr->io_seq;
+
+	if (ZVOL_IS_HEALTHY(zinfo->main_zv) ||
+	    ZVOL_IS_REBUILDING_AFS(zinfo->main_zv)) {
+		rc = uzfs_unmap_data(zinfo->main_zv, hdr->offset, hdr->len,
+		    &metadata);
+		if (rc != 0)
+			return (rc);
+	}
+
+	if (!ZVOL_IS_HEALTHY(zinfo->main_zv)) {
+		rc = uzfs_unmap_data(zinfo->clone_zv, hdr->offset, hdr->len,
+		    &metadata);
+		if (rc != 0)
+			return (rc);
+	}
+
+	uzfs_zinfo_update_running_ionum(zinfo, hdr->io_seq);
+	return (rc);
+}
+
 /*
  * We expect only one chunk of data with meta header in write request.
  * Nevertheless the code is general to handle even more of them.
+ * Rebuild writes can also have holes, which are chunks without data.
  */
 static int
 uzfs_submit_writes(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
@@ -234,10 +570,11 @@ uzfs_submit_writes(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
 	zvol_io_hdr_t 	*hdr = &zio_cmd->hdr;
 	struct zvol_io_rw_hdr *write_hdr;
 	char	*datap = (char *)zio_cmd->buf;
+	char	*chunkp;
 	size_t	data_offset = hdr->offset;
 	size_t	remain = hdr->len;
+	size_t	len, data_len;
 	int	rc = 0;
-	uint64_t running_ionum;
 	is_rebuild = hdr->flags & ZVOL_OP_FLAG_REBUILD;
 
 #ifdef DEBUG
@@ -257,7 +594,19 @@ uzfs_submit_writes(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
 
 		datap += sizeof (*write_hdr);
 		remain -= sizeof (*write_hdr);
-		if (remain < write_hdr->len)
+
+		/* hole is written by freeing its range */
+		len = write_hdr->len & ~ZVOL_IO_RW_HDR_HOLE;
+		if (write_hdr->len & ZVOL_IO_RW_HDR_HOLE) {
+			if (!is_rebuild)
+				return (-1);
+			chunkp = NULL;
+			data_len = 0;
+		} else {
+			chunkp = datap;
+			data_len = len;
+		}
+		if (remain < data_len)
 			return (-1);
 		/*
 		 * Write to main_zv when volume is either
@@ -265,36 +614,221 @@ uzfs_submit_writes(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
 		 */
 		if (ZVOL_IS_HEALTHY(zinfo->main_zv) || is_rebuild ||
 		    ZVOL_IS_REBUILDING_AFS(zinfo->main_zv)) {
-			rc = uzfs_write_data(zinfo->main_zv, datap, data_offset,
-			    write_hdr->len, &metadata, is_rebuild);
+			rc = uzfs_write_data(zinfo->main_zv, chunkp,
+			    data_offset, len, &metadata, is_rebuild);
 			if (rc != 0)
 				break;
 		}
 
 		/* IO to clone should be sent only when it is from app */
 		if (!is_rebuild && !ZVOL_IS_HEALTHY(zinfo->main_zv)) {
-			rc = uzfs_write_data(zinfo->clone_zv, datap,
-			    data_offset, write_hdr->len, &metadata,
+			rc = uzfs_write_data(zinfo->clone_zv, chunkp,
+			    data_offset, len, &metadata,
 			    is_rebuild);
 			if (rc != 0)
 				break;
 		}
-		/* Update the highest ionum used for checkpointing */
-		running_ionum = zinfo->running_ionum;
-		while (running_ionum < write_hdr->io_num) {
-			atomic_cas_64(&zinfo->running_ionum, running_ionum,
-			    write_hdr->io_num);
-			running_ionum = zinfo->running_ionum;
-		}
+		uzfs_zinfo_update_running_ionum(zinfo, write_hdr->io_num);
 
-		datap += write_hdr->len;
-		remain -= write_hdr->len;
-		data_offset += write_hdr->len;
+		datap += data_len;
+		remain -= data_len;
+		data_offset += len;
 	}
 
 	return (rc);
 }
 
+/*
+ * Group commit of SYNC cmds. Sync needs the writes that are done before
+ * it arrived to be committed to ZIL. Only one worker commits ZIL at a time,
+ * and, it covers all the writes done till then. Syncs that are waiting
+ * meanwhile complete once a commit covers their writes, and, sync is
+ * completed right away if there are no new writes since the last commit.
+ */
+static void
+uzfs_zvol_sync(zvol_info_t *zinfo)
+{
+	uint64_t sync_seq, commit_seq;
+
+	(void) pthread_mutex_lock(&zinfo->sync_mutex);
+	sync_seq = zinfo->write_done_seq;
+	while (zinfo->write_synced_seq < sync_seq) {
+		if (zinfo->sync_in_progress) {
+			(void) pthread_cond_wait(&zinfo->sync_cond,
+			    &zinfo->sync_mutex);
+			continue;
+		}
+		zinfo->sync_in_progress = 1;
+		commit_seq = zinfo->write_done_seq;
+		(void) pthread_mutex_unlock(&zinfo->sync_mutex);
+
+		if (ZVOL_IS_HEALTHY(zinfo->main_zv) ||
+		    ZVOL_IS_REBUILDING_AFS(zinfo->main_zv)) {
+			uzfs_flush_data(zinfo->main_zv);
+		}
+		if (!ZVOL_IS_HEALTHY(zinfo->main_zv))
+			uzfs_flush_data(zinfo->clone_zv);
+
+		(void) pthread_mutex_lock(&zinfo->sync_mutex);
+		zinfo->write_synced_seq = commit_seq;
+		zinfo->sync_in_progress = 0;
+		(void) pthread_cond_broadcast(&zinfo->sync_cond);
+	}
+	(void) pthread_mutex_unlock(&zinfo->sync_mutex);
+}
+
+/*
+ * Waits on rebuild_cmd_cond of scanner for acks or completions of its
+ * reads. Wait is bounded by a second, so that caller can check state of
+ * zinfo which is not signalled on this cond. Needs zinfo_mutex.
+ */
+static void
+zvol_rebuild_scanner_wait(zvol_info_t *zinfo,
+    zvol_rebuild_scanner_info_t *sinfo)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 1;
+
+	sinfo->rebuild_cmd_waiting++;
+	(void) pthread_cond_timedwait(&sinfo->rebuild_cmd_cond,
+	    &zinfo->zinfo_mutex, &ts);
+	sinfo->rebuild_cmd_waiting--;
+}
+
+/*
+ * Called by worker once it is done with read issued by rebuild scanner.
+ * Scanner can go away after this, so, it should not be accessed later.
+ */
+static void
+zvol_rebuild_scanner_cmd_done(zvol_info_t *zinfo,
+    zvol_rebuild_scanner_info_t *sinfo)
+{
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	ASSERT3U(sinfo->rebuild_cmd_inflight, >, 0);
+	sinfo->rebuild_cmd_inflight--;
+	if (sinfo->rebuild_cmd_waiting)
+		(void) pthread_cond_broadcast(&sinfo->rebuild_cmd_cond);
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+}
+
+/*
+ * Waits till all the reads issued by scanner are completed by workers,
+ * i.e., their responses are queued to complete_queue or dropped.
+ */
+static void
+zvol_rebuild_scanner_wait_inflight(zvol_info_t *zinfo,
+    zvol_rebuild_scanner_info_t *sinfo)
+{
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	while (sinfo->rebuild_cmd_inflight != 0)
+		zvol_rebuild_scanner_wait(zinfo, sinfo);
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+}
+
+/*
+ * Replaces payload of READ reply for rebuild with its compressed form (see
+ * zvol_io_compressed_hdr), if it saves at least 1/8th of the payload as zio
+ * does for blocks.
+ */
+void
+uzfs_zvol_rebuild_compress(zvol_io_cmd_t *zio_cmd)
+{
+	zvol_io_hdr_t	*hdr = &zio_cmd->hdr;
+	struct zvol_io_rw_hdr	*rw_hdr;
+	struct zvol_io_compressed_hdr	*c_hdr;
+	metadata_desc_t	*md;
+	uint64_t	lsize, clen, csize;
+	size_t		rel_offset = 0;
+	char		*lbuf, *cbuf, *p;
+	uint64_t	hole_len = 0;
+	int		md_len = 0;
+
+	for (md = zio_cmd->metadata_desc; md != NULL; md = md->next) {
+		md_len++;
+		if (md->hole)
+			hole_len += md->len;
+	}
+	lsize = hdr->len - hole_len + (MAX(md_len, 1) * sizeof (*rw_hdr));
+	/* LZ4 can't take larger input */
+	if (lsize > INT32_MAX / 2)
+		return;
+
+	p = lbuf = uzfs_buf_alloc(lsize);
+	if (zio_cmd->metadata_desc == NULL) {
+		rw_hdr = (struct zvol_io_rw_hdr *)p;
+		rw_hdr->io_num = 0;
+		rw_hdr->len = hdr->len;
+		bcopy(zio_cmd->buf, p + sizeof (*rw_hdr), hdr->len);
+	}
+	for (md = zio_cmd->metadata_desc; md != NULL; md = md->next) {
+		rw_hdr = (struct zvol_io_rw_hdr *)p;
+		rw_hdr->io_num = md->metadata.io_num;
+		rw_hdr->len = md->len;
+		p += sizeof (*rw_hdr);
+		if (md->hole) {
+			rw_hdr->len |= ZVOL_IO_RW_HDR_HOLE;
+		} else {
+			bcopy((char *)zio_cmd->buf + rel_offset, p, md->len);
+			p += md->len;
+		}
+		rel_offset += md->len;
+	}
+
+	clen = lsize - (lsize >> 3);
+	cbuf = uzfs_buf_alloc(sizeof (*c_hdr) + clen);
+	csize = lz4_compress_zfs(lbuf, cbuf + sizeof (*c_hdr), lsize, clen, 0);
+	uzfs_buf_free(lbuf, lsize);
+	if (csize >= clen) {
+		uzfs_buf_free(cbuf, sizeof (*c_hdr) + clen);
+		return;
+	}
+
+	c_hdr = (struct zvol_io_compressed_hdr *)cbuf;
+	c_hdr->lsize = lsize;
+	uzfs_buf_free(zio_cmd->buf, zio_cmd->buf_len);
+	zio_cmd->buf = cbuf;
+	zio_cmd->buf_len = sizeof (*c_hdr) + clen;
+	hdr->len = sizeof (*c_hdr) + csize;
+	hdr->flags |= ZVOL_OP_FLAG_REBUILD_COMPRESSED;
+}
+
+/*
+ * Replaces compressed payload of rebuild write with the payload it is
+ * compressed from. Returns -1 if it is not valid, including when it
+ * decompresses to other than lsize bytes.
+ */
+int
+uzfs_zvol_rebuild_decompress(zvol_io_cmd_t *zio_cmd)
+{
+	zvol_io_hdr_t	*hdr = &zio_cmd->hdr;
+	struct zvol_io_compressed_hdr	*c_hdr;
+	uint64_t	lsize;
+	char		*lbuf;
+
+	if (hdr->len <= sizeof (*c_hdr))
+		return (-1);
+	c_hdr = (struct zvol_io_compressed_hdr *)zio_cmd->buf;
+	lsize = c_hdr->lsize;
+	if ((lsize == 0) || (lsize > INT32_MAX / 2))
+		return (-1);
+
+	lbuf = uzfs_buf_alloc(lsize);
+	if (lz4_decompress_zfs_exact((char *)zio_cmd->buf + sizeof (*c_hdr),
+	    lbuf, hdr->len - sizeof (*c_hdr), lsize) != 0) {
+		uzfs_buf_free(lbuf, lsize);
+		return (-1);
+	}
+
+	uzfs_buf_free(zio_cmd->buf, zio_cmd->buf_len);
+	zio_cmd->buf = lbuf;
+	zio_cmd->buf_len = lsize;
+	hdr->len = lsize;
+	hdr->flags &= ~ZVOL_OP_FLAG_REBUILD_COMPRESSED;
+	return (0);
+}
+
 /*
  * zvol worker is responsible for actual work.
  * It execute read/write/sync command to uzfs.
@@ -310,7 +844,9 @@ uzfs_zvol_worker(void *arg)
 {
 	zvol_io_cmd_t	*zio_cmd;
 	zvol_info_t	*zinfo;
+	zvol_io_conn_t	*ioc;
 	zvol_state_t	*zvol_state, *read_zv;
+	zvol_rebuild_scanner_info_t	*scanner;
 	zvol_io_hdr_t 	*hdr;
 	metadata_desc_t	**metadata_desc;
 	int		rc = 0;
@@ -320,6 +856,7 @@ uzfs_zvol_worker(void *arg)
 	zio_cmd = (zvol_io_cmd_t *)arg;
 	hdr = &zio_cmd->hdr;
 	zinfo = zio_cmd->zinfo;
+	scanner = zio_cmd->scanner;
 	zvol_state = zinfo->main_zv;
 	rebuild_cmd_req = hdr->flags & ZVOL_OP_FLAG_REBUILD;
 	read_metadata = hdr->flags & ZVOL_OP_FLAG_READ_METADATA;
@@ -368,8 +905,8 @@ uzfs_zvol_worker(void *arg)
 				 * if we are rebuilding, we have
 				 * to read the data from the snapshot
 				 */
-				if (zinfo->rebuild_zv) {
-					read_zv = zinfo->rebuild_zv;
+				if (zio_cmd->rebuild_zv) {
+					read_zv = zio_cmd->rebuild_zv;
 				} else {
 					rc = -1;
 					break;
@@ -382,6 +919,11 @@ uzfs_zvol_worker(void *arg)
 			    (char *)zio_cmd->buf,
 			    hdr->offset, hdr->len,
 			    metadata_desc);
+			if ((rc == 0) && (hdr->flags & ZVOL_OP_FLAG_READ_HOLES))
+				rc = uzfs_read_holes(read_zv, hdr->offset,
+				    hdr->len, &zio_cmd->metadata_desc);
+			if ((rc == 0) && (scanner != NULL) && scanner->compress)
+				uzfs_zvol_rebuild_compress(zio_cmd);
 
 			atomic_inc_64(&zinfo->read_req_received_cnt);
 			break;
@@ -389,18 +931,20 @@ uzfs_zvol_worker(void *arg)
 		case ZVOL_OPCODE_WRITE:
 			rc = uzfs_submit_writes(zinfo, zio_cmd);
 			atomic_inc_64(&zinfo->write_req_received_cnt);
+			atomic_inc_64(&zinfo->write_done_seq);
 			break;
 
 		case ZVOL_OPCODE_SYNC:
-			if (ZVOL_IS_HEALTHY(zinfo->main_zv) ||
-			    ZVOL_IS_REBUILDING_AFS(zinfo->main_zv)) {
-				uzfs_flush_data(zinfo->main_zv);
-			}
-			if (!ZVOL_IS_HEALTHY(zinfo->main_zv))
-				uzfs_flush_data(zinfo->clone_zv);
+			uzfs_zvol_sync(zinfo);
 			atomic_inc_64(&zinfo->sync_req_received_cnt);
 			break;
 
+		case ZVOL_OPCODE_UNMAP:
+			rc = uzfs_submit_unmap(zinfo, zio_cmd);
+			atomic_inc_64(&zinfo->unmap_req_received_cnt);
+			atomic_inc_64(&zinfo->write_done_seq);
+			break;
+
 		case ZVOL_OPCODE_REBUILD_SNAP_DONE:
 		case ZVOL_OPCODE_REBUILD_ALL_SNAP_DONE:
 		case ZVOL_OPCODE_REBUILD_STEP_DONE:
@@ -409,6 +953,7 @@ uzfs_zvol_worker(void *arg)
 			VERIFY(!"Should be a valid opcode");
 			break;
 	}
+	zio_cmd->io_done_time = gethrtime();
 
 	if (rc != 0) {
 		LOG_ERR("OP code %d failed: %d", hdr->opcode, rc);
@@ -425,16 +970,21 @@ uzfs_zvol_worker(void *arg)
 		goto drop_refcount;
 	}
 
+	ioc = zio_cmd->io_conn;
 	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
-	if (!zinfo->is_io_ack_sender_created) {
+	if (!zinfo->is_io_ack_sender_created ||
+	    ((ioc != NULL) && !ioc->is_io_ack_sender_created)) {
 		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 		zio_cmd_free(&zio_cmd);
 		goto drop_refcount;
 	}
-	STAILQ_INSERT_TAIL(&zinfo->complete_queue, zio_cmd, cmd_link);
+	zio_cmd->io_queued_time = gethrtime();
+	STAILQ_INSERT_TAIL(&IO_CONN_STATE(zinfo, ioc, complete_queue),
+	    zio_cmd, cmd_link);
 
-	if (zinfo->io_ack_waiting) {
-		rc = pthread_cond_signal(&zinfo->io_ack_cond);
+	if (IO_CONN_STATE(zinfo, ioc, io_ack_waiting)) {
+		rc = pthread_cond_signal(&IO_CONN_STATE(zinfo, ioc,
+		    io_ack_cond));
 	}
 	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 
@@ -442,6 +992,9 @@ drop_refcount:
 	atomic_add_64(&zinfo->inflight_io_cnt, -1);
 	atomic_add_64(&zinfo->dispatched_io_cnt, -1);
 
+	if (scanner != NULL)
+		zvol_rebuild_scanner_cmd_done(zinfo, scanner);
+
 	uzfs_zinfo_drop_refcnt(zinfo);
 }
 
@@ -457,6 +1010,9 @@ static void zvol_rebuild_scanner_inc_ack_cnt(zvol_info_t *zinfo, int fd)
 	while (sinfo != NULL) {
 		if (sinfo->fd == fd) {
 			sinfo->rebuild_cmd_acked_cnt++;
+			if (sinfo->rebuild_cmd_waiting)
+				(void) pthread_cond_broadcast(
+				    &sinfo->rebuild_cmd_cond);
 			break;
 		}
 		sinfo = STAILQ_NEXT(sinfo, link);
@@ -475,6 +1031,9 @@ static void zvol_rebuild_scanner_set_errored_fd(zvol_info_t *zinfo, int fd)
 	while (sinfo != NULL) {
 		if (sinfo->fd == fd) {
 			sinfo->is_fd_errored = 1;
+			if (sinfo->rebuild_cmd_waiting)
+				(void) pthread_cond_broadcast(
+				    &sinfo->rebuild_cmd_cond);
 			break;
 		}
 		sinfo = STAILQ_NEXT(sinfo, link);
@@ -533,14 +1092,14 @@ uzfs_zvol_remove_from_rebuild_scanner(zvol_info_t *zinfo, int fd)
 
 /*
  * This fn appends zinfo related fd to zinfo fd list
+ * This fn needs zinfo_mutex lock to access fd list
  */
 static void
-uzfs_zvol_append_to_fd_list(zvol_info_t *zinfo, int fd)
+uzfs_zvol_append_to_fd_list_locked(zvol_info_t *zinfo, int fd)
 {
 	zinfo_fd_t *new_zinfo_fd = kmem_alloc(sizeof (zinfo_fd_t), KM_SLEEP);
 	new_zinfo_fd->fd = fd;
 
-	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
 #ifdef DEBUG
 	zinfo_fd_t *zinfo_fd = NULL;
 	STAILQ_FOREACH(zinfo_fd, &zinfo->fd_list, fd_link) {
@@ -551,6 +1110,13 @@ uzfs_zvol_append_to_fd_list(zvol_info_t *zinfo, int fd)
 #endif
 	STAILQ_INSERT_TAIL(&zinfo->fd_list, new_zinfo_fd, fd_link);
 	LOG_DEBUG("Appending fd %d for zvol %s", fd, zinfo->name);
+}
+
+static void
+uzfs_zvol_append_to_fd_list(zvol_info_t *zinfo, int fd)
+{
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	uzfs_zvol_append_to_fd_list_locked(zinfo, fd);
 	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 }
 
@@ -636,6 +1202,176 @@ uzfs_zvol_handle_rebuild_snap_done(zvol_io_hdr_t *hdrp,
 	return (rc);
 }
 
+static void
+uzfs_zvol_rebuild_writer_init(zvol_rebuild_writer_info_t *winfo,
+    zvol_info_t *zinfo, int fd)
+{
+	bzero(winfo, sizeof (*winfo));
+	winfo->zinfo = zinfo;
+	winfo->fd = fd;
+	(void) pthread_mutex_init(&winfo->rebuild_write_mtx, NULL);
+	(void) pthread_cond_init(&winfo->rebuild_write_cond, NULL);
+	if (zvol_rebuild_write_threads > 0)
+		winfo->write_tq = taskq_create("rebuild_write",
+		    zvol_rebuild_write_threads, defclsyspri,
+		    zvol_rebuild_write_threads, INT_MAX, TASKQ_PREPOPULATE);
+}
+
+/*
+ * Applies write received on rebuild connection. Any failure of it fails
+ * the rebuild, which is noticed by the receiving thread from writer.
+ */
+static void
+uzfs_zvol_rebuild_write(void *arg)
+{
+	zvol_io_cmd_t	*zio_cmd = arg;
+	zvol_rebuild_writer_info_t	*winfo = zio_cmd->writer;
+	int		rc = 0;
+
+	if ((zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD_COMPRESSED) &&
+	    (uzfs_zvol_rebuild_decompress(zio_cmd) != 0)) {
+		LOG_ERR("invalid compressed rebuild IO.. for %s.. on fd(%d)",
+		    winfo->zinfo->name, winfo->fd);
+		/* drop what is taken for uzfs_zvol_worker */
+		atomic_add_64(&winfo->zinfo->dispatched_io_cnt, -1);
+		uzfs_zinfo_drop_refcnt(winfo->zinfo);
+		rc = -1;
+	} else {
+		uzfs_zvol_worker(zio_cmd);
+#ifdef DEBUG
+		/* fails the write which brings the count down to zero */
+		if ((inject_error.inject_rebuild_error.
+		    dw_replica_rebuild_write_error_io > 0) &&
+		    (atomic_dec_64_nv(&inject_error.inject_rebuild_error.
+		    dw_replica_rebuild_write_error_io) == 0))
+			zio_cmd->hdr.status = ZVOL_OP_STATUS_FAILED;
+#endif
+		if (zio_cmd->hdr.status != ZVOL_OP_STATUS_OK) {
+			LOG_ERR("rebuild IO failed.. for %s.. on fd(%d)",
+			    winfo->zinfo->name, winfo->fd);
+			rc = -1;
+		}
+	}
+	zio_cmd_free(&zio_cmd);
+
+	(void) pthread_mutex_lock(&winfo->rebuild_write_mtx);
+	if (rc != 0 && winfo->rebuild_write_err == 0)
+		winfo->rebuild_write_err = rc;
+	winfo->rebuild_write_inflight--;
+	(void) pthread_cond_broadcast(&winfo->rebuild_write_cond);
+	(void) pthread_mutex_unlock(&winfo->rebuild_write_mtx);
+}
+
+/*
+ * Hands over write to threads of writer, waiting for the room if there
+ * are zvol_rebuild_write_queue_limit writes in flight already.
+ * Returns error of earlier write, if any, without taking this one.
+ */
+static int
+uzfs_zvol_rebuild_writer_dispatch(zvol_rebuild_writer_info_t *winfo,
+    zvol_io_cmd_t *zio_cmd)
+{
+	int	rc;
+
+	(void) pthread_mutex_lock(&winfo->rebuild_write_mtx);
+	while ((winfo->rebuild_write_err == 0) &&
+	    (winfo->rebuild_write_inflight >=
+	    MAX(zvol_rebuild_write_queue_limit, 1)))
+		(void) pthread_cond_wait(&winfo->rebuild_write_cond,
+		    &winfo->rebuild_write_mtx);
+	rc = winfo->rebuild_write_err;
+	if (rc == 0)
+		winfo->rebuild_write_inflight++;
+	(void) pthread_mutex_unlock(&winfo->rebuild_write_mtx);
+	if (rc != 0)
+		return (rc);
+
+	/*
+	 * Take refcount for uzfs_zvol_worker to work on it.
+	 * Will dropped by uzfs_zvol_worker once cmd is executed.
+	 */
+	uzfs_zinfo_take_refcnt(winfo->zinfo);
+	zio_cmd->zinfo = winfo->zinfo;
+	zio_cmd->writer = winfo;
+	atomic_inc_64(&winfo->zinfo->dispatched_io_cnt);
+	if (winfo->write_tq != NULL)
+		taskq_dispatch(winfo->write_tq, uzfs_zvol_rebuild_write,
+		    zio_cmd, TQ_SLEEP);
+	else
+		uzfs_zvol_rebuild_write(zio_cmd);
+	return (0);
+}
+
+/*
+ * Waits till all the writes handed over to writer are applied, and returns
+ * error of the failed one, if any.
+ */
+static int
+uzfs_zvol_rebuild_writer_wait(zvol_rebuild_writer_info_t *winfo)
+{
+	int	rc;
+
+	(void) pthread_mutex_lock(&winfo->rebuild_write_mtx);
+	while (winfo->rebuild_write_inflight != 0)
+		(void) pthread_cond_wait(&winfo->rebuild_write_cond,
+		    &winfo->rebuild_write_mtx);
+	rc = winfo->rebuild_write_err;
+	(void) pthread_mutex_unlock(&winfo->rebuild_write_mtx);
+	return (rc);
+}
+
+static int
+uzfs_zvol_rebuild_writer_fini(zvol_rebuild_writer_info_t *winfo)
+{
+	int	rc;
+
+	rc = uzfs_zvol_rebuild_writer_wait(winfo);
+	if (winfo->write_tq != NULL)
+		taskq_destroy(winfo->write_tq);
+	(void) pthread_cond_destroy(&winfo->rebuild_write_cond);
+	(void) pthread_mutex_destroy(&winfo->rebuild_write_mtx);
+	return (rc);
+}
+
+/*
+ * Progress of rebuild pass is tracked only while snapshots are rebuilt with
+ * single helping replica. Internal snapshot that helping replica rebuilds
+ * from in AFS phase is created for each rebuild connection, and passes of
+ * multiple helping replicas can't share the progress.
+ */
+static boolean_t
+uzfs_zvol_rebuild_progress_tracked(zvol_info_t *zinfo)
+{
+	boolean_t tracked;
+
+	mutex_enter(&zinfo->main_zv->rebuild_mtx);
+	tracked = ((uzfs_zvol_get_rebuild_status(zinfo->main_zv) ==
+	    ZVOL_REBUILDING_SNAP) &&
+	    (zinfo->main_zv->rebuild_info.rebuild_cnt == 1));
+	mutex_exit(&zinfo->main_zv->rebuild_mtx);
+	return (tracked);
+}
+
+/*
+ * Gets offset at which rebuild pass from checkpointed_ionum can resume, and
+ * guid of the snapshot the stored progress belongs to. Offset is 0 if there
+ * is no progress of this pass.
+ */
+static void
+uzfs_zvol_rebuild_get_resume_offset(zvol_info_t *zinfo,
+    uint64_t checkpointed_ionum, uint64_t *offset, uint64_t *snap_guid)
+{
+	if (!uzfs_zvol_rebuild_progress_tracked(zinfo) ||
+	    (uzfs_zvol_get_rebuild_progress(zinfo->main_zv,
+	    checkpointed_ionum, snap_guid, offset) != 0) ||
+	    (*offset >= ZVOL_VOLUME_SIZE(zinfo->main_zv))) {
+		*offset = *snap_guid = 0;
+		return;
+	}
+	LOG_INFO("Resuming rebuild of %s from offset %lu for io_seq %lu",
+	    zinfo->name, *offset, checkpointed_ionum);
+}
+
 void
 uzfs_zvol_rebuild_dw_replica(void *arg)
 {
@@ -643,19 +1379,26 @@ uzfs_zvol_rebuild_dw_replica(void *arg)
 	struct sockaddr_in replica_ip;
 
 	int		start_rebuild_from_clone = 0;
-	int		rc = 0;
+	int		rc = 0, err;
 	int		sfd = -1;
 	uint64_t	offset = 0;
+	uint64_t	req_offset = 0;
+	uint64_t	step_end[ZVOL_REBUILD_STEP_WINDOW_MAX];
+	uint64_t	step_head = 0, nsteps = 0, window = 1;
 	uint64_t	checkpointed_ionum;
+	uint64_t	resume_guid = 0;
+	time_t		progress_time;
 	boolean_t 	all_snap_done = B_FALSE;
 	zvol_info_t	*zinfo = NULL;
 	zvol_state_t	*zvol_state;
 	zvol_io_cmd_t	*zio_cmd = NULL;
 	zvol_io_hdr_t 	hdr;
+	zvol_rebuild_writer_info_t	winfo;
 	struct linger lo = { 1, 0 };
 
 	sfd = rebuild_args->fd;
 	zinfo = rebuild_args->zinfo;
+	uzfs_zvol_rebuild_writer_init(&winfo, zinfo, sfd);
 
 	uzfs_zvol_append_to_fd_list(zinfo, sfd);
 
@@ -692,11 +1435,21 @@ uzfs_zvol_rebuild_dw_replica(void *arg)
 		goto exit;
 	}
 
+	/* Helping replica has to confirm snapshot before opening window */
+	uzfs_zvol_rebuild_get_resume_offset(zinfo, checkpointed_ionum,
+	    &offset, &resume_guid);
+	req_offset = offset;
+	progress_time = time(NULL);
+
 	zvol_state = zinfo->main_zv;
 	bzero(&hdr, sizeof (hdr));
 	hdr.status = ZVOL_OP_STATUS_OK;
 	hdr.version = REPLICA_VERSION;
 	hdr.opcode = ZVOL_OPCODE_HANDSHAKE;
+	if (zvol_rebuild_compress)
+		hdr.flags |= ZVOL_OP_FLAG_REBUILD_COMPRESSED;
+	if (zvol_rebuild_holes)
+		hdr.flags |= ZVOL_OP_FLAG_READ_HOLES;
 	hdr.len = strlen(rebuild_args->zvol_name) + 1;
 
 	rc = uzfs_zvol_socket_write(sfd, (char *)&hdr, sizeof (hdr));
@@ -730,6 +1483,10 @@ next_step:
 			offset = ZVOL_VOLUME_SIZE(zvol_state) + 1;
 #endif
 		ASSERT(offset >= ZVOL_VOLUME_SIZE(zvol_state));
+		/* snapshot needs to have all the writes of this pass */
+		rc = uzfs_zvol_rebuild_writer_wait(&winfo);
+		if (rc != 0)
+			goto exit;
 		rc = uzfs_zvol_handle_rebuild_snap_done(&hdr,
 		    sfd, zinfo);
 		if (rc != 0) {
@@ -737,7 +1494,8 @@ next_step:
 			    zinfo->name, sfd);
 			goto exit;
 		}
-		offset = 0;
+		offset = req_offset = 0;
+		step_head = nsteps = 0;
 		rc = uzfs_zvol_get_last_committed_io_no(zinfo->main_zv,
 		    HEALTHY_IO_SEQNUM, &checkpointed_ionum);
 		if (rc != 0) {
@@ -745,9 +1503,17 @@ next_step:
 			    zinfo->name);
 			goto exit;
 		}
+		uzfs_zvol_rebuild_get_resume_offset(zinfo, checkpointed_ionum,
+		    &offset, &resume_guid);
+		req_offset = offset;
+		if (resume_guid != 0)
+			window = 1;
 	}
 
 	if (offset >= ZVOL_VOLUME_SIZE(zvol_state)) {
+		rc = uzfs_zvol_rebuild_writer_wait(&winfo);
+		if (rc != 0)
+			goto exit;
 		hdr.opcode = ZVOL_OPCODE_REBUILD_COMPLETE;
 		rc = uzfs_zvol_socket_write(sfd, (char *)&hdr, sizeof (hdr));
 		if (rc != 0) {
@@ -768,22 +1534,37 @@ next_step:
 			goto exit;
 		}
 	} else {
-		bzero(&hdr, sizeof (hdr));
-		hdr.status = ZVOL_OP_STATUS_OK;
-		hdr.version = REPLICA_VERSION;
-		hdr.opcode = ZVOL_OPCODE_REBUILD_STEP;
-		hdr.checkpointed_io_seq = checkpointed_ionum;
-		hdr.offset = offset;
-		if ((offset + zvol_rebuild_step_size) >
-		    ZVOL_VOLUME_SIZE(zvol_state))
-			hdr.len = ZVOL_VOLUME_SIZE(zvol_state) - offset;
-		else
-			hdr.len = zvol_rebuild_step_size;
-		rc = uzfs_zvol_socket_write(sfd, (char *)&hdr, sizeof (hdr));
-		if (rc != 0) {
-			LOG_ERR("Socket rebuild_step write failed for %s on "
-			    "fd(%d)", zvol_state->zv_name, sfd);
-			goto exit;
+		/*
+		 * Steps are sent ahead upto window, so that helping replica
+		 * has next step to work on by the time it completes one.
+		 * Ends of the outstanding steps are kept in step_end to match
+		 * them with STEP_DONEs, which come in the same order.
+		 */
+		while ((nsteps < window) &&
+		    (req_offset < ZVOL_VOLUME_SIZE(zvol_state))) {
+			bzero(&hdr, sizeof (hdr));
+			hdr.status = ZVOL_OP_STATUS_OK;
+			hdr.version = REPLICA_VERSION;
+			hdr.opcode = ZVOL_OPCODE_REBUILD_STEP;
+			hdr.checkpointed_io_seq = checkpointed_ionum;
+			hdr.offset = req_offset;
+			if ((req_offset + zvol_rebuild_step_size) >
+			    ZVOL_VOLUME_SIZE(zvol_state))
+				hdr.len = ZVOL_VOLUME_SIZE(zvol_state) -
+				    req_offset;
+			else
+				hdr.len = zvol_rebuild_step_size;
+			rc = uzfs_zvol_socket_write(sfd, (char *)&hdr,
+			    sizeof (hdr));
+			if (rc != 0) {
+				LOG_ERR("Socket rebuild_step write failed for "
+				    "%s on fd(%d)", zvol_state->zv_name, sfd);
+				goto exit;
+			}
+			req_offset += hdr.len;
+			step_end[(step_head + nsteps) %
+			    ZVOL_REBUILD_STEP_WINDOW_MAX] = req_offset;
+			nsteps++;
 		}
 	}
 
@@ -821,7 +1602,59 @@ next_step:
 		}
 
 		if (hdr.opcode == ZVOL_OPCODE_REBUILD_STEP_DONE) {
-			offset += zvol_rebuild_step_size;
+			if ((hdr.flags & ZVOL_OP_FLAG_REBUILD_STEP_END) &&
+			    ((nsteps == 0) ||
+			    (hdr.offset != step_end[step_head]))) {
+				LOG_ERR("STEP_DONE till %lu is not of "
+				    "outstanding step for %s on fd(%d)",
+				    hdr.offset, zinfo->name, sfd);
+				rc = -1;
+				goto exit;
+			}
+			if (nsteps != 0) {
+				offset = step_end[step_head];
+				step_head = (step_head + 1) %
+				    ZVOL_REBUILD_STEP_WINDOW_MAX;
+				nsteps--;
+			} else {
+				/* STEP_DONE without flag moves ahead a step */
+				offset += zvol_rebuild_step_size;
+				req_offset = offset;
+			}
+			if (hdr.flags & ZVOL_OP_FLAG_REBUILD_STEP_END)
+				window = MAX(1, MIN(zvol_rebuild_step_window,
+				    ZVOL_REBUILD_STEP_WINDOW_MAX));
+			/*
+			 * Range before resumed offset is rebuilt from the
+			 * snapshot of stored progress. If helping replica is
+			 * at other snapshot now, pass need to start over.
+			 */
+			if (resume_guid != 0) {
+				if (!(hdr.flags &
+				    ZVOL_OP_FLAG_REBUILD_STEP_END) ||
+				    (hdr.io_seq != resume_guid)) {
+					LOG_INFO("Snapshot changed for rebuild "
+					    "of %s on fd(%d), restarting pass",
+					    zinfo->name, sfd);
+					offset = req_offset = 0;
+				}
+				resume_guid = 0;
+			}
+			if ((hdr.flags & ZVOL_OP_FLAG_REBUILD_STEP_END) &&
+			    (offset != 0) &&
+			    (offset < ZVOL_VOLUME_SIZE(zvol_state)) &&
+			    ((uint64_t)(time(NULL) - progress_time) >=
+			    zvol_rebuild_progress_interval) &&
+			    uzfs_zvol_rebuild_progress_tracked(zinfo)) {
+				/* writes till offset need to be applied */
+				rc = uzfs_zvol_rebuild_writer_wait(&winfo);
+				if (rc != 0)
+					goto exit;
+				uzfs_zvol_store_rebuild_progress(
+				    zinfo->main_zv, checkpointed_ionum,
+				    hdr.io_seq, offset);
+				progress_time = time(NULL);
+			}
 			LOG_DEBUG("ZVOL_OPCODE_REBUILD_STEP_DONE received on "
 			    "fd: %d", sfd);
 			goto next_step;
@@ -834,6 +1667,9 @@ next_step:
 			LOG_DEBUG("Received ALL_SNAP_DONE on fd: %d", sfd);
 			/* All snapshots has been transferred */
 			all_snap_done = B_TRUE;
+			rc = uzfs_zvol_rebuild_writer_wait(&winfo);
+			if (rc != 0)
+				goto exit;
 			/*
 			 * Change rebuild state to mark that all
 			 * snapshots has been transferred now
@@ -895,26 +1731,29 @@ next_step:
 		if (rc != 0)
 			goto exit;
 
-		/*
-		 * Take refcount for uzfs_zvol_worker to work on it.
-		 * Will dropped by uzfs_zvol_worker once cmd is executed.
-		 */
-		uzfs_zinfo_take_refcnt(zinfo);
-		zio_cmd->zinfo = zinfo;
-		atomic_inc_64(&zinfo->dispatched_io_cnt);
-		uzfs_zvol_worker(zio_cmd);
-		if (zio_cmd->hdr.status != ZVOL_OP_STATUS_OK) {
-			LOG_ERR("rebuild IO failed.. for %s.. on fd(%d)",
-			    zinfo->name, sfd);
-			rc = -1;
+		/* Next block is received while this one is being written */
+		rc = uzfs_zvol_rebuild_writer_dispatch(&winfo, zio_cmd);
+		if (rc != 0)
 			goto exit;
-		}
-		zio_cmd_free(&zio_cmd);
+		zio_cmd = NULL;
 	}
 
 exit:
+	/* writes in flight need rebuild state to be as it is */
+	if ((err = uzfs_zvol_rebuild_writer_fini(&winfo)) != 0 && rc == 0)
+		rc = err;
 	uzfs_zvol_remove_from_fd_list(zinfo, sfd);
 
+	/*
+	 * Helping replica of older version fails the step at resumed offset,
+	 * so that next attempt need to start the pass from 0.
+	 */
+	if ((rc != 0) && (resume_guid != 0)) {
+		LOG_INFO("Resumed rebuild of %s failed before first step, "
+		    "clearing rebuild progress", zinfo->name);
+		uzfs_zvol_store_rebuild_progress(zinfo->main_zv, 0, 0, 0);
+	}
+
 	mutex_enter(&zinfo->main_zv->rebuild_mtx);
 	if (rc != 0) {
 		uzfs_zvol_set_rebuild_status(zinfo->main_zv,
@@ -950,6 +1789,9 @@ exit:
 		 */
 		uzfs_zvol_store_kv_pair(zinfo->clone_zv, STALE, 1);
 
+		/* progress of rebuild passes is not needed anymore */
+		uzfs_zvol_store_rebuild_progress(zinfo->main_zv, 0, 0, 0);
+
 		/*
 		 * set the quorum to 1 once rebuild is done. istgt will
 		 * start considering it in the quorum decision.
@@ -1125,6 +1967,22 @@ uzfs_zvol_timer_thread(void)
 	zk_thread_exit();
 }
 
+/*
+ * Resizes worker pools of volumes every zvol_workers_scale_interval_ms.
+ */
+void
+uzfs_zvol_workers_thread(void)
+{
+	prctl(PR_SET_NAME, "zvol_workers", 0, 0, 0);
+
+	while (1) {
+		usleep(zvol_workers_scale_interval_ms * 1000);
+		uzfs_zinfo_scale_workers();
+	}
+
+	zk_thread_exit();
+}
+
 /*
  * Update interval and wake up timer thread so that it can adjust to the new
  * value. If timeout is zero, then we just wake up the timer thread (used in
@@ -1399,55 +2257,134 @@ uzfs_zvol_rebuild_scanner_callback(off_t offset, size_t len,
 	hdr.offset = offset;
 	hdr.len = len;
 	hdr.flags = ZVOL_OP_FLAG_REBUILD;
+	if (warg->holes)
+		hdr.flags |= ZVOL_OP_FLAG_READ_HOLES;
 	hdr.status = ZVOL_OP_STATUS_OK;
 
 	LOG_DEBUG("IO number for rebuild %ld %ld %s", metadata->io_num, offset,
 	    zinfo->name);
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
 	while (1) {
 		if ((zinfo->state == ZVOL_INFO_STATE_OFFLINE) ||
 		    (!zinfo->is_io_ack_sender_created)) {
+			(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 			LOG_ERR("[%s:%d] in err state", zinfo->name, warg->fd);
 			return (-1);
 		}
 		if (warg->is_fd_errored) {
+			(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 			LOG_ERR("[%s:%d] errored at ack_sender", zinfo->name,
 			    warg->fd);
 			return (-1);
 		}
-		if (IS_REBUILD_HIT_MAX_CMD_LIMIT(warg)) {
-			count_to_print++;
-			if (count_to_print >= 1000) {
-				LOG_ERR("[%s:%d] waiting for ack to send",
-				    zinfo->name, warg->fd);
-				count_to_print = 0;
-			}
-			sleep(1);
-		}
-		else
+		if (!IS_REBUILD_HIT_MAX_CMD_LIMIT(warg))
 			break;
-	}
 
+		count_to_print++;
+		if (count_to_print >= 1000) {
+			LOG_ERR("[%s:%d] waiting for ack to send",
+			    zinfo->name, warg->fd);
+			count_to_print = 0;
+		}
+		zvol_rebuild_scanner_wait(zinfo, warg);
+	}
 	warg->rebuild_cmd_queued_cnt++;
+	warg->rebuild_cmd_inflight++;
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+
 	zio_cmd = zio_cmd_alloc(&hdr, warg->fd);
 	/* Take refcount for uzfs_zvol_worker to work on it */
 	uzfs_zinfo_take_refcnt(zinfo);
 	zio_cmd->zinfo = zinfo;
-	zinfo->rebuild_zv = zv;
+	zio_cmd->rebuild_zv = zv;
+	zio_cmd->scanner = warg;
 	atomic_inc_64(&zinfo->dispatched_io_cnt);
 
 	/*
 	 * Any error in uzfs_zvol_worker will send FAILURE status to degraded
 	 * replica. Degraded replica will take care of breaking the connection
 	 */
-	uzfs_zvol_worker(zio_cmd);
-	zinfo->rebuild_zv = NULL;
+	taskq_dispatch(zinfo->uzfs_zvol_taskq, uzfs_zvol_worker, zio_cmd,
+	    TQ_SLEEP);
 	return (0);
 }
 
+typedef struct rebuild_scan_part_s {
+	zvol_rebuild_scanner_info_t	*warg;
+	zvol_state_t	*zv;
+	zvol_state_t	*snap_zv;
+	blk_metadata_t	metadata;
+	uint64_t	offset;
+	uint64_t	len;
+	int		rc;
+} rebuild_scan_part_t;
+
+static void
+uzfs_zvol_rebuild_scan_part(void *arg)
+{
+	rebuild_scan_part_t *part = (rebuild_scan_part_t *)arg;
+
+	part->rc = uzfs_get_io_diff(part->zv, &part->metadata, part->snap_zv,
+	    uzfs_zvol_rebuild_scanner_callback, part->offset, part->len,
+	    part->warg);
+}
+
+/*
+ * Scans range of REBUILD_STEP for blocks changed after io_num in metadata,
+ * and, issues reads of them. Range is split into disjoint parts which are
+ * scanned in parallel by threads of scan_tq. Parts are aligned to the lun
+ * range covered by a block of metadata object, so that no two parts read
+ * the same metadata block.
+ */
+static int
+uzfs_zvol_rebuild_scan(zvol_rebuild_scanner_info_t *warg, zvol_state_t *zv,
+    zvol_state_t *snap_zv, blk_metadata_t *metadata, uint64_t offset,
+    uint64_t len)
+{
+	rebuild_scan_part_t *parts;
+	uint64_t unit, part_len, end, next;
+	uint64_t nparts, i;
+	int rc = 0;
+
+	unit = zv->zv_metavolblocksize *
+	    (zv->zv_volmetablocksize / zv->zv_volmetadatasize);
+	nparts = MIN(zvol_rebuild_scan_threads, howmany(len, unit));
+	if (nparts <= 1 || warg->scan_tq == NULL)
+		return (uzfs_get_io_diff(zv, metadata, snap_zv,
+		    uzfs_zvol_rebuild_scanner_callback, offset, len, warg));
+
+	part_len = howmany(len, nparts);
+	parts = kmem_zalloc(nparts * sizeof (*parts), KM_SLEEP);
+	end = offset + len;
+	for (i = 0; i < nparts && offset < end; i++, offset = next) {
+		next = (i == nparts - 1) ? end :
+		    MIN(P2ROUNDUP(offset + part_len, unit), end);
+		parts[i].warg = warg;
+		parts[i].zv = zv;
+		parts[i].snap_zv = snap_zv;
+		parts[i].metadata = *metadata;
+		parts[i].offset = offset;
+		parts[i].len = next - offset;
+		taskq_dispatch(warg->scan_tq, uzfs_zvol_rebuild_scan_part,
+		    &parts[i], TQ_SLEEP);
+	}
+	taskq_wait(warg->scan_tq);
+
+	for (i = 0; i < nparts; i++) {
+		if (parts[i].rc != 0) {
+			rc = parts[i].rc;
+			break;
+		}
+	}
+	kmem_free(parts, nparts * sizeof (*parts));
+	return (rc);
+}
+
 static void
 uzfs_zvol_send_zio_cmd(zvol_info_t *zinfo, zvol_io_hdr_t *hdrp,
     zvol_op_code_t opcode, int fd, char *payload, uint64_t payload_size,
-    uint64_t checkpointed_io_seq, zvol_rebuild_scanner_info_t *warg)
+    uint64_t checkpointed_io_seq, uint64_t offset,
+    zvol_rebuild_scanner_info_t *warg)
 {
 
 	zvol_io_cmd_t	*zio_cmd;
@@ -1457,6 +2394,11 @@ uzfs_zvol_send_zio_cmd(zvol_info_t *zinfo, zvol_io_hdr_t *hdrp,
 	hdrp->opcode = opcode;
 	hdrp->checkpointed_io_seq = checkpointed_io_seq;
 	hdrp->len = payload_size; // MAX_NAME_LEN + 1;
+	if ((opcode == ZVOL_OPCODE_REBUILD_STEP_DONE) &&
+	    (warg->version >= 7)) {
+		hdrp->flags = ZVOL_OP_FLAG_REBUILD_STEP_END;
+		hdrp->offset = offset;
+	}
 	zio_cmd = zio_cmd_alloc(hdrp, fd);
 	if (payload_size != 0)
 		bcopy(payload, zio_cmd->buf, payload_size);
@@ -1593,6 +2535,15 @@ read_socket:
 			warg->zinfo = zinfo;
 			warg->fd = fd;
 			warg->version = hdr.version;
+			warg->compress = !!(hdr.flags &
+			    ZVOL_OP_FLAG_REBUILD_COMPRESSED);
+			warg->holes = !!(hdr.flags & ZVOL_OP_FLAG_READ_HOLES);
+			(void) pthread_cond_init(&warg->rebuild_cmd_cond, NULL);
+			if (zvol_rebuild_scan_threads > 1)
+				warg->scan_tq = taskq_create("rebuild_scan",
+				    zvol_rebuild_scan_threads, defclsyspri,
+				    zvol_rebuild_scan_threads, INT_MAX,
+				    TASKQ_PREPOPULATE);
 			uzfs_zvol_append_to_rebuild_scanner(zinfo, warg);
 
 			kmem_free(name, hdr.len);
@@ -1636,8 +2587,14 @@ read_socket:
 			 * io_num, but, TODO: we need to make sure that there
 			 * are no ongoing snapshots. This is made sure by tgt?
 			 */
+				/*
+				 * Degraded replica from version 7 might
+				 * resume at non-zero offset, and goes back to
+				 * start if snapshot guid is not the same.
+				 */
 				if (all_snap_done == B_FALSE) {
-					if (rebuild_req_offset != 0) {
+					if ((rebuild_req_offset != 0) &&
+					    (warg->version < 7)) {
 						LOG_ERR("[%s:%d]invalid offset"
 						    " %d to send ALL_SNAP_DONE",
 						    rebuild_req_offset,
@@ -1646,7 +2603,7 @@ read_socket:
 					}
 					uzfs_zvol_send_zio_cmd(zinfo, &hdr,
 					    ZVOL_OPCODE_REBUILD_ALL_SNAP_DONE,
-					    fd, NULL, 0, 0, warg);
+					    fd, NULL, 0, 0, 0, warg);
 					all_snap_done = B_TRUE;
 				}
 				if (ZINFO_IS_DEGRADED(zinfo))
@@ -1660,18 +2617,26 @@ read_socket:
 				}
 			}
 
-			rc = uzfs_get_io_diff(zv, &metadata,
-			    snap_zv, uzfs_zvol_rebuild_scanner_callback,
-			    rebuild_req_offset, rebuild_req_len, warg);
+			rc = uzfs_zvol_rebuild_scan(warg, zv, snap_zv,
+			    &metadata, rebuild_req_offset, rebuild_req_len);
 			if (rc != 0) {
 				LOG_ERR("[%s:%d]Rebuild scanning failed err:%d",
 				    zinfo->name, fd, rc);
 				goto exit;
 			}
 
+			/*
+			 * STEP_DONE needs to be sent after data of the step.
+			 * It carries guid of the snapshot scanned, so that
+			 * degraded replica can resume from the step later only
+			 * if it rebuilds from the same snapshot.
+			 */
+			zvol_rebuild_scanner_wait_inflight(zinfo, warg);
 			uzfs_zvol_send_zio_cmd(zinfo, &hdr,
-			    ZVOL_OPCODE_REBUILD_STEP_DONE,
-			    fd, NULL, 0, 0, warg);
+			    ZVOL_OPCODE_REBUILD_STEP_DONE, fd, NULL, 0,
+			    dsl_dataset_phys(
+			    snap_zv->zv_objset->os_dsl_dataset)->ds_guid,
+			    rebuild_req_offset + rebuild_req_len, warg);
 			goto read_socket;
 
 		case ZVOL_OPCODE_REBUILD_COMPLETE:
@@ -1696,7 +2661,7 @@ read_socket:
 				uzfs_zvol_send_zio_cmd(zinfo, &hdr,
 				    ZVOL_OPCODE_REBUILD_SNAP_DONE,
 				    fd, payload, payload_size,
-				    checkpointed_io_seq + 1, warg);
+				    checkpointed_io_seq + 1, 0, warg);
 				free(payload);
 				/* Close snapshot dataset */
 				LOG_INFO("closing snap %s", snap_zv->zv_name);
@@ -1740,6 +2705,10 @@ read_socket:
 	}
 
 exit:
+	/* reads issued by scanner need snap_zv and warg */
+	if (warg != NULL)
+		zvol_rebuild_scanner_wait_inflight(zinfo, warg);
+
 	if (snap_zv != NULL && all_snap_done == B_FALSE) {
 		LOG_INFO("closing snap on conn break %s", snap_zv->zv_name);
 		uzfs_close_dataset(snap_zv);
@@ -1773,6 +2742,9 @@ exit:
 		remove_pending_cmds_to_ack(fd, zinfo);
 
 		uzfs_zvol_remove_from_rebuild_scanner(zinfo, fd);
+		if (warg->scan_tq != NULL)
+			taskq_destroy(warg->scan_tq);
+		(void) pthread_cond_destroy(&warg->rebuild_cmd_cond);
 		kmem_free(warg, sizeof (zvol_rebuild_scanner_info_t));
 
 		uzfs_zvol_remove_from_fd_list(zinfo, fd);
@@ -1804,61 +2776,278 @@ reinitialize_zv_state(zvol_state_t *zv)
 }
 
 /*
- * This func takes care of sending potentially multiple read blocks each
- * prefixed by metainfo.
+ * Sends out all the buffers accumulated in batch
+ */
+static int
+uzfs_zvol_ack_batch_flush(int fd, zvol_ack_batch_t *batch)
+{
+	int rc = 0;
+
+	if (batch->iovcnt != 0)
+		rc = uzfs_zvol_socket_writev(fd, batch->iov, batch->iovcnt);
+	batch->iovcnt = 0;
+	batch->rw_hdr_cnt = 0;
+	return (rc);
+}
+
+/*
+ * Appends (base, len) to iovec of batch. If iovec is full, all the
+ * accumulated entries are sent out first.
+ */
+static int
+uzfs_zvol_ack_batch_add(int fd, zvol_ack_batch_t *batch, void *base,
+    size_t len)
+{
+	int rc;
+
+	if (batch->iovcnt == ZVOL_ACK_IOV_MAX) {
+		rc = uzfs_zvol_ack_batch_flush(fd, batch);
+		if (rc != 0)
+			return (rc);
+	}
+
+	batch->iov[batch->iovcnt].iov_base = base;
+	batch->iov[batch->iovcnt].iov_len = len;
+	batch->iovcnt++;
+	return (0);
+}
+
+/*
+ * Returns slot for read header in the batch. This is done before adding
+ * it to iovec, so, flush the batch if there is no room for it in iovec.
+ */
+static struct zvol_io_rw_hdr *
+uzfs_zvol_ack_batch_rw_hdr(int fd, zvol_ack_batch_t *batch)
+{
+	if ((batch->iovcnt == ZVOL_ACK_IOV_MAX) &&
+	    (uzfs_zvol_ack_batch_flush(fd, batch) != 0))
+		return (NULL);
+	return (&batch->rw_hdr[batch->rw_hdr_cnt++]);
+}
+
+/*
+ * This func adds the response of zio_cmd to batch, i.e., header followed
+ * by potentially multiple read blocks each prefixed by metainfo.
  */
 static int
-uzfs_send_reads(int fd, zvol_io_cmd_t *zio_cmd)
+uzfs_zvol_ack_batch_add_cmd(int fd, zvol_ack_batch_t *batch,
+    zvol_io_cmd_t *zio_cmd)
 {
 	zvol_io_hdr_t 	*hdr = &zio_cmd->hdr;
-	struct zvol_io_rw_hdr read_hdr;
+	struct zvol_io_rw_hdr *read_hdr;
 	metadata_desc_t	*md;
 	size_t	rel_offset = 0;
-	int	rc = 0;
+	int	md_len = 0;
+	int	rc;
+
+	/* compressed payload has metadata headers in it */
+	if (hdr->flags & ZVOL_OP_FLAG_REBUILD_COMPRESSED) {
+		rc = uzfs_zvol_ack_batch_add(fd, batch, hdr, sizeof (*hdr));
+		if (rc != 0)
+			return (rc);
+		return (uzfs_zvol_ack_batch_add(fd, batch, zio_cmd->buf,
+		    hdr->len));
+	}
+
+	/*
+	 * account for space taken by metadata headers, and, for the data
+	 * of holes which is not sent
+	 */
+	if (hdr->status == ZVOL_OP_STATUS_OK &&
+	    hdr->opcode == ZVOL_OPCODE_READ) {
+		for (md = zio_cmd->metadata_desc; md != NULL; md = md->next) {
+			md_len++;
+			if (md->hole)
+				hdr->len -= md->len;
+		}
+		/* we need at least one header even if no metadata */
+		if (md_len == 0)
+			md_len++;
+		hdr->len += (md_len * sizeof (struct zvol_io_rw_hdr));
+	}
+
+	rc = uzfs_zvol_ack_batch_add(fd, batch, hdr, sizeof (*hdr));
+	if (rc != 0)
+		return (rc);
+
+	if (hdr->opcode == ZVOL_OPCODE_REBUILD_SNAP_DONE)
+		return (uzfs_zvol_ack_batch_add(fd, batch, zio_cmd->buf,
+		    hdr->len));
+
+	if (hdr->opcode != ZVOL_OPCODE_READ ||
+	    hdr->status != ZVOL_OP_STATUS_OK)
+		return (0);
 
 	/* special case for missing metadata */
 	if (zio_cmd->metadata_desc == NULL) {
-		read_hdr.io_num = 0;
+		if ((read_hdr = uzfs_zvol_ack_batch_rw_hdr(fd, batch)) == NULL)
+			return (-1);
+		read_hdr->io_num = 0;
 		/*
-		 * read_hdr.len should be adjusted back
+		 * read_hdr->len should be adjusted back
 		 * to actual read request size now
 		 */
-		read_hdr.len = hdr->len -
-		    sizeof (struct zvol_io_rw_hdr);
-		rc = uzfs_zvol_socket_write(fd, (char *)&read_hdr,
-		    sizeof (read_hdr));
+		read_hdr->len = hdr->len - sizeof (struct zvol_io_rw_hdr);
+		rc = uzfs_zvol_ack_batch_add(fd, batch, read_hdr,
+		    sizeof (*read_hdr));
 		if (rc != 0)
 			return (rc);
-		/* Data that need to be sent is equal to read_hdr.len */
-		rc = uzfs_zvol_socket_write(fd, zio_cmd->buf, read_hdr.len);
-		return (rc);
+		/* Data that need to be sent is equal to read_hdr->len */
+		return (uzfs_zvol_ack_batch_add(fd, batch, zio_cmd->buf,
+		    read_hdr->len));
 	}
 
-	/*
-	 * TODO: Optimize performance by combining multiple writes to a single
-	 * system call either by copying all data to larger buffer or using
-	 * vector write.
-	 */
 	for (md = zio_cmd->metadata_desc; md != NULL; md = md->next) {
-		read_hdr.io_num = md->metadata.io_num;
-		read_hdr.len = md->len;
-		rc = uzfs_zvol_socket_write(fd, (char *)&read_hdr,
-		    sizeof (read_hdr));
+		if ((read_hdr = uzfs_zvol_ack_batch_rw_hdr(fd, batch)) == NULL)
+			return (-1);
+		read_hdr->io_num = md->metadata.io_num;
+		read_hdr->len = md->len;
+		if (md->hole)
+			read_hdr->len |= ZVOL_IO_RW_HDR_HOLE;
+		rc = uzfs_zvol_ack_batch_add(fd, batch, read_hdr,
+		    sizeof (*read_hdr));
 		if (rc != 0)
-			goto end;
+			return (rc);
 
-		rc = uzfs_zvol_socket_write(fd,
-		    (char *)zio_cmd->buf + rel_offset, md->len);
-		if (rc != 0)
-			goto end;
+		if (!md->hole) {
+			rc = uzfs_zvol_ack_batch_add(fd, batch,
+			    (char *)zio_cmd->buf + rel_offset, md->len);
+			if (rc != 0)
+				return (rc);
+		}
 		rel_offset += md->len;
 	}
 
-end:
-	FREE_METADATA_LIST(zio_cmd->metadata_desc);
-	zio_cmd->metadata_desc = NULL;
+	return (0);
+}
 
-	return (rc);
+static int
+zvol_lat_hist_bucket(uint64_t ns)
+{
+	int k;
+
+	if (ns < 4)
+		return (ns);
+	k = highbit64(ns) - 1;
+	return (MIN(4 * (k - 1) + ((ns >> (k - 2)) & 3),
+	    ZVOL_LAT_HIST_BUCKETS - 1));
+}
+
+static void
+zvol_lat_hist_add(zvol_lat_hist_t *hist, uint64_t ns)
+{
+	atomic_inc_64(&hist->count);
+	atomic_add_64(&hist->sum, ns);
+	atomic_inc_64(&hist->buckets[zvol_lat_hist_bucket(ns)]);
+}
+
+/*
+ * Adds latency of stages of IO received on data connection, which is acked
+ * at 'now', to the histograms of zinfo.
+ */
+static void
+uzfs_zvol_ack_update_stage_hist(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd,
+    uint64_t now)
+{
+	zvol_lat_hist_t *hist;
+	uint64_t ts[ZVOL_IO_STAGE_TOTAL + 1];	/* when each stage begins */
+	int stage;
+
+	if (zio_cmd->io_rcv_time == 0 ||
+	    zio_cmd->hdr.opcode < ZVOL_OPCODE_READ ||
+	    zio_cmd->hdr.opcode > ZVOL_OPCODE_UNMAP)
+		return;
+
+	ts[ZVOL_IO_STAGE_RECEIVE] = zio_cmd->io_rcv_time;
+	ts[ZVOL_IO_STAGE_TASKQ] = zio_cmd->io_dispatch_time;
+	ts[ZVOL_IO_STAGE_DMU] = zio_cmd->io_start_time;
+	ts[ZVOL_IO_STAGE_QUEUE] = zio_cmd->io_done_time;
+	ts[ZVOL_IO_STAGE_ACK] = zio_cmd->io_queued_time;
+	ts[ZVOL_IO_STAGE_TOTAL] = now;
+
+	hist = zinfo->io_stage_hist[zio_cmd->hdr.opcode - ZVOL_OPCODE_READ];
+	for (stage = 0; stage < ZVOL_IO_STAGE_TOTAL; stage++)
+		zvol_lat_hist_add(&hist[stage], ts[stage + 1] - ts[stage]);
+	zvol_lat_hist_add(&hist[ZVOL_IO_STAGE_TOTAL],
+	    now - zio_cmd->io_rcv_time);
+}
+
+/*
+ * Updates stats of zinfo for acked zio_cmd
+ */
+static void
+uzfs_zvol_ack_update_stats(zvol_info_t *zinfo, zvol_io_cmd_t *zio_cmd)
+{
+	uint64_t len, latency = 0;
+
+	uzfs_zvol_ack_update_stage_hist(zinfo, zio_cmd, gethrtime());
+
+	if (zio_cmd->hdr.opcode == ZVOL_OPCODE_READ) {
+		latency = gethrtime() - zio_cmd->io_start_time;
+		atomic_inc_64(&zinfo->read_req_ack_cnt);
+		atomic_add_64(&zinfo->read_byte, zio_cmd->hdr.len);
+		atomic_add_64(&zinfo->read_latency, latency);
+
+		len = zio_cmd->hdr.len;
+		if (len < ZFS_HISTOGRAM_IO_SIZE) {
+			zfs_histogram_add(zinfo->uzfs_rio_histogram,
+			    len, len, latency);
+		} else {
+			zfs_histogram_add(zinfo->uzfs_rio_histogram,
+			    ZFS_HISTOGRAM_IO_SIZE, len, latency);
+		}
+	} else if (zio_cmd->hdr.opcode == ZVOL_OPCODE_WRITE) {
+		latency = gethrtime() - zio_cmd->io_start_time;
+		atomic_inc_64(&zinfo->write_req_ack_cnt);
+		atomic_add_64(&zinfo->write_byte, zio_cmd->hdr.len);
+		atomic_add_64(&zinfo->write_latency, latency);
+
+		len = zio_cmd->hdr.len;
+		if (len < ZFS_HISTOGRAM_IO_SIZE) {
+			zfs_histogram_add(zinfo->uzfs_wio_histogram,
+			    len, len, latency);
+		} else {
+			zfs_histogram_add(zinfo->uzfs_wio_histogram,
+			    ZFS_HISTOGRAM_IO_SIZE, len, latency);
+		}
+	} else if (zio_cmd->hdr.opcode == ZVOL_OPCODE_SYNC) {
+		atomic_inc_64(&zinfo->sync_req_ack_cnt);
+		latency = (gethrtime() - zio_cmd->io_start_time);
+		atomic_add_64(&zinfo->sync_latency, latency);
+	} else if (zio_cmd->hdr.opcode == ZVOL_OPCODE_UNMAP) {
+		atomic_inc_64(&zinfo->unmap_req_ack_cnt);
+		latency = (gethrtime() - zio_cmd->io_start_time);
+		atomic_add_64(&zinfo->unmap_latency, latency);
+	}
+
+	if ((latency >> 30) > IO_THRESHOLD_TIME)
+		LOG_INFO("IO %d with seq: %lu took %luns",
+		    zio_cmd->hdr.opcode, zio_cmd->hdr.io_seq, latency);
+}
+
+static void
+uzfs_zvol_ack_free_cmds(zvol_io_cmd_list_t *cmds)
+{
+	zvol_io_cmd_t *zio_cmd;
+
+	while ((zio_cmd = STAILQ_FIRST(cmds)) != NULL) {
+		STAILQ_REMOVE_HEAD(cmds, cmd_link);
+		zio_cmd_free(&zio_cmd);
+	}
+}
+
+/*
+ * Frees batch of cmds whose acks are sent or dropped. zio_cmd_in_ack is
+ * cleared before it, as remove_pending_cmds_to_ack looks into it.
+ */
+static void
+uzfs_zvol_ack_free_batch(zvol_info_t *zinfo, zvol_io_conn_t *ioc,
+    zvol_io_cmd_list_t *cmds)
+{
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	IO_CONN_STATE(zinfo, ioc, zio_cmd_in_ack) = NULL;
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+	uzfs_zvol_ack_free_cmds(cmds);
 }
 
 /*
@@ -1869,55 +3058,84 @@ end:
  * other is a replica which undergoes rebuild.
  * Need to exit from thread when there are network errors
  * on fd related to iscsi target.
+ *
+ * All the completed cmds at head of complete_queue that belong to same
+ * connection are taken off the queue in one go, and, their responses are
+ * sent together with a single writev call (as long as they fit in iovec).
+ *
+ * Each additional data connection of LUN/vol has its own ack sender which
+ * works on complete_queue of that connection.
  */
 static void
 uzfs_zvol_io_ack_sender(void *arg)
 {
-	int fd;
-	int md_len;
+	int fd, conn;
+	uint64_t		cnt;
 	zvol_info_t		*zinfo;
+	zvol_io_conn_t		*ioc;
 	thread_args_t 		*thrd_arg;
 	zvol_io_cmd_t 		*zio_cmd = NULL;
-	uint64_t len, latency;
+	zvol_io_cmd_list_t	cmds;
+	zvol_io_cmd_list_t	*complete_queue;
+	zvol_ack_batch_t	*batch;
 	int			s = 0;
 
 	thrd_arg = (thread_args_t *)arg;
 	fd = thrd_arg->fd;
 	zinfo = thrd_arg->zinfo;
+	ioc = thrd_arg->io_conn;
 	kmem_free(arg, sizeof (thread_args_t));
 
 	prctl(PR_SET_NAME, "ack_sender", 0, 0, 0);
 
+	complete_queue = &IO_CONN_STATE(zinfo, ioc, complete_queue);
+
 	LOG_INFO("Started ack sender for zvol %s fd: %d", zinfo->name, fd);
 
+	batch = kmem_zalloc(sizeof (zvol_ack_batch_t), KM_SLEEP);
+	STAILQ_INIT(&cmds);
+
 	while (1) {
 		int rc = 0;
 		(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
-		zinfo->zio_cmd_in_ack = NULL;
+		IO_CONN_STATE(zinfo, ioc, zio_cmd_in_ack) = NULL;
 		while (1) {
 			if ((zinfo->state == ZVOL_INFO_STATE_OFFLINE) ||
-			    (zinfo->conn_closed == B_TRUE)) {
+			    (IO_CONN_STATE(zinfo, ioc, conn_closed) ==
+			    B_TRUE)) {
 				(void) pthread_mutex_unlock(
 				    &zinfo->zinfo_mutex);
 				goto exit;
 			}
-			if (STAILQ_EMPTY(&zinfo->complete_queue)) {
-				zinfo->io_ack_waiting = 1;
-				pthread_cond_wait(&zinfo->io_ack_cond,
-				    &zinfo->zinfo_mutex);
-				zinfo->io_ack_waiting = 0;
+			if (STAILQ_EMPTY(complete_queue)) {
+				IO_CONN_STATE(zinfo, ioc, io_ack_waiting) = 1;
+				pthread_cond_wait(&IO_CONN_STATE(zinfo, ioc,
+				    io_ack_cond), &zinfo->zinfo_mutex);
+				IO_CONN_STATE(zinfo, ioc, io_ack_waiting) = 0;
 			}
 			else
 				break;
 		}
 
-		zio_cmd = STAILQ_FIRST(&zinfo->complete_queue);
-		STAILQ_REMOVE_HEAD(&zinfo->complete_queue, cmd_link);
-		zinfo->zio_cmd_in_ack = zio_cmd;
-
-		if (zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD) {
-			s = 1;
-			zvol_rebuild_scanner_inc_ack_cnt(zinfo, zio_cmd->conn);
+		/*
+		 * zio_cmd_in_ack is the first cmd of batch, and, all the cmds
+		 * of batch belong to its connection.
+		 */
+		zio_cmd = STAILQ_FIRST(complete_queue);
+		IO_CONN_STATE(zinfo, ioc, zio_cmd_in_ack) = zio_cmd;
+		conn = zio_cmd->conn;
+		s = 0;
+		cnt = 0;
+		while ((zio_cmd != NULL) && (zio_cmd->conn == conn) &&
+		    (cnt < zvol_ack_batch_max_cmds)) {
+			STAILQ_REMOVE_HEAD(complete_queue, cmd_link);
+			STAILQ_INSERT_TAIL(&cmds, zio_cmd, cmd_link);
+			if (zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD) {
+				s = 1;
+				zvol_rebuild_scanner_inc_ack_cnt(zinfo, conn);
+			}
+			cnt++;
+			zio_cmd = STAILQ_FIRST(complete_queue);
 		}
 
 		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
@@ -1927,123 +3145,46 @@ uzfs_zvol_io_ack_sender(void *arg)
 			if (inject_error.delay.helping_replica_ack_sender == 1)
 				sleep(2);
 #endif
-		LOG_DEBUG("ACK for op: %d, seq-id: %ld",
-		    zio_cmd->hdr.opcode, zio_cmd->hdr.io_seq);
-
-		/* account for space taken by metadata headers */
-		if (zio_cmd->hdr.status == ZVOL_OP_STATUS_OK &&
-		    zio_cmd->hdr.opcode == ZVOL_OPCODE_READ) {
-			md_len = 0;
-			for (metadata_desc_t *md = zio_cmd->metadata_desc;
-			    md != NULL;
-			    md = md->next) {
-				md_len++;
-			}
-			/* we need at least one header even if no metadata */
-			if (md_len == 0)
-				md_len++;
-			zio_cmd->hdr.len += (md_len *
-			    sizeof (struct zvol_io_rw_hdr));
-		}
 
-		rc = uzfs_zvol_socket_write(zio_cmd->conn,
-		    (char *)&zio_cmd->hdr, sizeof (zio_cmd->hdr));
-		if (rc == -1)
-			goto error_check;
-
-		if (zio_cmd->hdr.opcode == ZVOL_OPCODE_REBUILD_SNAP_DONE) {
-			rc = uzfs_zvol_socket_write(zio_cmd->conn,
-			    zio_cmd->buf, zio_cmd->hdr.len);
-error_check:
-			if (rc == -1) {
-				LOG_ERRNO("[fd:%d]socket write err",
-				    zio_cmd->conn);
-				zinfo->zio_cmd_in_ack = NULL;
-				/*
-				 * exit due to network errors on fd related
-				 * to iscsi target
-				 */
-				if (zio_cmd->conn == fd) {
-					zio_cmd_free(&zio_cmd);
-					goto exit;
-				} else {
-					zvol_rebuild_scanner_set_errored_fd(
-					    zinfo, zio_cmd->conn);
-				}
-				zio_cmd_free(&zio_cmd);
-				continue;
-			}
+		STAILQ_FOREACH(zio_cmd, &cmds, cmd_link) {
+			LOG_DEBUG("ACK for op: %d, seq-id: %ld",
+			    zio_cmd->hdr.opcode, zio_cmd->hdr.io_seq);
+			rc = uzfs_zvol_ack_batch_add_cmd(conn, batch, zio_cmd);
+			if (rc != 0)
+				break;
 		}
+		if (rc == 0)
+			rc = uzfs_zvol_ack_batch_flush(conn, batch);
 
-		latency = 0;
-		if (zio_cmd->hdr.opcode == ZVOL_OPCODE_READ) {
-			if (zio_cmd->hdr.status == ZVOL_OP_STATUS_OK) {
-				/* Send data read from disk */
-				rc = uzfs_send_reads(zio_cmd->conn, zio_cmd);
-				if (rc == -1) {
-					zinfo->zio_cmd_in_ack = NULL;
-					LOG_ERRNO("[fd:%d]socket write err",
-					    zio_cmd->conn);
-					if (zio_cmd->conn == fd) {
-						zio_cmd_free(&zio_cmd);
-						goto exit;
-					}
-					zvol_rebuild_scanner_set_errored_fd(
-					    zinfo, zio_cmd->conn);
-				}
-			}
-			latency = gethrtime() - zio_cmd->io_start_time;
-			atomic_inc_64(&zinfo->read_req_ack_cnt);
-			atomic_add_64(&zinfo->read_byte, zio_cmd->hdr.len);
-			atomic_add_64(&zinfo->read_latency, latency);
-
-			len = zio_cmd->hdr.len;
-			if (len < ZFS_HISTOGRAM_IO_SIZE) {
-				zfs_histogram_add(zinfo->uzfs_rio_histogram,
-				    len, len, latency);
-			} else {
-				zfs_histogram_add(zinfo->uzfs_rio_histogram,
-				    ZFS_HISTOGRAM_IO_SIZE, len, latency);
-			}
-		} else {
-			if (zio_cmd->hdr.opcode == ZVOL_OPCODE_WRITE) {
-				latency = gethrtime() - zio_cmd->io_start_time;
-				atomic_inc_64(&zinfo->write_req_ack_cnt);
-				atomic_add_64(&zinfo->write_byte,
-				    zio_cmd->hdr.len);
-				atomic_add_64(&zinfo->write_latency, latency);
-
-				len = zio_cmd->hdr.len;
-				if (len < ZFS_HISTOGRAM_IO_SIZE) {
-					zfs_histogram_add(zinfo->
-					    uzfs_wio_histogram, len,
-					    len, latency);
-				} else {
-					zfs_histogram_add(zinfo->
-					    uzfs_wio_histogram,
-					    ZFS_HISTOGRAM_IO_SIZE,
-					    len, latency);
-				}
-			} else if (zio_cmd->hdr.opcode == ZVOL_OPCODE_SYNC) {
-				atomic_inc_64(&zinfo->sync_req_ack_cnt);
-				latency = (gethrtime() -
-				    zio_cmd->io_start_time);
-				atomic_add_64(&zinfo->sync_latency, latency);
-			}
+		if (rc != 0) {
+			LOG_ERRNO("[fd:%d]socket write err", conn);
+			batch->iovcnt = batch->rw_hdr_cnt = 0;
+			uzfs_zvol_ack_free_batch(zinfo, ioc, &cmds);
+			/*
+			 * exit due to network errors on fd related
+			 * to iscsi target
+			 */
+			if (conn == fd)
+				goto exit;
+			zvol_rebuild_scanner_set_errored_fd(zinfo, conn);
+			continue;
 		}
-		if ((latency >> 30) > IO_THRESHOLD_TIME)
-			LOG_INFO("IO %d with seq: %lu took %luns",
-			    zio_cmd->hdr.opcode, zio_cmd->hdr.io_seq, latency);
-		zinfo->zio_cmd_in_ack = NULL;
-		zio_cmd_free(&zio_cmd);
+
+		STAILQ_FOREACH(zio_cmd, &cmds, cmd_link)
+			uzfs_zvol_ack_update_stats(zinfo, zio_cmd);
+		uzfs_zvol_ack_free_batch(zinfo, ioc, &cmds);
 	}
 exit:
-	zinfo->zio_cmd_in_ack = NULL;
+	IO_CONN_STATE(zinfo, ioc, zio_cmd_in_ack) = NULL;
+	kmem_free(batch, sizeof (zvol_ack_batch_t));
 	shutdown(fd, SHUT_RDWR);
 
 	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
-	zinfo->is_io_ack_sender_created = 0;
-	zinfo->conn_closed = B_FALSE;
+	if (ioc != NULL)
+		ioc->is_io_ack_sender_created = 0;
+	else
+		zinfo->is_io_ack_sender_created = 0;
+	IO_CONN_STATE(zinfo, ioc, conn_closed) = B_FALSE;
 	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 
 	LOG_INFO("Data connection for zvol %s closed on fd: %d",
@@ -2098,6 +3239,9 @@ get_open_opcode_data_len(zvol_io_hdr_t *hdr)
 		case 3:
 			return (sizeof (zvol_op_open_data_ver_3_t));
 		case 4:
+		case 5:
+		case 6:
+		case 7:
 			return (sizeof (zvol_op_open_data_t));
 		default:
 			return (-1);
@@ -2117,6 +3261,112 @@ fill_default_values_for_version_change(zvol_io_hdr_t *hdr,
 	}
 }
 
+/*
+ * Adds additional data connection on fd to zvol whose first data connection
+ * is already open, and, starts ack sender for it.
+ * This fn needs zinfo_mutex lock.
+ */
+static int
+uzfs_zvol_add_io_conn(int fd, zvol_info_t *zinfo,
+    zvol_op_open_data_t *open_data, zvol_io_conn_t **iocp)
+{
+	zvol_io_conn_t	*ioc;
+	kthread_t	*thrd_info;
+	thread_args_t 	*thrd_arg;
+
+	if (!zinfo->is_io_receiver_created ||
+	    !zinfo->is_io_ack_sender_created || zinfo->conn_closed) {
+		LOG_ERR("zvol %s doesn't have data connection open",
+		    zinfo->name);
+		return (-1);
+	}
+	if (zinfo->io_conn_cnt + 1 >= zvol_max_data_conns) {
+		LOG_ERR("zvol %s already has %u data connections",
+		    zinfo->name, zinfo->io_conn_cnt + 1);
+		return (-1);
+	}
+	if ((open_data->tgt_block_size !=
+	    zinfo->main_zv->zv_metavolblocksize) ||
+	    (open_data->timeout != zinfo->timeout)) {
+		LOG_ERR("zvol %s opened with different block size %u or "
+		    "timeout %u", zinfo->name, open_data->tgt_block_size,
+		    open_data->timeout);
+		return (-1);
+	}
+
+	ioc = kmem_zalloc(sizeof (zvol_io_conn_t), KM_SLEEP);
+	ioc->fd = fd;
+	STAILQ_INIT(&ioc->complete_queue);
+	(void) pthread_cond_init(&ioc->io_ack_cond, NULL);
+	ioc->is_io_ack_sender_created = 1;
+	STAILQ_INSERT_TAIL(&zinfo->io_conn_list, ioc, link);
+	zinfo->io_conn_cnt++;
+
+	/*
+	 * fd is shutdown along with other fds of zinfo when first data
+	 * connection is closed or zvol goes offline
+	 */
+	uzfs_zvol_append_to_fd_list_locked(zinfo, fd);
+
+	thrd_arg = kmem_alloc(sizeof (thread_args_t), KM_SLEEP);
+	thrd_arg->fd = fd;
+	thrd_arg->zinfo = zinfo;
+	thrd_arg->io_conn = ioc;
+	uzfs_zinfo_take_refcnt(zinfo);
+	thrd_info = zk_thread_create(NULL, 0,
+	    (thread_func_t)uzfs_zvol_io_ack_sender, (void *)thrd_arg, 0, NULL,
+	    TS_RUN, 0, PTHREAD_CREATE_DETACHED);
+	VERIFY3P(thrd_info, !=, NULL);
+
+	LOG_INFO("Data connection %u added to zvol %s on fd: %d",
+	    zinfo->io_conn_cnt + 1, zinfo->name, fd);
+	*iocp = ioc;
+	return (0);
+}
+
+/*
+ * Removes additional data connection from zvol once its receiver is done
+ * with reading from it.
+ */
+static void
+uzfs_zvol_remove_io_conn(zvol_info_t *zinfo, zvol_io_conn_t *ioc)
+{
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	if (ioc->is_io_ack_sender_created)
+		ioc->conn_closed = B_TRUE;
+
+	/*
+	 * Send signal to ack sender so that it can close fd and exit.
+	 */
+	if (ioc->io_ack_waiting)
+		(void) pthread_cond_signal(&ioc->io_ack_cond);
+
+	while (ioc->conn_closed || ioc->is_io_ack_sender_created) {
+		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+		LOG_INFO("Waiting for ack_sender of fd(%d) to exit for %s",
+		    ioc->fd, zinfo->name);
+		sleep(1);
+		(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	}
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+
+	/*
+	 * Workers don't queue cmds for ack once ack sender exited. Wait for
+	 * the ones that are already dispatched so that ioc can be freed.
+	 */
+	taskq_wait_outstanding(zinfo->uzfs_zvol_taskq, 0);
+
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	STAILQ_REMOVE(&zinfo->io_conn_list, ioc, zvol_io_conn_s, link);
+	zinfo->io_conn_cnt--;
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+
+	uzfs_zvol_ack_free_cmds(&ioc->complete_queue);
+	uzfs_zvol_remove_from_fd_list(zinfo, ioc->fd);
+	(void) pthread_cond_destroy(&ioc->io_ack_cond);
+	kmem_free(ioc, sizeof (zvol_io_conn_t));
+}
+
 /*
  * Process open request on data connection, the first message.
  *
@@ -2124,9 +3374,12 @@ fill_default_values_for_version_change(zvol_io_hdr_t *hdr,
  *   != 0: OPEN failed, stop reading data from connection.
  *   == 0 && zinfopp == NULL: OPEN failed, recoverable error
  *   == 0 && zinfopp != NULL: OPEN succeeded, proceed with other commands
+ *
+ * iocp is set if the connection is added as additional data connection
+ * of zvol (ZVOL_OP_FLAG_ADD_DATA_CONN).
  */
 static int
-open_zvol(int fd, zvol_info_t **zinfopp)
+open_zvol(int fd, zvol_info_t **zinfopp, zvol_io_conn_t **iocp)
 {
 	int		rc;
 	zvol_io_hdr_t	hdr;
@@ -2177,6 +3430,16 @@ open_zvol(int fd, zvol_info_t **zinfopp)
 		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
 		goto open_reply;
 	}
+	if ((hdr.version >= 6) && (hdr.flags & ZVOL_OP_FLAG_ADD_DATA_CONN)) {
+		if (uzfs_zvol_add_io_conn(fd, zinfo, &open_data, iocp) != 0) {
+			hdr.status = ZVOL_OP_STATUS_FAILED;
+		} else {
+			*zinfopp = zinfo;
+			hdr.status = ZVOL_OP_STATUS_OK;
+		}
+		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+		goto open_reply;
+	}
 	if (zinfo->is_io_ack_sender_created) {
 		LOG_ERR("zvol %s ack sender already present",
 		    open_data.volname);
@@ -2274,9 +3537,8 @@ error_ret:
 		uzfs_destroy_all_iosnap_snapshots(zinfo->clone_zv);
 	}
 	/*
-	 * TODO: Once we support multiple concurrent data connections for a
-	 * single zvol, we should probably check that the timeout is the same
-	 * for all data connections.
+	 * Additional data connections are checked to have the same timeout
+	 * in uzfs_zvol_add_io_conn.
 	 */
 	uzfs_update_ionum_interval(zinfo, open_data.timeout);
 	zinfo->timeout = open_data.timeout;
@@ -2299,6 +3561,7 @@ error_ret:
 	thrd_arg = kmem_alloc(sizeof (thread_args_t), KM_SLEEP);
 	thrd_arg->fd = fd;
 	thrd_arg->zinfo = zinfo;
+	thrd_arg->io_conn = NULL;
 	uzfs_zinfo_take_refcnt(zinfo);
 	thrd_info = zk_thread_create(NULL, 0,
 	    (thread_func_t)uzfs_zvol_io_ack_sender, (void *)thrd_arg, 0, NULL,
@@ -2336,15 +3599,17 @@ uzfs_zvol_io_receiver(void *arg)
 	int		rc;
 	int		fd = (uintptr_t)arg;
 	zvol_info_t	*zinfo = NULL;
+	zvol_io_conn_t	*ioc = NULL;
 	zvol_io_cmd_t	*zio_cmd;
 	zvol_io_hdr_t	hdr;
 	zvol_state_t	*snap_zv, *clone_zv;
+	zvol_rcv_ctx_t	ctx = { 0 };
 
 	prctl(PR_SET_NAME, "io_receiver", 0, 0, 0);
 
 	/* First command should be OPEN */
 	while (zinfo == NULL) {
-		if (open_zvol(fd, &zinfo) != 0) {
+		if (open_zvol(fd, &zinfo, &ioc) != 0) {
 			if ((zinfo != NULL) &&
 			    (zinfo->is_io_ack_sender_created))
 				goto exit;
@@ -2353,24 +3618,30 @@ uzfs_zvol_io_receiver(void *arg)
 		}
 	}
 
-	zinfo->io_fd = fd;
+	if (ioc == NULL)
+		zinfo->io_fd = fd;
 
 	LOG_INFO("Data connection associated with zvol %s fd: %d",
 	    zinfo->name, fd);
 
-	while ((rc = uzfs_zvol_read_header(fd, &hdr)) == 0) {
+	ctx.fd = fd;
+	ctx.rbuf = uzfs_zvol_rcv_buf_alloc(zvol_rcv_buf_size);
+
+	while ((rc = uzfs_zvol_rcv_header(&ctx, &hdr)) == 0) {
 		if ((zinfo->state == ZVOL_INFO_STATE_OFFLINE))
 			break;
 
 		if (hdr.opcode != ZVOL_OPCODE_WRITE &&
 		    hdr.opcode != ZVOL_OPCODE_READ &&
-		    hdr.opcode != ZVOL_OPCODE_SYNC) {
+		    hdr.opcode != ZVOL_OPCODE_SYNC &&
+		    hdr.opcode != ZVOL_OPCODE_UNMAP) {
 			LOG_ERR("Unexpected opcode %d", hdr.opcode);
 			break;
 		}
 
 		if (((hdr.opcode == ZVOL_OPCODE_WRITE) ||
-		    (hdr.opcode == ZVOL_OPCODE_READ)) && !hdr.len) {
+		    (hdr.opcode == ZVOL_OPCODE_READ) ||
+		    (hdr.opcode == ZVOL_OPCODE_UNMAP)) && !hdr.len) {
 			LOG_ERR("Zero Payload size for opcode %d", hdr.opcode);
 			break;
 		} else if ((hdr.opcode == ZVOL_OPCODE_SYNC) && hdr.len > 0) {
@@ -2378,24 +3649,35 @@ uzfs_zvol_io_receiver(void *arg)
 			break;
 		}
 
-		zio_cmd = zio_cmd_alloc(&hdr, fd);
 		/* Read payload for commands which have it */
 		if (hdr.opcode == ZVOL_OPCODE_WRITE) {
-			rc = uzfs_zvol_socket_read(fd, zio_cmd->buf, hdr.len);
-			if (rc != 0) {
-				zio_cmd_free(&zio_cmd);
+			zio_cmd = uzfs_zvol_rcv_write_cmd(&ctx, &hdr);
+			if (zio_cmd == NULL)
 				break;
-			}
+		} else {
+			zio_cmd = zio_cmd_alloc(&hdr, fd);
 		}
+		zio_cmd->io_rcv_time = gethrtime();
 
 		if (zinfo->state == ZVOL_INFO_STATE_OFFLINE) {
 			zio_cmd_free(&zio_cmd);
 			break;
 		}
 
+		/*
+		 * Additional connection stops once first one is being closed,
+		 * as clone of zvol is released after that.
+		 */
+		if ((ioc != NULL) && (zinfo->conn_closed ||
+		    !zinfo->is_io_ack_sender_created)) {
+			zio_cmd_free(&zio_cmd);
+			break;
+		}
+
 		/* Take refcount for uzfs_zvol_worker to work on it */
 		uzfs_zinfo_take_refcnt(zinfo);
 		zio_cmd->zinfo = zinfo;
+		zio_cmd->io_conn = ioc;
 
 		/*
 		 * Rebuild want to take consistent snapshot
@@ -2410,6 +3692,7 @@ uzfs_zvol_io_receiver(void *arg)
 
 		atomic_inc_64(&zinfo->dispatched_io_cnt);
 
+		zio_cmd->io_dispatch_time = gethrtime();
 		taskq_dispatch(zinfo->uzfs_zvol_taskq, uzfs_zvol_worker,
 		    zio_cmd, TQ_SLEEP);
 	}
@@ -2418,6 +3701,11 @@ exit:
 	if (inject_error.delay.io_receiver_exit == 1)
 		sleep(5);
 #endif
+	if (ioc != NULL) {
+		uzfs_zvol_remove_io_conn(zinfo, ioc);
+		goto drop_refcnt;
+	}
+
 	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
 
 	if (zinfo->is_io_ack_sender_created)
@@ -2448,6 +3736,21 @@ exit:
 
 	shutdown_fds_related_to_zinfo(zinfo);
 
+	/*
+	 * Wait for receivers of additional connections, whose fds are shut
+	 * down above, to leave so that they don't dispatch IOs after taskq
+	 * is drained.
+	 */
+	(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	while (zinfo->io_conn_cnt != 0) {
+		(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+		LOG_INFO("Waiting for %u data connections of %s to close",
+		    zinfo->io_conn_cnt, zinfo->name);
+		sleep(1);
+		(void) pthread_mutex_lock(&zinfo->zinfo_mutex);
+	}
+	(void) pthread_mutex_unlock(&zinfo->zinfo_mutex);
+
 	zinfo->io_ack_waiting = 0;
 
 	taskq_wait(zinfo->uzfs_zvol_taskq);
@@ -2467,7 +3770,10 @@ exit:
 	zinfo->quiesce_done = 1;
 	zinfo->is_io_receiver_created = 0;
 	zinfo->io_fd = -1;
+drop_refcnt:
 	uzfs_zinfo_drop_refcnt(zinfo);
+	if (ctx.rbuf != NULL)
+		uzfs_zvol_rcv_buf_rele(ctx.rbuf);
 thread_exit:
 	close(fd);
 	LOG_INFO("Data connection closed on fd: %d", fd);
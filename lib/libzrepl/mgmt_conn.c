@@ -551,6 +551,8 @@ uzfs_zvol_mgmt_get_handshake_info(zvol_io_hdr_t *in_hdr, const char *name,
 	mgmt_ack->checkpointed_degraded_io_seq =
 	    zinfo->degraded_checkpointed_ionum;
 	mgmt_ack->quorum = uzfs_zinfo_get_quorum(zinfo);
+	if (in_hdr->version >= 6)
+		mgmt_ack->max_data_conns = MIN(zvol_max_data_conns, UINT8_MAX);
 
 	return (0);
 }
@@ -612,15 +614,175 @@ uzfs_zvol_rebuild_status(uzfs_mgmt_conn_t *conn, zvol_io_hdr_t *hdrp,
 	return (reply_data(conn, &hdr, &status_ack, sizeof (status_ack)));
 }
 
+/*
+ * Appends latency histograms of stages of IOs of zinfo, which have IOs in
+ * them, to buf. Only the buckets from the first to the last used one are
+ * sent. Returns number of bytes appended.
+ */
+static size_t
+uzfs_zvol_stats_stage_hist(zvol_info_t *zinfo, char *buf)
+{
+	zvol_op_stage_hist_t	*sh;
+	zvol_lat_hist_t		*hist;
+	size_t			len = 0;
+	int			op, stage, first, last;
+
+	for (op = 0; op < ZVOL_STAGE_HIST_OPS; op++) {
+		for (stage = 0; stage < ZVOL_IO_STAGE_MAX; stage++) {
+			hist = &zinfo->io_stage_hist[op][stage];
+			if (hist->count == 0)
+				continue;
+			for (first = 0; first < ZVOL_LAT_HIST_BUCKETS - 1 &&
+			    hist->buckets[first] == 0; first++)
+				;
+			for (last = ZVOL_LAT_HIST_BUCKETS - 1; last > first &&
+			    hist->buckets[last] == 0; last--)
+				;
+
+			sh = (zvol_op_stage_hist_t *)(buf + len);
+			bzero(sh, sizeof (*sh));
+			sh->opcode = ZVOL_OPCODE_READ + op;
+			sh->stage = stage;
+			sh->first_bucket = first;
+			sh->nbuckets = last - first + 1;
+			sh->count = hist->count;
+			sh->sum = hist->sum;
+			bcopy(&hist->buckets[first], sh->buckets,
+			    sh->nbuckets * sizeof (uint64_t));
+			len += sizeof (*sh) + sh->nbuckets * sizeof (uint64_t);
+		}
+	}
+	return (len);
+}
+
+CTASSERT_GLOBAL(ZVOL_STATS_SIZE_HIST_BUCKETS ==
+    ZFS_HISTOGRAM_IO_SIZE / ZFS_HISTOGRAM_IO_BLOCK + 1);
+
+/*
+ * Copies counters of zinfo to st. Counters are updated by IO threads with
+ * atomics, and are read here without any lock, so, they may not be
+ * consistent with each other, but polling them doesn't hold up IOs.
+ */
+static void
+uzfs_zvol_stats_fill(zvol_info_t *zinfo, zvol_op_stats_t *st)
+{
+	zvol_state_t	*zv = zinfo->main_zv;
+	taskq_t		*tq = zinfo->uzfs_zvol_taskq;
+	int		i;
+
+	bzero(st, sizeof (*st));
+	strlcpy(st->volname, zinfo->name, sizeof (st->volname));
+	st->status = uzfs_zvol_get_status(zv);
+	st->rebuild_status = uzfs_zvol_get_rebuild_status(zv);
+	if (tq != NULL)
+		st->workers = (tq->tq_flags & TASKQ_LOCKFREE) ?
+		    tq->tq_ntarget : tq->tq_nthreads;
+	st->io_conns = (zinfo->is_io_receiver_created ? 1 : 0) +
+	    zinfo->io_conn_cnt;
+	st->used = dsl_dir_phys(
+	    zv->zv_objset->os_dsl_dataset->ds_dir)->dd_uncompressed_bytes;
+	st->running_ionum = zinfo->running_ionum;
+	st->checkpointed_ionum = zinfo->checkpointed_ionum;
+	st->rebuild_bytes = zv->rebuild_info.rebuild_bytes;
+	st->inflight_io_cnt = zinfo->inflight_io_cnt;
+	st->dispatched_io_cnt = zinfo->dispatched_io_cnt;
+	st->read_req_received_cnt = zinfo->read_req_received_cnt;
+	st->write_req_received_cnt = zinfo->write_req_received_cnt;
+	st->sync_req_received_cnt = zinfo->sync_req_received_cnt;
+	st->unmap_req_received_cnt = zinfo->unmap_req_received_cnt;
+	st->read_req_ack_cnt = zinfo->read_req_ack_cnt;
+	st->write_req_ack_cnt = zinfo->write_req_ack_cnt;
+	st->sync_req_ack_cnt = zinfo->sync_req_ack_cnt;
+	st->unmap_req_ack_cnt = zinfo->unmap_req_ack_cnt;
+	st->read_byte = zinfo->read_byte;
+	st->write_byte = zinfo->write_byte;
+	st->read_latency = zinfo->read_latency;
+	st->write_latency = zinfo->write_latency;
+	st->sync_latency = zinfo->sync_latency;
+	st->unmap_latency = zinfo->unmap_latency;
+	for (i = 0; i < ZVOL_STATS_SIZE_HIST_BUCKETS; i++) {
+		st->rio_hist[i].count = zinfo->uzfs_rio_histogram[i].count;
+		st->rio_hist[i].size = zinfo->uzfs_rio_histogram[i].size;
+		st->rio_hist[i].latency = zinfo->uzfs_rio_histogram[i].latency;
+		st->wio_hist[i].count = zinfo->uzfs_wio_histogram[i].count;
+		st->wio_hist[i].size = zinfo->uzfs_wio_histogram[i].size;
+		st->wio_hist[i].latency = zinfo->uzfs_wio_histogram[i].latency;
+	}
+}
+
+/*
+ * Replies to STATS with ZVOL_OP_FLAG_STATS_EXT with counters of zinfo, or,
+ * if zinfo is NULL, of all the zvols served by conn.
+ */
+static int
+uzfs_zvol_stats_ext(uzfs_mgmt_conn_t *conn, zvol_io_hdr_t *hdrp,
+    zvol_info_t *zinfo)
+{
+	zvol_io_hdr_t		hdr;
+	zvol_op_stats_reply_t	*rep;
+	zvol_op_stats_t		*st;
+	zvol_info_t		*zv;
+	size_t			size;
+	uint32_t		n = 0;
+	int			rc;
+
+	if (zinfo != NULL) {
+		size = sizeof (*rep) + sizeof (*st);
+		rep = kmem_zalloc(size, KM_SLEEP);
+		st = (zvol_op_stats_t *)(rep + 1);
+		uzfs_zvol_stats_fill(zinfo, st);
+		n = 1;
+	} else {
+		mutex_enter(&zvol_list_mutex);
+		SLIST_FOREACH(zv, &zvol_list, zinfo_next) {
+			if (zv->mgmt_conn == conn)
+				n++;
+		}
+		size = sizeof (*rep) + n * sizeof (*st);
+		rep = kmem_zalloc(size, KM_SLEEP);
+		st = (zvol_op_stats_t *)(rep + 1);
+		SLIST_FOREACH(zv, &zvol_list, zinfo_next) {
+			if (zv->mgmt_conn == conn)
+				uzfs_zvol_stats_fill(zv, st++);
+		}
+		mutex_exit(&zvol_list_mutex);
+	}
+	rep->version = ZVOL_STATS_VERSION;
+	rep->entry_len = sizeof (zvol_op_stats_t);
+	rep->nentries = n;
+
+	bzero(&hdr, sizeof (hdr));
+	hdr.version = hdrp->version;
+	hdr.opcode = hdrp->opcode;
+	hdr.io_seq = hdrp->io_seq;
+	hdr.len = size;
+	hdr.status = ZVOL_OP_STATUS_OK;
+	hdr.flags = ZVOL_OP_FLAG_STATS_EXT;
+
+	rc = reply_data(conn, &hdr, rep, size);
+	kmem_free(rep, size);
+	return (rc);
+}
+
 static int
 uzfs_zvol_stats(uzfs_mgmt_conn_t *conn, zvol_io_hdr_t *hdrp, zvol_info_t *zinfo)
 {
 	zvol_io_hdr_t	hdr;
-	zvol_op_stat_t	stat;
+	zvol_op_stat_t	*stat;
 	objset_t	*zv_objset = zinfo->main_zv->zv_objset;
-
-	strlcpy(stat.label, "used", sizeof (stat.label));
-	stat.value = dsl_dir_phys(
+	size_t		size = sizeof (*stat);
+	char		*buf;
+	int		rc;
+
+	if (hdrp->flags & ZVOL_OP_FLAG_STATS_LATENCY)
+		size += ZVOL_STAGE_HIST_OPS * ZVOL_IO_STAGE_MAX *
+		    (sizeof (zvol_op_stage_hist_t) +
+		    ZVOL_LAT_HIST_BUCKETS * sizeof (uint64_t));
+	buf = kmem_zalloc(size, KM_SLEEP);
+
+	stat = (zvol_op_stat_t *)buf;
+	strlcpy(stat->label, "used", sizeof (stat->label));
+	stat->value = dsl_dir_phys(
 	    zv_objset->os_dsl_dataset->ds_dir)->dd_uncompressed_bytes;
 
 	bzero(&hdr, sizeof (hdr));
@@ -629,8 +791,14 @@ uzfs_zvol_stats(uzfs_mgmt_conn_t *conn, zvol_io_hdr_t *hdrp, zvol_info_t *zinfo)
 	hdr.io_seq = hdrp->io_seq;
 	hdr.len = sizeof (zvol_op_stat_t);
 	hdr.status = ZVOL_OP_STATUS_OK;
+	if (hdrp->flags & ZVOL_OP_FLAG_STATS_LATENCY) {
+		hdr.flags = ZVOL_OP_FLAG_STATS_LATENCY;
+		hdr.len += uzfs_zvol_stats_stage_hist(zinfo, buf + hdr.len);
+	}
 
-	return (reply_data(conn, &hdr, &stat, sizeof (stat)));
+	rc = reply_data(conn, &hdr, buf, hdr.len);
+	kmem_free(buf, size);
+	return (rc);
 }
 
 static void
@@ -1388,6 +1556,14 @@ process_message(uzfs_mgmt_conn_t *conn)
 		strlcpy(zvol_name, payload, payload_size);
 		zvol_name[payload_size] = '\0';
 
+		if (hdrp->opcode == ZVOL_OPCODE_STATS &&
+		    (hdrp->flags & ZVOL_OP_FLAG_STATS_EXT) &&
+		    zvol_name[0] == '\0') {
+			DBGCONN(conn, "Stats command for all zvols");
+			rc = uzfs_zvol_stats_ext(conn, hdrp, NULL);
+			break;
+		}
+
 		if ((zinfo = uzfs_zinfo_lookup(zvol_name)) == NULL) {
 			LOGERRCONN(conn, "Unknown zvol: %s", zvol_name);
 			rc = reply_nodata(conn, ZVOL_OP_STATUS_FAILED, hdrp);
@@ -1423,7 +1599,10 @@ process_message(uzfs_mgmt_conn_t *conn)
 			    zinfo);
 		} else if (hdrp->opcode == ZVOL_OPCODE_STATS) {
 			DBGCONN(conn, "Stats command for zvol %s", zvol_name);
-			rc = uzfs_zvol_stats(conn, hdrp, zinfo);
+			if (hdrp->flags & ZVOL_OP_FLAG_STATS_EXT)
+				rc = uzfs_zvol_stats_ext(conn, hdrp, zinfo);
+			else
+				rc = uzfs_zvol_stats(conn, hdrp, zinfo);
 		} else {
 			ASSERT(0);
 		}
@@ -404,8 +404,12 @@ abd_free_pages(abd_t *abd)
 struct page;
 
 #define	kpm_enable			1
+/*
+ * Chunks are page aligned, so that disk vdevs can do direct IO on them
+ * without copying data to a linear buffer.
+ */
 #define	abd_alloc_chunk(o) \
-	((struct page *)umem_alloc_aligned(PAGESIZE << (o), 64, KM_SLEEP))
+	((struct page *)umem_alloc_aligned(PAGESIZE << (o), PAGESIZE, KM_SLEEP))
 #define	abd_free_chunk(chunk, o)	umem_free(chunk, PAGESIZE << (o))
 #define	zfs_kmap_atomic(chunk, km)	((void *)chunk)
 #define	zfs_kunmap_atomic(addr, km)	do { (void)(addr); } while (0)
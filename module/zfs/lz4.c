@@ -93,6 +93,26 @@ lz4_decompress_zfs(void *s_start, void *d_start, size_t s_len,
 	    d_start, bufsiz, d_len) < 0);
 }
 
+/*
+ * As lz4_decompress_zfs(), but also fails if the output is shorter than
+ * d_len, for callers which need all of d_start to be filled.
+ */
+int
+lz4_decompress_zfs_exact(void *s_start, void *d_start, size_t s_len,
+    size_t d_len)
+{
+	const char *src = s_start;
+	uint32_t bufsiz = BE_IN32(src);
+	int len;
+
+	if (bufsiz + sizeof (bufsiz) > s_len)
+		return (1);
+
+	len = LZ4_uncompress_unknownOutputSize(&src[sizeof (bufsiz)],
+	    d_start, bufsiz, d_len);
+	return (len < 0 || (size_t)len != d_len);
+}
+
 /*
  * LZ4 API Description:
  *
@@ -147,6 +147,27 @@ int metaslab_unload_delay = TXG_SIZE * 2;
  */
 int metaslab_preload_limit = SPA_DVAS_PER_BP;
 
+/*
+ * When set, space freed in loaded metaslabs is trimmed (discarded on disks,
+ * punched out of files) in background every zfs_txgs_per_trim txgs.
+ */
+int zfs_autotrim = B_FALSE;
+int zfs_txgs_per_trim = 32;
+
+/*
+ * Max size of a single trim IO, and, number of trim IOs issued to a top
+ * level vdev at once. The next batch is issued after current one completes.
+ */
+uint64_t zfs_trim_max_bytes = 128ULL << 20;
+int zfs_trim_max_active = 8;
+
+/*
+ * Max bytes trimmed per second from a metaslab, 0 for no limit. As trim
+ * of a pool goes through one metaslab at a time, this limits the rate of
+ * trim of the pool. Batches of trim IOs are delayed to keep within it.
+ */
+uint64_t zfs_trim_rate_limit = 0;
+
 /*
  * Enable/disable preloading of metaslab.
  */
@@ -481,6 +502,8 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 
 	msp_free_space = range_tree_space(msp->ms_tree) + allocated +
 	    msp->ms_deferspace + range_tree_space(msp->ms_freedtree);
+	if (msp->ms_trimming != NULL)
+		msp_free_space += range_tree_space(msp->ms_trimming);
 
 	VERIFY3U(sm_free_space, ==, msp_free_space);
 }
@@ -1387,7 +1410,9 @@ void
 metaslab_unload(metaslab_t *msp)
 {
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3P(msp->ms_trimming, ==, NULL);
 	range_tree_vacate(msp->ms_tree, NULL, NULL);
+	range_tree_vacate(msp->ms_trimset, NULL, NULL);
 	msp->ms_loaded = B_FALSE;
 	msp->ms_weight &= ~METASLAB_ACTIVE_MASK;
 	msp->ms_max_size = 0;
@@ -1433,6 +1458,7 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_trimset = range_tree_create(NULL, ms, &ms->ms_lock);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1487,6 +1513,7 @@ metaslab_fini(metaslab_t *msp)
 
 	metaslab_unload(msp);
 	range_tree_destroy(msp->ms_tree);
+	range_tree_destroy(msp->ms_trimset);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
 
@@ -2270,8 +2297,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	metaslab_class_histogram_verify(mg->mg_class);
 	metaslab_group_histogram_remove(mg, msp);
 
+	/*
+	 * Space being trimmed is not in ms_tree, so, condensing has to wait
+	 * for trim to complete, else it would be written as allocated.
+	 */
 	if (msp->ms_loaded && spa_sync_pass(spa) == 1 &&
-	    metaslab_should_condense(msp)) {
+	    msp->ms_trimming == NULL && metaslab_should_condense(msp)) {
 		metaslab_condense(msp, txg, tx);
 	} else {
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC, tx);
@@ -2353,6 +2384,118 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+/*
+ * Queues the ranges of rt, which are becoming free, for trim.
+ */
+static void
+metaslab_trimset_add(metaslab_t *msp, range_tree_t *rt)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_loaded && zfs_autotrim)
+		range_tree_walk(rt, range_tree_add, msp->ms_trimset);
+}
+
+/*
+ * Trims the free space of a metaslab, which is either the space freed since
+ * last trim, or, all of the free space if 'full' is set. Ranges being trimmed
+ * are taken out of ms_tree so that they can't be allocated and written while
+ * trim of them is in flight, and, are given back once trim IOs complete.
+ *
+ * SCL_STATE is held as reader while issuing trim IOs, but not while sleeping
+ * for zfs_trim_rate_limit, so that config changes aren't held up by it.
+ * Metaslabs are freed only after trim is stopped (see spa_unload() and
+ * spa_vdev_remove()), so, msp stays valid, but its top level vdev may change
+ * meanwhile (i.e. on detach from mirror).
+ */
+void
+metaslab_trim(metaslab_t *msp, boolean_t full)
+{
+	vdev_t *vd;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	enum zio_flag flags = ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+	    ZIO_FLAG_DONT_RETRY;
+	range_tree_t *trimming;
+	range_seg_t *rs;
+	zio_t *zio;
+	uint64_t offset, size, trimmed = 0;
+	hrtime_t start;
+	int active = 0;
+
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	vd = msp->ms_group->mg_vd;
+
+	mutex_enter(&msp->ms_lock);
+	metaslab_load_wait(msp);
+	if (full && !msp->ms_loaded) {
+		(void) metaslab_load(msp);
+		msp->ms_selected_txg = spa_syncing_txg(spa);
+	}
+	if (!msp->ms_loaded || msp->ms_condensing ||
+	    msp->ms_trimming != NULL) {
+		mutex_exit(&msp->ms_lock);
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return;
+	}
+
+	if (full) {
+		range_tree_vacate(msp->ms_trimset, NULL, NULL);
+		range_tree_walk(msp->ms_tree, range_tree_add, msp->ms_trimset);
+	}
+	if (range_tree_space(msp->ms_trimset) == 0) {
+		mutex_exit(&msp->ms_lock);
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return;
+	}
+
+	trimming = range_tree_create(NULL, msp, &msp->ms_lock);
+	range_tree_swap(&msp->ms_trimset, &trimming);
+	msp->ms_trimming = trimming;
+	range_tree_walk(trimming, range_tree_remove, msp->ms_tree);
+	msp->ms_max_size = metaslab_block_maxsize(msp);
+	mutex_exit(&msp->ms_lock);
+
+	/*
+	 * ms_trimming is changed only by this thread, so, it can be walked
+	 * without ms_lock.
+	 */
+	start = gethrtime();
+	zio = zio_root(spa, NULL, NULL, flags);
+	for (rs = avl_first(&trimming->rt_root); rs != NULL &&
+	    !spa->spa_trim_stop; rs = AVL_NEXT(&trimming->rt_root, rs)) {
+		for (offset = rs->rs_start; offset < rs->rs_end;
+		    offset += size) {
+			size = MIN(rs->rs_end - offset, zfs_trim_max_bytes);
+			zio_nowait(zio_trim(zio, spa, vd, offset, size,
+			    NULL, NULL, flags));
+			trimmed += size;
+			if (++active < zfs_trim_max_active)
+				continue;
+
+			(void) zio_wait(zio);
+			active = 0;
+			if (zfs_trim_rate_limit != 0) {
+				spa_config_exit(spa, SCL_STATE, FTAG);
+				zfs_sleep_until(start + trimmed * NANOSEC /
+				    zfs_trim_rate_limit);
+				spa_config_enter(spa, SCL_STATE, FTAG,
+				    RW_READER);
+				vd = msp->ms_group->mg_vd;
+			}
+			zio = zio_root(spa, NULL, NULL, flags);
+		}
+	}
+	(void) zio_wait(zio);
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	mutex_enter(&msp->ms_lock);
+	msp->ms_trimming = NULL;
+	range_tree_vacate(trimming, range_tree_add, msp->ms_tree);
+	range_tree_destroy(trimming);
+	msp->ms_max_size = metaslab_block_maxsize(msp);
+	mutex_exit(&msp->ms_lock);
+}
+
 /*
  * Called after a transaction group has completely synced to mark
  * all of the metaslab's free space as usable.
@@ -2432,13 +2575,15 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
 	 * defer_tree -- this is safe to do because we've just emptied out
-	 * the defer_tree.
+	 * the defer_tree. Space becoming free is also queued for trim.
 	 */
+	metaslab_trimset_add(msp, *defer_tree);
 	range_tree_vacate(*defer_tree,
 	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
 	if (defer_allowed) {
 		range_tree_swap(&msp->ms_freedtree, defer_tree);
 	} else {
+		metaslab_trimset_add(msp, msp->ms_freedtree);
 		range_tree_vacate(msp->ms_freedtree,
 		    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
 	}
@@ -2466,7 +2611,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * If the metaslab is loaded and we've not tried to load or allocate
 	 * from it in 'metaslab_unload_delay' txgs, then unload it.
 	 */
-	if (msp->ms_loaded &&
+	if (msp->ms_loaded && msp->ms_trimming == NULL &&
 	    msp->ms_selected_txg + metaslab_unload_delay < txg) {
 
 		for (t = 1; t < TXG_CONCURRENT_STATES; t++) {
@@ -2716,6 +2861,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trimset, start, size);
 
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -3318,6 +3464,7 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 	VERIFY3U(range_tree_space(msp->ms_tree) - size, <=, msp->ms_size);
 	range_tree_remove(msp->ms_tree, offset, size);
+	range_tree_clear(msp->ms_trimset, offset, size);
 
 	if (spa_writeable(spa)) {	/* don't dirty if we're zdb(1M) */
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
@@ -3612,4 +3759,23 @@ MODULE_PARM_DESC(zfs_metaslab_segment_weight_enabled,
 module_param(zfs_metaslab_switch_threshold, int, 0644);
 MODULE_PARM_DESC(zfs_metaslab_switch_threshold,
 	"segment-based metaslab selection maximum buckets before switching");
+
+module_param(zfs_autotrim, int, 0644);
+MODULE_PARM_DESC(zfs_autotrim, "trim freed space in background");
+
+module_param(zfs_txgs_per_trim, int, 0644);
+MODULE_PARM_DESC(zfs_txgs_per_trim, "txgs between background trims");
+
+/* CSTYLED */
+module_param(zfs_trim_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(zfs_trim_max_bytes, "max size of a trim IO");
+
+module_param(zfs_trim_max_active, int, 0644);
+MODULE_PARM_DESC(zfs_trim_max_active,
+	"max trim IOs issued to a vdev at once");
+
+/* CSTYLED */
+module_param(zfs_trim_rate_limit, ulong, 0644);
+MODULE_PARM_DESC(zfs_trim_rate_limit,
+	"max bytes trimmed per second, 0 for no limit");
 #endif /* _KERNEL && HAVE_SPL */
@@ -1196,6 +1196,14 @@ spa_activate(spa_t *spa, int mode)
 	 */
 	spa->spa_upgrade_taskq = taskq_create("z_upgrade", boot_ncpus,
 	    defclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
+
+	/*
+	 * Taskq for trim of free space, which goes through metaslabs one
+	 * at a time.
+	 */
+	spa->spa_trim_taskq = taskq_create("z_trim", 1, defclsyspri,
+	    1, INT_MAX, 0);
+	spa->spa_trim_stop = B_FALSE;
 }
 
 /*
@@ -1229,6 +1237,11 @@ spa_deactivate(spa_t *spa)
 		spa->spa_upgrade_taskq = NULL;
 	}
 
+	if (spa->spa_trim_taskq) {
+		taskq_destroy(spa->spa_trim_taskq);
+		spa->spa_trim_taskq = NULL;
+	}
+
 	txg_list_destroy(&spa->spa_vdev_txg_list);
 
 	list_destroy(&spa->spa_config_dirty_list);
@@ -1357,6 +1370,14 @@ spa_unload(spa_t *spa)
 		spa->spa_sync_on = B_FALSE;
 	}
 
+	/*
+	 * Stop trim, which doesn't start again until the pool is activated.
+	 */
+	if (spa->spa_trim_taskq != NULL) {
+		spa->spa_trim_stop = B_TRUE;
+		taskq_wait(spa->spa_trim_taskq);
+	}
+
 	/*
 	 * Even though vdev_free() also calls vdev_metaslab_fini, we need
 	 * to call it earlier, before we wait for async i/o to complete.
@@ -5785,6 +5806,15 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		spa_vdev_config_exit(spa, NULL,
 		    txg + TXG_CONCURRENT_STATES + TXG_DEFER_SIZE, 0, FTAG);
 
+		/*
+		 * Trim doesn't hold config lock while it is rate limited, so,
+		 * stop it before metaslabs of the vdev are freed. It can be
+		 * started again once the vdev is gone.
+		 */
+		spa->spa_trim_stop = B_TRUE;
+		if (spa->spa_trim_taskq != NULL)
+			taskq_wait(spa->spa_trim_taskq);
+
 		/*
 		 * Attempt to evacuate the vdev.
 		 */
@@ -5796,6 +5826,7 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		 * If we couldn't evacuate the vdev, unwind.
 		 */
 		if (error) {
+			spa->spa_trim_stop = B_FALSE;
 			metaslab_group_activate(mg);
 			return (spa_vdev_exit(spa, NULL, txg, error));
 		}
@@ -5805,6 +5836,7 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		 */
 		ev = spa_event_create(spa, vd, NULL, ESC_ZFS_VDEV_REMOVE_DEV);
 		spa_vdev_remove_from_namespace(spa, vd);
+		spa->spa_trim_stop = B_FALSE;
 
 	} else if (vd != NULL) {
 		/*
@@ -6255,6 +6287,88 @@ spa_async_request(spa_t *spa, int task)
 	mutex_exit(&spa->spa_async_lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA trim routines
+ * ==========================================================================
+ */
+
+/*
+ * Trims metaslabs of all top level vdevs, one metaslab at a time. Config
+ * lock is taken for each metaslab, so that vdev changes aren't held up for
+ * the whole trim. Metaslab stays valid after the lock is dropped, as trim
+ * is stopped and waited for before metaslabs are freed, i.e., on unload
+ * and on removal of log device.
+ */
+static void
+spa_trim_metaslabs(spa_t *spa, boolean_t full)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *vd;
+	metaslab_t *msp;
+	uint64_t c, m;
+	boolean_t done = B_FALSE;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	for (c = 0; !done; c++) {
+		for (m = 0; !spa->spa_trim_stop; m++) {
+			spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+			if (c >= rvd->vdev_children) {
+				spa_config_exit(spa, SCL_STATE, FTAG);
+				done = B_TRUE;
+				break;
+			}
+			vd = rvd->vdev_child[c];
+			if (m >= vd->vdev_ms_count) {
+				spa_config_exit(spa, SCL_STATE, FTAG);
+				break;
+			}
+			msp = vd->vdev_ms[m];
+			spa_config_exit(spa, SCL_STATE, FTAG);
+			metaslab_trim(msp, full);
+		}
+		if (spa->spa_trim_stop)
+			break;
+	}
+
+	atomic_dec_64(&spa->spa_trim_pending);
+	spl_fstrans_unmark(cookie);
+}
+
+static void
+spa_trim_task(void *arg)
+{
+	spa_trim_metaslabs(arg, B_FALSE);
+}
+
+static void
+spa_trim_full_task(void *arg)
+{
+	spa_trim_metaslabs(arg, B_TRUE);
+}
+
+/*
+ * Starts trim of the pool in background. Full trim covers all of the free
+ * space, while, otherwise, only the space freed since last trim is trimmed.
+ */
+int
+spa_trim(spa_t *spa, boolean_t full)
+{
+	if (!spa_writeable(spa))
+		return (SET_ERROR(EROFS));
+	if (spa->spa_trim_taskq == NULL || spa->spa_trim_stop)
+		return (SET_ERROR(ENXIO));
+
+	atomic_inc_64(&spa->spa_trim_pending);
+	if (taskq_dispatch(spa->spa_trim_taskq,
+	    full ? spa_trim_full_task : spa_trim_task, spa,
+	    full ? TQ_SLEEP : TQ_NOSLEEP) == TASKQID_INVALID) {
+		atomic_dec_64(&spa->spa_trim_pending);
+		return (SET_ERROR(EBUSY));
+	}
+	return (0);
+}
+
 /*
  * ==========================================================================
  * SPA syncing routines
@@ -7063,6 +7177,13 @@ spa_sync(spa_t *spa, uint64_t txg)
 
 	spa_handle_ignored_writes(spa);
 
+	/*
+	 * Trim space freed in recent txgs, unless trim is still going on.
+	 */
+	if (zfs_autotrim && zfs_txgs_per_trim != 0 &&
+	    txg % zfs_txgs_per_trim == 0 && spa->spa_trim_pending == 0)
+		(void) spa_trim(spa, B_FALSE);
+
 	/*
 	 * If any async tasks have been requested, kick them off.
 	 */
@@ -1894,6 +1894,7 @@ spa_init(int mode)
 	vdev_file_init();
 #ifndef _KERNEL
 	vdev_disk_aio_init();
+	vdev_disk_uring_init();
 #endif
 	zfs_prop_init();
 	zpool_prop_init();
@@ -1911,6 +1912,7 @@ spa_fini(void)
 	spa_evict_all();
 
 #ifndef _KERNEL
+	vdev_disk_uring_fini();
 	vdev_disk_aio_fini();
 #endif
 	vdev_file_fini();
@@ -49,6 +49,9 @@
 #include <sys/abd.h>
 #include <sys/zvol.h>
 #include <sys/zfs_ratelimit.h>
+#ifndef _KERNEL
+#include <sys/vdev_disk_aio.h>
+#endif
 
 /*
  * When a vdev is added, it will be divided into approximately (but no
@@ -101,6 +104,11 @@ vdev_getops(const char *type)
 		if (strcmp(ops->vdev_op_type, type) == 0)
 			break;
 
+#ifndef _KERNEL
+	/* disks can be driven by either aio or io_uring from userland */
+	if (ops == &vdev_disk_ops)
+		ops = vdev_disk_ops_get();
+#endif
 	return (ops);
 }
 
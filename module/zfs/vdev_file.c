@@ -186,6 +186,24 @@ vdev_file_io_fsync(void *arg)
 	zio_interrupt(zio);
 }
 
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	flock64_t fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = zio->io_offset;
+	fl.l_len = zio->io_size;
+	zio->io_error = VOP_SPACE(vf->vf_vnode, F_FREESP, &fl,
+	    FWRITE | FOFFMAX, 0, kcred, NULL);
+
+	zio_interrupt(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -223,6 +241,20 @@ vdev_file_io_start(zio_t *zio)
 			zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
 			    kcred, NULL);
 			break;
+		case DKIOCFREE:
+			if (vd->vdev_notrim) {
+				zio->io_error = SET_ERROR(ENOTSUP);
+				break;
+			}
+
+			/*
+			 * Punching holes can take long on large ranges, so,
+			 * trims are done in taskq and can run in parallel.
+			 */
+			VERIFY3U(taskq_dispatch(vdev_file_taskq,
+			    vdev_file_io_trim, zio, TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+			return;
 		default:
 			zio->io_error = SET_ERROR(ENOTSUP);
 		}
@@ -1902,6 +1902,26 @@ zfs_ioc_pool_get_history(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name		name of the pool
+ *
+ * Starts trim of all free space of the pool in background.
+ */
+static int
+zfs_ioc_pool_trim(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	error = spa_open(zc->zc_name, &spa, FTAG);
+	if (error == 0) {
+		error = spa_trim(spa, B_TRUE);
+		spa_close(spa, FTAG);
+	}
+	return (error);
+}
+
 #if defined(_KERNEL)
 static int
 zfs_ioc_pool_reguid(zfs_cmd_t *zc)
@@ -6557,6 +6577,8 @@ zfs_ioctl_init(void)
 	    zfs_ioc_vdev_split);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_REGUID,
 	    zfs_ioc_pool_reguid);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_TRIM,
+	    zfs_ioc_pool_trim);
 
 	zfs_ioctl_register_pool_meta(ZFS_IOC_POOL_CONFIGS,
 	    zfs_ioc_pool_configs, zfs_secpolicy_none);
@@ -7468,6 +7490,9 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_clear(zc);
 		break;
 	}
+	case ZFS_IOC_POOL_TRIM:
+		err = zfs_ioc_pool_trim(zc);
+		break;
 	default:
 		fprintf(stderr, "ioctl(0x%lx) not supported!\n",
 		    uzfs_cmd->ioc_num);
@@ -1012,6 +1012,52 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Frees a range of space of a top level vdev on its leaf devices. offset is
+ * relative to the start of allocatable space, as in DVAs. Only leaves of
+ * mirror, replacing and spare vdevs are trimmed, as the same offsets map to
+ * their children. Space of RAID-Z vdevs is not trimmed.
+ */
+zio_t *
+zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *private, enum zio_flag flags)
+{
+	zio_t *zio;
+	int c;
+
+	ASSERT0(P2PHASE(offset, SPA_MINBLOCKSIZE));
+	ASSERT0(P2PHASE(size, SPA_MINBLOCKSIZE));
+
+	if (vd->vdev_children == 0) {
+		if (vd->vdev_notrim || !vdev_writeable(vd))
+			return (zio_null(pio, spa, NULL, NULL, NULL, flags));
+
+		/*
+		 * Size is set after creation as trim can be larger
+		 * than SPA_MAXBLOCKSIZE.
+		 */
+		zio = zio_create(pio, spa, 0, NULL, NULL, 0, 0, done, private,
+		    ZIO_TYPE_IOCTL, ZIO_PRIORITY_NOW, flags | ZIO_FLAG_PHYSICAL,
+		    vd, offset + VDEV_LABEL_START_SIZE, NULL, ZIO_STAGE_OPEN,
+		    ZIO_IOCTL_PIPELINE);
+		zio->io_size = zio->io_orig_size = size;
+		zio->io_cmd = DKIOCFREE;
+	} else {
+		zio = zio_null(pio, spa, NULL, NULL, NULL, flags);
+
+		if (vd->vdev_ops != &vdev_mirror_ops &&
+		    vd->vdev_ops != &vdev_replacing_ops &&
+		    vd->vdev_ops != &vdev_spare_ops)
+			return (zio);
+
+		for (c = 0; c < vd->vdev_children; c++)
+			zio_nowait(zio_trim(zio, spa, vd->vdev_child[c],
+			    offset, size, done, private, flags));
+	}
+
+	return (zio);
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
     abd_t *data, int checksum, zio_done_func_t *done, void *private,
@@ -3438,6 +3484,14 @@ zio_vdev_io_assess(zio_t *zio)
 	    zio->io_cmd == DKIOCFLUSHWRITECACHE && vd != NULL)
 		vd->vdev_nowritecache = B_TRUE;
 
+	/*
+	 * Similarly, devices that don't support trim are not asked again.
+	 */
+	if ((zio->io_error == ENOTSUP || zio->io_error == ENOTTY) &&
+	    zio->io_type == ZIO_TYPE_IOCTL &&
+	    zio->io_cmd == DKIOCFREE && vd != NULL)
+		vd->vdev_notrim = B_TRUE;
+
 	if (zio->io_error)
 		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
 
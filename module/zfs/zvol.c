@@ -75,6 +75,7 @@
  */
 
 #include <sys/dbuf.h>
+#include <sys/dmu_impl.h>
 #include <sys/dmu_traverse.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_prop.h>
@@ -418,6 +419,10 @@ uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 			    zv->sync_req_ack_cnt);
 			fnvlist_add_uint64(innvl, "syncLatency",
 			    zv->sync_latency);
+			fnvlist_add_uint64(innvl, "unmapCount",
+			    zv->unmap_req_ack_cnt);
+			fnvlist_add_uint64(innvl, "unmapLatency",
+			    zv->unmap_latency);
 			fnvlist_add_uint64(innvl, "inflightIOCnt",
 			    zv->inflight_io_cnt);
 			fnvlist_add_uint64(innvl, "dispatchedIOCnt",
@@ -805,6 +810,12 @@ static int
 zvol_replay_truncate(zvol_state_t *zv, lr_truncate_t *lr, boolean_t byteswap)
 {
 	uint64_t offset, length;
+#if !defined(_KERNEL)
+	objset_t *os = zv->zv_objset;
+	metaobj_blk_offset_t metablk;
+	dmu_tx_t *tx;
+	int error;
+#endif
 
 	if (byteswap)
 		byteswap_uint64_array(lr, sizeof (*lr));
@@ -812,6 +823,28 @@ zvol_replay_truncate(zvol_state_t *zv, lr_truncate_t *lr, boolean_t byteswap)
 	offset = lr->lr_offset;
 	length = lr->lr_length;
 
+#if !defined(_KERNEL)
+	/*
+	 * Records logged by uzfs unmap carry the io number of the unmap
+	 * request, which has to be stamped over the freed range so that
+	 * rebuild doesn't bring back the stale data.
+	 */
+	if (lr->lr_common.lrc_reclen >= sizeof (lr_truncate_t) &&
+	    lr->lr_version == VERSION_1) {
+		get_zv_metaobj_block_details(&metablk, zv, offset, length);
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
+		    metablk.m_len);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error) {
+			dmu_tx_abort(tx);
+			return (error);
+		}
+		zvol_write_metadata(zv, offset, length, &lr->lr_metadata, tx);
+		dmu_tx_commit(tx);
+	}
+#endif
+
 	return (dmu_free_long_range(zv->zv_objset, ZVOL_OBJ, offset, length));
 }
 
@@ -864,6 +897,52 @@ get_metadata_len(zvol_state_t *zv, uint64_t offset, uint64_t len)
 	return ((n_th_entry - m_th_entry + 1) * metadatasize);
 }
 
+/*
+ * Metadata is the same for all the blocks of range, so, it is copied
+ * straight into dbufs of metadata object instead of building buffer with
+ * metadata replicated for every block and passing it to dmu_write.
+ * tx should have hold on metadata object for the range.
+ */
+void
+zvol_write_metadata(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    blk_metadata_t *md, dmu_tx_t *tx)
+{
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	metaobj_blk_offset_t metablk;
+	uint64_t moffset, mlen, bufoff, tocpy;
+	dmu_buf_t *db;
+	char *p, *end;
+
+	get_zv_metaobj_block_details(&metablk, zv, offset, len);
+	moffset = metablk.m_offset;
+	mlen = metablk.m_len;
+
+	while (mlen > 0) {
+		/* dmu_buf_will_dirty reads block if it is partially filled */
+		VERIFY0(dmu_buf_hold_noread(zv->zv_objset, ZVOL_META_OBJ,
+		    moffset, FTAG, &db));
+		bufoff = moffset - db->db_offset;
+		tocpy = MIN(db->db_size - bufoff, mlen);
+		ASSERT0(tocpy % metadatasize);
+
+		if (tocpy == db->db_size)
+			dmu_buf_will_fill(db, tx);
+		else
+			dmu_buf_will_dirty(db, tx);
+
+		p = (char *)db->db_data + bufoff;
+		for (end = p + tocpy; p < end; p += metadatasize)
+			memcpy(p, md, metadatasize);
+
+		if (tocpy == db->db_size)
+			dmu_buf_fill_done(db, tx);
+		dmu_buf_rele(db, FTAG);
+
+		moffset += tocpy;
+		mlen -= tocpy;
+	}
+}
+
 #endif
 
 /*
@@ -881,8 +960,7 @@ zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
 #if !defined(_KERNEL)
 	blk_metadata_t *metadata = NULL;
 	metaobj_blk_offset_t metablk;
-	uint64_t version, metadatasize;
-	char *mdata = NULL, *tmdata, *tmdataend;
+	uint64_t version;
 #endif
 	if (byteswap)
 		byteswap_uint64_array(lr, sizeof (*lr));
@@ -908,13 +986,6 @@ zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
 #if !defined(_KERNEL)
 	if (lr->lr_version == VERSION_1) {
 		get_zv_metaobj_block_details(&metablk, zv, offset, length);
-		metadatasize = zv->zv_volmetadatasize;
-		tmdata = mdata = kmem_alloc(metablk.m_len, KM_SLEEP);
-		tmdataend = mdata + metablk.m_len;
-		while (tmdata < tmdataend) {
-			memcpy(tmdata, metadata, metadatasize);
-			tmdata += metadatasize;
-		}
 		dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
 		    metablk.m_len);
 	}
@@ -926,14 +997,8 @@ zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
 	} else {
 		dmu_write(os, ZVOL_OBJ, offset, length, data, tx);
 #if !defined(_KERNEL)
-		if (lr->lr_version == VERSION_1) {
-			get_zv_metaobj_block_details(&metablk, zv, offset,
-			    length);
-			dmu_write(os, ZVOL_META_OBJ, metablk.m_offset,
-			    metablk.m_len, mdata, tx);
-		}
-		if (mdata != NULL)
-			kmem_free(mdata, metablk.m_len);
+		if (lr->lr_version == VERSION_1)
+			zvol_write_metadata(zv, offset, length, metadata, tx);
 #endif
 		dmu_tx_commit(tx);
 	}
@@ -1053,6 +1118,44 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
 	}
 }
 
+/*
+ * Log a DKIOCFREE/free-long-range to the ZIL with TX_TRUNCATE.
+ */
+#if defined(_KERNEL)
+static void
+zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len,
+    boolean_t sync)
+#else
+void
+zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len,
+    boolean_t sync, blk_metadata_t *metadata)
+#endif
+{
+	itx_t *itx;
+	lr_truncate_t *lr;
+	zilog_t *zilog = zv->zv_zilog;
+
+	if (zil_replaying(zilog, tx))
+		return;
+
+	itx = zil_itx_create(TX_TRUNCATE, sizeof (*lr));
+	lr = (lr_truncate_t *)&itx->itx_lr;
+	lr->lr_foid = ZVOL_OBJ;
+	lr->lr_offset = off;
+	lr->lr_length = len;
+#if !defined(_KERNEL)
+	if (metadata != NULL) {
+		lr->lr_version = VERSION_1;
+		memcpy(&lr->lr_metadata, metadata, sizeof (blk_metadata_t));
+	} else {
+		lr->lr_version = VERSION_0;
+	}
+#endif
+
+	itx->itx_sync = sync;
+	zil_itx_assign(zilog, itx, tx);
+}
+
 #if defined(_KERNEL)
 typedef struct zv_request {
 	zvol_state_t	*zv;
@@ -1129,30 +1232,6 @@ zvol_write(void *arg)
 	kmem_free(zvr, sizeof (zv_request_t));
 }
 
-/*
- * Log a DKIOCFREE/free-long-range to the ZIL with TX_TRUNCATE.
- */
-static void
-zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len,
-    boolean_t sync)
-{
-	itx_t *itx;
-	lr_truncate_t *lr;
-	zilog_t *zilog = zv->zv_zilog;
-
-	if (zil_replaying(zilog, tx))
-		return;
-
-	itx = zil_itx_create(TX_TRUNCATE, sizeof (*lr));
-	lr = (lr_truncate_t *)&itx->itx_lr;
-	lr->lr_foid = ZVOL_OBJ;
-	lr->lr_offset = off;
-	lr->lr_length = len;
-
-	itx->itx_sync = sync;
-	zil_itx_assign(zilog, itx, tx);
-}
-
 static void
 zvol_discard(void *arg)
 {
@@ -32,6 +32,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_disk_aio.h>
 #include <libuzfs.h>
 #include <zrepl_mgmt.h>
 #include <mgmt_conn.h>
@@ -42,6 +45,10 @@
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_prop.h>
 #include <uzfs_rebuilding.h>
+#include <uzfs_md_scan.h>
+#include <uzfs_cache.h>
+#include <uzfs_kstat.h>
+#include <sys/un.h>
 
 #include "gtest_utils.h"
 
@@ -69,6 +76,10 @@ extern void (*zinfo_create_hook)(zvol_info_t *, nvlist_t *);
 extern void (*zinfo_destroy_hook)(zvol_info_t *);
 int receiver_created = 0;
 extern uint64_t zvol_rebuild_step_size;
+extern uint64_t zvol_rebuild_write_threads;
+extern uint64_t zvol_rebuild_write_queue_limit;
+extern uint64_t zvol_rebuild_scan_threads;
+extern uint64_t zvol_rebuild_cmd_queue_limit;
 
 //void (*dw_replica_fn)(void *);
 #if DEBUG
@@ -223,6 +234,151 @@ uzfs_mock_rebuild_scanner_exit_after_rebuild_step(void *arg)
 	zk_thread_exit();
 }
 
+void
+uzfs_mock_rebuild_scanner_step_window(void *arg)
+{
+	int rc = 0;
+	zvol_io_hdr_t hdr;
+	int fd = (int)(uintptr_t)arg;
+
+	/* Establish a connection with DW replica */
+	uzfs_mock_rebuild_scanner_setup_connection(fd);
+
+	/* Read HANDSHAKE */
+	uzfs_mock_rebuild_scanner_handshake(fd, &hdr);
+
+	/* Read ZVOL_OPCODE_REBUILD_STEP */
+	uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+	EXPECT_EQ(hdr.offset, 0);
+
+	/* Write REBUILD_STEP_DONE with end of the step */
+	hdr.opcode = ZVOL_OPCODE_REBUILD_STEP_DONE;
+	hdr.flags = ZVOL_OP_FLAG_REBUILD_STEP_END;
+	hdr.offset = zvol_rebuild_step_size;
+	hdr.len = 0;
+	rc = uzfs_zvol_socket_write(fd, (char *)&hdr, sizeof(hdr));
+	EXPECT_NE(rc, -1);
+
+	/* Window of steps is sent without waiting for STEP_DONE */
+	for (int i = 1; i <= zvol_rebuild_step_window; i++) {
+		uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+		EXPECT_EQ(hdr.offset, i * zvol_rebuild_step_size);
+	}
+
+	/* STEP_DONE of a step which is not the oldest one fails rebuild */
+	hdr.opcode = ZVOL_OPCODE_REBUILD_STEP_DONE;
+	hdr.flags = ZVOL_OP_FLAG_REBUILD_STEP_END;
+	hdr.offset = 3 * zvol_rebuild_step_size;
+	hdr.len = 0;
+	rc = uzfs_zvol_socket_write(fd, (char *)&hdr, sizeof(hdr));
+	EXPECT_NE(rc, -1);
+
+	rc = uzfs_zvol_socket_read(fd, (char *)&hdr, sizeof (hdr));
+	EXPECT_EQ(rc, -1);
+
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	rebuild_test_case = 0;
+	zk_thread_exit();
+}
+
+/* guid of snapshot which mock helping replica claims to rebuild from */
+#define	REBUILD_TEST_SNAP_GUID	1234
+
+void
+uzfs_mock_rebuild_scanner_resume(void *arg)
+{
+	int rc = 0;
+	zvol_io_hdr_t hdr;
+	int fd = (int)(uintptr_t)arg;
+
+	/* Establish a connection with DW replica */
+	uzfs_mock_rebuild_scanner_setup_connection(fd);
+
+	/* Read HANDSHAKE */
+	uzfs_mock_rebuild_scanner_handshake(fd, &hdr);
+
+	/* Rebuild resumes from stored progress */
+	uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+	EXPECT_EQ(hdr.offset, 3 * zvol_rebuild_step_size);
+
+	/* STEP_DONE from other snapshot makes it to start from 0 */
+	hdr.opcode = ZVOL_OPCODE_REBUILD_STEP_DONE;
+	hdr.flags = ZVOL_OP_FLAG_REBUILD_STEP_END;
+	hdr.io_seq = REBUILD_TEST_SNAP_GUID + 1;
+	hdr.offset = 4 * zvol_rebuild_step_size;
+	hdr.len = 0;
+	rc = uzfs_zvol_socket_write(fd, (char *)&hdr, sizeof(hdr));
+	EXPECT_NE(rc, -1);
+
+	for (int i = 0; i < zvol_rebuild_step_window; i++) {
+		uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+		EXPECT_EQ(hdr.offset, i * zvol_rebuild_step_size);
+	}
+
+	/* progress is stored with snapshot of STEP_DONE */
+	hdr.opcode = ZVOL_OPCODE_REBUILD_STEP_DONE;
+	hdr.flags = ZVOL_OP_FLAG_REBUILD_STEP_END;
+	hdr.io_seq = REBUILD_TEST_SNAP_GUID;
+	hdr.offset = zvol_rebuild_step_size;
+	hdr.len = 0;
+	rc = uzfs_zvol_socket_write(fd, (char *)&hdr, sizeof(hdr));
+	EXPECT_NE(rc, -1);
+
+	uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+	EXPECT_EQ(hdr.offset, zvol_rebuild_step_window *
+	    zvol_rebuild_step_size);
+
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	rebuild_test_case = 0;
+	zk_thread_exit();
+}
+
+void
+uzfs_mock_rebuild_scanner_resume_rejected(void *arg)
+{
+	zvol_io_hdr_t hdr;
+	int fd = (int)(uintptr_t)arg;
+
+	/* Establish a connection with DW replica */
+	uzfs_mock_rebuild_scanner_setup_connection(fd);
+
+	/* Read HANDSHAKE */
+	uzfs_mock_rebuild_scanner_handshake(fd, &hdr);
+
+	/* Older helping replica drops connection on step at non-zero offset */
+	uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+	EXPECT_EQ(hdr.offset, 3 * zvol_rebuild_step_size);
+
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	rebuild_test_case = 0;
+	zk_thread_exit();
+}
+
+void
+uzfs_mock_rebuild_scanner_step_from_start(void *arg)
+{
+	zvol_io_hdr_t hdr;
+	int fd = (int)(uintptr_t)arg;
+
+	/* Establish a connection with DW replica */
+	uzfs_mock_rebuild_scanner_setup_connection(fd);
+
+	/* Read HANDSHAKE */
+	uzfs_mock_rebuild_scanner_handshake(fd, &hdr);
+
+	/* Read ZVOL_OPCODE_REBUILD_STEP */
+	uzfs_mock_rebuild_scanner_read_rebuild_step(fd, &hdr);
+	EXPECT_EQ(hdr.offset, 0);
+
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	rebuild_test_case = 0;
+	zk_thread_exit();
+}
+
 void
 uzfs_mock_rebuild_scanner_min_version(void *arg)
 {
@@ -1017,6 +1173,11 @@ TEST(uZFS, TestZInfoRefcnt) {
 	zinfo1 = uzfs_zinfo_lookup(ds1);
 	EXPECT_EQ(NULL, zinfo1);
 
+	/* Falls in the same hash bucket as pool1/vol1 */
+	GtestUtils::strlcpy(ds1, "pool2/vol1", MAXNAMELEN);
+	zinfo1 = uzfs_zinfo_lookup(ds1);
+	EXPECT_EQ(NULL, zinfo1);
+
 	GtestUtils::strlcpy(ds1, "pool1/vol1", MAXNAMELEN);
 	zinfo1 = uzfs_zinfo_lookup(ds1);
 	EXPECT_EQ(NULL, !zinfo1);
@@ -1105,6 +1266,805 @@ TEST(uZFS, RemovePendingCmds) {
 	EXPECT_EQ(0, complete_q_list_count(zinfo));
 }
 
+static zvol_io_cmd_t *
+compress_test_cmd(uint64_t len)
+{
+	zvol_io_hdr_t hdr;
+	zvol_io_cmd_t *zio_cmd;
+	metadata_desc_t *md;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.opcode = ZVOL_OPCODE_READ;
+	hdr.len = len;
+	zio_cmd = zio_cmd_alloc(&hdr, -1);
+	/* two chunks of io_nums 5 and 6 */
+	for (int i = 1; i >= 0; i--) {
+		md = (metadata_desc_t *)uzfs_cache_zalloc(
+		    &uzfs_metadata_desc_cache);
+		md->metadata.io_num = 5 + i;
+		md->len = len / 2;
+		md->next = zio_cmd->metadata_desc;
+		zio_cmd->metadata_desc = md;
+	}
+	return (zio_cmd);
+}
+
+/*
+ * Rebuild payload is compressed only if it compresses well, and decompresses
+ * to rw headers followed by data of chunks.
+ */
+TEST(uZFS, RebuildCompress) {
+	struct zvol_io_rw_hdr *rw_hdr;
+	zvol_io_cmd_t *zio_cmd;
+	uint64_t len = 8192, lsize, clen;
+	char *p;
+
+	/* compressible payload */
+	zio_cmd = compress_test_cmd(len);
+	memset(zio_cmd->buf, 'a', len);
+	uzfs_zvol_rebuild_compress(zio_cmd);
+	EXPECT_TRUE(zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD_COMPRESSED);
+	EXPECT_LT(zio_cmd->hdr.len, len);
+	lsize = ((struct zvol_io_compressed_hdr *)zio_cmd->buf)->lsize;
+	EXPECT_EQ(len + 2 * sizeof (*rw_hdr), lsize);
+	clen = zio_cmd->hdr.len;
+
+	EXPECT_EQ(0, uzfs_zvol_rebuild_decompress(zio_cmd));
+	EXPECT_FALSE(zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD_COMPRESSED);
+	EXPECT_EQ(lsize, zio_cmd->hdr.len);
+	p = (char *)zio_cmd->buf;
+	for (int i = 0; i < 2; i++) {
+		rw_hdr = (struct zvol_io_rw_hdr *)p;
+		EXPECT_EQ(5 + i, rw_hdr->io_num);
+		EXPECT_EQ(len / 2, rw_hdr->len);
+		p += sizeof (*rw_hdr);
+		for (uint64_t j = 0; j < len / 2; j++)
+			ASSERT_EQ('a', p[j]);
+		p += len / 2;
+	}
+	zio_cmd_free(&zio_cmd);
+
+	/* payload which decompresses to less than lsize is rejected */
+	zio_cmd = compress_test_cmd(len);
+	memset(zio_cmd->buf, 'a', len);
+	uzfs_zvol_rebuild_compress(zio_cmd);
+	((struct zvol_io_compressed_hdr *)zio_cmd->buf)->lsize = lsize + 512;
+	EXPECT_EQ(-1, uzfs_zvol_rebuild_decompress(zio_cmd));
+
+	/* truncated payload is rejected */
+	((struct zvol_io_compressed_hdr *)zio_cmd->buf)->lsize = lsize;
+	zio_cmd->hdr.len = clen / 2;
+	EXPECT_EQ(-1, uzfs_zvol_rebuild_decompress(zio_cmd));
+	zio_cmd_free(&zio_cmd);
+
+	/* incompressible payload is sent as is */
+	zio_cmd = compress_test_cmd(len);
+	srandom(len);
+	for (uint64_t j = 0; j < len; j++)
+		((char *)zio_cmd->buf)[j] = random();
+	p = (char *)zio_cmd->buf;
+	uzfs_zvol_rebuild_compress(zio_cmd);
+	EXPECT_FALSE(zio_cmd->hdr.flags & ZVOL_OP_FLAG_REBUILD_COMPRESSED);
+	EXPECT_EQ(len, zio_cmd->hdr.len);
+	EXPECT_EQ(p, zio_cmd->buf);
+	zio_cmd_free(&zio_cmd);
+}
+
+TEST(uZFS, ObjectCache) {
+	uzfs_cache_t cache;
+	void *obj1, *obj2, *obj3;
+	char *buf;
+
+	memset(&cache, 0, sizeof (cache));
+	cache.name = "test";
+	cache.size = 64;
+	cache.max_free = 1;
+	pthread_mutex_init(&cache.mtx, NULL);
+
+	obj1 = uzfs_cache_alloc(&cache);
+	obj2 = uzfs_cache_alloc(&cache);
+	EXPECT_EQ(0, cache.hits);
+	EXPECT_EQ(2, cache.misses);
+	EXPECT_EQ(2, cache.inuse_cnt);
+	EXPECT_EQ(2, cache.high_water);
+
+	/* only one object is kept in free list */
+	uzfs_cache_free(&cache, obj1);
+	uzfs_cache_free(&cache, obj2);
+	EXPECT_EQ(1, cache.free_cnt);
+	EXPECT_EQ(0, cache.inuse_cnt);
+
+	obj3 = uzfs_cache_alloc(&cache);
+	EXPECT_EQ(obj1, obj3);
+	EXPECT_EQ(1, cache.hits);
+	EXPECT_EQ(0, cache.free_cnt);
+	uzfs_cache_free(&cache, obj3);
+
+	obj3 = uzfs_cache_zalloc(&cache);
+	for (int i = 0; i < 64; i++)
+		EXPECT_EQ(0, ((char *)obj3)[i]);
+	uzfs_cache_free(&cache, obj3);
+	EXPECT_EQ(2, cache.high_water);
+
+	uzfs_cache_reap(&cache);
+	EXPECT_EQ(0, cache.free_cnt);
+	EXPECT_EQ(NULL, cache.free_list);
+
+	/*
+	 * 3000 bytes buffer comes from 4K size class. Reaping adds counts of
+	 * magazine of this thread to cache.
+	 */
+	uzfs_cache_reap(&uzfs_buf_cache[3]);
+	uint64_t hits = uzfs_buf_cache[3].hits;
+	buf = (char *)uzfs_buf_alloc(3000);
+	memset(buf, 'a', 3000);
+	uzfs_buf_free(buf, 3000);
+	EXPECT_EQ(buf, uzfs_buf_alloc(4096));
+	uzfs_buf_free(buf, 4096);
+	uzfs_cache_reap(&uzfs_buf_cache[3]);
+	EXPECT_EQ(hits + 1, uzfs_buf_cache[3].hits);
+
+	/* buffers bigger than max size class are not cached */
+	buf = (char *)uzfs_buf_alloc(UZFS_BUF_CACHE_MAX + 1);
+	uzfs_buf_free(buf, UZFS_BUF_CACHE_MAX + 1);
+}
+
+static uzfs_cache_t mag_cache = UZFS_CACHE_INITIALIZER("mag_test", 64, 64);
+
+static void *
+mag_cache_user(void *arg)
+{
+	void *objs[10];
+
+	for (int i = 0; i < 10; i++)
+		objs[i] = uzfs_cache_alloc(&mag_cache);
+	/* all the threads hold their objects at once */
+	pthread_barrier_wait((pthread_barrier_t *)arg);
+	for (int i = 0; i < 10; i++)
+		uzfs_cache_free(&mag_cache, objs[i]);
+	return (NULL);
+}
+
+/*
+ * Objects freed to magazines of threads go to free list of cache when the
+ * threads exit.
+ */
+TEST(uZFS, ObjectCacheMagazines) {
+	pthread_barrier_t barrier;
+	pthread_t threads[4];
+	void *obj;
+
+	pthread_barrier_init(&barrier, NULL, 4);
+	for (int i = 0; i < 4; i++)
+		EXPECT_EQ(0, pthread_create(&threads[i], NULL, mag_cache_user,
+		    &barrier));
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&barrier);
+
+	EXPECT_EQ(0, mag_cache.inuse_cnt);
+	EXPECT_EQ(40, mag_cache.hits + mag_cache.misses);
+	EXPECT_EQ(40, mag_cache.free_cnt);
+	EXPECT_EQ(40, mag_cache.high_water);
+
+	/* allocation refills magazine from free list */
+	obj = uzfs_cache_alloc(&mag_cache);
+	EXPECT_EQ(1, mag_cache.inuse_cnt);
+	EXPECT_EQ(31, mag_cache.free_cnt);
+	uzfs_cache_free(&mag_cache, obj);
+
+	uzfs_cache_reap(&mag_cache);
+	EXPECT_EQ(0, mag_cache.inuse_cnt);
+	EXPECT_EQ(0, mag_cache.free_cnt);
+	EXPECT_EQ(NULL, mag_cache.free_list);
+}
+
+static void
+verify_metadata_desc(metadata_desc_t *md, uint64_t io_num, uint64_t len)
+{
+	ASSERT_NE((metadata_desc_t *)NULL, md);
+	EXPECT_EQ(io_num, md->metadata.io_num);
+	EXPECT_EQ(len, md->len);
+}
+
+/*
+ * Metadata of a write is stamped over all the blocks of its range, which
+ * spans many blocks of volume and of metadata object.
+ */
+TEST(uZFS, WriteMetadata) {
+	blk_metadata_t md;
+	metadata_desc_t *md_head = NULL, *m;
+	int len = 64 * 1024;
+	char *buf = (char *)malloc(len);
+	char *rbuf = (char *)malloc(len);
+
+	memset(buf, 'a', len);
+	md.io_num = 10;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, 0, len, &md, B_FALSE));
+	md.io_num = 11;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, 4096, 1536, &md,
+	    B_FALSE));
+	md.io_num = 12;
+	EXPECT_EQ(0, uzfs_unmap_data(zv_todelete, 8192, 512, &md));
+
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 0, len, &md_head));
+	EXPECT_EQ(0, memcmp(buf, rbuf, 8192));
+	for (int i = 8192; i < 8192 + 512; i++)
+		EXPECT_EQ(0, rbuf[i]);
+	EXPECT_EQ(0, memcmp(buf + 8704, rbuf + 8704, len - 8704));
+
+	m = md_head;
+	verify_metadata_desc(m, 10, 4096);
+	m = m->next;
+	verify_metadata_desc(m, 11, 1536);
+	m = m->next;
+	verify_metadata_desc(m, 10, 8192 - 5632);
+	m = m->next;
+	verify_metadata_desc(m, 12, 512);
+	m = m->next;
+	verify_metadata_desc(m, 10, len - 8704);
+	EXPECT_EQ((metadata_desc_t *)NULL, m->next);
+
+	FREE_METADATA_LIST(md_head);
+	free(buf);
+	free(rbuf);
+}
+
+/*
+ * Holes are found from block pointers once data is synced, and, write
+ * without data frees the range while stamping its metadata.
+ */
+TEST(uZFS, ReadHoles) {
+	blk_metadata_t md;
+	metadata_desc_t *md_head = NULL, *m;
+	uint64_t bs = zv_todelete->zv_volblocksize;
+	uint64_t len = 4 * bs;
+	char *buf = (char *)malloc(len);
+	char *rbuf = (char *)malloc(len);
+
+	memset(buf, 'a', len);
+	md.io_num = 13;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, 0, len, &md, B_FALSE));
+	md.io_num = 14;
+	EXPECT_EQ(0, uzfs_unmap_data(zv_todelete, bs, bs, &md));
+	md.io_num = 15;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, NULL, 2 * bs, bs, &md,
+	    B_FALSE));
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, 3 * bs, bs, &md,
+	    B_FALSE));
+
+	/* holes are not looked for in data which is not synced */
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 0, len, &md_head));
+	EXPECT_EQ(0, uzfs_read_holes(zv_todelete, 0, len, &md_head));
+	for (m = md_head; m != NULL; m = m->next)
+		EXPECT_EQ(B_FALSE, m->hole);
+	FREE_METADATA_LIST(md_head);
+
+	txg_wait_synced(spa_get_dsl(zv_todelete->zv_spa), 0);
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 0, len, &md_head));
+	EXPECT_EQ(0, uzfs_read_holes(zv_todelete, 0, len, &md_head));
+	EXPECT_EQ(0, memcmp(buf, rbuf, bs));
+	for (int i = bs; i < 3 * bs; i++)
+		EXPECT_EQ(0, rbuf[i]);
+	EXPECT_EQ(0, memcmp(buf + 3 * bs, rbuf + 3 * bs, bs));
+
+	m = md_head;
+	verify_metadata_desc(m, 13, bs);
+	EXPECT_EQ(B_FALSE, m->hole);
+	m = m->next;
+	verify_metadata_desc(m, 14, bs);
+	EXPECT_EQ(B_TRUE, m->hole);
+	/* chunk of io 15 is split at the end of hole */
+	m = m->next;
+	verify_metadata_desc(m, 15, bs);
+	EXPECT_EQ(B_TRUE, m->hole);
+	m = m->next;
+	verify_metadata_desc(m, 15, bs);
+	EXPECT_EQ(B_FALSE, m->hole);
+	EXPECT_EQ((metadata_desc_t *)NULL, m->next);
+	FREE_METADATA_LIST(md_head);
+
+	free(buf);
+	free(rbuf);
+}
+
+/*
+ * While zvol is rebuilding, rebuild writes find the blocks overwritten by
+ * newer IOs from io_num index, which is populated from disk on a miss.
+ */
+TEST(uZFS, IONumIndex) {
+	zvol_ionum_index_t *idx = &zv_todelete->zv_ionum_index;
+	zvol_rebuild_status_t status;
+	blk_metadata_t md;
+	metadata_desc_t *md_head = NULL, *m;
+	int len = 64 * 1024;
+	char *rbuf = (char *)malloc(len);
+	char *buf1 = (char *)malloc(len);
+	char *buf2 = (char *)malloc(4096);
+	char *buf3 = (char *)malloc(len);
+
+	memset(buf1, 'b', len);
+	memset(buf2, 'c', 4096);
+	memset(buf3, 'd', len);
+
+	ASSERT_TRUE(ZVOL_IS_DEGRADED(zv_todelete));
+	status = uzfs_zvol_get_rebuild_status(zv_todelete);
+	EXPECT_EQ(B_FALSE, idx->active);
+	uzfs_zvol_set_rebuild_status(zv_todelete, ZVOL_REBUILDING_SNAP);
+	EXPECT_EQ(B_TRUE, idx->active);
+	EXPECT_EQ(0, idx->nsegs);
+
+	/* index is empty, so, metadata is read from disk */
+	md.io_num = 15;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf1, 0, len, &md, B_TRUE));
+	EXPECT_EQ(1, idx->misses);
+	EXPECT_EQ(0, idx->hits);
+	EXPECT_EQ(1, idx->nsegs);
+
+	md.io_num = 30;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf2, 4096, 4096, &md,
+	    B_FALSE));
+	EXPECT_EQ(3, idx->nsegs);
+
+	/* block written with io_num 30 is skipped by rebuild write */
+	md.io_num = 25;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf3, 0, len, &md, B_TRUE));
+	EXPECT_EQ(1, idx->misses);
+	EXPECT_EQ(1, idx->hits);
+	EXPECT_EQ(3, idx->nsegs);
+
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 0, len, &md_head));
+	EXPECT_EQ(0, memcmp(buf3, rbuf, 4096));
+	EXPECT_EQ(0, memcmp(buf2, rbuf + 4096, 4096));
+	EXPECT_EQ(0, memcmp(buf3 + 8192, rbuf + 8192, len - 8192));
+	m = md_head;
+	verify_metadata_desc(m, 25, 4096);
+	m = m->next;
+	verify_metadata_desc(m, 30, 4096);
+	m = m->next;
+	verify_metadata_desc(m, 25, len - 8192);
+	EXPECT_EQ((metadata_desc_t *)NULL, m->next);
+	FREE_METADATA_LIST(md_head);
+
+	uzfs_zvol_set_rebuild_status(zv_todelete, status);
+	EXPECT_EQ(B_FALSE, idx->active);
+	EXPECT_EQ(0, idx->nsegs);
+	EXPECT_EQ(0, avl_numnodes(&idx->tree));
+
+	free(rbuf);
+	free(buf1);
+	free(buf2);
+	free(buf3);
+}
+
+static uint64_t
+md_scan_skip_ref(blk_metadata_t *md, uint64_t n, uint64_t low)
+{
+	uint64_t i;
+
+	for (i = 0; i < n && md[i].io_num <= low; i++)
+		;
+	return (i);
+}
+
+static uint64_t
+md_scan_run_ref(blk_metadata_t *md, uint64_t n, uint64_t io_num)
+{
+	uint64_t i;
+
+	for (i = 0; i < n && md[i].io_num == io_num; i++)
+		;
+	return (i);
+}
+
+/*
+ * All the metadata scan implementations supported by cpu should give same
+ * results as simple loops, including for io_nums with top bit set.
+ */
+TEST(uZFS, MetadataScan) {
+	const char *impls[] = { "scalar", "sse2", "avx2" };
+	const uzfs_md_scan_ops_t *ops = uzfs_md_scan_ops;
+	uint64_t lows[] = { 0, 5, 100, (1ULL << 63), (1ULL << 63) + 7,
+	    UINT64_MAX };
+	uint64_t n = 300, i, j, k;
+	blk_metadata_t *md;
+
+	md = (blk_metadata_t *)malloc(n * sizeof (*md));
+	for (i = 0; i < n; i++) {
+		if (i < 50)
+			md[i].io_num = 5;
+		else if (i < 120)
+			md[i].io_num = (i % 7 == 0) ? 0 : 5;
+		else if (i < 200)
+			md[i].io_num = 100 + i / 20;
+		else if (i < 260)
+			md[i].io_num = (1ULL << 63) + i / 30;
+		else
+			md[i].io_num = UINT64_MAX;
+	}
+
+	EXPECT_EQ(EINVAL, uzfs_md_scan_impl_set("none"));
+	for (k = 0; k < sizeof (impls) / sizeof (impls[0]); k++) {
+		if (uzfs_md_scan_impl_set(impls[k]) != 0)
+			continue;
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < sizeof (lows) / sizeof (lows[0]); j++)
+				EXPECT_EQ(md_scan_skip_ref(md + i, n - i,
+				    lows[j]), uzfs_md_scan_ops->skip(md + i,
+				    n - i, lows[j])) << impls[k];
+			EXPECT_EQ(md_scan_run_ref(md + i, n - i,
+			    md[i].io_num), uzfs_md_scan_ops->run(md + i,
+			    n - i, md[i].io_num)) << impls[k];
+		}
+	}
+	EXPECT_EQ(0, uzfs_md_scan_impl_set("scalar"));
+
+	uzfs_md_scan_ops = ops;
+	free(md);
+}
+
+/*
+ * Full trim of the pool punches out space freed by overwrites from the file
+ * vdev, without touching live data.
+ */
+extern int zfs_trim_max_active;
+extern uint64_t zfs_trim_rate_limit;
+
+TEST(uZFS, Trim) {
+	blk_metadata_t md;
+	metadata_desc_t *md_head = NULL;
+	int len = 1024 * 1024, autotrim = zfs_autotrim;
+	int trim_max_active = zfs_trim_max_active;
+	uint64_t offset = 512 * 1024 * 1024;
+	char *buf = (char *)malloc(len);
+	char *rbuf = (char *)malloc(len);
+	struct stat st;
+	blkcnt_t blocks;
+	int i;
+
+	zfs_autotrim = 0;
+	md.io_num = 20;
+	for (i = 0; i < 3; i++) {
+		memset(buf, 'a' + i, len);
+		EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, offset, len,
+		    &md, B_FALSE));
+		txg_wait_synced(spa_get_dsl(spa), 0);
+	}
+	for (i = 0; i < TXG_DEFER_SIZE + 1; i++)
+		txg_wait_synced(spa_get_dsl(spa), spa_last_synced_txg(spa) + 1);
+
+	EXPECT_EQ(0, stat("/tmp/uztest.1a", &st));
+	blocks = st.st_blocks;
+	/* trim IOs one at a time with rate limit, which drops config lock */
+	zfs_trim_max_active = 1;
+	zfs_trim_rate_limit = 1ULL << 40;
+	EXPECT_EQ(0, spa_trim(spa, B_TRUE));
+	taskq_wait(spa->spa_trim_taskq);
+	zfs_trim_max_active = trim_max_active;
+	zfs_trim_rate_limit = 0;
+	EXPECT_EQ(0, stat("/tmp/uztest.1a", &st));
+	EXPECT_LT(st.st_blocks, blocks);
+	EXPECT_FALSE(spa->spa_root_vdev->vdev_child[0]->vdev_notrim);
+
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, offset, len, &md_head));
+	EXPECT_EQ(0, memcmp(buf, rbuf, len));
+
+	zfs_autotrim = autotrim;
+	FREE_METADATA_LIST(md_head);
+	free(buf);
+	free(rbuf);
+}
+
+/*
+ * Log device is removed while rate limited trim of the pool is going on,
+ * which stops the trim before metaslabs of the device are freed.
+ */
+TEST(uZFS, TrimLogRemoval) {
+	char tpool[] = "trimlogpool";
+	char path[] = "/tmp/uztest.trimlog";
+	char log_path[] = "/tmp/uztest.trimlog.log";
+	int trim_max_active = zfs_trim_max_active;
+	spa_t *tspa;
+	vdev_t *lvd;
+
+	make_vdev(path);
+	make_vdev(log_path);
+	ASSERT_EQ(0, uzfs_create_pool(tpool, path, &tspa));
+	ASSERT_EQ(0, uzfs_vdev_add(tspa, log_path, 12, 1));
+	lvd = tspa->spa_root_vdev->vdev_child[1];
+	EXPECT_TRUE(lvd->vdev_islog);
+
+	zfs_trim_max_active = 1;
+	zfs_trim_rate_limit = 1ULL << 20;
+	EXPECT_EQ(0, spa_trim(tspa, B_TRUE));
+	sleep(1);
+	EXPECT_NE(0, tspa->spa_trim_pending);
+	EXPECT_EQ(0, spa_vdev_remove(tspa, lvd->vdev_guid, B_FALSE));
+	EXPECT_EQ(0, tspa->spa_trim_pending);
+	EXPECT_EQ(1, tspa->spa_root_vdev->vdev_children);
+	zfs_trim_max_active = trim_max_active;
+	zfs_trim_rate_limit = 0;
+
+	/* trim can be started again */
+	EXPECT_EQ(0, spa_trim(tspa, B_TRUE));
+	taskq_wait(tspa->spa_trim_taskq);
+
+	uzfs_close_pool(tspa);
+	EXPECT_EQ(0, spa_destroy(tpool));
+	unlink(path);
+	unlink(log_path);
+}
+
+#ifdef HAVE_IO_URING
+extern vdev_ops_t vdev_disk_uring_ops;
+
+/*
+ * Creates pool on a loop device with io_uring backend, and verifies that
+ * data written to it is read back from disk.
+ */
+TEST(uZFS, UringVdev) {
+	char dev[MAXNAMELEN] = { 0 };
+	char upool[] = "uringpool", uvol[] = "uvol";
+	int len = 1024 * 1024;
+	char *buf = (char *)malloc(len);
+	char *rbuf = (char *)malloc(len);
+	metadata_desc_t *md_head = NULL;
+	blk_metadata_t md;
+	zvol_state_t *uzv;
+	spa_t *uspa;
+	FILE *fp;
+
+	zfs_vdev_disk_uring = 1;
+	if (vdev_disk_ops_get() != &vdev_disk_uring_ops) {
+		zfs_vdev_disk_uring = 0;
+		GTEST_SKIP() << "io_uring is not available";
+	}
+	zfs_vdev_disk_uring = 0;
+
+	make_vdev("/tmp/uztest.uring");
+	fp = popen("losetup -f --show /tmp/uztest.uring 2>/dev/null", "r");
+	if (fp == NULL || fgets(dev, sizeof (dev), fp) == NULL) {
+		if (fp != NULL)
+			pclose(fp);
+		unlink("/tmp/uztest.uring");
+		GTEST_SKIP() << "loop device is not available";
+	}
+	pclose(fp);
+	dev[strcspn(dev, "\n")] = '\0';
+
+	zfs_vdev_disk_uring = 1;
+	EXPECT_EQ(0, uzfs_create_pool(upool, dev, &uspa));
+	zfs_vdev_disk_uring = 0;
+	ASSERT_NE((spa_t *)NULL, uspa);
+	EXPECT_EQ(&vdev_disk_uring_ops,
+	    uspa->spa_root_vdev->vdev_child[0]->vdev_ops);
+
+	EXPECT_EQ(0, uzfs_create_dataset(uspa, uvol, 64 * 1024 * 1024, 4096,
+	    &uzv));
+	EXPECT_EQ(0, uzfs_hold_dataset(uzv));
+	uzfs_update_metadata_granularity(uzv, 4096);
+	md.io_num = 1;
+	for (int i = 0; i < 4; i++) {
+		memset(buf, 'a' + i, len);
+		EXPECT_EQ(0, uzfs_write_data(uzv, buf, i * len, len, &md,
+		    B_FALSE));
+	}
+	uzfs_flush_data(uzv);
+	txg_wait_synced(spa_get_dsl(uspa), 0);
+	arc_flush(uspa, B_FALSE);
+
+	for (int i = 0; i < 4; i++) {
+		memset(buf, 'a' + i, len);
+		EXPECT_EQ(0, uzfs_read_data(uzv, rbuf, i * len, len,
+		    &md_head));
+		EXPECT_EQ(0, memcmp(buf, rbuf, len));
+		FREE_METADATA_LIST(md_head);
+	}
+
+	uzfs_close_dataset(uzv);
+	uzfs_close_pool(uspa);
+	EXPECT_EQ(0, spa_destroy(upool));
+	/* kernel drops reference of io_uring on device asynchronously */
+	sleep(1);
+	EXPECT_EQ(0, system((std::string("losetup -d ") + dev).c_str()));
+	unlink("/tmp/uztest.uring");
+	free(buf);
+	free(rbuf);
+}
+#endif
+
+extern int taskq_lf_ring_size;
+
+static void
+lf_task_count(void *arg)
+{
+	atomic_inc_64((uint64_t *)arg);
+}
+
+static void
+lf_task_block(void *arg)
+{
+	while (*(volatile int *)arg == 0)
+		usleep(1000);
+}
+
+TEST(uZFS, LockfreeTaskq) {
+	int ring_size = taskq_lf_ring_size, block = 0, i;
+	uint64_t count = 0;
+	taskq_ent_t ent;
+	taskq_t *tq;
+
+	/* small rings to get tasks on the overflow list too */
+	taskq_lf_ring_size = 4;
+	tq = taskq_create("lf_test", 4, defclsyspri, 4, INT_MAX,
+	    TASKQ_PREPOPULATE | TASKQ_LOCKFREE);
+	taskq_lf_ring_size = ring_size;
+	EXPECT_EQ(0, taskq_check_active_ios(tq));
+
+	EXPECT_NE(0, taskq_dispatch(tq, lf_task_block, &block, TQ_SLEEP));
+	for (i = 0; i < 10000; i++)
+		EXPECT_NE(0, taskq_dispatch(tq, lf_task_count, &count,
+		    (i % 100) ? TQ_SLEEP : TQ_SLEEP | TQ_FRONT));
+	taskq_init_ent(&ent);
+	taskq_dispatch_ent(tq, lf_task_count, &count, 0, &ent);
+	EXPECT_EQ(1, taskq_check_active_ios(tq));
+
+	block = 1;
+	taskq_wait(tq);
+	EXPECT_EQ(10001, count);
+	EXPECT_EQ(0, taskq_check_active_ios(tq));
+	EXPECT_TRUE(taskq_empty_ent(&ent));
+	taskq_destroy(tq);
+
+	/* name longer than that of ring */
+	tq = taskq_create("lf_test_with_name_of_31_chars__", 1, defclsyspri,
+	    1, INT_MAX, TASKQ_LOCKFREE);
+	EXPECT_NE(0, taskq_dispatch(tq, lf_task_count, &count, TQ_SLEEP));
+	taskq_wait(tq);
+	EXPECT_EQ(10002, count);
+	taskq_destroy(tq);
+}
+
+TEST(uZFS, ScaleWorkers) {
+	taskq_t *tq, *ztq = zinfo->uzfs_zvol_taskq;
+	uint64_t count = 0;
+	int i;
+
+	tq = taskq_create("lf_test", 4, defclsyspri, 4, INT_MAX,
+	    TASKQ_LOCKFREE | TASKQ_DYNAMIC);
+	EXPECT_EQ(1, tq->tq_nthreads);
+	taskq_set_nthreads(tq, 8);
+	EXPECT_EQ(4, tq->tq_ntarget);
+	EXPECT_EQ(4, tq->tq_nthreads);
+	for (i = 0; i < 1000; i++)
+		taskq_dispatch(tq, lf_task_count, &count, TQ_SLEEP);
+	taskq_set_nthreads(tq, 1);
+	taskq_wait(tq);
+	EXPECT_EQ(1000, count);
+	while (tq->tq_nthreads != 1)
+		usleep(1000);
+	taskq_destroy(tq);
+
+	/* deep queue on the volume grows its pool up to the cores */
+	atomic_add_64(&zinfo->dispatched_io_cnt, 1000);
+	uzfs_zinfo_scale_workers();
+	EXPECT_LE(ztq->tq_ntarget, MAX(boot_ncpus, 2));
+	if (boot_ncpus > 2 && ztq->tq_nrings > 1)
+		EXPECT_GT(ztq->tq_ntarget, 1);
+	atomic_add_64(&zinfo->dispatched_io_cnt, -1000);
+
+	for (i = 0; i < 100 && ztq->tq_ntarget != 1; i++)
+		uzfs_zinfo_scale_workers();
+	EXPECT_EQ(1, ztq->tq_ntarget);
+}
+
+static std::string
+kstat_text(const char *path, int *rc)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	std::string text;
+
+	fp = open_memstream(&buf, &len);
+	*rc = kstat_show_path(path, fp);
+	fclose(fp);
+	text = std::string(buf, len);
+	free(buf);
+	return (text);
+}
+
+TEST(uZFS, Kstats) {
+	std::string pool = spa_name(zinfo->main_zv->zv_spa);
+	char kpool[] = "kstatpool";
+	spa_t *kspa;
+	std::string text;
+	int rc;
+
+	/* named kstat, with header and a line per stat */
+	text = kstat_text("zfs/arcstats", &rc);
+	EXPECT_EQ(0, rc);
+	EXPECT_NE(std::string::npos, text.find("\nname "));
+	EXPECT_NE(std::string::npos, text.find("\nhits "));
+
+	/* io kstat of pool isn't created unless zfs_kstat_io is set */
+	text = kstat_text(("zfs/" + pool + "/io").c_str(), &rc);
+	EXPECT_EQ(ENOENT, rc);
+
+	zfs_kstat_io = 1;
+	make_vdev("/tmp/uztest.kstat");
+	EXPECT_EQ(0, uzfs_create_pool(kpool, (char *)"/tmp/uztest.kstat",
+	    &kspa));
+	zfs_kstat_io = 0;
+	text = kstat_text("zfs/kstatpool/io", &rc);
+	EXPECT_EQ(0, rc);
+	EXPECT_NE(std::string::npos, text.find("nread"));
+	uzfs_close_pool(kspa);
+	EXPECT_EQ(0, spa_destroy(kpool));
+	unlink("/tmp/uztest.kstat");
+
+	/* raw kstat, with a line per dbuf */
+	text = kstat_text("zfs/dbufs", &rc);
+	EXPECT_EQ(0, rc);
+	EXPECT_NE(std::string::npos, text.find("objset"));
+	EXPECT_NE(std::string::npos, text.find("\n" + pool + " "));
+
+	text = kstat_text("", &rc);
+	EXPECT_EQ(0, rc);
+	EXPECT_NE(std::string::npos, text.find("zfs/arcstats\n"));
+	EXPECT_NE(std::string::npos, text.find("zfs/vdev_aio_stats\n"));
+
+	text = kstat_text("zfs/nosuchkstat", &rc);
+	EXPECT_EQ(ENOENT, rc);
+	EXPECT_EQ(0, text.length());
+}
+
+static int
+kstat_connect(const char *sock_path)
+{
+	struct sockaddr_un addr = { 0 };
+	struct timeval tv = { 10, 0 };
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	/* not to wait forever for server that is stuck */
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	addr.sun_family = AF_UNIX;
+	GtestUtils::strlcpy(addr.sun_path, sock_path, sizeof (addr.sun_path));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof (addr)) != 0) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * Client which connects to kstat server and sends nothing doesn't keep
+ * others from being served.
+ */
+TEST(uZFS, KstatServer) {
+	const char *sock_path = "/tmp/uztest.kstat.sock";
+	char buf[4096];
+	std::string text;
+	int idle_fd, fd, n;
+
+	ASSERT_EQ(0, uzfs_kstat_server_init(sock_path));
+	idle_fd = kstat_connect(sock_path);
+	ASSERT_NE(-1, idle_fd);
+
+	fd = kstat_connect(sock_path);
+	ASSERT_NE(-1, fd);
+	EXPECT_EQ(13, write(fd, "zfs/arcstats\n", 13));
+	while ((n = read(fd, buf, sizeof (buf))) > 0)
+		text.append(buf, n);
+	EXPECT_NE(std::string::npos, text.find("\nhits "));
+
+	/* idle client is dropped */
+	EXPECT_EQ(0, read(idle_fd, buf, sizeof (buf)));
+	close(idle_fd);
+	close(fd);
+}
+
 /* Internal clone create API testing */
 TEST(SnapRebuild, CloneCreate) {
 
@@ -2050,6 +3010,7 @@ void send_ios_to_replicas(void *arg)
 	max_count = (wargs->total_len / 4096) - 1;
 	ASSERT0(wargs->total_len % 4096);
 	count = 0;
+	offset = wargs->start_offset;
 	end = wargs->start_offset + wargs->total_len;
 
 	while (offset < end) {
@@ -2088,6 +3049,7 @@ void verify_ios_from_two_replica(void *arg)
 	max_count = (wargs->total_len / 4096) - 1;
 	ASSERT0(wargs->total_len % 4096);
 	count = 0;
+	offset = wargs->start_offset;
 	end = wargs->start_offset + wargs->total_len;
 
 	while (offset < end) {
@@ -2284,6 +3246,124 @@ TEST(uZFSRebuild, TestErroredRebuild) {
 	sleep(10);
 }
 
+/*
+ * Rebuilds with writes applied by threads of writer, one write in flight at
+ * a time so that every dispatch waits for the room. Failure of a write fails
+ * later dispatches and so the rebuild, and next rebuild starts afresh.
+ */
+TEST(uZFSRebuild, TestRebuildWriteThreads) {
+	replica_writes_io_t wargs = { 0 };
+	kthread_t *writer_thread, *reader_thread;
+	uint64_t write_threads = zvol_rebuild_write_threads;
+	uint64_t write_queue_limit = zvol_rebuild_write_queue_limit;
+	uint64_t total_ios = 64;
+
+	io_receiver = &uzfs_zvol_io_receiver;
+	rebuild_scanner = &uzfs_zvol_rebuild_scanner;
+	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
+	zvol_rebuild_write_threads = 4;
+	zvol_rebuild_write_queue_limit = 1;
+	zvol_rebuild_step_size = (10 * 1024ULL * 1024ULL * 1024ULL);
+
+	/* data to rebuild is written to helping replica only */
+	zinfo->main_zv->zv_status = ZVOL_STATUS_DEGRADED;
+	wargs.r1_fd = -1;
+	do_data_connection(wargs.r2_fd, "127.0.0.1", IO_SERVER_PORT, "vol3");
+	wargs.io_num = 200000000;
+	wargs.start_offset = 16 * 1024 * 1024;
+	wargs.total_len = total_ios * 4096;
+	writer_thread = zk_thread_create(NULL, 0,
+	    send_ios_to_replicas, &wargs, 0, NULL, TS_RUN,
+	    0, 0);
+	zk_thread_join(writer_thread->t_tid);
+
+	do_data_connection(wargs.r1_fd, "127.0.0.1", IO_SERVER_PORT, "vol1");
+	sleep(2);
+#ifdef DEBUG
+	inject_error.inject_rebuild_error.dw_replica_rebuild_write_error_io =
+	    total_ios / 2;
+	execute_rebuild_test_case("errored write with writer threads", 15,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED, 4, "vol3");
+	EXPECT_EQ(ZVOL_REBUILDING_FAILED,
+	    uzfs_zvol_get_rebuild_status(zinfo->main_zv));
+	inject_error.inject_rebuild_error.dw_replica_rebuild_write_error_io = 0;
+	close(wargs.r1_fd);
+	wargs.r1_fd = -1;
+	sleep(10);
+
+	do_data_connection(wargs.r1_fd, "127.0.0.1", IO_SERVER_PORT, "vol1");
+	sleep(2);
+#endif
+	execute_rebuild_test_case("rebuild with writer threads", 15,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_DONE, 4, "vol3");
+	EXPECT_EQ(ZVOL_REBUILDING_DONE,
+	    uzfs_zvol_get_rebuild_status(zinfo->main_zv));
+
+	reader_thread = zk_thread_create(NULL, 0,
+	    verify_ios_from_two_replica, &wargs, 0, NULL, TS_RUN,
+	    0, 0);
+	zk_thread_join(reader_thread->t_tid);
+	EXPECT_LE(total_ios, wargs.read_cnt);
+
+	zvol_rebuild_write_threads = write_threads;
+	zvol_rebuild_write_queue_limit = write_queue_limit;
+	close(wargs.r1_fd);
+	close(wargs.r2_fd);
+	sleep(10);
+}
+
+/*
+ * Rebuilds with steps scanned by several threads in parallel, and, with
+ * scanner waiting for acks of reads it has issued every few blocks.
+ */
+TEST(uZFSRebuild, TestRebuildScanThreads) {
+	replica_writes_io_t wargs = { 0 };
+	kthread_t *writer_thread, *reader_thread;
+	uint64_t scan_threads = zvol_rebuild_scan_threads;
+	uint64_t cmd_queue_limit = zvol_rebuild_cmd_queue_limit;
+	uint64_t total_ios = 128;
+
+	io_receiver = &uzfs_zvol_io_receiver;
+	rebuild_scanner = &uzfs_zvol_rebuild_scanner;
+	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
+	zvol_rebuild_scan_threads = 8;
+	zvol_rebuild_cmd_queue_limit = 4;
+	/* step spans lun ranges of many blocks of metadata object */
+	zvol_rebuild_step_size = 32 * 1024 * 1024;
+
+	/* data to rebuild is written to helping replica only */
+	zinfo->main_zv->zv_status = ZVOL_STATUS_DEGRADED;
+	wargs.r1_fd = -1;
+	do_data_connection(wargs.r2_fd, "127.0.0.1", IO_SERVER_PORT, "vol3");
+	wargs.io_num = 300000000;
+	wargs.start_offset = 32 * 1024 * 1024 - (total_ios / 2) * 4096;
+	wargs.total_len = total_ios * 4096;
+	writer_thread = zk_thread_create(NULL, 0,
+	    send_ios_to_replicas, &wargs, 0, NULL, TS_RUN,
+	    0, 0);
+	zk_thread_join(writer_thread->t_tid);
+
+	do_data_connection(wargs.r1_fd, "127.0.0.1", IO_SERVER_PORT, "vol1");
+	sleep(2);
+	execute_rebuild_test_case("rebuild with scan threads", 15,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_DONE, 4, "vol3");
+	EXPECT_EQ(ZVOL_REBUILDING_DONE,
+	    uzfs_zvol_get_rebuild_status(zinfo->main_zv));
+
+	reader_thread = zk_thread_create(NULL, 0,
+	    verify_ios_from_two_replica, &wargs, 0, NULL, TS_RUN,
+	    0, 0);
+	zk_thread_join(reader_thread->t_tid);
+	EXPECT_LE(total_ios, wargs.read_cnt);
+
+	zvol_rebuild_scan_threads = scan_threads;
+	zvol_rebuild_cmd_queue_limit = cmd_queue_limit;
+	zvol_rebuild_step_size = (10 * 1024ULL * 1024ULL * 1024ULL);
+	close(wargs.r1_fd);
+	close(wargs.r2_fd);
+	sleep(10);
+}
+
 TEST(uZFSRebuild, TestAppIO) {
 	io_receiver = &uzfs_zvol_io_receiver;
 	rebuild_scanner = &uzfs_mock_rebuild_scanner_full;
@@ -2348,6 +3428,83 @@ TEST(uZFSRebuild, TestRebuildExitAfterStep) {
 	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED);
 }
 
+TEST(uZFSRebuild, TestRebuildStepWindow) {
+	uint64_t step_size = zvol_rebuild_step_size;
+
+	rebuild_scanner = &uzfs_mock_rebuild_scanner_step_window;
+	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
+
+	zvol_rebuild_step_size = ZVOL_VOLUME_SIZE(zinfo->main_zv) / 8;
+	execute_rebuild_test_case("rebuild step window", 16,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED);
+	zvol_rebuild_step_size = step_size;
+}
+
+TEST(uZFSRebuild, TestRebuildResume) {
+	uint64_t step_size = zvol_rebuild_step_size;
+	uint64_t interval = zvol_rebuild_progress_interval;
+	uint64_t io_seq, snap_guid, offset;
+
+	rebuild_scanner = &uzfs_mock_rebuild_scanner_resume;
+	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
+
+	zvol_rebuild_step_size = ZVOL_VOLUME_SIZE(zinfo->main_zv) / 8;
+	zvol_rebuild_progress_interval = 0;
+	EXPECT_EQ(0, uzfs_zvol_get_last_committed_io_no(zinfo->main_zv,
+	    HEALTHY_IO_SEQNUM, &io_seq));
+	EXPECT_NE(0, io_seq);
+
+	/* progress of other pass is not used */
+	uzfs_zvol_store_rebuild_progress(zinfo->main_zv, io_seq + 1,
+	    REBUILD_TEST_SNAP_GUID, 3 * zvol_rebuild_step_size);
+	EXPECT_EQ(ENOENT, uzfs_zvol_get_rebuild_progress(zinfo->main_zv,
+	    io_seq, &snap_guid, &offset));
+	EXPECT_EQ(0, offset);
+
+	uzfs_zvol_store_rebuild_progress(zinfo->main_zv, io_seq,
+	    REBUILD_TEST_SNAP_GUID, 3 * zvol_rebuild_step_size);
+	execute_rebuild_test_case("rebuild resume", 17,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED);
+
+	EXPECT_EQ(0, uzfs_zvol_get_rebuild_progress(zinfo->main_zv,
+	    io_seq, &snap_guid, &offset));
+	EXPECT_EQ(REBUILD_TEST_SNAP_GUID, snap_guid);
+	EXPECT_EQ(zvol_rebuild_step_size, offset);
+
+	uzfs_zvol_store_rebuild_progress(zinfo->main_zv, 0, 0, 0);
+	zvol_rebuild_progress_interval = interval;
+	zvol_rebuild_step_size = step_size;
+}
+
+TEST(uZFSRebuild, TestRebuildResumeRejected) {
+	uint64_t step_size = zvol_rebuild_step_size;
+	uint64_t io_seq, snap_guid, offset;
+
+	rebuild_scanner = &uzfs_mock_rebuild_scanner_resume_rejected;
+	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
+
+	zvol_rebuild_step_size = ZVOL_VOLUME_SIZE(zinfo->main_zv) / 8;
+	EXPECT_EQ(0, uzfs_zvol_get_last_committed_io_no(zinfo->main_zv,
+	    HEALTHY_IO_SEQNUM, &io_seq));
+
+	uzfs_zvol_store_rebuild_progress(zinfo->main_zv, io_seq,
+	    REBUILD_TEST_SNAP_GUID, 3 * zvol_rebuild_step_size);
+	execute_rebuild_test_case("rebuild resume rejected", 18,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED);
+
+	/* failure before first STEP_DONE clears progress */
+	EXPECT_EQ(ENOENT, uzfs_zvol_get_rebuild_progress(zinfo->main_zv,
+	    io_seq, &snap_guid, &offset));
+	EXPECT_EQ(0, offset);
+
+	/* so that next attempt starts the pass from 0 */
+	rebuild_scanner = &uzfs_mock_rebuild_scanner_step_from_start;
+	execute_rebuild_test_case("rebuild after resume rejected", 18,
+	    ZVOL_REBUILDING_SNAP, ZVOL_REBUILDING_FAILED);
+
+	zvol_rebuild_step_size = step_size;
+}
+
 TEST(uZFSRebuild, TestRebuildExitAfterInvalidWrite) {
 	rebuild_scanner = &uzfs_mock_rebuild_scanner_exit_after_write;
 	dw_replica_fn = &uzfs_zvol_rebuild_dw_replica;
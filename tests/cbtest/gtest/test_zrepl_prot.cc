@@ -32,6 +32,7 @@
 
 #include <gtest/gtest.h>
 #include <iostream>
+#include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -116,7 +117,8 @@ static void do_handshake(std::string zvol_name, std::string &host,
  */
 static void do_data_connection(int &data_fd, std::string host, uint16_t port,
     std::string zvol_name, int bs=4096, int timeout=120,
-    int res=ZVOL_OP_STATUS_OK, int rep_factor = 3, int version = REPLICA_VERSION) {
+    int res=ZVOL_OP_STATUS_OK, int rep_factor = 3, int version = REPLICA_VERSION,
+    int flags = 0) {
 	struct sockaddr_in addr;
 	zvol_io_hdr_t hdr_in, hdr_out = {0};
 	zvol_op_open_data_t open_data;
@@ -139,6 +141,7 @@ retry:
 	hdr_out.version = version;
 	hdr_out.opcode = ZVOL_OPCODE_OPEN;
 	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.flags = flags;
 	if (version == 3)
 		hdr_out.len = sizeof (zvol_op_open_data_ver_3_t);
 	else
@@ -543,6 +546,7 @@ TEST_F(ZreplHandshakeTest, HandshakeOk) {
 	rc = read(m_control_fd, &mgmt_ack, sizeof (mgmt_ack));
 	ASSERT_EQ(rc, sizeof (mgmt_ack));
 	EXPECT_STREQ(mgmt_ack.volname, m_zvol_name.c_str());
+	EXPECT_GT(mgmt_ack.max_data_conns, 1);
 	output = execCmd("zpool", std::string("get guid -Hpo value ") +
 	    m_pool->m_name);
 	EXPECT_EQ(mgmt_ack.pool_guid, std::stoul(output));
@@ -827,7 +831,238 @@ TEST_F(ZreplDataTest, WriteAndReadBlocksWithIonum) {
 	sleep(5);
 }
 
+/*
+ * Issue many writes and reads without waiting for their responses, so that
+ * replica acks several of them together, and verify all the responses.
+ */
+TEST_F(ZreplDataTest, PipelinedWritesAndReads) {
+	zvol_io_hdr_t hdr_in, hdr_out = {0};
+	struct zvol_io_rw_hdr read_hdr;
+	char buf[4096];
+	int rc, i, count = 64;
+	uint64_t first_seq, blk;
+	std::vector<int> acked(count, 0);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	first_seq = m_ioseq1 + 1;
+	for (i = 0; i < count; i++)
+		write_data(m_datasock1.fd(), m_ioseq1, buf, i * sizeof (buf),
+		    sizeof (buf), 1000 + i);
+
+	for (i = 0; i < count; i++) {
+		rc = recv(m_datasock1.fd(), &hdr_in, sizeof (hdr_in),
+		    MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (hdr_in));
+		EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_WRITE);
+		EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+		ASSERT_GE(hdr_in.io_seq, first_seq);
+		ASSERT_LT(hdr_in.io_seq, first_seq + count);
+		acked[hdr_in.io_seq - first_seq]++;
+	}
+	for (i = 0; i < count; i++)
+		EXPECT_EQ(acked[i], 1);
+
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_READ;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.len = sizeof (buf);
+	for (i = 0; i < count; i++) {
+		hdr_out.io_seq = ++m_ioseq1;
+		hdr_out.offset = i * sizeof (buf);
+		rc = write(m_datasock1.fd(), &hdr_out, sizeof (hdr_out));
+		ASSERT_EQ(rc, sizeof (hdr_out));
+	}
+
+	for (i = 0; i < count; i++) {
+		rc = recv(m_datasock1.fd(), &hdr_in, sizeof (hdr_in),
+		    MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (hdr_in));
+		EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_READ);
+		ASSERT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+		ASSERT_EQ(hdr_in.len, sizeof (read_hdr) + sizeof (buf));
+
+		rc = recv(m_datasock1.fd(), &read_hdr, sizeof (read_hdr),
+		    MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (read_hdr));
+		blk = hdr_in.offset / sizeof (buf);
+		EXPECT_EQ(read_hdr.io_num, 1000 + blk);
+		ASSERT_EQ(read_hdr.len, sizeof (buf));
+
+		rc = recv(m_datasock1.fd(), buf, sizeof (buf), MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (buf));
+		EXPECT_EQ(verify_buf(buf, sizeof (buf), "cStor-data"), 0);
+	}
+	m_datasock1.graceful_close();
+	m_datasock2.graceful_close();
+	sleep(5);
+}
+
+/*
+ * Send several write cmds with single write call, followed by a write whose
+ * payload is bigger than receive buffer of replica, and verify the data.
+ */
+TEST_F(ZreplDataTest, WritesInSingleSend) {
+	zvol_io_hdr_t hdr_in, hdr_out = {0};
+	struct zvol_io_rw_hdr rw_hdr;
+	char buf[4096];
+	int rc, i, count = 8;
+	size_t big_len = 2 * 1024 * 1024, off = 0, msg_len;
+	char *msg, *big_buf;
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	msg_len = count * (sizeof (hdr_out) + sizeof (rw_hdr) + sizeof (buf));
+	msg = (char *)malloc(msg_len);
+
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_WRITE;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.len = sizeof (rw_hdr) + sizeof (buf);
+	rw_hdr.len = sizeof (buf);
+	for (i = 0; i < count; i++) {
+		hdr_out.io_seq = ++m_ioseq1;
+		hdr_out.offset = i * sizeof (buf);
+		rw_hdr.io_num = 2000 + i;
+		memcpy(msg + off, &hdr_out, sizeof (hdr_out));
+		off += sizeof (hdr_out);
+		memcpy(msg + off, &rw_hdr, sizeof (rw_hdr));
+		off += sizeof (rw_hdr);
+		memcpy(msg + off, buf, sizeof (buf));
+		off += sizeof (buf);
+	}
+	rc = write(m_datasock1.fd(), msg, msg_len);
+	ASSERT_EQ(rc, msg_len);
+	free(msg);
+
+	for (i = 0; i < count; i++) {
+		rc = recv(m_datasock1.fd(), &hdr_in, sizeof (hdr_in),
+		    MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (hdr_in));
+		EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_WRITE);
+		EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	}
+
+	big_buf = (char *)malloc(big_len);
+	init_buf(big_buf, big_len, "cStor-big-data");
+	write_data_and_verify_resp(m_datasock1.fd(), m_ioseq1, big_buf,
+	    count * sizeof (buf), big_len, 3000);
+
+	for (i = 0; i < count; i++) {
+		read_data_start(m_datasock1.fd(), m_ioseq1, i * sizeof (buf),
+		    sizeof (buf), &hdr_in, &rw_hdr);
+		ASSERT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+		ASSERT_EQ(rw_hdr.io_num, 2000 + i);
+		ASSERT_EQ(rw_hdr.len, sizeof (buf));
+		rc = recv(m_datasock1.fd(), buf, sizeof (buf), MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (buf));
+		EXPECT_EQ(verify_buf(buf, sizeof (buf), "cStor-data"), 0);
+	}
+
+	read_data_start(m_datasock1.fd(), m_ioseq1, count * sizeof (buf),
+	    big_len, &hdr_in, &rw_hdr);
+	ASSERT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	ASSERT_EQ(rw_hdr.io_num, 3000);
+	ASSERT_EQ(rw_hdr.len, big_len);
+	memset(big_buf, 0, big_len);
+	rc = recv(m_datasock1.fd(), big_buf, big_len, MSG_WAITALL);
+	ASSERT_EQ(rc, big_len);
+	EXPECT_EQ(verify_buf(big_buf, big_len, "cStor-big-data"), 0);
+	free(big_buf);
+
+	m_datasock1.graceful_close();
+	m_datasock2.graceful_close();
+	sleep(5);
+}
+
 /* Read two blocks without metadata from the end of zvol */
+/*
+ * Open additional data connection to zvol, write on one connection and
+ * read the data back on the other one.
+ */
+TEST_F(ZreplDataTest, MultipleDataConnections) {
+	SocketFd datasock;
+	char buf[4096];
+
+	do_data_connection(datasock.fd(), m_host1, m_port1, m_zvol_name1,
+	    4096, 120, ZVOL_OP_STATUS_OK, 3, REPLICA_VERSION,
+	    ZVOL_OP_FLAG_ADD_DATA_CONN);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	write_data_and_verify_resp(datasock.fd(), m_ioseq1, buf, 0,
+	    sizeof (buf), 123);
+	write_two_chunks_and_verify_resp(m_datasock1.fd(), m_ioseq1, 4096);
+	read_data_and_verify_resp(datasock.fd(), m_ioseq1);
+	read_data_and_verify_resp(m_datasock1.fd(), m_ioseq1);
+	datasock.graceful_close();
+
+	/* additional connection must use the same block size */
+	do_data_connection(datasock.fd(), m_host1, m_port1, m_zvol_name1,
+	    512, 120, ZVOL_OP_STATUS_FAILED, 3, REPLICA_VERSION,
+	    ZVOL_OP_FLAG_ADD_DATA_CONN);
+	datasock.graceful_close();
+
+	/* first data connection is not affected by others */
+	read_data_and_verify_resp(m_datasock1.fd(), m_ioseq1);
+}
+
+/*
+ * Close first data connection while writes sent on additional connection
+ * are being received, and verify that the additional one is closed too and
+ * zvol can be connected again.
+ */
+TEST_F(ZreplDataTest, CloseFirstDataConnWhileWriting) {
+	SocketFd datasock;
+	zvol_io_hdr_t hdr_out = {0};
+	struct zvol_io_rw_hdr rw_hdr;
+	struct timeval tv = { 60, 0 };
+	char buf[4096];
+	int i, count = 256;
+	size_t off = 0, msg_len;
+	ssize_t rc;
+	char *msg;
+
+	do_data_connection(datasock.fd(), m_host1, m_port1, m_zvol_name1,
+	    4096, 120, ZVOL_OP_STATUS_OK, 3, REPLICA_VERSION,
+	    ZVOL_OP_FLAG_ADD_DATA_CONN);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	msg_len = count * (sizeof (hdr_out) + sizeof (rw_hdr) + sizeof (buf));
+	msg = (char *)malloc(msg_len);
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_WRITE;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.len = sizeof (rw_hdr) + sizeof (buf);
+	rw_hdr.len = sizeof (buf);
+	for (i = 0; i < count; i++) {
+		hdr_out.io_seq = ++m_ioseq1;
+		hdr_out.offset = (i % 64) * sizeof (buf);
+		rw_hdr.io_num = 4000 + i;
+		memcpy(msg + off, &hdr_out, sizeof (hdr_out));
+		off += sizeof (hdr_out);
+		memcpy(msg + off, &rw_hdr, sizeof (rw_hdr));
+		off += sizeof (rw_hdr);
+		memcpy(msg + off, buf, sizeof (buf));
+		off += sizeof (buf);
+	}
+	rc = send(datasock.fd(), msg, msg_len, MSG_NOSIGNAL);
+	free(msg);
+	ASSERT_GT(rc, 0);
+
+	/* writes are still being received on additional connection */
+	m_datasock1.graceful_close();
+
+	/* replica closes additional connection after acking some writes */
+	setsockopt(datasock.fd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	while ((rc = read(datasock.fd(), buf, sizeof (buf))) > 0)
+		;
+	EXPECT_GE(0, rc);
+	datasock.graceful_close();
+
+	do_data_connection(m_datasock1.fd(), m_host1, m_port1, m_zvol_name1);
+	init_buf(buf, sizeof (buf), "cStor-data");
+	write_data_and_verify_resp(m_datasock1.fd(), m_ioseq1, buf, 0,
+	    sizeof (buf), 5000);
+}
+
 TEST_F(ZreplDataTest, ReadBlockWithoutMeta) {
 	zvol_io_hdr_t hdr_in;
 	struct zvol_io_rw_hdr read_hdr;
@@ -892,6 +1127,119 @@ TEST_F(ZreplDataTest, WriteAndSync) {
 	sleep(5);
 }
 
+/*
+ * Interleave writes with many syncs without waiting for their responses,
+ * so that syncs are committed in groups, and verify that all of them are
+ * acked.
+ */
+TEST_F(ZreplDataTest, PipelinedWritesAndSyncs) {
+	zvol_io_hdr_t hdr_in, hdr_out = {0};
+	char buf[4096];
+	int rc, i, count = 32;
+	int writes = 0, syncs = 0;
+	uint64_t first_seq;
+	std::vector<int> acked(2 * count, 0);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_SYNC;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	first_seq = m_ioseq1 + 1;
+	for (i = 0; i < count; i++) {
+		write_data(m_datasock1.fd(), m_ioseq1, buf, i * sizeof (buf),
+		    sizeof (buf), 1000 + i);
+		hdr_out.io_seq = ++m_ioseq1;
+		rc = write(m_datasock1.fd(), &hdr_out, sizeof (hdr_out));
+		ASSERT_EQ(rc, sizeof (hdr_out));
+	}
+
+	for (i = 0; i < 2 * count; i++) {
+		rc = recv(m_datasock1.fd(), &hdr_in, sizeof (hdr_in),
+		    MSG_WAITALL);
+		ASSERT_EQ(rc, sizeof (hdr_in));
+		EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+		ASSERT_GE(hdr_in.io_seq, first_seq);
+		ASSERT_LT(hdr_in.io_seq, first_seq + 2 * count);
+		acked[hdr_in.io_seq - first_seq]++;
+		if (hdr_in.opcode == ZVOL_OPCODE_SYNC) {
+			EXPECT_EQ(hdr_in.len, 0);
+			syncs++;
+		} else {
+			EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_WRITE);
+			writes++;
+		}
+	}
+	EXPECT_EQ(writes, count);
+	EXPECT_EQ(syncs, count);
+	for (i = 0; i < 2 * count; i++)
+		EXPECT_EQ(acked[i], 1);
+	m_datasock1.graceful_close();
+	m_datasock2.graceful_close();
+	sleep(5);
+}
+
+/*
+ * Unmap a written block and verify that it reads back as zeros with io_num
+ * of the unmap request stamped in its metadata.
+ */
+TEST_F(ZreplDataTest, WriteAndUnmap) {
+	zvol_io_hdr_t hdr_in, hdr_out = {0};
+	struct zvol_io_rw_hdr read_hdr;
+	char buf[4096], zbuf[4096];
+	int rc;
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	write_data_and_verify_resp(m_datasock1.fd(), m_ioseq1, buf, 0, sizeof (buf), 777);
+
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_UNMAP;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.io_seq = 778;
+	hdr_out.offset = 0;
+	hdr_out.len = sizeof (buf);
+
+	rc = write(m_datasock1.fd(), &hdr_out, sizeof (hdr_out));
+	ASSERT_ERRNO("write", rc >= 0);
+	ASSERT_EQ(rc, sizeof (hdr_out));
+
+	rc = read(m_datasock1.fd(), &hdr_in, sizeof (hdr_in));
+	ASSERT_ERRNO("read", rc >= 0);
+	ASSERT_EQ(rc, sizeof (hdr_in));
+	EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_UNMAP);
+	EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	EXPECT_EQ(hdr_in.io_seq, 778);
+	EXPECT_EQ(hdr_in.len, sizeof (buf));
+
+	read_data_start(m_datasock1.fd(), m_ioseq1, 0, sizeof (buf), &hdr_in, &read_hdr, ZVOL_OP_FLAG_READ_METADATA);
+	ASSERT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	ASSERT_EQ(hdr_in.len, sizeof (read_hdr) + sizeof (buf));
+	ASSERT_EQ(read_hdr.io_num, 778);
+	ASSERT_EQ(read_hdr.len, sizeof (buf));
+
+	rc = read(m_datasock1.fd(), buf, sizeof (buf));
+	ASSERT_ERRNO("read", rc >= 0);
+	ASSERT_EQ(rc, sizeof (buf));
+	memset(zbuf, 0, sizeof (zbuf));
+	ASSERT_EQ(memcmp(buf, zbuf, sizeof (buf)), 0);
+
+	/* unaligned length should fail */
+	hdr_out.io_seq = 779;
+	hdr_out.len = 4097;
+	rc = write(m_datasock1.fd(), &hdr_out, sizeof (hdr_out));
+	ASSERT_ERRNO("write", rc >= 0);
+	ASSERT_EQ(rc, sizeof (hdr_out));
+
+	rc = read(m_datasock1.fd(), &hdr_in, sizeof (hdr_in));
+	ASSERT_ERRNO("read", rc >= 0);
+	ASSERT_EQ(rc, sizeof (hdr_in));
+	EXPECT_EQ(hdr_in.opcode, ZVOL_OPCODE_UNMAP);
+	EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_FAILED);
+	EXPECT_EQ(hdr_in.io_seq, 779);
+	m_datasock1.graceful_close();
+	m_datasock2.graceful_close();
+	sleep(5);
+}
+
 TEST_F(ZreplDataTest, UnknownOpcode) {
 	zvol_io_hdr_t hdr_in, hdr_out = {0};
 	int rc;
@@ -1991,3 +2339,199 @@ TEST(ZvolStatsTest, StatsZvol) {
 	EXPECT_LE(val1, val2);
 	graceful_close(control_fd);
 }
+
+/*
+ * Test latency histograms of stages of IOs in zvol stats
+ */
+TEST(ZvolStatsTest, StatsLatency) {
+	Zrepl zrepl;
+	Target target;
+	int rc, control_fd, stage;
+	SocketFd datasock;
+	uint64_t ioseq = 0, nios, len;
+	std::string host;
+	uint16_t port;
+	TestPool pool("statspool");
+	std::string zvolname = pool.getZvolName("vol");
+	zvol_io_hdr_t hdr_in, hdr_out = {0};
+	zvol_op_stat_t *stat;
+	zvol_op_stage_hist_t *sh;
+	char buf[4096], *reply;
+
+	zrepl.start();
+	pool.create();
+	pool.createZvol("vol", "-o io.openebs:targetip=127.0.0.1");
+
+	rc = target.listen();
+	ASSERT_GE(rc, 0);
+	control_fd = target.accept(-1);
+	ASSERT_GE(control_fd, 0);
+	do_handshake(zvolname, host, port, NULL, NULL, control_fd,
+	    ZVOL_OP_STATUS_OK);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	do_data_connection(datasock.fd(), host, port, zvolname, 4096);
+	for (int i = 0; i < 100; i++) {
+		write_data_and_verify_resp(datasock.fd(), ioseq, buf, 4096 * i, sizeof (buf), i + 1);
+	}
+	// stats are updated after ack is sent
+	sleep(1);
+
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_STATS;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.flags = ZVOL_OP_FLAG_STATS_LATENCY;
+	hdr_out.io_seq = 1;
+	hdr_out.len = zvolname.length() + 1;
+	rc = write(control_fd, &hdr_out, sizeof (hdr_out));
+	ASSERT_EQ(rc, sizeof (hdr_out));
+	rc = write(control_fd, zvolname.c_str(), hdr_out.len);
+	ASSERT_EQ(rc, hdr_out.len);
+
+	rc = read(control_fd, &hdr_in, sizeof (hdr_in));
+	ASSERT_EQ(rc, sizeof (hdr_in));
+	EXPECT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	EXPECT_EQ(hdr_in.flags, ZVOL_OP_FLAG_STATS_LATENCY);
+	ASSERT_GT(hdr_in.len, sizeof (*stat));
+	reply = (char *)malloc(hdr_in.len);
+	rc = read(control_fd, reply, hdr_in.len);
+	ASSERT_EQ(rc, hdr_in.len);
+	stat = (zvol_op_stat_t *)reply;
+	EXPECT_STREQ(stat->label, "used");
+
+	// one histogram for each stage of writes
+	stage = 0;
+	for (len = sizeof (*stat); len < hdr_in.len; ) {
+		sh = (zvol_op_stage_hist_t *)(reply + len);
+		EXPECT_EQ(sh->opcode, ZVOL_OPCODE_WRITE);
+		EXPECT_EQ(sh->stage, stage);
+		EXPECT_EQ(sh->count, 100);
+		ASSERT_LE(sh->first_bucket + sh->nbuckets,
+		    ZVOL_LAT_HIST_BUCKETS);
+		nios = 0;
+		for (int i = 0; i < sh->nbuckets; i++)
+			nios += sh->buckets[i];
+		EXPECT_EQ(nios, 100);
+		EXPECT_NE(sh->buckets[0], 0);
+		EXPECT_NE(sh->buckets[sh->nbuckets - 1], 0);
+		len += sizeof (*sh) + sh->nbuckets * sizeof (uint64_t);
+		stage++;
+	}
+	EXPECT_EQ(len, hdr_in.len);
+	EXPECT_EQ(stage, ZVOL_IO_STAGE_MAX);
+	free(reply);
+
+	datasock.graceful_close();
+	graceful_close(control_fd);
+}
+
+static void
+get_stats_ext(int control_fd, std::string zvolname, zvol_io_hdr_t &hdr_in,
+    char **reply)
+{
+	zvol_io_hdr_t hdr_out = {0};
+	int rc;
+
+	hdr_out.version = REPLICA_VERSION;
+	hdr_out.opcode = ZVOL_OPCODE_STATS;
+	hdr_out.status = ZVOL_OP_STATUS_OK;
+	hdr_out.flags = ZVOL_OP_FLAG_STATS_EXT;
+	hdr_out.io_seq = 1;
+	hdr_out.len = zvolname.length() + 1;
+	rc = write(control_fd, &hdr_out, sizeof (hdr_out));
+	ASSERT_EQ(rc, sizeof (hdr_out));
+	rc = write(control_fd, zvolname.c_str(), hdr_out.len);
+	ASSERT_EQ(rc, hdr_out.len);
+
+	rc = read(control_fd, &hdr_in, sizeof (hdr_in));
+	ASSERT_EQ(rc, sizeof (hdr_in));
+	ASSERT_EQ(hdr_in.status, ZVOL_OP_STATUS_OK);
+	ASSERT_EQ(hdr_in.flags, ZVOL_OP_FLAG_STATS_EXT);
+	ASSERT_GE(hdr_in.len, sizeof (zvol_op_stats_reply_t));
+	*reply = (char *)malloc(hdr_in.len);
+	rc = read(control_fd, *reply, hdr_in.len);
+	ASSERT_EQ(rc, hdr_in.len);
+}
+
+/*
+ * Test versioned stats with all counters of one and of all zvols
+ */
+TEST(ZvolStatsTest, StatsExt) {
+	Zrepl zrepl;
+	Target target;
+	int rc, control_fd;
+	SocketFd datasock;
+	uint64_t ioseq = 0;
+	std::string host1, host2;
+	uint16_t port1, port2;
+	TestPool pool("statspool");
+	std::string zvolname1 = pool.getZvolName("vol1");
+	std::string zvolname2 = pool.getZvolName("vol2");
+	zvol_io_hdr_t hdr_in;
+	zvol_op_stats_reply_t *rep;
+	zvol_op_stats_t *st;
+	char buf[4096], *reply;
+
+	zrepl.start();
+	pool.create();
+	pool.createZvol("vol1", "-o io.openebs:targetip=127.0.0.1");
+	pool.createZvol("vol2", "-o io.openebs:targetip=127.0.0.1");
+
+	rc = target.listen();
+	ASSERT_GE(rc, 0);
+	control_fd = target.accept(-1);
+	ASSERT_GE(control_fd, 0);
+	do_handshake(zvolname1, host1, port1, NULL, NULL, control_fd,
+	    ZVOL_OP_STATUS_OK);
+	do_handshake(zvolname2, host2, port2, NULL, NULL, control_fd,
+	    ZVOL_OP_STATUS_OK);
+
+	init_buf(buf, sizeof (buf), "cStor-data");
+	do_data_connection(datasock.fd(), host1, port1, zvolname1, 4096);
+	for (int i = 0; i < 100; i++) {
+		write_data_and_verify_resp(datasock.fd(), ioseq, buf, 4096 * i, sizeof (buf), i + 1);
+	}
+	// stats are updated after ack is sent
+	sleep(1);
+
+	get_stats_ext(control_fd, zvolname1, hdr_in, &reply);
+	rep = (zvol_op_stats_reply_t *)reply;
+	EXPECT_EQ(rep->version, ZVOL_STATS_VERSION);
+	ASSERT_EQ(rep->entry_len, sizeof (*st));
+	ASSERT_EQ(rep->nentries, 1);
+	ASSERT_EQ(hdr_in.len, sizeof (*rep) + sizeof (*st));
+	st = (zvol_op_stats_t *)(rep + 1);
+	EXPECT_STREQ(st->volname, zvolname1.c_str());
+	EXPECT_EQ(st->io_conns, 1);
+	EXPECT_GE(st->workers, 1);
+	EXPECT_EQ(st->write_req_received_cnt, 100);
+	EXPECT_EQ(st->write_req_ack_cnt, 100);
+	EXPECT_EQ(st->read_req_ack_cnt, 0);
+	EXPECT_GE(st->write_byte, 100 * sizeof (buf));
+	EXPECT_GT(st->write_latency, 0);
+	EXPECT_EQ(st->wio_hist[0].count, 100);
+	EXPECT_EQ(st->inflight_io_cnt, 0);
+	EXPECT_EQ(st->running_ionum, 100);
+	free(reply);
+
+	// empty name gets all the zvols of the connection
+	get_stats_ext(control_fd, "", hdr_in, &reply);
+	rep = (zvol_op_stats_reply_t *)reply;
+	ASSERT_EQ(rep->nentries, 2);
+	ASSERT_EQ(hdr_in.len, sizeof (*rep) + 2 * rep->entry_len);
+	for (int i = 0; i < 2; i++) {
+		st = (zvol_op_stats_t *)(reply + sizeof (*rep) +
+		    i * rep->entry_len);
+		if (zvolname1 == st->volname) {
+			EXPECT_EQ(st->write_req_ack_cnt, 100);
+		} else {
+			EXPECT_STREQ(st->volname, zvolname2.c_str());
+			EXPECT_EQ(st->write_req_ack_cnt, 0);
+			EXPECT_EQ(st->io_conns, 0);
+		}
+	}
+	free(reply);
+
+	datasock.graceful_close();
+	graceful_close(control_fd);
+}